@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cfloat>
 #include <cstdio>
+#include <cstring>
 
 #include <gflags/gflags.h>
 #include <GL/glew.h>
@@ -7,8 +10,13 @@
 #include "imgui.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "gfx/profiler.h"
+#include "gfx/program_cache.h"
+#include "gfx/shader_reloader.h"
 #include "imwidget/error_dialog.h"
 #include "util/browser.h"
+#include "util/file.h"
 #include "util/os.h"
 #include "util/logging.h"
 #include "util/imgui_impl_sdl.h"
@@ -20,9 +28,52 @@
 #include "nfd.h"
 #endif
 
+DEFINE_bool(shader_cache, true, "Cache linked shader programs on disk");
+DEFINE_bool(hot_reload, true,
+            "Rebuild shaders in the background when their files change");
+DEFINE_double(target_ms, 12.0,
+              "GPU time to scale the scene's resolution to meet");
+DEFINE_double(min_scale, 0.5, "Smallest fraction of the window to render");
+DEFINE_double(max_scale, 1.0, "Largest fraction of the window to render");
+DEFINE_double(render_scale, 0.0,
+              "Render at this fraction of the window instead of scaling "
+              "dynamically, e.g. for benchmarking");
+DEFINE_string(upscale, "edge", "Upscaling filter: bilinear or edge");
+DEFINE_int32(prepass, 0,
+             "Cone march a depth prepass at 1/prepass resolution; 0 for none");
+DEFINE_bool(temporal, false,
+            "Reuse pixels from the previous frame and accumulate samples "
+            "while the camera is still; needs --prepass to reuse pixels "
+            "while it moves");
+DEFINE_int32(temporal_samples, 16,
+             "Samples to accumulate per pixel while the camera is still");
+DEFINE_int32(temporal_refresh, 8,
+             "March every pixel again at least this often, in frames");
+DEFINE_string(sampling, "full",
+              "Pixels to march each frame: full, checkerboard or interlaced "
+              "(half each, alternating)");
+DEFINE_int32(antialias, 0,
+             "Samples per pixel on edges found in the first sample's depth, "
+             "normals and colors; 1 or less for none");
+DEFINE_string(record, "",
+              "Record every frame to PNG files named by this printf "
+              "pattern, with one %d for the frame number, e.g. "
+              "/tmp/frame%05d.png");
+
 
 namespace project {
 
+App::~App() {
+    StopRecording();
+    // The scene and resolution_ own the reloader, whose thread uses
+    // reload_context_.
+    resolution_.set_reloader(nullptr);
+    scene_.reset();
+    if (reload_context_) {
+        SDL_GL_DeleteContext(reload_context_);
+    }
+}
+
 void App::Init() {
     GLenum err = glewInit();
     if (err != GLEW_OK) {
@@ -32,13 +83,65 @@ void App::Init() {
     clear_color_ = ImVec4(0, 0, 0, 0);
     theta_ = 0;
     phi_ = 0;
+    profiler_ = new ProfilerWindow();
+    AddDrawCallback(profiler_);
+    RegisterCommand("trace", "Write recent frame timings as a Chrome trace.",
+                    this, &App::Trace);
+    RegisterCommand("record", "Record frames to PNG files or their CRCs.",
+                    this, &App::Record);
 
 #if 1
-    scene_ = absl::make_unique<GFX::RayMarchScene>(1920, 1080);
+    int64_t start = os::utime_now();
+    GFX::ProgramCache::set_enabled(FLAGS_shader_cache);
+    auto* options = resolution_.mutable_options();
+    options->target_ms = FLAGS_target_ms;
+    options->min_scale = FLAGS_min_scale;
+    options->max_scale = FLAGS_max_scale;
+    options->locked = FLAGS_render_scale > 0.0;
+    options->locked_scale = options->locked ? FLAGS_render_scale : 1.0;
+    options->filter = FLAGS_upscale == "bilinear"
+        ? GFX::DynamicResolution::kBilinear
+        : GFX::DynamicResolution::kEdgeAware;
+    // The scene is resized to the render target every frame.
+    scene_ = absl::make_unique<GFX::RayMarchScene>(width_, height_);
     if (scene_->LoadProgram("content/raymarch.vs", "content/raymarch.fs")) {
         LOGF(INFO, "Shader program loaded.");
     }
     scene_->Init();
+    scene_->set_prepass(FLAGS_prepass, 2);
+    scene_->set_temporal(FLAGS_temporal, FLAGS_temporal_samples,
+                         FLAGS_temporal_refresh);
+    scene_->set_sampling(
+        FLAGS_sampling == "checkerboard" ? GFX::RayMarchScene::kCheckerboard
+        : FLAGS_sampling == "interlaced" ? GFX::RayMarchScene::kInterlaced
+        : GFX::RayMarchScene::kFullRate);
+    scene_->set_antialias(FLAGS_antialias);
+    if (!FLAGS_record.empty()) {
+        util::Status status = StartRecording(FLAGS_record, "");
+        if (!status.ok()) {
+            LOG(ERROR, status.error_message());
+        }
+    }
+    // A warm start loads every program from the cache.
+    if (const auto* cache = GFX::ProgramCache::Get()) {
+        auto stats = cache->stats();
+        LOGF(INFO, "%s start: shaders ready in %.1f ms; "
+                   "%d cached (%.1f ms), %d compiled (%.1f ms)",
+             stats.misses ? "Cold" : "Warm",
+             double(os::utime_now() - start) / 1000.0,
+             stats.hits, stats.load_ms, stats.misses, stats.compile_ms);
+    }
+    if (FLAGS_hot_reload) {
+        reload_context_ = CreateSharedContext();
+    }
+    if (reload_context_) {
+        SDL_GLContext context = reload_context_;
+        auto reloader = std::make_shared<GFX::ShaderReloader>(
+                [this, context]() { return MakeCurrent(context); },
+                [this]() { MakeCurrent(nullptr); });
+        scene_->set_reloader(reloader);
+        resolution_.set_reloader(reloader);
+    }
 #else
     scene_ = absl::make_unique<GFX::SWMarcher>(256, 256);
 #endif
@@ -79,12 +182,7 @@ bool App::PreDraw() {
 
 
 
-    float cost = cosf(theta_), sint = sinf(theta_);
-    float cosp = cosf(phi_), sinp = sinf(phi_);
-
-    c->forward = glm::vec3(sint*cosp, -sinp, cost*cosp);
-    c->right = glm::vec3(cost, 0.0f, -sint);
-    c->up = glm::normalize(glm::cross(c->forward, c->right));
+    c->Orient(theta_, phi_);
 
     /*
     LOGF(INFO, "eye = (%.2f, %.2f, %.2f)", c->eye.x, c->eye.y, c->eye.z);
@@ -95,12 +193,24 @@ bool App::PreDraw() {
     */
 
 
-    glViewport(0, 0,
-               (int)ImGui::GetIO().DisplaySize.x,
-               (int)ImGui::GetIO().DisplaySize.y);
+    int width = (int)ImGui::GetIO().DisplaySize.x;
+    int height = (int)ImGui::GetIO().DisplaySize.y;
+    glViewport(0, 0, width, height);
     glClearColor(clear_color_.x, clear_color_.y, clear_color_.z, clear_color_.w);
     glClear(GL_COLOR_BUFFER_BIT);
+    resolution_.Begin(width, height);
+    scene_->Resize(resolution_.render_width(), resolution_.render_height());
     scene_->Draw();
+    resolution_.End();
+    if (capture_) {
+        // Frames are captured before the UI is drawn over them.
+        std::string filename = absl::StrCat("frame", record_frame_);
+        if (record_crc_file_.empty()) {
+            filename = GFX::FrameFilename(record_pattern_, record_frame_);
+        }
+        capture_->Capture(0, 0, width, height, filename);
+        ++record_frame_;
+    }
     return true;
 }
 
@@ -156,6 +266,7 @@ save_as:
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("View")) {
+            ImGui::MenuItem("Profiler", nullptr, &profiler_->visible());
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Help")) {
@@ -197,6 +308,13 @@ save_as:
         ImGui::ColorEdit4("Ambient", glm::value_ptr(scene_->ambient_));
         ImGui::ColorEdit4("Light0", glm::value_ptr(scene_->light0col_));
         ImGui::InputInt("Operation", &scene_->op_);
+        DrawResolution();
+        DrawTemporal();
+        DrawSampling();
+        DrawAntialias();
+        DrawMarchCost();
+        DrawStepping();
+        DrawRecording();
         ImGui::End();
     }
 #if 0
@@ -208,7 +326,292 @@ save_as:
 
 }
 
+void App::DrawResolution() {
+    if (!ImGui::CollapsingHeader("Resolution")) {
+        return;
+    }
+    auto* options = resolution_.mutable_options();
+    ImGui::Text("%dx%d (%.0f%%), %.2f ms",
+                resolution_.render_width(), resolution_.render_height(),
+                resolution_.scale() * 100.0f, resolution_.gpu_ms());
+    ImGui::Checkbox("Locked", &options->locked);
+    if (options->locked) {
+        ImGui::SliderFloat("Scale", &options->locked_scale, 0.1f, 2.0f);
+    } else {
+        ImGui::SliderFloat("Target ms", &options->target_ms, 1.0f, 50.0f);
+        ImGui::SliderFloat("Min scale", &options->min_scale, 0.1f,
+                           options->max_scale);
+        ImGui::SliderFloat("Max scale", &options->max_scale,
+                           options->min_scale, 2.0f);
+    }
+    int filter = options->filter;
+    ImGui::RadioButton("Bilinear", &filter,
+                       GFX::DynamicResolution::kBilinear);
+    ImGui::SameLine();
+    ImGui::RadioButton("Edge-aware", &filter,
+                       GFX::DynamicResolution::kEdgeAware);
+    options->filter = GFX::DynamicResolution::Filter(filter);
+}
+
+void App::DrawTemporal() {
+    if (!ImGui::CollapsingHeader("Temporal")) {
+        return;
+    }
+    bool enable = scene_->temporal();
+    int samples = scene_->temporal_max_samples();
+    int refresh = scene_->temporal_refresh();
+    bool changed = ImGui::Checkbox("Enabled", &enable);
+    changed |= ImGui::SliderInt("Samples", &samples, 1, 64);
+    changed |= ImGui::SliderInt("Refresh", &refresh, 0, 32);
+    if (changed) {
+        scene_->set_temporal(enable, samples, refresh);
+    }
+    ImGui::Text("%d samples per pixel", scene_->temporal_samples());
+    if (scene_->prepass_factor() == 0) {
+        ImGui::TextDisabled("No prepass: every pixel is marched in motion");
+    }
+}
+
+void App::DrawSampling() {
+    if (!ImGui::CollapsingHeader("Sampling")) {
+        return;
+    }
+    int sampling = scene_->sampling();
+    ImGui::RadioButton("Full", &sampling, GFX::RayMarchScene::kFullRate);
+    ImGui::SameLine();
+    ImGui::RadioButton("Checkerboard", &sampling,
+                       GFX::RayMarchScene::kCheckerboard);
+    ImGui::SameLine();
+    ImGui::RadioButton("Interlaced", &sampling,
+                       GFX::RayMarchScene::kInterlaced);
+    if (sampling != scene_->sampling()) {
+        scene_->set_sampling(GFX::RayMarchScene::Sampling(sampling));
+    }
+    // Flip between the modes to compare their cost.
+    if (!scene_->pass_stats().empty()) {
+        ImGui::Text("March: %.2f ms", scene_->pass_stats().back().ms);
+    }
+    if (scene_->temporal()) {
+        ImGui::TextDisabled("Ignored while temporal is enabled");
+    }
+}
+
+void App::DrawAntialias() {
+    if (!ImGui::CollapsingHeader("Antialiasing")) {
+        return;
+    }
+    int samples = std::max(scene_->antialias(), 1);
+    if (ImGui::SliderInt("Edge samples", &samples, 1,
+                         GFX::RayMarchScene::kMaxAntialiasSamples)) {
+        scene_->set_antialias(samples);
+    }
+    if (samples > 1) {
+        ImGui::Text("%.1f%% of pixels refined",
+                    scene_->antialias_refined() * 100.0);
+    }
+    if (scene_->temporal() ||
+        scene_->sampling() != GFX::RayMarchScene::kFullRate) {
+        ImGui::TextDisabled("Ignored while temporal or sampling are on");
+    }
+}
+
+// Where the march spends its budget: a heatmap of one cost over the
+// frame, and histograms of each.
+void App::DrawMarchCost() {
+    if (!ImGui::CollapsingHeader("March cost")) {
+        return;
+    }
+    int steps = scene_->steps();
+    if (ImGui::SliderInt("Steps", &steps, 8, 256)) {
+        scene_->set_steps(steps);
+    }
+    float epsilon = scene_->epsilon();
+    if (ImGui::SliderFloat("Epsilon", &epsilon, 0.0001f, 0.01f, "%.4f",
+                           3.0f)) {
+        scene_->set_epsilon(epsilon);
+    }
+    bool collect = scene_->collect_stats();
+    if (ImGui::Checkbox("Collect", &collect)) {
+        scene_->set_collect_stats(collect);
+    }
+
+    const char* labels[] = {"March", "Shadow", "Normal"};
+    int shown = scene_->heatmap() ? scene_->heatmap_counter() : -1;
+    ImGui::RadioButton("No heatmap", &shown, -1);
+    for(int c = 0; c < GFX::MarchCostMap::kCounters; ++c) {
+        ImGui::SameLine();
+        ImGui::RadioButton(labels[c], &shown, c);
+    }
+    float range = scene_->heatmap_range();
+    ImGui::SliderFloat("Red at", &range, 1.0f, 256.0f, "%.0f");
+    scene_->set_heatmap(shown >= 0,
+                        GFX::MarchCostMap::Counter(std::max(shown, 0)),
+                        range);
+    if (!collect && shown < 0) {
+        ImGui::TextDisabled("Collect or show a heatmap to measure");
+        return;
+    }
+
+    const GFX::MarchCostMap& map = scene_->cost_map();
+    for(int c = 0; c < GFX::MarchCostMap::kCounters; ++c) {
+        auto counter = GFX::MarchCostMap::Counter(c);
+        // March steps are binned up to the budget, so the last bin holds
+        // the rays that used it up.
+        bool march = counter == GFX::MarchCostMap::kMarchSteps;
+        auto s = map.Summarize(counter, 32, march ? steps : 0.0f);
+        ImGui::Text("%s: mean %.1f, max %.0f",
+                    GFX::MarchCostMap::Name(counter), s.mean, s.max);
+        if (march) {
+            ImGui::SameLine();
+            ImGui::Text("(%.2f%% out of steps)", s.saturated * 100.0);
+        }
+        ImGui::PlotHistogram(absl::StrCat("##cost", c).c_str(),
+                             s.histogram.data(), s.histogram.size(), 0,
+                             absl::StrCat("0 - ", s.range).c_str(),
+                             0.0f, FLT_MAX, ImVec2(0, 60));
+    }
+}
+
+// Pick how primary rays step and compare what each costs.
+void App::DrawStepping() {
+    if (!ImGui::CollapsingHeader("Stepping")) {
+        return;
+    }
+    GFX::Stepping stepping = scene_->stepping();
+    int strategy = stepping.strategy;
+    for(int s = 0; s < GFX::Stepping::kStrategies; ++s) {
+        if (s) {
+            ImGui::SameLine();
+        }
+        ImGui::RadioButton(
+                GFX::Stepping::Name(GFX::Stepping::Strategy(s)), &strategy, s);
+    }
+    stepping.strategy = GFX::Stepping::Strategy(strategy);
+    if (strategy == GFX::Stepping::kOverRelaxed ||
+        strategy == GFX::Stepping::kEnhanced) {
+        ImGui::SliderFloat("Relaxation", &stepping.relaxation, 1.0f, 2.0f);
+    } else if (strategy == GFX::Stepping::kLipschitz) {
+        ImGui::SliderFloat("Lipschitz", &stepping.lipschitz, 0.25f, 4.0f);
+    }
+    scene_->set_stepping(stepping);
+    if (!scene_->pass_stats().empty()) {
+        const auto& pass = scene_->pass_stats().back();
+        ImGui::Text("March: %.2f ms", pass.ms);
+        if (pass.steps >= 0) {
+            ImGui::SameLine();
+            ImGui::Text("%.1f steps per ray", pass.steps);
+        } else {
+            ImGui::TextDisabled("Collect in March cost to count steps");
+        }
+    }
+}
+
+void App::DrawRecording() {
+    if (!ImGui::CollapsingHeader("Recording")) {
+        return;
+    }
+    if (!capture_) {
+        ImGui::TextDisabled("Use the 'record' command to start");
+        return;
+    }
+    const auto& stats = capture_->stats();
+    ImGui::Text("%lld frames, %d in flight", (long long)stats.frames,
+                capture_->pending());
+    ImGui::Text("%lld stalls, %.2f ms waiting, %.2f ms copying per frame",
+                (long long)stats.stalls,
+                stats.wait_ms / std::max(stats.frames, int64_t(1)),
+                stats.copy_ms / std::max(stats.frames, int64_t(1)));
+    if (ImGui::Button("Stop")) {
+        util::Status status = StopRecording();
+        if (!status.ok()) {
+            ErrorDialog::Spawn("Recording Error", status.ToString());
+        }
+    }
+}
+
+util::Status App::StartRecording(const std::string& pattern,
+                                 const std::string& crc_file) {
+    if (crc_file.empty()) {
+        util::Status status = GFX::CheckFramePattern(pattern);
+        if (!status.ok()) {
+            return status;
+        }
+    }
+    StopRecording();
+    recorder_ = absl::make_unique<GFX::FrameWriter>();
+    if (!crc_file.empty()) {
+        recorder_->set_output(GFX::FrameWriter::kCRC32);
+    }
+    capture_ = absl::make_unique<GFX::FrameCapture>(recorder_.get());
+    record_pattern_ = pattern;
+    record_crc_file_ = crc_file;
+    record_frame_ = 0;
+    return util::Status();
+}
+
+util::Status App::StopRecording() {
+    if (!capture_) {
+        return util::Status();
+    }
+    capture_.reset();
+    util::Status status = recorder_->Finish();
+    if (status.ok() && !record_crc_file_.empty()) {
+        auto hashes = recorder_->hashes();
+        std::string list;
+        for(int i = 0; i < record_frame_; ++i) {
+            std::string name = absl::StrCat("frame", i);
+            char line[64];
+            snprintf(line, sizeof(line), " %08x\n", hashes[name]);
+            list += name + line;
+        }
+        if (!File::SetContents(record_crc_file_, list)) {
+            status = util::Status(util::error::Code::UNKNOWN,
+                                  "Can't write " + record_crc_file_);
+        }
+    }
+    recorder_.reset();
+    return status;
+}
+
 void App::Help(const std::string& topickey) {
 }
 
+void App::Trace(DebugConsole* console, int argc, char **argv) {
+    if (argc != 2) {
+        console->AddLog("Usage: %s <filename>", argv[0]);
+        return;
+    }
+    util::Status status = GFX::Profiler::Get()->WriteTrace(argv[1]);
+    if (status.ok()) {
+        console->AddLog("Wrote %s", argv[1]);
+    } else {
+        console->AddLog("[error] %s", status.ToString().c_str());
+    }
+}
+
+void App::Record(DebugConsole* console, int argc, char **argv) {
+    if (argc == 2 && !strcmp(argv[1], "stop")) {
+        int frames = record_frame_;
+        util::Status status = StopRecording();
+        if (status.ok()) {
+            console->AddLog("Recorded %d frames", frames);
+        } else {
+            console->AddLog("[error] %s", status.ToString().c_str());
+        }
+    } else if (argc == 3 && !strcmp(argv[1], "crc")) {
+        StartRecording("", argv[2]);
+        console->AddLog("Recording CRCs to %s", argv[2]);
+    } else if (argc == 2) {
+        util::Status status = StartRecording(argv[1], "");
+        if (status.ok()) {
+            console->AddLog("Recording to %s", argv[1]);
+        } else {
+            console->AddLog("[error] %s", status.ToString().c_str());
+        }
+    } else {
+        console->AddLog("Usage: %s <printf pattern> | crc <filename> | stop",
+                        argv[0]);
+    }
+}
+
 }  // namespace project
@@ -4,16 +4,26 @@
 #include <string>
 #include <SDL2/SDL.h>
 
+#include "gfx/dynamic_resolution.h"
+#include "gfx/frame_capture.h"
+#include "gfx/frame_writer.h"
 #include "gfx/raymarch.h"
 //#include "gfx/swmarch.h"
 #include "imwidget/imapp.h"
+#include "imwidget/profiler_window.h"
+#include "util/status.h"
 
 namespace project {
 
 class App: public ImApp {
   public:
-    App(const std::string& name) : ImApp(name, 1280, 720) {}
-    ~App() override {}
+    App(const std::string& name)
+      : ImApp(name, 1280, 720),
+        reload_context_(nullptr),
+        profiler_(nullptr),
+        record_frame_(0)
+    {}
+    ~App() override;
 
     void Init() override;
     void ProcessEvent(SDL_Event* event) override;
@@ -23,9 +33,34 @@ class App: public ImApp {
 
     void Help(const std::string& topickey);
   private:
+    void Trace(DebugConsole* console, int argc, char **argv);
+    void DrawResolution();
+    void DrawTemporal();
+    void DrawSampling();
+    void DrawAntialias();
+    void DrawMarchCost();
+    void DrawStepping();
+    void DrawRecording();
+    void Record(DebugConsole* console, int argc, char **argv);
+    // Capture every frame to PNG files named by pattern, or, given a
+    // crc_file, list each frame's CRC32 there when recording stops.
+    // Fails if pattern isn't one CheckFramePattern accepts.
+    util::Status StartRecording(const std::string& pattern,
+                                const std::string& crc_file);
+    util::Status StopRecording();
+
     std::string save_filename_;
     //std::unique_ptr<GFX::SWMarcher> scene_;
     std::unique_ptr<GFX::RayMarchScene> scene_;
+    GFX::DynamicResolution resolution_;
+    // The context shaders are rebuilt with when their files change.
+    SDL_GLContext reload_context_;
+    ProfilerWindow* profiler_;
+    std::unique_ptr<GFX::FrameWriter> recorder_;
+    std::unique_ptr<GFX::FrameCapture> capture_;
+    std::string record_pattern_;
+    std::string record_crc_file_;
+    int record_frame_;
     float theta_, phi_;
     static constexpr float TAU = 3.141592654f * 2.0f;
 };
@@ -0,0 +1,51 @@
+#version 140
+
+// Cone marching depth prepass for raymarch.fs.
+//
+// Each fragment stands for a cone_factor^2 block of full resolution
+// pixels and marches a cone wide enough to hold all of their rays.  A
+// step is only as long as the empty sphere around the cone's axis
+// reaches past the cone's edge, so the depth written is one every ray in
+// the block can start marching from.  x holds the depth, y the steps.
+out vec4 outDepth;
+
+#include "uniforms.inc"
+
+// The coarser level to start from, as in raymarch.fs.
+uniform sampler2D scene_prepass;
+
+#include "hg_sdf.inc"
+#include "scene.inc"
+
+void main()
+{
+    // The centre of this texel's block, in full resolution pixels.
+    vec2 pixel = gl_FragCoord.xy * float(cone_factor);
+    vec2 uv = pixel / scene_viewport.zw * 2.0f - 1.0f;
+    vec3 rd = normalize(camera_forward * camera_focal_length +
+                        camera_right * uv.x * scene_aspect_ratio +
+                        camera_up * uv.y);
+
+    // Any ray in the block is within half the block's diagonal of the
+    // centre ray on the image plane, so this bounds the cone's radius
+    // per unit of distance.
+    vec2 half_block = vec2(scene_aspect_ratio, 1.0f) *
+                      float(cone_factor) / scene_viewport.zw;
+    float k = length(half_block) / camera_focal_length;
+
+    float t = 0.0f;
+    if (scene_prepass_factor != 0) {
+        t = texelFetch(scene_prepass,
+                       ivec2(pixel) / scene_prepass_factor, 0).x;
+    }
+    int i;
+    for(i=0; i<scene_steps; ++i) {
+        float r = t * k;
+        float d = DistPrimary(camera_eye + rd * t);
+        if (d < r * 2.0f || t >= camera_far) {
+            break;
+        }
+        t += d - r;
+    }
+    outDepth = vec4(min(t, camera_far), float(i), 0.0f, 1.0f);
+}
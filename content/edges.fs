@@ -0,0 +1,66 @@
+#version 140
+
+// Finds the pixels RayMarchScene::set_antialias refines.  Copies the
+// first sample's color, and marks the pixels whose depth, normal or
+// color differ from a neighbour's by writing the far depth, which the
+// refining march's depth test passes; every other pixel writes the near
+// depth.  SWMarcher::FindEdges makes the same tests.
+out vec4 outColor;
+
+uniform sampler2D antialias_color;
+// The normal and the distance to what the ray hit; see raymarch.fs.
+uniform sampler2D antialias_surface;
+
+// The largest second difference of the reciprocal depth across a pixel,
+// relative to the pixel's own.  A plane's reciprocal depth changes
+// nearly evenly across the screen, so this ignores slanted surfaces but
+// catches silhouettes.
+const float kDepthEdge = 0.1f;
+// The smallest cosine between neighbouring normals.
+const float kNormalEdge = 0.9f;
+// The largest difference in luma between neighbours.
+const float kColorEdge = 0.1f;
+
+float Luma(vec3 c) {
+    return dot(c, vec3(0.299f, 0.587f, 0.114f));
+}
+
+// The pixel at p + d, clamped to the frame.
+ivec2 Neighbour(ivec2 p, ivec2 d) {
+    return clamp(p + d, ivec2(0), textureSize(antialias_color, 0) - 1);
+}
+
+bool DepthEdge(float t, ivec2 a, ivec2 b) {
+    float ta = texelFetch(antialias_surface, a, 0).w;
+    float tb = texelFetch(antialias_surface, b, 0).w;
+    return abs(2.0f - t / ta - t / tb) > kDepthEdge;
+}
+
+bool Edge(ivec2 p, vec4 color, vec4 surface, ivec2 q) {
+    vec4 c = texelFetch(antialias_color, q, 0);
+    vec4 s = texelFetch(antialias_surface, q, 0);
+    // The sky's normal is 0, so only compare normals between hits.
+    bool hits = dot(surface.xyz, surface.xyz) > 0.25f &&
+                dot(s.xyz, s.xyz) > 0.25f;
+    return abs(Luma(color.rgb) - Luma(c.rgb)) > kColorEdge ||
+           (hits && dot(surface.xyz, s.xyz) < kNormalEdge);
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 color = texelFetch(antialias_color, p, 0);
+    vec4 surface = texelFetch(antialias_surface, p, 0);
+    ivec2 left = Neighbour(p, ivec2(-1, 0));
+    ivec2 right = Neighbour(p, ivec2(1, 0));
+    ivec2 down = Neighbour(p, ivec2(0, -1));
+    ivec2 up = Neighbour(p, ivec2(0, 1));
+    bool edge = DepthEdge(surface.w, left, right) ||
+                DepthEdge(surface.w, down, up) ||
+                Edge(p, color, surface, left) ||
+                Edge(p, color, surface, right) ||
+                Edge(p, color, surface, down) ||
+                Edge(p, color, surface, up);
+    outColor = color;
+    gl_FragDepth = edge ? 1.0f : 0.0f;
+}
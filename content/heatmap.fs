@@ -0,0 +1,27 @@
+#version 140
+
+// Draws a false-color map of one of the per-pixel counters
+// RayMarchScene::set_collect_stats reads back, to be blended over the
+// frame.  The ramp matches HeatColor in gfx/march_stats.cc.
+out vec4 outColor;
+
+#include "uniforms.inc"
+
+// March steps, shadow steps and normal evaluations in rgb.
+// heatmap_counter says which of them to show, and heatmap_range is the
+// count shown in red.
+uniform sampler2D heatmap_costs;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+    vec3 costs = texelFetch(heatmap_costs, pixel, 0).rgb;
+    float n = heatmap_counter == 0 ? costs.r
+            : heatmap_counter == 1 ? costs.g : costs.b;
+    float t = n / max(heatmap_range, 1.0f);
+    vec3 heat = clamp(vec3(4.0f * t - 2.0f,
+                           min(4.0f * t, 4.0f - 4.0f * t),
+                           2.0f - 4.0f * t), 0.0f, 1.0f);
+    // 5/8 heat over 3/8 image, so the geometry stays readable.
+    outColor = vec4(heat, 0.625f);
+}
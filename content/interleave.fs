@@ -0,0 +1,76 @@
+#version 140
+
+// Reconstructs a full frame from RayMarchScene's interleaved passes.  See
+// RayMarchScene::set_sampling.
+//
+// Each pass marched half the pixels, packed together as in raymarch.fs's
+// ScenePixel.  The other half were marched by the previous pass, whose
+// phase was the opposite, so a pixel is at the same packed position in
+// whichever pass marched it.  While the camera is still the previous
+// pass is exact; otherwise, without motion vectors, it's further off
+// than interpolating the neighbours, so it isn't used.
+out vec4 outColor;
+
+uniform sampler2D interleave_current;
+uniform sampler2D interleave_previous;
+// The Sampling, and the current pass's phase.
+uniform int   interleave_mode;
+uniform int   interleave_phase;
+// Whether the previous pass was drawn from the same camera.
+uniform bool  interleave_still;
+// Where the frame goes in the framebuffer, and its size.
+uniform vec4  interleave_viewport;
+
+float Luma(vec3 c) {
+    return dot(c, vec3(0.299f, 0.587f, 0.114f));
+}
+
+bool Marched(ivec2 p) {
+    int n = interleave_mode == 1 ? p.x + p.y : p.y;
+    return ((n + interleave_phase) & 1) == 0;
+}
+
+ivec2 Packed(ivec2 p) {
+    return interleave_mode == 1 ? ivec2(p.x >> 1, p.y) : ivec2(p.x, p.y >> 1);
+}
+
+// A marched neighbour of an unmarched pixel p, p + d or, off the edge of
+// the frame, p - d.
+vec4 Neighbour(ivec2 p, ivec2 d) {
+    ivec2 size = ivec2(interleave_viewport.zw);
+    ivec2 q = p + d;
+    if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) {
+        q = p - d;
+    }
+    return texelFetch(interleave_current, Packed(q), 0);
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy - interleave_viewport.xy);
+    if (Marched(p)) {
+        outColor = vec4(texelFetch(interleave_current, Packed(p), 0).rgb,
+                        1.0f);
+        return;
+    }
+    if (interleave_still) {
+        outColor = vec4(texelFetch(interleave_previous, Packed(p), 0).rgb,
+                        1.0f);
+        return;
+    }
+    vec4 up = Neighbour(p, ivec2(0, 1));
+    vec4 down = Neighbour(p, ivec2(0, -1));
+    // Interpolate along whichever of the rows and columns the color
+    // changes least, so edges aren't blurred across.
+    vec4 color = (up + down) * 0.5f;
+    if (interleave_mode == 1) {
+        vec4 left = Neighbour(p, ivec2(-1, 0));
+        vec4 right = Neighbour(p, ivec2(1, 0));
+        float h = abs(Luma(left.rgb) - Luma(right.rgb));
+        float v = abs(Luma(up.rgb) - Luma(down.rgb));
+        color = h < v ? (left + right) * 0.5f
+              : v < h ? color
+              : (left + right + up + down) * 0.25f;
+    }
+    outColor = vec4(color.rgb, 1.0f);
+}
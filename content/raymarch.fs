@@ -4,25 +4,52 @@
 // The uv variable interpolates between the quad vertices
 smooth in vec2 uv;
 out vec4 outColor;
+// The normal and the distance to what the ray hit, for finding the edges
+// to antialias.  See RayMarchScene::set_antialias.
+out vec4 outSurface;
 
-// Camera
-uniform vec3 camera_up;
-uniform vec3 camera_right;
-uniform vec3 camera_forward;
-uniform vec3 camera_eye;
-uniform float camera_focal_length;
-uniform float camera_near;
-uniform float camera_far;
-
-// Scene
-uniform vec2  scene_resolution;
-uniform int   scene_steps;
-uniform float scene_epsilon;
-uniform float scene_aspect_ratio;
-uniform vec4  scene_sky_color;
-uniform vec4  scene_ambient;
-uniform vec3  scene_light0pos;
-uniform vec4  scene_light0col;
+#include "uniforms.inc"
+
+// Depth prepass.  Each texel of scene_prepass holds a depth every ray
+// through its scene_prepass_factor^2 block of pixels can safely start
+// marching from.  A factor of 0 means there's no prepass.
+uniform sampler2D scene_prepass;
+// scene_output_steps: write the march steps, shadow steps and normal
+// evaluations in rgb instead of the color.  See
+// RayMarchScene::set_collect_stats.
+// scene_interleave: 1: march the pixels where x + y + phase is even,
+// 2: the rows where y + phase is even, packed together into the
+// framebuffer.  See RayMarchScene::set_sampling.
+int march_steps;
+int shadow_steps;
+int normal_evals;
+// Temporal reprojection, see RayMarchScene::set_temporal.  0: off.  1:
+// write the distance to what each ray hit in alpha, for reproject.fs.
+// 2: the camera hasn't moved; average a jittered sample into
+// temporal_history, which already holds temporal_samples.
+// temporal_jitter is the sub-pixel offset of this frame's rays, in
+// pixels.
+uniform sampler2D temporal_history;
+// The distance to what the ray hit, or camera_far for the sky.
+float march_depth;
+// The surface normal there, or 0 for the sky.
+vec3 march_normal;
+// Adaptive antialiasing.  0: march one sample.  Otherwise march
+// antialias_samples more rays, offset by AntialiasOffset pixels, and
+// average them with the sample already in antialias_color.
+uniform sampler2D antialias_color;
+#ifdef SHADOW_CACHE
+// Shadow cache, see RayMarchScene::set_shadows.  Each texel of
+// shadow_cache holds the visibility of what the centre ray of a
+// shadow_cache_factor^2 block of pixels hit and how far away that was,
+// or -1 for the sky.  A factor of 0 means there's no cache.  A nonzero
+// shadow_cache_pass draws the cache at that factor instead of the scene.
+// Programs only have the cache while it's on, as the lookup slows down
+// every pixel even when it's skipped.
+uniform sampler2D shadow_cache;
+// The visibility of the last point shaded.
+float shadow_visibility;
+#endif
 
 float mapTo(float x, float minX, float maxX, float minY, float maxY) {
     float a = (maxY - minY) / (maxX - minX);
@@ -31,16 +58,13 @@ float mapTo(float x, float minX, float maxX, float minY, float maxY) {
 }
 
 #include "hg_sdf.inc"
-#include "boolops.inc"
-
-float DistScene(vec3 position) {
-    return fBoolOps(position);
-}
+#include "scene.inc"
 
 // Approximate the normalized gradient of the distance function at point p.
 // If p is near a surface, the gradient will approximate the surface normal.
 vec3 GetNormal(vec3 p) {
     float h = 0.0001f;
+    normal_evals += 6;
     return normalize(vec3(
         DistScene(p + vec3(h, 0, 0)) - DistScene(p - vec3(h, 0, 0)),
         DistScene(p + vec3(0, h, 0)) - DistScene(p - vec3(0, h, 0)),
@@ -49,32 +73,97 @@ vec3 GetNormal(vec3 p) {
 
 // Return a value [0,1] depending on how visible p1 is from p0.
 // k is the soft shadow factor (larger -> harder shadows).
-// See http://www.iquilezles.org/www/articles/rmshadows/rmshadows.htm
+// See http://www.iquilezles.org/www/articles/rmshadows/rmshadows.htm and
+// gfx/shadow.h.
 float GetVisibility(vec3 p0, vec3 p1, float k) {
     vec3 rd = normalize(p1 - p0);
     float maxt = length(p1 - p0);
     float t = scene_epsilon * 10.0f;
     float f = 1.0f;
+    float last = 1e20f;
 
+    // Only march where the scene's penumbra can reach.
+    vec3 inv = 1.0f / rd;
+    vec3 a = (shadow_lo - maxt / k - p0) * inv;
+    vec3 b = (shadow_hi + maxt / k - p0) * inv;
+    vec3 enter = min(a, b), leave = max(a, b);
+    t = max(t, max(max(enter.x, enter.y), enter.z));
+    maxt = min(maxt, min(min(leave.x, leave.y), leave.z));
     while (t < maxt) {
         float d = DistScene(p0 + rd*t);
+        ++shadow_steps;
 
         // If we hit a surface before reaching p1, not visible.
         if (d < scene_epsilon) {
             return 0.0f;
         }
-        // Compute penumbra factor
-        f = min(f, k * d/t);
-        t += d;
+        // Compute penumbra factor, and give up once it's dark.
+        float y = d * d / (2.0f * last);
+        float h = sqrt(max(d * d - y * y, 0.0f));
+        f = min(f, k * h / max(t - y, 1e-6f));
+        if (f < shadow_threshold) {
+            return 0.0f;
+        }
+        last = d;
+        t += clamp(d, shadow_min_step, shadow_max_step);
     }
     return f;
 }
 
+#ifdef SHADOW_CACHE
+// p's visibility interpolated from the four shadow cache texels around
+// it, or -1 if they hit much nearer or further than p or disagree.
+float CachedVisibility(vec3 p) {
+    if (shadow_cache_factor == 0) {
+        return -1.0f;
+    }
+    // Project p back onto the image plane, undoing RayDirection, and
+    // from there into the cache's texels.
+    vec3 v = p - camera_eye;
+    float z = dot(v, camera_forward);
+    if (z <= 0.0f) {
+        return -1.0f;
+    }
+    vec2 ray = vec2(dot(v, camera_right) / scene_aspect_ratio,
+                    dot(v, camera_up)) * camera_focal_length / z;
+    vec2 pixel = (ray + 1.0f) * 0.5f * scene_viewport.zw;
+    vec2 texel = pixel / float(shadow_cache_factor) - 0.5f;
+    ivec2 size = textureSize(shadow_cache, 0) - 1;
+    ivec2 t0 = clamp(ivec2(floor(texel)), ivec2(0), size);
+    ivec2 t1 = min(t0 + 1, size);
+
+    vec2 c00 = texelFetch(shadow_cache, t0, 0).xy;
+    vec2 c10 = texelFetch(shadow_cache, ivec2(t1.x, t0.y), 0).xy;
+    vec2 c01 = texelFetch(shadow_cache, ivec2(t0.x, t1.y), 0).xy;
+    vec2 c11 = texelFetch(shadow_cache, t1, 0).xy;
+    vec4 vis = vec4(c00.x, c10.x, c01.x, c11.x);
+    vec4 depth = vec4(c00.y, c10.y, c01.y, c11.y);
+    float d = length(v);
+    if (any(greaterThan(abs(depth - d), vec4(0.05f * d)))) {
+        return -1.0f;
+    }
+    vec2 lo = min(vis.xy, vis.zw), hi = max(vis.xy, vis.zw);
+    if (max(hi.x, hi.y) - min(lo.x, lo.y) > shadow_cache_tolerance) {
+        return -1.0f;
+    }
+    vec2 w = clamp(texel - floor(texel), 0.0f, 1.0f);
+    return mix(mix(vis.x, vis.y, w.x), mix(vis.z, vis.w, w.x), w.y);
+}
+#endif
+
 vec4 GetShading(
         vec3 pos, vec3 normal,
         vec3 light_pos, vec4 light_col) {
     float intensity = 0.0f;
-    float vis = GetVisibility(pos, light_pos, 16.0f);
+#ifdef SHADOW_CACHE
+    float vis = CachedVisibility(pos);
+    if (vis < 0.0f) {
+        vis = GetVisibility(pos, light_pos, shadow_k);
+    }
+    shadow_visibility = vis;
+#else
+    float vis = GetVisibility(pos, light_pos, shadow_k);
+#endif
     if (vis > 0.0f) {
         vec3 light_dir = normalize(light_pos - pos);
         intensity = vis * clamp(dot(normal, light_dir), 0, 1);
@@ -82,20 +171,60 @@ vec4 GetShading(
     return light_col * intensity + scene_ambient * (1.0f - intensity);
 }
 
+// The pixel this fragment marches.
+ivec2 ScenePixel() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+    if (scene_interleave == 1) {
+        pixel.x = pixel.x * 2 + ((pixel.y + scene_interleave_phase) & 1);
+    } else if (scene_interleave == 2) {
+        pixel.y = pixel.y * 2 + scene_interleave_phase;
+    }
+    return pixel;
+}
+
+float PrepassDepth() {
+    if (scene_prepass_factor == 0) {
+        return 0.0f;
+    }
+    ivec2 pixel = ScenePixel();
+    return texelFetch(scene_prepass, pixel / scene_prepass_factor, 0).x;
+}
+
+// March from the starting distance passed in distance, stepping as
+// gfx/stepping.h describes.
 void RayMarch(
         vec3 ro, vec3 rd,
         inout int i, inout float distance) {
-    distance = 0.0f;
+    // Stepping::kEnhanced predicts each step's stretch.
+    bool predict = scene_stepping == 2;
+    bool stretching = scene_stepping != 0;
+    float stretch = predict ? 1.0f : scene_stretch;
+    float step = 0.0f, last = 0.0f;
     for(i=0; i<scene_steps; ++i) {
-        float d = DistScene(ro + rd * distance);
+        float d = DistPrimary(ro + rd * distance);
 
+        if (step > last && last + d < step) {
+            // The step was longer than the last distance and its spheres
+            // don't overlap: go back and step plainly from there on.
+            distance -= step - last;
+            step = last;
+            stretch = 1.0f;
+            stretching = false;
+            continue;
+        }
         // Make epsilon proportional to the distance so that accuracy can
         // drop as we get further into the scene.  We also just drop the
         // ray if it goes outside the far camera bound.
         if (d < scene_epsilon*distance*2.0f || distance >= camera_far) {
             break;
         }
-        distance += d;
+        if (predict && stretching && step > 0.0f) {
+            float gap = max(step + last - d, 1e-6f);
+            stretch = min(max(1.8f * step / gap, 1.0f), scene_relaxation);
+        }
+        step = d * stretch;
+        last = d;
+        distance += step;
     }
 }
 
@@ -123,8 +252,9 @@ vec4 ComputeColor(vec3 ro, vec3 rd) {
     vec4 texture = vec4(1.0f);  // Surface texture
 
     int i;          // Steps traveled in raymarch
-    float t0;     // Distance traveled in raymarch
+    float t0 = PrepassDepth();  // Distance traveled in raymarch
     RayMarch(ro, rd, i, t0);
+    march_steps += i;
 
     float t1 = RaytraceFloor(ro, rd, floor_normal, floor_pos);
 
@@ -140,8 +270,12 @@ vec4 ComputeColor(vec3 ro, vec3 rd) {
         p = ro + rd*t;
         normal = GetNormal(p);
     } else {
+        march_depth = camera_far;
+        march_normal = vec3(0.0f);
         return scene_sky_color;
     }
+    march_depth = t;
+    march_normal = normal;
 
     vec4 color;
     // float z = mapTo(t, camera_near, camera_far, 1, 0);
@@ -153,15 +287,52 @@ vec4 ComputeColor(vec3 ro, vec3 rd) {
     return color;
 }
 
+vec3 RayDirection(vec2 ray) {
+    return normalize(camera_forward * camera_focal_length +
+                     camera_right * ray.x * scene_aspect_ratio +
+                     camera_up * ray.y);
+}
+
 void main()
 {
     vec3 rayorigin = camera_eye;
     vec4 color;
+    march_steps = 0;
+    shadow_steps = 0;
+    normal_evals = 0;
 #if 1
-    vec3 raydirection = normalize(camera_forward * camera_focal_length +
-                                  camera_right * uv.x * scene_aspect_ratio + 
-                                  camera_up * uv.y);
-    color = ComputeColor(rayorigin, raydirection);
+    vec2 ray = uv + temporal_jitter * 2.0f / scene_viewport.zw;
+    if (scene_interleave != 0) {
+        ray = (vec2(ScenePixel()) + 0.5f) / scene_viewport.zw * 2.0f - 1.0f;
+    }
+#ifdef SHADOW_CACHE
+    shadow_visibility = 0.0f;
+    if (shadow_cache_pass != 0) {
+        // Each fragment stands for the block of pixels around the ray
+        // through its centre, like conemarch.fs's.
+        ray = gl_FragCoord.xy * float(shadow_cache_pass) /
+              scene_viewport.zw * 2.0f - 1.0f;
+    }
+#endif
+    if (antialias_samples > 0) {
+        ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+        color = texelFetch(antialias_color, pixel, 0);
+        for(int i = 0; i < antialias_samples; ++i) {
+            vec2 offset = AntialiasOffset(i) * 2.0f / scene_viewport.zw;
+            color += ComputeColor(rayorigin, RayDirection(uv + offset));
+        }
+        color /= float(antialias_samples + 1);
+    } else {
+        color = ComputeColor(rayorigin, RayDirection(ray));
+    }
+    outSurface = vec4(march_normal, march_depth);
+    if (temporal_mode == 2) {
+        // Progressive average of every sample taken since the camera
+        // stopped.
+        ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+        vec4 history = texelFetch(temporal_history, pixel, 0);
+        color = mix(history, color, 1.0f / float(temporal_samples + 1));
+    }
 #else
     // 4x Anti-Aliasing
     vec2 hps = vec2(1.0) / (scene_resolution * 2.0);
@@ -186,4 +357,18 @@ void main()
 #endif
 
 	outColor = vec4(color.xyz, 1.0f);
+    if (temporal_mode != 0) {
+        outColor.a = march_depth;
+    }
+#ifdef SHADOW_CACHE
+    if (shadow_cache_pass != 0) {
+        outColor = vec4(shadow_visibility,
+                        march_depth < camera_far ? march_depth : -1.0f,
+                        0.0f, 1.0f);
+    }
+#endif
+    if (scene_output_steps != 0) {
+        outColor = vec4(float(march_steps), float(shadow_steps),
+                        float(normal_evals), 1.0f);
+    }
 }
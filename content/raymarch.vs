@@ -1,10 +1,12 @@
 #version 140
 
-in vec2 position;
+// A single triangle covering the screen, placed from gl_VertexID with no
+// vertex data: (-1,-1), (3,-1) and (-1,3).
 smooth out vec2 uv;
 
 void main()
 {
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0f - 1.0f;
 	uv = position;
 	gl_Position = vec4(position.xy, 0.0f, 1.0f);
-}
\ No newline at end of file
+}
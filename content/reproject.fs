@@ -0,0 +1,110 @@
+#version 140
+
+// Temporal reprojection for RayMarchScene, drawn into the new history
+// before raymarch.fs.  Each pixel whose surface the previous frame saw
+// gets that frame's color; the rest are discarded, and raymarch.fs is
+// then drawn with a depth test that only passes where nothing was
+// written here, so reused pixels aren't marched at all.
+//
+// The history holds the previous frame's color in rgb and the distance
+// along each pixel's ray to what it saw in a.  It was drawn with the
+// camera in temporal_eye, temporal_forward, temporal_right and
+// temporal_up; the lens and the scene haven't changed since.
+out vec4 outColor;
+
+#include "uniforms.inc"
+
+// The depth prepass, as in raymarch.fs.
+uniform sampler2D scene_prepass;
+
+// The history.  Every pixel is marched again at least every
+// temporal_refresh frames.
+uniform sampler2D temporal_history;
+
+#include "hg_sdf.inc"
+#include "scene.inc"
+
+// Pixels are refreshed in 8x8 blocks, so the pixels marched together
+// mostly take the same branch.
+bool Refresh(ivec2 pixel) {
+    ivec2 block = pixel / 8;
+    return temporal_refresh > 0 &&
+        (block.x + block.y * 3 + temporal_frame) % temporal_refresh == 0;
+}
+
+// Look for this pixel's surface in the history.  The surface is found
+// by reprojecting a guess at its depth into the previous frame and
+// taking the point seen there; it must lie on this pixel's ray and on a
+// surface, which also keeps reused depths from drifting off the surface
+// as pixels are reused from pixels that were reused.  The depth prepass
+// is what makes reuse safe: it proves nothing the previous frame
+// couldn't see, e.g. something that came in from the edge of the
+// screen, is in front of the point.
+bool Reuse(ivec2 pixel, vec3 ro, vec3 rd, out vec4 result) {
+    float safe = texelFetch(scene_prepass, pixel / scene_prepass_factor, 0).x;
+    // The prepass stops within two cone radii of a surface.
+    vec2 block = vec2(scene_aspect_ratio, 1.0f) *
+                 float(scene_prepass_factor) / scene_viewport.zw;
+    float band = 2.0f * length(block) / camera_focal_length;
+    // The size of a pixel per unit of distance.
+    float pixel_size = 2.0f / (scene_viewport.w * camera_focal_length);
+
+    // The floor isn't part of the distance field, so it's traced here, as
+    // in raymarch.fs.
+    float floor_t = (-1.5f - ro.y) / rd.y;
+    if (floor_t < camera_near) {
+        floor_t = camera_far;
+    }
+    float t = min(safe, floor_t);
+    for(int i = 0; i < 2; ++i) {
+        vec3 v = ro + rd * t - temporal_eye;
+        float z = dot(v, temporal_forward);
+        if (z <= 0.0f) {
+            return false;
+        }
+        vec2 uv = vec2(dot(v, temporal_right) / scene_aspect_ratio,
+                       dot(v, temporal_up)) * camera_focal_length / z;
+        vec2 xy = (uv * 0.5f + 0.5f) * scene_viewport.zw;
+        if (any(lessThan(xy, vec2(0.0f))) ||
+            any(greaterThanEqual(xy, scene_viewport.zw))) {
+            return false;
+        }
+        vec4 history = texelFetch(temporal_history, ivec2(xy), 0);
+
+        // The point the previous frame saw through that pixel.
+        vec2 centre = (floor(xy) + 0.5f) / scene_viewport.zw * 2.0f - 1.0f;
+        vec3 prd = normalize(temporal_forward * camera_focal_length +
+                             temporal_right * centre.x * scene_aspect_ratio +
+                             temporal_up * centre.y);
+        vec3 q = temporal_eye + prd * history.a;
+        float tq = dot(q - ro, rd);
+        float tolerance = pixel_size * tq;
+        if (length(ro + rd * tq - q) < 2.0f * tolerance &&
+            tq <= safe + band * tq && tq <= floor_t + tolerance) {
+            bool hit = history.a >= camera_far
+                ? safe >= camera_far && floor_t >= camera_far
+                : abs(tq - floor_t) < tolerance ||
+                  abs(DistScene(ro + rd * tq)) < tolerance;
+            if (hit) {
+                result = vec4(history.rgb, tq);
+                return true;
+            }
+        }
+        t = tq;
+    }
+    return false;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+    vec2 uv = (vec2(pixel) + 0.5f) / scene_viewport.zw * 2.0f - 1.0f;
+    vec3 rd = normalize(camera_forward * camera_focal_length +
+                        camera_right * uv.x * scene_aspect_ratio +
+                        camera_up * uv.y);
+    // Without a prepass nothing can be reused.
+    if (scene_prepass_factor == 0 || Refresh(pixel) ||
+        !Reuse(pixel, camera_eye, rd, outColor)) {
+        discard;
+    }
+}
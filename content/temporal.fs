@@ -0,0 +1,15 @@
+#version 140
+
+// Copies the color from RayMarchScene's temporal history to the screen.
+// The history's alpha holds depths, so the alpha written is 1.
+out vec4 outColor;
+
+#include "uniforms.inc"
+
+uniform sampler2D temporal_history;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy - scene_viewport.xy);
+    outColor = vec4(texelFetch(temporal_history, pixel, 0).rgb, 1.0f);
+}
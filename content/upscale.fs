@@ -0,0 +1,60 @@
+#version 140
+
+// Upscales the part of a DynamicResolution target that was drawn to the
+// whole viewport.  See gfx/dynamic_resolution.h.
+smooth in vec2 uv;
+out vec4 outColor;
+
+uniform sampler2D source;
+// The texture's size, and the part of it, from the origin, to upscale.
+uniform vec2 source_size;
+uniform vec2 render_size;
+// 0 for bilinear, 1 for edge-aware.
+uniform int upscale_filter;
+
+// How quickly a texel's weight falls as its luminance moves away from
+// the nearest texel's.
+const float kEdgeSharpness = 8.0f;
+
+float Luma(vec3 c) {
+    return dot(c, vec3(0.299f, 0.587f, 0.114f));
+}
+
+vec4 Bilinear(vec2 p) {
+    // Keep the filter off the texels outside render_size.
+    p = clamp(p, vec2(0.5f), render_size - vec2(0.5f));
+    return texture(source, p / source_size);
+}
+
+// Bilinear weights scaled down for texels on the far side of an edge from
+// the nearest texel, so edges aren't smeared across the upscaled pixels.
+vec4 EdgeAware(vec2 p) {
+    vec2 q = p - vec2(0.5f);
+    vec2 f = fract(q);
+    ivec2 base = ivec2(floor(q));
+    ivec2 hi = ivec2(render_size) - ivec2(1);
+    vec4 t[4];
+    t[0] = texelFetch(source, clamp(base, ivec2(0), hi), 0);
+    t[1] = texelFetch(source, clamp(base + ivec2(1, 0), ivec2(0), hi), 0);
+    t[2] = texelFetch(source, clamp(base + ivec2(0, 1), ivec2(0), hi), 0);
+    t[3] = texelFetch(source, clamp(base + ivec2(1, 1), ivec2(0), hi), 0);
+    vec4 w = vec4((1.0f - f.x) * (1.0f - f.y), f.x * (1.0f - f.y),
+                  (1.0f - f.x) * f.y, f.x * f.y);
+
+    int nearest = (f.x < 0.5f ? 0 : 1) + (f.y < 0.5f ? 0 : 2);
+    float guide = Luma(t[nearest].rgb);
+    vec4 color = vec4(0.0f);
+    float total = 0.0f;
+    for(int i = 0; i < 4; ++i) {
+        float wi = w[i] * exp(-kEdgeSharpness * abs(Luma(t[i].rgb) - guide));
+        color += t[i] * wi;
+        total += wi;
+    }
+    return color / total;
+}
+
+void main()
+{
+    vec2 p = (uv * 0.5f + 0.5f) * render_size;
+    outColor = upscale_filter == 1 ? EdgeAware(p) : Bilinear(p);
+}
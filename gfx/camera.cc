@@ -1,32 +1,35 @@
 #include "gfx/camera.h"
 
+#include <cmath>
+#include <cstring>
 #include <GL/glew.h>
 
 #include "glm/glm.hpp"
-#include "glm/gtc/type_ptr.hpp"
 
 namespace GFX {
 
-void Camera::Init(GLuint program) {
-    loc_.up      =      glGetUniformLocation(program, "camera_up");
-    loc_.right   =      glGetUniformLocation(program, "camera_right");
-    loc_.forward =      glGetUniformLocation(program, "camera_forward");
-    loc_.eye     =      glGetUniformLocation(program, "camera_eye");
-    loc_.focal_length = glGetUniformLocation(program, "camera_focal_length");
-    loc_.near    =      glGetUniformLocation(program, "camera_near");
-    loc_.far     =      glGetUniformLocation(program, "camera_far");
+void Camera::Orient(float theta, float phi) {
+    float cost = cosf(theta), sint = sinf(theta);
+    float cosp = cosf(phi), sinp = sinf(phi);
+    forward = glm::vec3(sint*cosp, -sinp, cost*cosp);
+    right = glm::vec3(cost, 0.0f, -sint);
+    up = glm::normalize(glm::cross(forward, right));
 }
 
-void Camera::Update() {
-    glUniform3fv(loc_.up, 1, glm::value_ptr(up));
-    glUniform3fv(loc_.right, 1, glm::value_ptr(right));
-    glUniform3fv(loc_.forward, 1, glm::value_ptr(forward));
-    glUniform3fv(loc_.eye, 1, glm::value_ptr(eye));
-    glUniform1f(loc_.focal_length, focal_length);
+void Camera::Init(GLuint program) {
+    GLuint index = glGetUniformBlockIndex(program, "CameraBlock");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, index, kUniformBinding);
+    }
+}
 
-    // maybe don't have to do these on every frame.
-    glUniform1f(loc_.near, near);
-    glUniform1f(loc_.far, far);
+void Camera::Update(UniformRing* ring) {
+    CameraUniforms u{up, focal_length, right, near, forward, far, eye, 0.0f};
+    if (!ring->Live(block_) || memcmp(&u, &uniforms_, sizeof(u)) != 0) {
+        uniforms_ = u;
+        block_ = ring->Write(&uniforms_, sizeof(uniforms_));
+    }
+    ring->Bind(kUniformBinding, block_);
 }
 
 }  // namespace GFX
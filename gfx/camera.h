@@ -3,8 +3,23 @@
 #include <GL/glew.h>
 
 #include "glm/glm.hpp"
+#include "gfx/uniform_ring.h"
 
 namespace GFX {
+
+// The camera's std140 uniform block, CameraBlock in content/uniforms.inc.
+struct CameraUniforms {
+    glm::vec3 up;
+    float focal_length;
+    glm::vec3 right;
+    float near;
+    glm::vec3 forward;
+    float far;
+    glm::vec3 eye;
+    float pad;
+};
+static_assert(sizeof(CameraUniforms) == 64, "CameraUniforms isn't std140");
+
 class Camera {
   public:
     Camera()
@@ -14,7 +29,9 @@ class Camera {
         eye(glm::vec3(0.0f, 0.0f, -2.0f)),
         focal_length(1.67f),
         near(0.0f),
-        far(150.0f) {}
+        far(150.0f),
+        uniforms_{},
+        block_{} {}
 
     glm::vec3 up;
     glm::vec3 right;
@@ -24,19 +41,23 @@ class Camera {
     float near;
     float far;
 
-    void Init(GLuint program);
-    void Update();
+    // Point the camera theta radians right of +z and phi radians down,
+    // keeping it level.
+    void Orient(float theta, float phi);
+
+    // The uniform buffer binding point CameraBlock is read from.
+    static const GLuint kUniformBinding = 0;
+
+    // Point a program's CameraBlock at kUniformBinding.  Only needs doing
+    // once per program.
+    static void Init(GLuint program);
+    // Bind the camera's uniform block, writing it to ring first if the
+    // camera changed or the block isn't live any more.
+    void Update(UniformRing* ring);
 
   private:
-    struct Locations {
-        GLuint up;
-        GLuint right;
-        GLuint forward;
-        GLuint eye;
-        GLuint focal_length;
-        GLuint near;
-        GLuint far;
-    } loc_;
+    CameraUniforms uniforms_;
+    UniformRing::Block block_;
 };
 
 }  // namespace GFX
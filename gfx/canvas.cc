@@ -2,6 +2,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #define GLM_FORCE_SWIZZLE
 #include "gfx/canvas.h"
+#include "gfx/geometry.h"
 
 #include "absl/memory/memory.h"
 #include "glm/gtc/matrix_transform.hpp"
@@ -196,25 +197,14 @@ void Context2D::Draw() {
 
     glBindSampler(0, 0); // Rely on combined texture/sampler state.
 
+    // The vertex array already holds the attribute layout and the element
+    // buffer; only the data is uploaded.
     glBindVertexArray(vao_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glEnableVertexAttribArray(vars_.position);
-    glEnableVertexAttribArray(vars_.uv);
-    glEnableVertexAttribArray(vars_.color);
-    glVertexAttribPointer(vars_.position, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, pos));
-    glVertexAttribPointer(vars_.uv, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, uv));
-    glVertexAttribPointer(vars_.color, 4, GL_FLOAT, GL_FALSE,
-                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, color));
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(Vertex),
-                 (const GLvoid*)vertices_.data(), GL_STREAM_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(GLuint),
-                 (const GLvoid*)indices_.data(), GL_STREAM_DRAW);
+    StreamData(GL_ARRAY_BUFFER, vertices_.data(),
+               vertices_.size() * sizeof(Vertex), &vbo_capacity_);
+    StreamData(GL_ELEMENT_ARRAY_BUFFER, indices_.data(),
+               indices_.size() * sizeof(GLuint), &ebo_capacity_);
     GLuint* offset = 0;
     for(const auto& c : command_) {
         if (c.antialias) {
@@ -281,6 +271,23 @@ void Context2D::Init() {
     glGenVertexArrays(1, &vao_);
     glGenBuffers(1, &vbo_);
     glGenBuffers(1, &ebo_);
+    vbo_capacity_ = 0;
+    ebo_capacity_ = 0;
+
+    // Capture the vertex layout once.
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+    glEnableVertexAttribArray(vars_.position);
+    glEnableVertexAttribArray(vars_.uv);
+    glEnableVertexAttribArray(vars_.color);
+    glVertexAttribPointer(vars_.position, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, pos));
+    glVertexAttribPointer(vars_.uv, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, uv));
+    glVertexAttribPointer(vars_.color, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex), (GLvoid*)offsetof(Vertex, color));
+    glBindVertexArray(0);
 
     InitWhitePixel();
     InitCommandList();
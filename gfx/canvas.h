@@ -98,6 +98,8 @@ class Context2D {
     GLuint vao_;  // vertex array object
     GLuint vbo_;  // vertex buffer object
     GLuint ebo_;  // element buffer object
+    GLsizeiptr vbo_capacity_;
+    GLsizeiptr ebo_capacity_;
     GLuint white_pixel_;  // default texture
 
     GLuint fb_width_;
@@ -0,0 +1,14 @@
+#include "gfx/distance_field.h"
+
+namespace GFX {
+
+// Out of line so the packet kernels, which are built per instruction
+// set, call this rather than emitting copies of it.
+void DistanceField::Distance(const float* x, const float* y, const float* z,
+                             float* d, int n) const {
+    for(int i=0; i<n; ++i) {
+        d[i] = Distance(glm::vec3(x[i], y[i], z[i]));
+    }
+}
+
+}  // namespace GFX
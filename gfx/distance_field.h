@@ -0,0 +1,30 @@
+#ifndef RMX_GFX_DISTANCE_FIELD_H
+#define RMX_GFX_DISTANCE_FIELD_H
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+namespace GFX {
+
+// A signed distance field which the software marcher can evaluate.
+class DistanceField {
+  public:
+    virtual ~DistanceField() {}
+
+    // Distance from p to the nearest surface.
+    virtual float Distance(const glm::vec3& p) const = 0;
+
+    // Evaluate n points stored in structure-of-arrays form.  The packet
+    // marcher calls this once per step for a whole packet, so
+    // implementations should override it to amortize their per-call
+    // overhead.  The default just loops over Distance().
+    virtual void Distance(const float* x, const float* y, const float* z,
+                          float* d, int n) const;
+
+    // A value which changes whenever the field changes.  Anything which
+    // caches data derived from the field keys it on this.
+    virtual uint64_t Fingerprint() const = 0;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_DISTANCE_FIELD_H
@@ -0,0 +1,233 @@
+#include "gfx/dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gfx/profiler.h"
+#include "util/logging.h"
+
+namespace GFX {
+namespace {
+const char kUpscaleVertexShader[] = "content/raymarch.vs";
+const char kUpscaleShader[] = "content/upscale.fs";
+
+// Times within this fraction of the target leave the scale alone, so
+// noise in the timings doesn't make the resolution shimmer.
+const double kDeadband = 0.05;
+// The most the scale changes after one frame.  It falls faster than it
+// rises, to get back under budget quickly after a spike.
+const float kMaxFall = 0.8f;
+const float kMaxRise = 1.05f;
+}  // namespace
+
+DynamicResolution::DynamicResolution()
+  : scale_(1.0f),
+    texture_width_(0),
+    texture_height_(0),
+    render_width_(0),
+    render_height_(0),
+    fbo_(0),
+    texture_(0),
+    loc_{-1, -1, -1, -1},
+    framebuffer_(0),
+    viewport_{0, 0, 0, 0},
+    queries_{},
+    pending_{},
+    scales_{},
+    timing_(false),
+    frame_(0),
+    gpu_ms_(0.0)
+{}
+
+DynamicResolution::~DynamicResolution() {
+    if (reloader_) {
+        reloader_->Unwatch(this);
+    }
+    if (fbo_) {
+        glDeleteFramebuffers(1, &fbo_);
+        glDeleteTextures(1, &texture_);
+        glDeleteQueries(2 * kQueryFrames, &queries_[0][0]);
+    }
+}
+
+void DynamicResolution::set_reloader(
+        std::shared_ptr<ShaderReloader> reloader) {
+    if (reloader_) {
+        reloader_->Unwatch(this);
+    }
+    reloader_ = std::move(reloader);
+    if (!reloader_) {
+        return;
+    }
+    ShaderReloader::Source source{kUpscaleVertexShader, kUpscaleShader};
+    if (upscale_) {
+        reloader_->Watch(this, 0, source, upscale_->dependencies());
+    } else {
+        // End blits until it's built.
+        reloader_->Build(this, 0, source);
+    }
+}
+
+void DynamicResolution::InitUpscale() {
+    GLuint p = upscale_->program();
+    loc_.source = glGetUniformLocation(p, "source");
+    loc_.source_size = glGetUniformLocation(p, "source_size");
+    loc_.render_size = glGetUniformLocation(p, "render_size");
+    loc_.filter = glGetUniformLocation(p, "upscale_filter");
+}
+
+// Allocate the texture for the largest scale the options allow.
+void DynamicResolution::Resize(int width, int height) {
+    float largest = options_.max_scale;
+    if (options_.locked) {
+        largest = std::max(largest, options_.locked_scale);
+    }
+    int w = std::max(1, int(std::ceil(width * largest)));
+    int h = std::max(1, int(std::ceil(height * largest)));
+    if (w == texture_width_ && h == texture_height_) {
+        return;
+    }
+    if (!fbo_) {
+        glGenFramebuffers(1, &fbo_);
+        glGenTextures(1, &texture_);
+        glGenQueries(2 * kQueryFrames, &queries_[0][0]);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, texture_, 0);
+    texture_width_ = w;
+    texture_height_ = h;
+    LOGF(INFO, "Dynamic resolution target is %dx%d", w, h);
+}
+
+void DynamicResolution::Begin(int width, int height) {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer_);
+    glGetIntegerv(GL_VIEWPORT, viewport_);
+    Resize(width, height);
+    ReadTimers();
+
+    if (options_.locked) {
+        scale_ = options_.locked_scale;
+    } else {
+        scale_ = std::min(std::max(scale_, options_.min_scale),
+                          options_.max_scale);
+    }
+    render_width_ = std::min(texture_width_,
+                             std::max(1, int(std::lround(width * scale_))));
+    render_height_ = std::min(texture_height_,
+                              std::max(1, int(std::lround(height * scale_))));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    glViewport(0, 0, render_width_, render_height_);
+
+    // A frame isn't timed if the GPU is so far behind that its queries
+    // are still outstanding.
+    int slot = frame_ % kQueryFrames;
+    timing_ = GLEW_ARB_timer_query && !pending_[slot];
+    if (timing_) {
+        glQueryCounter(queries_[slot][0], GL_TIMESTAMP);
+    }
+}
+
+void DynamicResolution::End() {
+    int slot = frame_ % kQueryFrames;
+    if (timing_) {
+        glQueryCounter(queries_[slot][1], GL_TIMESTAMP);
+        pending_[slot] = true;
+        scales_[slot] = scale_;
+    }
+    ++frame_;
+
+    Profiler::Scope scope("upscale");
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+    if (reloader_) {
+        if (auto p = reloader_->Take(this, 0)) {
+            upscale_ = std::move(p);
+            InitUpscale();
+        }
+    } else if (!upscale_) {
+        upscale_ = Shader::Load(kUpscaleVertexShader, kUpscaleShader, "");
+        if (!upscale_) {
+            LOG(ERROR, "Can't load ", kUpscaleShader,
+                "; upscaling with glBlitFramebuffer");
+        } else {
+            InitUpscale();
+        }
+    }
+    if (!upscale_) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+        glBlitFramebuffer(0, 0, render_width_, render_height_,
+                          viewport_[0], viewport_[1],
+                          viewport_[0] + viewport_[2],
+                          viewport_[1] + viewport_[3],
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+        return;
+    }
+
+    // Scenes leave their program bound from one frame to the next.
+    GLint program;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    upscale_->Use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glUniform1i(loc_.source, 0);
+    glUniform2f(loc_.source_size, texture_width_, texture_height_);
+    glUniform2f(loc_.render_size, render_width_, render_height_);
+    glUniform1i(loc_.filter, options_.filter);
+    geometry_.DrawFullscreen(-1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(program);
+}
+
+// Read the timings of finished frames, oldest first, without waiting for
+// any that aren't.
+void DynamicResolution::ReadTimers() {
+    for(int i = 0; i < kQueryFrames; ++i) {
+        int slot = (frame_ + i) % kQueryFrames;
+        if (!pending_[slot]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(queries_[slot][1], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 start, end;
+        glGetQueryObjectui64v(queries_[slot][0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(queries_[slot][1], GL_QUERY_RESULT, &end);
+        pending_[slot] = false;
+        gpu_ms_ = double(end - start) / 1e6;
+        Adjust(scales_[slot], gpu_ms_);
+    }
+}
+
+// The cost of a frame is taken to be proportional to its pixel count, so
+// the scale that would have met the target is the frame's scale times
+// sqrt(target / ms).  Timings lag behind, so the frame's scale may not be
+// the current one.
+void DynamicResolution::Adjust(float frame_scale, double ms) {
+    if (options_.locked || ms <= 0.0) {
+        return;
+    }
+    double ratio = options_.target_ms / ms;
+    if (std::abs(ratio - 1.0) < kDeadband) {
+        return;
+    }
+    float want = frame_scale * float(std::sqrt(ratio));
+    want = std::min(std::max(want, scale_ * kMaxFall), scale_ * kMaxRise);
+    scale_ = std::min(std::max(want, options_.min_scale),
+                      options_.max_scale);
+}
+
+}  // namespace GFX
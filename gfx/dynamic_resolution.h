@@ -0,0 +1,114 @@
+#ifndef RMX_GFX_DYNAMIC_RESOLUTION_H
+#define RMX_GFX_DYNAMIC_RESOLUTION_H
+#include <memory>
+#include <GL/glew.h>
+
+#include "gfx/geometry.h"
+#include "gfx/shader.h"
+#include "gfx/shader_reloader.h"
+
+namespace GFX {
+
+// An offscreen render target whose resolution follows a frame time
+// budget.  Whatever is drawn between Begin and End is rendered at a
+// fraction of the output size, timed on the GPU, and upscaled to the
+// framebuffer that was bound at Begin.  After each timed frame the scale
+// is moved towards the one whose pixel count would have met the budget,
+// assuming the cost is proportional to the pixel count.
+//
+// The texture is allocated at the largest scale and frames are drawn
+// into its lower left corner, so changing the scale never reallocates.
+class DynamicResolution {
+  public:
+    enum Filter {
+        // Bilinear interpolation of the four nearest texels.
+        kBilinear,
+        // Bilinear, but texels whose luminance differs from the nearest
+        // texel's are weighted down, so edges stay sharp instead of
+        // being blurred across.
+        kEdgeAware,
+    };
+
+    struct Options {
+        // The GPU time to aim for between Begin and End.
+        float target_ms = 12.0f;
+        // The range of the scale, the fraction of the output's width and
+        // height rendered.
+        float min_scale = 0.5f;
+        float max_scale = 1.0f;
+        // Keep the scale at locked_scale, e.g. for benchmarking.
+        bool locked = false;
+        float locked_scale = 1.0f;
+        Filter filter = kEdgeAware;
+    };
+
+    DynamicResolution();
+    ~DynamicResolution();
+
+    // Bind the render target and set the viewport to the render size for
+    // a width x height output.
+    void Begin(int width, int height);
+    // Upscale what was drawn since Begin to the previous framebuffer and
+    // viewport.
+    void End();
+
+    // Changes to the limits apply from the next Begin.
+    inline Options* mutable_options() { return &options_; }
+    inline const Options& options() const { return options_; }
+
+    // Rebuild the upscaling program in the background when its source
+    // changes, as RayMarchScene::set_reloader does.  If it isn't built
+    // yet, it's built in the background too, and End blits until then.
+    void set_reloader(std::shared_ptr<ShaderReloader> reloader);
+
+    inline float scale() const { return scale_; }
+    inline int render_width() const { return render_width_; }
+    inline int render_height() const { return render_height_; }
+    // The last GPU time measured between Begin and End, which lags a few
+    // frames behind.
+    inline double gpu_ms() const { return gpu_ms_; }
+
+  private:
+    // Frames whose timer queries may be outstanding at once.
+    static const int kQueryFrames = 4;
+
+    void Resize(int width, int height);
+    void ReadTimers();
+    void Adjust(float frame_scale, double ms);
+    void InitUpscale();
+
+    Options options_;
+    float scale_;
+    // The size allocated, and the part of it drawn this frame.
+    int texture_width_;
+    int texture_height_;
+    int render_width_;
+    int render_height_;
+
+    GLuint fbo_;
+    GLuint texture_;
+    StaticGeometry geometry_;
+    std::unique_ptr<Shader> upscale_;
+    struct {
+        GLint source;
+        GLint source_size;
+        GLint render_size;
+        GLint filter;
+    } loc_;
+    std::shared_ptr<ShaderReloader> reloader_;
+    GLint framebuffer_;
+    GLint viewport_[4];
+
+    // Timestamp pairs, rather than GL_TIME_ELAPSED, so the frame can use
+    // its own elapsed time queries.
+    GLuint queries_[kQueryFrames][2];
+    bool pending_[kQueryFrames];
+    // The scale each timed frame was drawn at.
+    float scales_[kQueryFrames];
+    bool timing_;
+    int frame_;
+    double gpu_ms_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_DYNAMIC_RESOLUTION_H
@@ -0,0 +1,126 @@
+#include "gfx/file_watcher.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#endif
+
+#include "util/logging.h"
+
+namespace GFX {
+namespace {
+
+void SplitPath(const std::string& path, std::string* dir, std::string* name) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        *dir = ".";
+        *name = path;
+    } else {
+        *dir = slash ? path.substr(0, slash) : "/";
+        *name = path.substr(slash + 1);
+    }
+}
+
+}  // namespace
+
+#ifdef __linux__
+FileWatcher::FileWatcher()
+  : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (fd_ < 0) {
+        LOG(ERROR, "inotify_init1 failed; files won't be watched");
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void FileWatcher::Watch(const std::string& path) {
+    std::string dir, name;
+    SplitPath(path, &dir, &name);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end() && fd_ >= 0) {
+        int wd = inotify_add_watch(fd_, dir.c_str(),
+                                   IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0) {
+            LOG(ERROR, "Can't watch ", dir);
+            return;
+        }
+        wds_[wd].push_back(dir);
+    }
+    dirs_[dir][name] = path;
+}
+
+std::vector<std::string> FileWatcher::Wait(int timeout_ms) {
+    std::set<std::string> changed;
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    if (fd_ < 0 || poll(&pfd, 1, timeout_ms) <= 0) {
+        return {};
+    }
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(fd_, buf, sizeof(buf))) > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(char* p = buf; p < buf + len; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(*event) + event->len;
+            auto dirs = wds_.find(event->wd);
+            if (dirs == wds_.end() || !event->len) {
+                continue;
+            }
+            for(const auto& dir : dirs->second) {
+                const auto& names = dirs_[dir];
+                auto name = names.find(event->name);
+                if (name != names.end()) {
+                    changed.insert(name->second);
+                }
+            }
+        }
+    }
+    return std::vector<std::string>(changed.begin(), changed.end());
+}
+#else
+namespace {
+int64_t ModificationTime(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? int64_t(st.st_mtime) : 0;
+}
+}  // namespace
+
+FileWatcher::FileWatcher() {}
+FileWatcher::~FileWatcher() {}
+
+void FileWatcher::Watch(const std::string& path) {
+    std::string dir, name;
+    SplitPath(path, &dir, &name);
+    int64_t mtime = ModificationTime(path);
+    std::lock_guard<std::mutex> lock(mutex_);
+    dirs_[dir][name] = path;
+    mtimes_.emplace(path, mtime);
+}
+
+std::vector<std::string> FileWatcher::Wait(int timeout_ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    std::vector<std::string> changed;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto& file : mtimes_) {
+        int64_t mtime = ModificationTime(file.first);
+        if (mtime != file.second) {
+            file.second = mtime;
+            changed.push_back(file.first);
+        }
+    }
+    return changed;
+}
+#endif
+
+}  // namespace GFX
@@ -0,0 +1,41 @@
+#ifndef RMX_GFX_FILE_WATCHER_H
+#define RMX_GFX_FILE_WATCHER_H
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace GFX {
+
+// Reports when watched files are written.  On Linux this uses inotify on
+// the files' directories, so files replaced by a rename (as many editors
+// save) are still seen.  Elsewhere the files' modification times are
+// polled.  Watch may be called from any thread; Wait from one thread.
+class FileWatcher {
+  public:
+    FileWatcher();
+    ~FileWatcher();
+
+    void Watch(const std::string& path);
+    // Wait up to timeout_ms for changes, returning the changed paths as
+    // they were passed to Watch.
+    std::vector<std::string> Wait(int timeout_ms);
+
+  private:
+    std::mutex mutex_;
+    // Watched paths by directory and file name.
+    std::map<std::string, std::map<std::string, std::string>> dirs_;
+#ifdef __linux__
+    int fd_;
+    // Watch descriptors and the directories they watch.  Different
+    // spellings of a directory share one descriptor.
+    std::map<int, std::vector<std::string>> wds_;
+#else
+    std::map<std::string, int64_t> mtimes_;
+#endif
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_FILE_WATCHER_H
@@ -0,0 +1,114 @@
+#include "gfx/frame_capture.h"
+
+#include <algorithm>
+
+#include "gfx/profiler.h"
+#include "util/os.h"
+
+namespace GFX {
+
+FrameCapture::FrameCapture(FrameWriter* writer, int depth)
+  : writer_(writer),
+    slots_(std::max(depth, 1), Slot{0, 0, nullptr, 0, 0, ""}),
+    head_(0),
+    pending_(0),
+    stats_{0, 0, 0.0, 0.0}
+{}
+
+FrameCapture::~FrameCapture() {
+    Flush();
+    for(const Slot& slot : slots_) {
+        if (slot.buffer) {
+            glDeleteBuffers(1, &slot.buffer);
+        }
+    }
+}
+
+void FrameCapture::Capture(int x, int y, int width, int height,
+                           const std::string& filename) {
+    Profiler::Scope scope("capture");
+    Poll();
+    if (pending_ == depth()) {
+        ++stats_.stalls;
+        Collect(true);
+    }
+    Slot& slot = slots_[head_];
+    GLsizeiptr size = GLsizeiptr(width) * height * sizeof(uint32_t);
+    if (!slot.buffer) {
+        glGenBuffers(1, &slot.buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot.size = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.filename = filename;
+    head_ = (head_ + 1) % depth();
+    ++pending_;
+}
+
+void FrameCapture::Poll() {
+    // The first check flushes the fence, so it signals even if nothing
+    // else flushes the context.
+    while (pending_ > 0) {
+        const Slot& slot = slots_[(head_ - pending_ + depth()) % depth()];
+        GLenum status = glClientWaitSync(slot.sync,
+                                         GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        Collect(false);
+    }
+}
+
+void FrameCapture::Flush() {
+    while (pending_ > 0) {
+        Collect(true);
+    }
+}
+
+void FrameCapture::Collect(bool wait) {
+    Slot& slot = slots_[(head_ - pending_ + depth()) % depth()];
+    --pending_;
+    int64_t start = os::utime_now();
+    if (wait) {
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(slot.sync, flags, 1000000) ==
+               GL_TIMEOUT_EXPIRED) {
+            flags = 0;
+        }
+    }
+    glDeleteSync(slot.sync);
+    slot.sync = nullptr;
+
+    int64_t copy = os::utime_now();
+    FrameWriter::Frame frame{slot.filename, slot.width, slot.height, {}};
+    frame.bottom_up = true;
+    size_t pixels = size_t(slot.width) * slot.height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                        pixels * sizeof(uint32_t),
+                                        GL_MAP_READ_BIT);
+    if (data) {
+        const uint32_t* p = static_cast<const uint32_t*>(data);
+        frame.pixels.assign(p, p + pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        frame.pixels.assign(pixels, 0);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    int64_t submit = os::utime_now();
+    stats_.copy_ms += double(submit - copy) / 1000.0;
+
+    writer_->Submit(std::move(frame));
+    stats_.wait_ms += double(copy - start + os::utime_now() - submit) / 1000.0;
+    ++stats_.frames;
+}
+
+}  // namespace GFX
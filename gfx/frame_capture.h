@@ -0,0 +1,72 @@
+#ifndef RMX_GFX_FRAME_CAPTURE_H
+#define RMX_GFX_FRAME_CAPTURE_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "gfx/frame_writer.h"
+
+namespace GFX {
+
+// Reads rendered frames back without stalling the pipeline.  Capture
+// starts an asynchronous glReadPixels into the next of a ring of pixel
+// buffer objects and fences it; the copy completes while the following
+// frames render.  Poll hands the readbacks whose fences have signalled
+// to a FrameWriter, whose threads encode or hash them.
+//
+// With a ring of depth buffers, frame N is collected once frames N+1 to
+// N+depth-1 have been submitted.  Capture only waits for the GPU when
+// every buffer is still in flight, which stats() counts as a stall.
+class FrameCapture {
+  public:
+    struct Stats {
+        int64_t frames;
+        // Captures that had to wait for the oldest readback.
+        int64_t stalls;
+        // Time spent waiting for readbacks and for the writer's queue.
+        double wait_ms;
+        // Time spent copying readbacks out of mapped buffers.
+        double copy_ms;
+    };
+
+    explicit FrameCapture(FrameWriter* writer, int depth=3);
+    // Flushes; the GL context must still be current.
+    ~FrameCapture();
+
+    // Read back x, y, width, height of the read framebuffer's read
+    // buffer, to be written as filename.
+    void Capture(int x, int y, int width, int height,
+                 const std::string& filename);
+    // Hand completed readbacks to the writer without waiting for the GPU.
+    void Poll();
+    // Wait for every readback and hand it to the writer.
+    void Flush();
+
+    inline int depth() const { return slots_.size(); }
+    inline int pending() const { return pending_; }
+    inline const Stats& stats() const { return stats_; }
+
+  private:
+    struct Slot {
+        GLuint buffer;
+        GLsizeiptr size;
+        GLsync sync;
+        int width;
+        int height;
+        std::string filename;
+    };
+    // Map the oldest pending slot, which must have signalled or be
+    // waited for, and submit it.
+    void Collect(bool wait);
+
+    FrameWriter* writer_;
+    std::vector<Slot> slots_;
+    // The next slot to capture into, and how many before it are pending.
+    int head_;
+    int pending_;
+    Stats stats_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_FRAME_CAPTURE_H
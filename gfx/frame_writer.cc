@@ -0,0 +1,149 @@
+#include "gfx/frame_writer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include "util/crc.h"
+#include "util/file.h"
+#include "util/png.h"
+
+namespace GFX {
+
+util::Status CheckFramePattern(const std::string& pattern) {
+    int conversions = 0;
+    for(size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+        if (++i < pattern.size() && pattern[i] == '%') {
+            continue;
+        }
+        while (i < pattern.size() && strchr("-+ #0", pattern[i])) {
+            ++i;
+        }
+        while (i < pattern.size() && isdigit(pattern[i])) {
+            ++i;
+        }
+        if (i < pattern.size() && pattern[i] == '.') {
+            ++i;
+            while (i < pattern.size() && isdigit(pattern[i])) {
+                ++i;
+            }
+        }
+        if (i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) {
+            return util::Status(util::error::Code::INVALID_ARGUMENT,
+                                "Only %d conversions can name frames: " +
+                                pattern);
+        }
+        ++conversions;
+    }
+    if (conversions != 1) {
+        return util::Status(util::error::Code::INVALID_ARGUMENT,
+                            "Frame names need one %d for the frame number: " +
+                            pattern);
+    }
+    return util::Status();
+}
+
+std::string FrameFilename(const std::string& pattern, int frame) {
+    int size = snprintf(nullptr, 0, pattern.c_str(), frame);
+    std::string filename(std::max(size, 0), '\0');
+    snprintf(&filename[0], filename.size() + 1, pattern.c_str(), frame);
+    return filename;
+}
+
+FrameWriter::FrameWriter(int threads, int max_pending)
+  : output_(kPNG),
+    busy_(0),
+    quit_(false)
+{
+    if (threads == 0) {
+        threads = std::max(int(std::thread::hardware_concurrency()), 1);
+    }
+    max_pending_ = max_pending > 0 ? max_pending : 2 * threads;
+    for(int i = 0; i < threads; ++i) {
+        workers_.emplace_back(&FrameWriter::Work, this);
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    queued_.notify_all();
+    for(auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void FrameWriter::Submit(Frame frame) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return int(queue_.size()) < max_pending_; });
+    queue_.push_back(std::move(frame));
+    queued_.notify_one();
+}
+
+util::Status FrameWriter::Finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return queue_.empty() && busy_ == 0; });
+    util::Status status = status_;
+    status_ = util::Status();
+    return status;
+}
+
+std::map<std::string, uint32_t> FrameWriter::hashes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hashes_;
+}
+
+void FrameWriter::Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;) {
+        queued_.wait(lock, [this]() { return quit_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        Frame frame = std::move(queue_.front());
+        queue_.pop_front();
+        ++busy_;
+        done_.notify_all();
+        lock.unlock();
+
+        if (frame.bottom_up) {
+            auto top = frame.pixels.begin();
+            auto bottom = frame.pixels.end();
+            for(int y = 0; y < frame.height / 2; ++y) {
+                bottom -= frame.width;
+                std::swap_ranges(top, top + frame.width, bottom);
+                top += frame.width;
+            }
+        }
+        bool ok = true;
+        uint32_t crc = 0;
+        if (output_ == kCRC32) {
+            crc = Crc32(0, frame.pixels.data(),
+                        frame.pixels.size() * sizeof(uint32_t));
+        } else {
+            std::string png = PNG::Encode(frame.pixels.data(), frame.width,
+                                          frame.height);
+            ok = File::SetContents(frame.filename, png);
+        }
+
+        lock.lock();
+        if (output_ == kCRC32) {
+            hashes_[frame.filename] = crc;
+        }
+        if (!ok && status_.ok()) {
+            status_ = util::Status(util::error::Code::UNKNOWN,
+                                   "Can't write " + frame.filename);
+        }
+        --busy_;
+        done_.notify_all();
+    }
+}
+
+}  // namespace GFX
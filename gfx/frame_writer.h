@@ -0,0 +1,88 @@
+#ifndef RMX_GFX_FRAME_WRITER_H
+#define RMX_GFX_FRAME_WRITER_H
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/status.h"
+
+namespace GFX {
+
+// Whether pattern names frames safely: it must have exactly one printf
+// integer conversion, %d or %i with optional flags, width and precision,
+// and no other conversions but %%.
+util::Status CheckFramePattern(const std::string& pattern);
+// The filename for frame from a pattern CheckFramePattern accepted, e.g.
+// "/tmp/frame%05d.png".
+std::string FrameFilename(const std::string& pattern, int frame);
+
+// FrameWriter encodes rendered frames to PNG files on a pool of worker
+// threads, so the renderer can go on to the next frame while the last
+// ones are compressed and written.  At most max_pending frames wait to
+// be encoded; Submit blocks until there's room, which bounds memory when
+// encoding falls behind rendering.
+class FrameWriter {
+  public:
+    // Pixels are ABGR words, see PNG::Encode.
+    struct Frame {
+        std::string filename;
+        int width;
+        int height;
+        std::vector<uint32_t> pixels;
+        // Rows are bottom first, as glReadPixels returns them.  The
+        // workers flip them.
+        bool bottom_up = false;
+    };
+
+    enum Output {
+        // Encode each frame to a PNG file.
+        kPNG,
+        // Only compute the CRC32 of each frame's pixels, top row first,
+        // to compare renders without writing files.
+        kCRC32,
+    };
+
+    // A thread count of zero means "one thread per hardware core"; a
+    // max_pending of zero allows two frames per thread.
+    explicit FrameWriter(int threads=0, int max_pending=0);
+    ~FrameWriter();
+
+    // Set before frames are submitted.
+    inline void set_output(Output output) { output_ = output; }
+    inline Output output() const { return output_; }
+
+    void Submit(Frame frame);
+    // Wait for every submitted frame to be written.  Returns the first
+    // error since the last Finish.
+    util::Status Finish();
+
+    inline int threads() const { return workers_.size(); }
+    // kCRC32's results, by frame filename.
+    std::map<std::string, uint32_t> hashes();
+
+  private:
+    void Work();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    // Signalled when a frame is queued or the workers should quit.
+    std::condition_variable queued_;
+    // Signalled when a worker takes or finishes a frame.
+    std::condition_variable done_;
+    std::deque<Frame> queue_;
+    Output output_;
+    int max_pending_;
+    // Frames being encoded.
+    int busy_;
+    bool quit_;
+    util::Status status_;
+    std::map<std::string, uint32_t> hashes_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_FRAME_WRITER_H
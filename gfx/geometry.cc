@@ -0,0 +1,89 @@
+#include "gfx/geometry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <GL/glew.h>
+
+namespace GFX {
+
+StaticGeometry::StaticGeometry()
+  : empty_vao_(0),
+    quad_vbo_(0)
+{}
+
+StaticGeometry::~StaticGeometry() {
+    if (!quad_vbo_) {
+        return;
+    }
+    glDeleteVertexArrays(1, &empty_vao_);
+    glDeleteBuffers(1, &quad_vbo_);
+    for(const auto& vao : quad_vao_) {
+        glDeleteVertexArrays(1, &vao.second);
+    }
+}
+
+void StaticGeometry::Init() {
+    const GLfloat quad[] = {
+        -1.0f, -1.0f,
+        -1.0f,  1.0f,
+         1.0f, -1.0f,
+         1.0f,  1.0f,
+    };
+    glGenVertexArrays(1, &empty_vao_);
+    glGenBuffers(1, &quad_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo_);
+    if (GLEW_ARB_buffer_storage) {
+        glBufferStorage(GL_ARRAY_BUFFER, sizeof(quad), quad, 0);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GLuint StaticGeometry::QuadArray(GLint position) {
+    GLuint& vao = quad_vao_[position];
+    if (!vao) {
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo_);
+        glEnableVertexAttribArray(position);
+        glVertexAttribPointer(position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return vao;
+}
+
+void StaticGeometry::DrawFullscreen(GLint position) {
+    if (!quad_vbo_) {
+        Init();
+    }
+    if (position < 0) {
+        glBindVertexArray(empty_vao_);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    } else {
+        glBindVertexArray(QuadArray(position));
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glBindVertexArray(0);
+}
+
+void StreamData(GLenum target, const void* data, GLsizeiptr size,
+                GLsizeiptr* capacity) {
+    if (size > *capacity) {
+        *capacity = std::max(size, *capacity * 2);
+        glBufferData(target, *capacity, nullptr, GL_STREAM_DRAW);
+    }
+    if (size == 0) {
+        return;
+    }
+    void* p = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT |
+                               GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (p) {
+        memcpy(p, data, size);
+        glUnmapBuffer(target);
+    } else {
+        glBufferSubData(target, 0, size, data);
+    }
+}
+
+}  // namespace GFX
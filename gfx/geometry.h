@@ -0,0 +1,43 @@
+#ifndef RMX_GFX_GEOMETRY_H
+#define RMX_GFX_GEOMETRY_H
+#include <map>
+#include <GL/glew.h>
+
+namespace GFX {
+
+// Geometry that never changes, uploaded once into immutable buffers with
+// its vertex array state captured once.  Vertex arrays aren't shared
+// between GL contexts, so each object that draws with it owns one, which
+// is created in the first context it draws in and must only be used and
+// destroyed in that context.
+class StaticGeometry {
+  public:
+    StaticGeometry();
+    ~StaticGeometry();
+    StaticGeometry(const StaticGeometry&) = delete;
+    StaticGeometry& operator=(const StaticGeometry&) = delete;
+
+    // Cover the viewport.  With a position attribute, a quad from (-1, -1)
+    // to (1, 1) is fed to it.  Without one (position < 0), a single
+    // triangle is drawn with no vertex data, and the vertex shader places
+    // it from gl_VertexID, as content/raymarch.vs does.
+    void DrawFullscreen(GLint position);
+
+  private:
+    void Init();
+    // The quad's vertex array for an attribute location.
+    GLuint QuadArray(GLint position);
+
+    GLuint empty_vao_;
+    GLuint quad_vbo_;
+    std::map<GLint, GLuint> quad_vao_;
+};
+
+// Upload data to the buffer bound to target, which holds *capacity bytes.
+// The buffer only grows, so drawing the same amount every frame never
+// reallocates; the old contents are invalidated rather than waited for.
+void StreamData(GLenum target, const void* data, GLsizeiptr size,
+                GLsizeiptr* capacity);
+
+}  // namespace GFX
+#endif // RMX_GFX_GEOMETRY_H
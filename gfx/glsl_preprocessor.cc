@@ -0,0 +1,303 @@
+#include "gfx/glsl_preprocessor.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+#include "absl/strings/str_cat.h"
+#include "util/file.h"
+#include "util/os.h"
+#include "util/status_macros.h"
+
+namespace GFX {
+namespace {
+
+absl::string_view SkipSpace(absl::string_view s) {
+    while (!s.empty() && (s[0] == ' ' || s[0] == '\t')) {
+        s.remove_prefix(1);
+    }
+    return s;
+}
+
+// Split the next word off s.
+absl::string_view Word(absl::string_view* s) {
+    *s = SkipSpace(*s);
+    size_t n = 0;
+    while (n < s->size() &&
+           (isalnum(static_cast<unsigned char>((*s)[n])) || (*s)[n] == '_')) {
+        ++n;
+    }
+    absl::string_view word = s->substr(0, n);
+    s->remove_prefix(n);
+    return word;
+}
+
+// Whether a line starting inside a /* */ comment if comment is set ends
+// inside one.
+bool EndsInComment(absl::string_view line, bool comment) {
+    for(size_t i = 0; i + 1 < line.size(); ++i) {
+        if (comment) {
+            if (line[i] == '*' && line[i + 1] == '/') {
+                comment = false;
+                ++i;
+            }
+        } else if (line[i] == '/' && line[i + 1] == '/') {
+            break;
+        } else if (line[i] == '/' && line[i + 1] == '*') {
+            comment = true;
+            ++i;
+        }
+    }
+    return comment;
+}
+
+util::Status Error(const std::string& message) {
+    return util::Status(util::error::Code::INVALID_ARGUMENT, message);
+}
+
+}  // namespace
+
+SourceFiles* SourceFiles::Default() {
+    static SourceFiles files;
+    return &files;
+}
+
+std::shared_ptr<const std::string> SourceFiles::Get(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = files_.find(path);
+        if (it != files_.end()) {
+            return it->second;
+        }
+    }
+    auto text = std::make_shared<std::string>();
+    if (!File::GetContents(path, text.get())) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.emplace(path, std::move(text)).first->second;
+}
+
+void SourceFiles::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.erase(path);
+}
+
+void SourceFiles::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.clear();
+}
+
+GLSLPreprocessor::GLSLPreprocessor(
+        const std::map<std::string, std::string>& includes,
+        SourceFiles* files)
+  : includes_(includes),
+    files_(files),
+    version_(110)
+{}
+
+util::Status GLSLPreprocessor::Process(const std::string& path,
+                                      std::string* out) {
+    auto text = files_->Get(path);
+    if (!text) {
+        return util::Status(util::error::Code::NOT_FOUND,
+                            absl::StrCat("Can't read ", path));
+    }
+    return Process(path, *text, out);
+}
+
+util::Status GLSLPreprocessor::Process(const std::string& name,
+                                      absl::string_view text,
+                                      std::string* out) {
+    sources_.clear();
+    ids_.clear();
+    once_.clear();
+    stack_.clear();
+    version_ = 110;
+    out->clear();
+    out->reserve(text.size() * 2);
+
+    sources_.push_back(Source{name, name, {}});
+    ids_[name] = 0;
+    if (SkipSpace(text).substr(0, 8) != "#version") {
+        Define(1, out);
+    }
+    return Expand(0, text, out);
+}
+
+util::Status GLSLPreprocessor::Open(
+        const std::string& name, int* id,
+        std::shared_ptr<const std::string>* text) {
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+        *id = it->second;
+    } else {
+        *id = sources_.size();
+        ids_[name] = *id;
+        sources_.push_back(Source{name, "", {}});
+    }
+    Source* source = &sources_[*id];
+
+    auto include = includes_.find(name);
+    if (include != includes_.end()) {
+        // Map-provided text lives as long as the map; alias it instead of
+        // copying.
+        *text = std::shared_ptr<const std::string>(
+                std::shared_ptr<const std::string>(), &include->second);
+        return util::Status();
+    }
+    source->path = os::path::Join({os::path::ResourceDir(), "content", name});
+    *text = files_->Get(source->path);
+    if (!*text) {
+        return util::Status(util::error::Code::NOT_FOUND,
+                            absl::StrCat("Can't read ", source->path));
+    }
+    return util::Status();
+}
+
+void GLSLPreprocessor::LineDirective(int line, int id,
+                                     std::string* out) const {
+    // Before GLSL 3.30, #line gives the number of the line after next.
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#line %d %d\n",
+             version_ < 330 ? line - 1 : line, id);
+    out->append(buf);
+}
+
+// Emit the defines, then resume the main file at line.
+void GLSLPreprocessor::Define(int line, std::string* out) const {
+    if (defines_.empty()) {
+        return;
+    }
+    for(const auto& define : defines_) {
+        out->append(absl::StrCat("#define ", define.first, " ",
+                                 define.second, "\n"));
+    }
+    LineDirective(line, 0, out);
+}
+
+util::Status GLSLPreprocessor::Expand(int id, absl::string_view text,
+                                      std::string* out) {
+    stack_.push_back(id);
+    int line = 0;
+    // Lines that start inside a comment are passed through untouched.
+    bool comment = false;
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        absl::string_view current = text.substr(0, eol);
+        text.remove_prefix(eol == absl::string_view::npos ? text.size()
+                                                          : eol + 1);
+        ++line;
+
+        bool commented = comment;
+        comment = EndsInComment(current, comment);
+        absl::string_view rest = SkipSpace(current);
+        if (commented || rest.empty() || rest[0] != '#') {
+            out->append(current.data(), current.size());
+            out->push_back('\n');
+            continue;
+        }
+        rest.remove_prefix(1);
+        absl::string_view directive = Word(&rest);
+
+        if (directive == "version") {
+            version_ = atoi(std::string(Word(&rest)).c_str());
+            if (id == 0) {
+                out->append(current.data(), current.size());
+                out->push_back('\n');
+                Define(line + 1, out);
+                continue;
+            }
+        } else if (directive == "pragma" && Word(&rest) == "once") {
+            once_.insert(id);
+            out->push_back('\n');
+            continue;
+        } else if (directive == "include") {
+            rest = SkipSpace(rest);
+            size_t end = rest.size() > 1 ? rest.find('"', 1)
+                                         : absl::string_view::npos;
+            if (rest.empty() || rest[0] != '"' ||
+                end == absl::string_view::npos) {
+                return Error(absl::StrCat(sources_[id].name, ":", line,
+                                          ": malformed #include"));
+            }
+            std::string name(rest.substr(1, end - 1));
+            int child;
+            std::shared_ptr<const std::string> include;
+            RETURN_IF_ERROR(Open(name, &child, &include));
+            sources_[id].includes.push_back(child);
+
+            if (once_.count(child)) {
+                out->push_back('\n');
+                continue;
+            }
+            for(int parent : stack_) {
+                if (parent == child) {
+                    return Error(absl::StrCat(sources_[id].name, ":", line,
+                                              ": recursive #include \"",
+                                              name, "\""));
+                }
+            }
+            LineDirective(1, child, out);
+            RETURN_IF_ERROR(Expand(child, *include, out));
+            LineDirective(line + 1, id, out);
+            continue;
+        }
+        out->append(current.data(), current.size());
+        out->push_back('\n');
+    }
+    stack_.pop_back();
+    return util::Status();
+}
+
+std::set<std::string> GLSLPreprocessor::Dependencies() const {
+    std::set<std::string> paths;
+    for(const Source& source : sources_) {
+        if (!source.path.empty()) {
+            paths.insert(source.path);
+        }
+    }
+    return paths;
+}
+
+std::string GLSLPreprocessor::Annotate(const std::string& log) const {
+    // Drivers prefix messages with the source string number in one of a
+    // few ways: "0:12(3): error" (Mesa), "0(12) : error" (NVIDIA) or
+    // "ERROR: 0:12: " (AMD and others).
+    std::string result;
+    absl::string_view text(log);
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        absl::string_view current = text.substr(0, eol);
+        text.remove_prefix(eol == absl::string_view::npos ? text.size()
+                                                          : eol + 1);
+
+        size_t start = 0;
+        for(absl::string_view prefix : {"ERROR: ", "WARNING: "}) {
+            if (current.substr(0, prefix.size()) == prefix) {
+                start = prefix.size();
+            }
+        }
+        size_t end = start;
+        while (end < current.size() &&
+               isdigit(static_cast<unsigned char>(current[end]))) {
+            ++end;
+        }
+        size_t id = end > start
+                  ? atoi(std::string(current.substr(start, end - start)).c_str())
+                  : sources_.size();
+        if (id < sources_.size() && end < current.size() &&
+            (current[end] == ':' || current[end] == '(')) {
+            result.append(current.data(), start);
+            result.append(sources_[id].name);
+            current.remove_prefix(end);
+            result.append(current.data(), current.size());
+        } else {
+            result.append(current.data(), current.size());
+        }
+        result.push_back('\n');
+    }
+    return result;
+}
+
+}  // namespace GFX
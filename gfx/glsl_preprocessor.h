@@ -0,0 +1,96 @@
+#ifndef RMX_GFX_GLSL_PREPROCESSOR_H
+#define RMX_GFX_GLSL_PREPROCESSOR_H
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "util/status.h"
+
+namespace GFX {
+
+// Shader files read from disk, kept so a file included by many programs
+// is only read once.  Thread safe.
+class SourceFiles {
+  public:
+    static SourceFiles* Default();
+
+    // The contents of the file at path, or nullptr if it can't be read.
+    std::shared_ptr<const std::string> Get(const std::string& path);
+    // Forget a file, e.g. because it changed on disk.
+    void Invalidate(const std::string& path);
+    void Clear();
+
+  private:
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<const std::string>> files_;
+};
+
+// Expands #include "name" directives in GLSL source in a single pass.
+// Included files are read from the content directory, unless includes
+// supplies their text.  A file containing #pragma once is only expanded
+// the first time it's included, and including a file from itself is an
+// error.  Directives on lines which start inside a /* */ comment are
+// left alone.
+//
+// Each file gets a GLSL source string number, 0 for the main file, and
+// #line directives are emitted around every include so compiler messages
+// can be mapped back to the right file with Annotate.
+//
+// Defines are inserted after the main file's #version directive, so
+// variants of a program can be built from the same source.
+class GLSLPreprocessor {
+  public:
+    // A file that went into the output, and the files it includes.  path
+    // is empty for text supplied through includes.
+    struct Source {
+        std::string name;
+        std::string path;
+        std::vector<int> includes;
+    };
+
+    explicit GLSLPreprocessor(
+            const std::map<std::string, std::string>& includes={},
+            SourceFiles* files=SourceFiles::Default());
+
+    inline void set_defines(const std::map<std::string, std::string>& d) {
+        defines_ = d;
+    }
+
+    // Expand the file at path into out.
+    util::Status Process(const std::string& path, std::string* out);
+    // Expand text, named name in messages, into out.
+    util::Status Process(const std::string& name, absl::string_view text,
+                         std::string* out);
+
+    // The dependency graph of the last Process, indexed by source string
+    // number.
+    inline const std::vector<Source>& sources() const { return sources_; }
+    // The paths of every file the last Process read.
+    std::set<std::string> Dependencies() const;
+
+    // Replace the source string numbers in a compiler log with names.
+    std::string Annotate(const std::string& log) const;
+
+  private:
+    util::Status Expand(int id, absl::string_view text, std::string* out);
+    util::Status Open(const std::string& name, int* id,
+                      std::shared_ptr<const std::string>* text);
+    void LineDirective(int line, int id, std::string* out) const;
+    void Define(int line, std::string* out) const;
+
+    std::map<std::string, std::string> includes_;
+    std::map<std::string, std::string> defines_;
+    SourceFiles* files_;
+    std::vector<Source> sources_;
+    std::map<std::string, int> ids_;
+    std::set<int> once_;
+    std::vector<int> stack_;
+    int version_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_GLSL_PREPROCESSOR_H
@@ -0,0 +1,171 @@
+// Checks GLSLPreprocessor's include expansion, #line numbering and
+// Annotate on text supplied through its includes map, so no GL or files
+// are needed.
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gfx/glsl_preprocessor.h"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace {
+
+size_t Count(const std::string& text, const std::string& word) {
+    size_t n = 0;
+    for(size_t i = text.find(word); i != std::string::npos;
+        i = text.find(word, i + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+TEST(GLSLPreprocessorTest, PragmaOnce) {
+    GLSLPreprocessor pp({
+        {"once.inc", "#pragma once\nfloat once_value;\n"},
+        {"twice.inc", "float twice_value;\n"},
+    });
+    std::string out;
+    ASSERT_TRUE(pp.Process("main.fs",
+                           "#include \"once.inc\"\n"
+                           "#include \"twice.inc\"\n"
+                           "#include \"once.inc\"\n"
+                           "#include \"twice.inc\"\n",
+                           &out).ok());
+    EXPECT_EQ(Count(out, "once_value"), 1u);
+    EXPECT_EQ(Count(out, "twice_value"), 2u);
+    EXPECT_EQ(Count(out, "#pragma"), 0u);
+
+    ASSERT_EQ(pp.sources().size(), 3u);
+    EXPECT_EQ(pp.sources()[0].name, "main.fs");
+    EXPECT_EQ(pp.sources()[0].includes, std::vector<int>({1, 2, 1, 2}));
+    // Only files read from disk are dependencies.
+    EXPECT_TRUE(pp.Dependencies().count("main.fs"));
+    EXPECT_EQ(pp.Dependencies().size(), 1u);
+}
+
+TEST(GLSLPreprocessorTest, RecursiveInclude) {
+    GLSLPreprocessor pp({
+        {"a.inc", "float a;\n#include \"b.inc\"\n"},
+        {"b.inc", "float b;\n#include \"a.inc\"\n"},
+    });
+    std::string out;
+    util::Status status = pp.Process("main.fs", "#include \"a.inc\"\n", &out);
+    ASSERT_FALSE(status.ok());
+    EXPECT_NE(status.error_message().find("b.inc:2: recursive #include"),
+              std::string::npos)
+        << status.error_message();
+
+    std::map<std::string, std::string> loop = {
+        {"self.inc", "#include \"self.inc\"\n"},
+    };
+    GLSLPreprocessor self(loop);
+    status = self.Process("main.fs", "#include \"self.inc\"\n", &out);
+    ASSERT_FALSE(status.ok());
+    EXPECT_NE(status.error_message().find("self.inc:1: recursive #include"),
+              std::string::npos)
+        << status.error_message();
+}
+
+TEST(GLSLPreprocessorTest, MalformedInclude) {
+    GLSLPreprocessor pp;
+    std::string out;
+    util::Status status = pp.Process("main.fs", "\n#include <a.inc>\n", &out);
+    ASSERT_FALSE(status.ok());
+    EXPECT_NE(status.error_message().find("main.fs:2: malformed"),
+              std::string::npos)
+        << status.error_message();
+}
+
+TEST(GLSLPreprocessorTest, IncludesInCommentsAreLeftAlone) {
+    // missing.inc isn't in the map or on disk, so expanding it fails.
+    GLSLPreprocessor pp;
+    std::string out;
+    const char* text =
+        "// #include \"missing.inc\"\n"
+        "/* #include \"missing.inc\" */\n"
+        "/*\n"
+        "#include \"missing.inc\"\n"
+        "*/\n"
+        "float after;\n";
+    ASSERT_TRUE(pp.Process("main.fs", text, &out).ok());
+    EXPECT_EQ(out, text);
+
+    EXPECT_FALSE(pp.Process("main.fs", "/* */\n#include \"missing.inc\"\n",
+                            &out).ok());
+}
+
+// Before GLSL 3.30, "#line n" numbers the line after it n + 1; from 3.30
+// on, n.  Either way the compiler should see each line at its number in
+// its own file.
+TEST(GLSLPreprocessorTest, LineDirectives) {
+    std::map<std::string, std::string> includes = {
+        {"a.inc", "float a;\n"},
+    };
+    const char* source =
+        "#version %d\n"
+        "float before;\n"
+        "#include \"a.inc\"\n"
+        "float after;\n";
+
+    std::string out;
+    char text[128];
+    snprintf(text, sizeof(text), source, 150);
+    GLSLPreprocessor old(includes);
+    old.set_defines({{"VARIANT", "1"}});
+    ASSERT_TRUE(old.Process("main.fs", text, &out).ok());
+    EXPECT_EQ(out,
+              "#version 150\n"
+              "#define VARIANT 1\n"
+              "#line 1 0\n"
+              "float before;\n"
+              "#line 0 1\n"
+              "float a;\n"
+              "#line 3 0\n"
+              "float after;\n");
+
+    snprintf(text, sizeof(text), source, 330);
+    GLSLPreprocessor core(includes);
+    core.set_defines({{"VARIANT", "1"}});
+    ASSERT_TRUE(core.Process("main.fs", text, &out).ok());
+    EXPECT_EQ(out,
+              "#version 330\n"
+              "#define VARIANT 1\n"
+              "#line 2 0\n"
+              "float before;\n"
+              "#line 1 1\n"
+              "float a;\n"
+              "#line 4 0\n"
+              "float after;\n");
+}
+
+TEST(GLSLPreprocessorTest, Annotate) {
+    GLSLPreprocessor pp({
+        {"a.inc", "float a;\n"},
+        {"b.inc", "float b;\n"},
+    });
+    std::string out;
+    ASSERT_TRUE(pp.Process("main.fs",
+                           "#version 330\n"
+                           "#include \"a.inc\"\n"
+                           "#include \"b.inc\"\n",
+                           &out).ok());
+    EXPECT_EQ(pp.Annotate("0:12(3): error: syntax error\n"
+                          "2:4(1): warning: unused\n"
+                          "1(7) : error C0000: nope\n"
+                          "ERROR: 2:9: 'x' : undeclared\n"
+                          "WARNING: 1:1: something\n"
+                          "7:1(1): error: no such source\n"
+                          "12 errors\n"),
+              "main.fs:12(3): error: syntax error\n"
+              "b.inc:4(1): warning: unused\n"
+              "a.inc(7) : error C0000: nope\n"
+              "ERROR: b.inc:9: 'x' : undeclared\n"
+              "WARNING: a.inc:1: something\n"
+              "7:1(1): error: no such source\n"
+              "12 errors\n");
+}
+
+}  // namespace
+}  // namespace GFX
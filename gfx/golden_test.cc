@@ -0,0 +1,499 @@
+// Renders a fixed set of scenes and camera poses through SWMarcher and,
+// given a surfaceless EGL context (Mesa's llvmpipe is enough), through
+// RayMarchScene, and compares each frame to a stored golden image.
+// Per-case ms/frame, rays/s and mean march steps are written to a JSON
+// report.  Only the images decide whether the test passes; with
+// --max_regression set, a case also fails if its rays/s fall more than
+// that fraction below the stored baseline, see //gfx:golden_perf_test.
+//
+// --stepping renders every case once per stepping strategy, see
+// gfx/stepping.h, against the same sphere traced goldens, to find the
+// fastest strategy that still matches for each scene.
+//
+// Regenerate the goldens and the baseline after an intended change with
+//   bazel run //gfx:golden_test -- --update
+// Timings only compare on the machine that recorded them, so the timing
+// gate is off by default; a machine that keeps its own baseline can run
+//   bazel test //gfx:golden_perf_test
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <gflags/gflags.h>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "gfx/headless_gl.h"
+#include "gfx/raymarch.h"
+#include "gfx/sdf.h"
+#include "gfx/shadow.h"
+#include "gfx/stepping.h"
+#include "gfx/swmarch.h"
+#include "glm/glm.hpp"
+#include "re2/re2.h"
+#include "util/file.h"
+#include "util/logging.h"
+#include "util/os.h"
+#include "util/png.h"
+
+DEFINE_string(golden_dir, "gfx/testdata/golden",
+              "Where the golden images and baseline.json live");
+DEFINE_bool(update, false,
+            "Write the rendered frames and their timings as the new goldens "
+            "and baseline instead of comparing against them");
+DEFINE_string(report, "",
+              "Where to write the JSON report; defaults to the test's "
+              "undeclared outputs directory");
+DEFINE_string(renderers, "cpu,gl", "Comma separated renderers to test");
+DEFINE_int32(width, 192, "Frame width");
+DEFINE_int32(height, 108, "Frame height");
+DEFINE_int32(frames, 5, "Frames timed per case; the fastest is reported");
+DEFINE_double(bad_delta_e, 10.0,
+              "A pixel is bad if its CIE76 color difference from the golden "
+              "exceeds this");
+DEFINE_double(max_bad_fraction, 0.005,
+              "The largest fraction of bad pixels that still matches");
+DEFINE_double(max_mean_delta_e, 1.0,
+              "The largest mean color difference that still matches");
+DEFINE_string(stepping, "sphere",
+              "Comma separated stepping strategies to render each case "
+              "with: sphere, overrelaxed, enhanced or lipschitz");
+DEFINE_double(relaxation, 1.6,
+              "The overrelaxed step factor, and the most enhanced steps "
+              "stretch by");
+DEFINE_double(lipschitz, 1.0, "The bound lipschitz stepping divides by");
+DEFINE_int32(shadow_cache, 0,
+             "Cache shadows at 1/shadow_cache resolution; 0 for none");
+DEFINE_double(max_regression, -1.0,
+              "Fail when a case's rays/s fall this fraction below the "
+              "baseline; negative to only report");
+
+namespace {
+
+struct Scene {
+    const char* name;
+    // nullptr for the marchers' built-in scene.
+    GFX::sdf::NodeRef (*build)();
+};
+
+struct Pose {
+    const char* name;
+    glm::vec3 eye;
+    float theta;
+    float phi;
+};
+
+GFX::sdf::NodeRef RoundUnion() {
+    return GFX::sdf::BoolOpsScene(3);
+}
+
+GFX::sdf::NodeRef Stairs() {
+    return GFX::sdf::BoolOpsScene(12);
+}
+
+// A field of pillars repeated with pMod1, which costs many steps along
+// grazing rays.
+GFX::sdf::NodeRef Pillars() {
+    using namespace GFX::sdf;
+    NodeRef pillar = Capsule(0.25f, 1.5f);
+    NodeRef grid = Translate(glm::vec3(1.0f, 0.0f, 1.0f),
+                             Mod1(X, 2.0f, Mod1(Z, 2.0f, pillar)));
+    return Union(Plane(glm::vec3(0, 1, 0), 1.0f), grid);
+}
+
+const Scene kScenes[] = {
+    {"builtin", nullptr},
+    {"round_union", RoundUnion},
+    {"stairs", Stairs},
+    {"pillars", Pillars},
+};
+
+const Pose kPoses[] = {
+    {"front", glm::vec3(0.0f, 1.0f, -5.0f), 0.0f, 0.15f},
+    {"side", glm::vec3(4.0f, 2.0f, -3.0f), -0.9f, 0.3f},
+};
+
+GFX::ShadowOptions FlagShadows() {
+    GFX::ShadowOptions shadows;
+    shadows.cache = FLAGS_shadow_cache;
+    return shadows;
+}
+
+// Renders one frame of the current scene into ABGR pixels, top row
+// first.
+class Renderer {
+  public:
+    virtual ~Renderer() {}
+    virtual GFX::Camera* camera() = 0;
+    virtual void SetScene(const GFX::sdf::NodeRef& scene) = 0;
+    virtual void SetStepping(const GFX::Stepping& stepping) = 0;
+    // Returns the wall time in milliseconds.
+    virtual double Render(std::vector<uint32_t>* pixels) = 0;
+    // The mean march steps per ray of the last frame, or -1.
+    virtual double Steps() = 0;
+};
+
+class CPURenderer : public Renderer {
+  public:
+    CPURenderer() : marcher_(FLAGS_width, FLAGS_height) {
+        marcher_.set_upload(false);
+        marcher_.set_shadows(FlagShadows());
+    }
+    GFX::Camera* camera() override { return marcher_.camera(); }
+    void SetScene(const GFX::sdf::NodeRef& scene) override {
+        if (scene) {
+            marcher_.set_scene(GFX::sdf::Program::Compile(scene));
+        } else {
+            marcher_.set_scene(nullptr);
+        }
+    }
+    void SetStepping(const GFX::Stepping& stepping) override {
+        marcher_.set_stepping(stepping);
+    }
+    double Render(std::vector<uint32_t>* pixels) override {
+        int64_t start = os::utime_now();
+        marcher_.Render();
+        double ms = double(os::utime_now() - start) / 1000.0;
+        const uint32_t* p = marcher_.pixels();
+        pixels->assign(p, p + FLAGS_width * FLAGS_height);
+        return ms;
+    }
+    double Steps() override {
+        return marcher_.pass_stats().back().steps;
+    }
+  private:
+    GFX::SWMarcher marcher_;
+};
+
+class GLRenderer : public Renderer {
+  public:
+    GLRenderer() : scene_(FLAGS_width, FLAGS_height) {}
+    ~GLRenderer() override {
+        glDeleteFramebuffers(1, &fbo_);
+        glDeleteRenderbuffers(1, &color_);
+    }
+    // Needs a current context; see InitHeadlessGL.
+    bool Init() {
+        if (!scene_.LoadProgram("content/raymarch.vs", "content/raymarch.fs")) {
+            return false;
+        }
+        scene_.Init();
+        scene_.set_shadows(FlagShadows());
+        glGenRenderbuffers(1, &color_);
+        glBindRenderbuffer(GL_RENDERBUFFER, color_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8,
+                              FLAGS_width, FLAGS_height);
+        glGenFramebuffers(1, &fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER, color_);
+        return glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE;
+    }
+    GFX::Camera* camera() override { return scene_.camera(); }
+    void SetScene(const GFX::sdf::NodeRef& scene) override {
+        scene_.SetScene(scene);
+    }
+    void SetStepping(const GFX::Stepping& stepping) override {
+        scene_.set_stepping(stepping);
+    }
+    double Render(std::vector<uint32_t>* pixels) override {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glViewport(0, 0, FLAGS_width, FLAGS_height);
+        glFinish();
+        int64_t start = os::utime_now();
+        scene_.Draw();
+        glFinish();
+        double ms = double(os::utime_now() - start) / 1000.0;
+
+        pixels->resize(FLAGS_width * FLAGS_height);
+        glReadPixels(0, 0, FLAGS_width, FLAGS_height, GL_RGBA,
+                     GL_UNSIGNED_BYTE, pixels->data());
+        for(int y = 0; y < FLAGS_height / 2; ++y) {
+            std::swap_ranges(pixels->begin() + y * FLAGS_width,
+                             pixels->begin() + (y + 1) * FLAGS_width,
+                             pixels->end() - (y + 1) * FLAGS_width);
+        }
+        return ms;
+    }
+    double Steps() override {
+        // Counting steps reads the passes back and marches again, so it
+        // gets a frame of its own.
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        scene_.set_collect_stats(true);
+        scene_.Draw();
+        scene_.FlushStats();
+        scene_.set_collect_stats(false);
+        return scene_.pass_stats().back().steps;
+    }
+  private:
+    GFX::RayMarchScene scene_;
+    GLuint fbo_ = 0;
+    GLuint color_ = 0;
+};
+
+// CIE L*a*b* of an ABGR pixel, taking its color as sRGB.
+glm::vec3 Lab(uint32_t abgr) {
+    glm::vec3 c;
+    for(int i = 0; i < 3; ++i) {
+        float v = float(abgr >> (8 * i) & 0xff) / 255.0f;
+        c[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+    }
+    glm::vec3 xyz(0.4124f * c.r + 0.3576f * c.g + 0.1805f * c.b,
+                  0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b,
+                  0.0193f * c.r + 0.1192f * c.g + 0.9505f * c.b);
+    xyz = xyz / glm::vec3(0.9505f, 1.0f, 1.089f);
+    for(int i = 0; i < 3; ++i) {
+        xyz[i] = xyz[i] > 0.008856f ? cbrtf(xyz[i])
+                                    : 7.787f * xyz[i] + 16.0f / 116.0f;
+    }
+    return glm::vec3(116.0f * xyz.y - 16.0f,
+                     500.0f * (xyz.x - xyz.y),
+                     200.0f * (xyz.y - xyz.z));
+}
+
+struct Difference {
+    double mean_delta_e;
+    double bad_fraction;
+};
+
+Difference Compare(const std::vector<uint32_t>& a,
+                   const std::vector<uint32_t>& b) {
+    double sum = 0.0;
+    size_t bad = 0;
+    for(size_t i = 0; i < a.size(); ++i) {
+        double e = glm::length(Lab(a[i]) - Lab(b[i]));
+        sum += e;
+        bad += e > FLAGS_bad_delta_e;
+    }
+    return Difference{sum / a.size(), double(bad) / a.size()};
+}
+
+struct Result {
+    std::string name;
+    double ms;
+    double rays_per_second;
+    double steps;
+    Difference difference;
+    double baseline;
+    bool match;
+    bool regressed;
+};
+
+// rays/s by case name, from a report written by an earlier --update.
+std::map<std::string, double> LoadBaseline(const std::string& filename) {
+    std::map<std::string, double> baseline;
+    std::string json;
+    if (!File::GetContents(filename, &json)) {
+        return baseline;
+    }
+    re2::StringPiece input(json);
+    std::string name;
+    double rays;
+    RE2 entry("\"name\": \"([^\"]+)\"[^}]*?\"rays_per_second\": ([0-9.e+-]+)");
+    while (RE2::FindAndConsume(&input, entry, &name, &rays)) {
+        baseline[name] = rays;
+    }
+    return baseline;
+}
+
+std::string Report(const std::vector<Result>& results) {
+    std::string json = absl::StrCat(
+            "{\n  \"width\": ", FLAGS_width, ",\n  \"height\": ",
+            FLAGS_height, ",\n  \"cases\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        char line[1024];
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"ms_per_frame\": %.3f, "
+                 "\"rays_per_second\": %.0f, \"mean_steps\": %.2f, "
+                 "\"mean_delta_e\": %.3f, \"bad_pixels\": %.5f, "
+                 "\"baseline_rays_per_second\": %.0f, \"match\": %s, "
+                 "\"regressed\": %s}%s\n",
+                 r.name.c_str(), r.ms, r.rays_per_second, r.steps,
+                 r.difference.mean_delta_e, r.difference.bad_fraction,
+                 r.baseline, r.match ? "true" : "false",
+                 r.regressed ? "true" : "false",
+                 i + 1 < results.size() ? "," : "");
+        json += line;
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+std::string WorkspacePath(const std::string& path) {
+    // Under bazel run, write to the source tree rather than the runfiles.
+    const char* workspace = getenv("BUILD_WORKSPACE_DIRECTORY");
+    return workspace ? absl::StrCat(workspace, "/", path) : path;
+}
+
+// Render the current scene from the renderer's camera, compare it to the
+// golden image, or write it there if write_golden, and append the result
+// to results.  Returns false if the case failed.
+bool RunCase(Renderer* renderer, const std::string& name,
+             const std::string& golden, bool write_golden,
+             const std::map<std::string, double>& baseline,
+             std::vector<Result>* results) {
+    bool ok = true;
+    std::vector<uint32_t> pixels;
+    Result r{name};
+    r.ms = 1e30;
+    for(int i = 0; i < std::max(FLAGS_frames, 1); ++i) {
+        r.ms = std::min(r.ms, renderer->Render(&pixels));
+    }
+    r.rays_per_second = FLAGS_width * FLAGS_height * 1000.0 / r.ms;
+    r.steps = renderer->Steps();
+    auto it = baseline.find(r.name);
+    r.baseline = it == baseline.end() ? 0.0 : it->second;
+    r.difference = Difference{0.0, 0.0};
+    r.match = true;
+    r.regressed = false;
+
+    if (FLAGS_update) {
+        if (write_golden) {
+            std::string png = PNG::Encode(pixels.data(), FLAGS_width,
+                                          FLAGS_height);
+            if (!File::SetContents(WorkspacePath(golden), png)) {
+                LOG(ERROR, "Can't write ", golden);
+                ok = false;
+            }
+        }
+    } else {
+        std::string png;
+        std::vector<uint32_t> expected;
+        int w = 0, h = 0;
+        if (!File::GetContents(golden, &png)) {
+            LOG(ERROR, "No golden image ", golden);
+            r.match = false;
+        } else if (!PNG::Decode(png, &w, &h, &expected).ok() ||
+                   w != FLAGS_width || h != FLAGS_height) {
+            LOG(ERROR, golden, " isn't a ", FLAGS_width, "x",
+                FLAGS_height, " PNG");
+            r.match = false;
+        } else {
+            r.difference = Compare(pixels, expected);
+            r.match = r.difference.mean_delta_e <= FLAGS_max_mean_delta_e &&
+                      r.difference.bad_fraction <= FLAGS_max_bad_fraction;
+        }
+        r.regressed = FLAGS_max_regression >= 0.0 && r.baseline > 0 &&
+                      r.rays_per_second <
+                          r.baseline * (1.0 - FLAGS_max_regression);
+        if (!r.match) {
+            // Leave the frame next to the report to look at.
+            const char* dir = getenv("TEST_UNDECLARED_OUTPUTS_DIR");
+            File::SetContents(
+                    absl::StrCat(dir ? dir : ".", "/", r.name, ".actual.png"),
+                    PNG::Encode(pixels.data(), FLAGS_width, FLAGS_height));
+        }
+    }
+    printf("%-28s %8.2f ms %10.0f rays/s %6.1f steps  "
+           "dE %.3f bad %.4f%s%s\n",
+           r.name.c_str(), r.ms, r.rays_per_second, r.steps,
+           r.difference.mean_delta_e, r.difference.bad_fraction,
+           r.match ? "" : "  MISMATCH",
+           r.regressed ? "  REGRESSED" : "");
+    results->push_back(r);
+    return ok && r.match && !r.regressed;
+}
+
+// Render every case with renderer, once per stepping strategy, appending
+// to results.  Returns false if any case failed.
+bool RunCases(const std::string& renderer_name, Renderer* renderer,
+              const std::vector<GFX::Stepping::Strategy>& strategies,
+              const std::map<std::string, double>& baseline,
+              std::vector<Result>* results) {
+    bool ok = true;
+    for(const Scene& scene : kScenes) {
+        renderer->SetScene(scene.build ? scene.build() : nullptr);
+        for(const Pose& pose : kPoses) {
+            GFX::Camera* camera = renderer->camera();
+            camera->eye = pose.eye;
+            camera->Orient(pose.theta, pose.phi);
+            std::string name = absl::StrCat(renderer_name, "_", scene.name,
+                                            "_", pose.name);
+            // Every strategy is compared to the sphere traced golden.
+            std::string golden = absl::StrCat(FLAGS_golden_dir, "/", name,
+                                              ".png");
+            for(GFX::Stepping::Strategy strategy : strategies) {
+                renderer->SetStepping(GFX::Stepping{
+                        strategy, float(FLAGS_relaxation),
+                        float(FLAGS_lipschitz)});
+                bool sphere = strategy == GFX::Stepping::kSphere;
+                ok &= RunCase(renderer,
+                              sphere ? name : absl::StrCat(
+                                      name, "_",
+                                      GFX::Stepping::Name(strategy)),
+                              golden, sphere, baseline, results);
+            }
+        }
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    std::string baseline_file = FLAGS_golden_dir + "/baseline.json";
+    std::map<std::string, double> baseline;
+    if (!FLAGS_update) {
+        baseline = LoadBaseline(baseline_file);
+    }
+    std::vector<GFX::Stepping::Strategy> strategies;
+    for(absl::string_view name : absl::StrSplit(FLAGS_stepping, ',')) {
+        GFX::Stepping::Strategy s;
+        if (!GFX::Stepping::FromName(std::string(name).c_str(), &s)) {
+            LOG(ERROR, "Unknown stepping strategy ", name);
+            return 1;
+        }
+        strategies.push_back(s);
+    }
+    std::vector<Result> results;
+    bool ok = true;
+    for(absl::string_view name : absl::StrSplit(FLAGS_renderers, ',')) {
+        if (name == "cpu") {
+            CPURenderer renderer;
+            ok &= RunCases("cpu", &renderer, strategies, baseline, &results);
+        } else if (name == "gl") {
+            util::Status status = GFX::InitHeadlessGL();
+            if (!status.ok()) {
+                // Not every machine has a software GL; the CPU cases
+                // still count.
+                printf("Skipping gl: %s\n", status.error_message().c_str());
+                continue;
+            }
+            GLRenderer renderer;
+            if (!renderer.Init()) {
+                LOG(ERROR, "Can't set up the GL renderer");
+                ok = false;
+                continue;
+            }
+            ok &= RunCases("gl", &renderer, strategies, baseline, &results);
+        } else {
+            LOG(ERROR, "Unknown renderer ", name);
+            ok = false;
+        }
+    }
+
+    std::string report = Report(results);
+    std::string report_file = FLAGS_report;
+    if (FLAGS_update) {
+        report_file = WorkspacePath(baseline_file);
+    } else if (report_file.empty()) {
+        const char* dir = getenv("TEST_UNDECLARED_OUTPUTS_DIR");
+        report_file = absl::StrCat(dir ? dir : ".", "/golden_report.json");
+    }
+    if (!File::SetContents(report_file, report)) {
+        LOG(ERROR, "Can't write ", report_file);
+        ok = false;
+    }
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", report_file.c_str());
+    return ok ? 0 : 1;
+}
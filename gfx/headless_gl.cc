@@ -0,0 +1,60 @@
+#include "gfx/headless_gl.h"
+
+#include <string>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+
+namespace GFX {
+namespace {
+util::Status Unavailable(const std::string& why) {
+    return util::Status(util::error::Code::UNAVAILABLE, why);
+}
+}  // namespace
+
+util::Status InitHeadlessGL() {
+    auto get_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (!get_display) {
+        return Unavailable("EGL has no eglGetPlatformDisplayEXT");
+    }
+    EGLDisplay display = get_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                     EGL_DEFAULT_DISPLAY, nullptr);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY ||
+        !eglInitialize(display, &major, &minor)) {
+        return Unavailable("Can't open a surfaceless EGL display");
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 2,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR,
+                                          EGL_NO_CONTEXT, attribs);
+    if (context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        return Unavailable("Can't make a GL 3.2 core context");
+    }
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW loads the GL entry points before looking for a GLX display,
+    // which there isn't one of.
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY) {
+        err = GLEW_OK;
+    }
+#endif
+    if (err != GLEW_OK) {
+        return Unavailable(std::string("GLEW Error: ") +
+                reinterpret_cast<const char*>(glewGetErrorString(err)));
+    }
+    // glewInit can leave an error behind on core contexts.
+    glGetError();
+    return util::Status();
+}
+
+}  // namespace GFX
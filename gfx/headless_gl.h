@@ -0,0 +1,14 @@
+#ifndef RMX_GFX_HEADLESS_GL_H
+#define RMX_GFX_HEADLESS_GL_H
+
+#include "util/status.h"
+
+namespace GFX {
+
+// Make a GL 3.2 core context current without a window or display
+// server, through Mesa's surfaceless EGL platform, and load the GL entry
+// points with GLEW.  For tools and tests; llvmpipe is enough.
+util::Status InitHeadlessGL();
+
+}  // namespace GFX
+#endif // RMX_GFX_HEADLESS_GL_H
@@ -0,0 +1,83 @@
+#include "gfx/march_stats.h"
+
+#include <algorithm>
+
+namespace GFX {
+namespace {
+float Saturate(float x) {
+    return std::min(std::max(x, 0.0f), 1.0f);
+}
+}  // namespace
+
+const char* MarchCostMap::Name(Counter c) {
+    switch(c) {
+        case kMarchSteps: return "March steps";
+        case kShadowSteps: return "Shadow steps";
+        case kNormalEvals: return "Normal evaluations";
+        default: return "?";
+    }
+}
+
+void MarchCostMap::Reset(int w, int h) {
+    width = w;
+    height = h;
+    for(auto& c : counts) {
+        c.assign(size_t(w) * h, 0.0f);
+    }
+}
+
+MarchCostMap::Summary MarchCostMap::Summarize(Counter c, int bins,
+                                              float range) const {
+    const std::vector<float>& v = counts[c];
+    Summary s{0.0, 0.0f, range, 0.0,
+              std::vector<float>(std::max(bins, 1))};
+    for(float n : v) {
+        s.mean += n;
+        s.max = std::max(s.max, n);
+    }
+    if (!v.empty()) {
+        s.mean /= v.size();
+    }
+    if (s.range <= 0.0f) {
+        s.range = std::max(s.max, 1.0f);
+    }
+    float scale = float(s.histogram.size()) / s.range;
+    int last = int(s.histogram.size()) - 1;
+    for(float n : v) {
+        s.histogram[std::min(int(n * scale), last)] += 1.0f;
+        s.saturated += n >= s.range;
+    }
+    if (!v.empty()) {
+        s.saturated /= v.size();
+    }
+    return s;
+}
+
+void MarchCostMap::Overlay(Counter c, float range, const uint32_t* image,
+                           uint32_t* out) const {
+    const std::vector<float>& v = counts[c];
+    float scale = 1.0f / std::max(range, 1.0f);
+    for(size_t i = 0; i < v.size(); ++i) {
+        // 5/8 heat over 3/8 image, so the geometry stays readable.
+        uint32_t h = HeatColor(v[i] * scale);
+        uint32_t p = image[i];
+        uint32_t blend = 0xff000000;
+        for(int shift = 0; shift < 24; shift += 8) {
+            uint32_t a = h >> shift & 0xff, b = p >> shift & 0xff;
+            blend |= ((a * 5 + b * 3) / 8) << shift;
+        }
+        out[i] = blend;
+    }
+}
+
+uint32_t HeatColor(float t) {
+    float r = Saturate(4.0f * t - 2.0f);
+    float g = Saturate(std::min(4.0f * t, 4.0f - 4.0f * t));
+    float b = Saturate(2.0f - 4.0f * t);
+    return uint32_t(r * 255.0f) <<  0 |
+           uint32_t(g * 255.0f) <<  8 |
+           uint32_t(b * 255.0f) << 16 |
+           0xff000000u;
+}
+
+}  // namespace GFX
@@ -0,0 +1,68 @@
+#ifndef RMX_GFX_MARCH_STATS_H
+#define RMX_GFX_MARCH_STATS_H
+#include <cstdint>
+#include <vector>
+
+namespace GFX {
+
+// Statistics for one pass of a ray marcher, e.g. one level of a depth
+// prepass or the full resolution pass.
+struct MarchPassStats {
+    // Pixels per texel along each axis; 1 is full resolution.
+    int factor;
+    int width;
+    int height;
+    double ms;
+    // Mean march steps per ray, or -1 if not measured.
+    double steps;
+};
+
+// What each pixel of a frame cost, in distance evaluations.  Filled in
+// by SWMarcher and RayMarchScene when collecting stats.
+struct MarchCostMap {
+    enum Counter {
+        // Primary ray march steps.  A ray that used up the step budget
+        // has steps_ of them.
+        kMarchSteps,
+        // Shadow march steps, in GetVisibility.
+        kShadowSteps,
+        // Evaluations for the surface normal, in GetNormal.
+        kNormalEvals,
+        kCounters,
+    };
+    static const char* Name(Counter c);
+
+    // A counter over the whole frame.  histogram has bins buckets
+    // spanning [0, range]; larger counts land in the last one.
+    struct Summary {
+        double mean;
+        float max;
+        float range;
+        // The fraction of pixels at range or more, e.g. the rays that
+        // used up the step budget.
+        double saturated;
+        std::vector<float> histogram;
+    };
+    // A range of 0 spans the largest count.
+    Summary Summarize(Counter c, int bins, float range=0.0f) const;
+
+    // Blend the false color of counter c, red at range or more, over an
+    // ABGR image of the same size, both with the top row first.
+    void Overlay(Counter c, float range, const uint32_t* image,
+                 uint32_t* out) const;
+
+    // Resize and zero every counter.
+    void Reset(int w, int h);
+
+    int width;
+    int height;
+    // counts[c][y * width + x], with the top row first.
+    std::vector<float> counts[kCounters];
+};
+
+// The false color for t in [0, 1], from blue through cyan, green and
+// yellow to red, as ABGR.  content/heatmap.fs uses the same ramp.
+uint32_t HeatColor(float t);
+
+}  // namespace GFX
+#endif // RMX_GFX_MARCH_STATS_H
@@ -0,0 +1,46 @@
+#ifndef RMX_GFX_OCTREE_H
+#define RMX_GFX_OCTREE_H
+#include "glm/glm.hpp"
+
+namespace GFX {
+
+// A cell of an octree over a box.  index is the cell's position in the
+// grid of 2^depth cells a side that its depth splits the box into.
+struct OctreeCell {
+    glm::vec3 lo;
+    glm::vec3 hi;
+    int depth;
+    glm::ivec3 index;
+
+    // Child i takes the upper half of the cell in x if bit 0 of i is set,
+    // in y if bit 1 is and in z if bit 2 is.
+    OctreeCell Child(int i) const {
+        int bx = i & 1, by = (i >> 1) & 1, bz = (i >> 2) & 1;
+        glm::vec3 mid = (lo + hi) * 0.5f;
+        return OctreeCell{
+            glm::vec3(bx ? mid.x : lo.x, by ? mid.y : lo.y,
+                      bz ? mid.z : lo.z),
+            glm::vec3(bx ? hi.x : mid.x, by ? hi.y : mid.y,
+                      bz ? hi.z : mid.z),
+            depth + 1,
+            index * 2 + glm::ivec3(bx, by, bz)};
+    }
+};
+
+// Walk the octree under cell depth first, children in Child order.
+// visit(cell) returns whether to go on into cell's children; it has to
+// stop at some depth.  While a cell's children are visited, whatever
+// visit left for each shallower depth is still that of the cell's
+// ancestors, so visit can keep per-depth state in an array.
+template<typename Visit>
+void SubdivideOctree(const OctreeCell& cell, Visit& visit) {
+    if (!visit(cell)) {
+        return;
+    }
+    for(int i = 0; i < 8; ++i) {
+        SubdivideOctree(cell.Child(i), visit);
+    }
+}
+
+}  // namespace GFX
+#endif // RMX_GFX_OCTREE_H
@@ -0,0 +1,213 @@
+#include "gfx/profiler.h"
+
+#include <cstdio>
+#include <GL/glew.h>
+
+#include "util/file.h"
+#include "util/os.h"
+
+namespace GFX {
+
+Profiler* Profiler::Get() {
+    static Profiler profiler;
+    return &profiler;
+}
+
+Profiler::Profiler()
+  : enabled_(true),
+    timer_query_(false),
+    recording_(false),
+    frame_(0),
+    resolved_(0),
+    dropped_(0),
+    buffers_{},
+    current_(nullptr)
+{}
+
+Profiler::Scope::Scope(const char* name, bool gpu)
+  : event_(Profiler::Get()->Open(name, gpu))
+{}
+
+Profiler::Scope::~Scope() {
+    Profiler::Get()->Close(event_);
+}
+
+void Profiler::BeginFrame() {
+    if (!enabled_ || recording_) {
+        return;
+    }
+    timer_query_ = GLEW_ARB_timer_query;
+    ++frame_;
+    current_ = &buffers_[frame_ % kBuffers];
+    if (current_->pending) {
+        // Its queries are about to be reused; take whatever is there.
+        Resolve(frame_ % kBuffers, true);
+    }
+    current_->frame.number = frame_;
+    current_->frame.events.clear();
+    current_->gpu.clear();
+    current_->last_query = -1;
+    if (timer_query_) {
+        GLint64 gpu_now;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        current_->gpu_offset = double(os::utime_now()) - gpu_now / 1000.0;
+    }
+    recording_ = true;
+    stack_.clear();
+    Open("frame", true);
+}
+
+void Profiler::EndFrame() {
+    if (!recording_) {
+        return;
+    }
+    while (!stack_.empty()) {
+        Close(stack_.back());
+    }
+    recording_ = false;
+    current_->pending = true;
+    current_ = nullptr;
+    // The previous frame has had a whole frame to finish.
+    int previous = (frame_ + kBuffers - 1) % kBuffers;
+    if (buffers_[previous].pending) {
+        Resolve(previous, false);
+    }
+}
+
+int Profiler::Open(const char* name, bool gpu) {
+    if (!recording_) {
+        return -1;
+    }
+    Buffer* b = current_;
+    int event = b->frame.events.size();
+    b->frame.events.push_back(Event{name, int(stack_.size()),
+                                    os::utime_now(), 0, -1.0, -1.0});
+    gpu = gpu && timer_query_;
+    b->gpu.push_back(gpu);
+    if (gpu) {
+        if (b->queries.size() < size_t(2 * event + 2)) {
+            size_t n = b->queries.size();
+            b->queries.resize(2 * event + 16);
+            glGenQueries(b->queries.size() - n, &b->queries[n]);
+        }
+        glQueryCounter(b->queries[2 * event], GL_TIMESTAMP);
+        b->last_query = 2 * event;
+    }
+    stack_.push_back(event);
+    return event;
+}
+
+void Profiler::Close(int event) {
+    if (!recording_ || event < 0) {
+        return;
+    }
+    Buffer* b = current_;
+    b->frame.events[event].cpu_end = os::utime_now();
+    if (b->gpu[event]) {
+        glQueryCounter(b->queries[2 * event + 1], GL_TIMESTAMP);
+        b->last_query = 2 * event + 1;
+    }
+    if (!stack_.empty() && stack_.back() == event) {
+        stack_.pop_back();
+    }
+}
+
+// Read a recorded frame's GPU times if they're available, or without
+// them if force is set.  Returns whether the frame was recorded.
+bool Profiler::Resolve(int buffer, bool force) {
+    Buffer* b = &buffers_[buffer];
+    GLint available = 0;
+    if (b->last_query >= 0) {
+        // Queries complete in order, so the last one issued being
+        // available means they all are.
+        glGetQueryObjectiv(b->queries[b->last_query],
+                           GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !force) {
+            return false;
+        }
+        if (!available) {
+            dropped_++;
+        }
+    }
+    std::vector<Event>& events = b->frame.events;
+    for(size_t i = 0; available && i < events.size(); ++i) {
+        if (!b->gpu[i]) {
+            continue;
+        }
+        GLuint64 start, end;
+        glGetQueryObjectui64v(b->queries[2 * i], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(b->queries[2 * i + 1], GL_QUERY_RESULT, &end);
+        events[i].gpu_start = start / 1000.0 + b->gpu_offset;
+        events[i].gpu_end = end / 1000.0 + b->gpu_offset;
+    }
+    Record(b->frame);
+    b->pending = false;
+    return true;
+}
+
+void Profiler::Record(const Frame& frame) {
+    resolved_ = frame.number;
+    int index = frame.number % kHistory;
+    for(auto& h : history_) {
+        h.second.cpu_ms[index] = 0.0f;
+        h.second.gpu_ms[index] = 0.0f;
+    }
+    for(const Event& event : frame.events) {
+        auto it = history_.find(event.name);
+        if (it == history_.end()) {
+            it = history_.emplace(event.name, History{}).first;
+            it->second.depth = event.depth;
+            order_.push_back(event.name);
+        }
+        History& h = it->second;
+        h.cpu_ms[index] += (event.cpu_end - event.cpu_start) / 1000.0f;
+        if (event.gpu_start >= 0.0) {
+            h.gpu_ms[index] += (event.gpu_end - event.gpu_start) / 1000.0f;
+        }
+    }
+    frames_.push_back(frame);
+    if (frames_.size() > kTraceFrames) {
+        frames_.pop_front();
+    }
+}
+
+util::Status Profiler::WriteTrace(const std::string& filename) const {
+    std::string json =
+        "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+        "\"args\":{\"name\":\"CPU\"}},\n"
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+        "\"args\":{\"name\":\"GPU\"}}";
+    char buf[256];
+    for(const Frame& frame : frames_) {
+        for(const Event& event : frame.events) {
+            snprintf(buf, sizeof(buf),
+                     ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\","
+                     "\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld,"
+                     "\"args\":{\"frame\":%llu}}",
+                     event.name, static_cast<long long>(event.cpu_start),
+                     static_cast<long long>(event.cpu_end - event.cpu_start),
+                     static_cast<unsigned long long>(frame.number));
+            json.append(buf);
+            if (event.gpu_start < 0.0) {
+                continue;
+            }
+            snprintf(buf, sizeof(buf),
+                     ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\","
+                     "\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,"
+                     "\"args\":{\"frame\":%llu}}",
+                     event.name, event.gpu_start,
+                     event.gpu_end - event.gpu_start,
+                     static_cast<unsigned long long>(frame.number));
+            json.append(buf);
+        }
+    }
+    json.append("\n]}\n");
+    if (!File::SetContents(filename, json)) {
+        return util::Status(util::error::Code::UNKNOWN,
+                            "Can't write " + filename);
+    }
+    return util::Status();
+}
+
+}  // namespace GFX
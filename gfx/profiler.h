@@ -0,0 +1,126 @@
+#ifndef RMX_GFX_PROFILER_H
+#define RMX_GFX_PROFILER_H
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "util/status.h"
+
+namespace GFX {
+
+// Times the parts of each frame on the CPU and the GPU.  Scopes record
+// os::utime_now on the CPU and GL_TIMESTAMP queries on the GPU, so they
+// can nest, which GL_TIME_ELAPSED queries can't.  Query results are
+// double buffered: a frame's results are read while the next frame is
+// recorded, and only once they're available, so the profiler never waits
+// for the GPU.  A frame whose results still aren't available when its
+// queries are needed again loses its GPU times.
+//
+// Scopes may only be opened on the thread that renders.
+class Profiler {
+  public:
+    // Times a scope.  name must outlive the profiler, e.g. be a string
+    // literal.  gpu=false only times the CPU, for work that issues no GL
+    // commands.
+    class Scope {
+      public:
+        explicit Scope(const char* name, bool gpu=true);
+        ~Scope();
+      private:
+        int event_;
+    };
+
+    // A timed scope.  Times are in microseconds on the os::utime_now
+    // clock; the GPU times are -1 if they weren't measured.
+    struct Event {
+        const char* name;
+        int depth;
+        int64_t cpu_start;
+        int64_t cpu_end;
+        double gpu_start;
+        double gpu_end;
+    };
+    struct Frame {
+        uint64_t number;
+        std::vector<Event> events;
+    };
+
+    // Recent times of each scope in milliseconds, in a ring indexed by
+    // frame number % kHistory.  Scopes opened several times in a frame
+    // are summed.
+    static const int kHistory = 120;
+    struct History {
+        int depth;
+        float cpu_ms[kHistory];
+        float gpu_ms[kHistory];
+    };
+
+    static Profiler* Get();
+
+    inline void set_enabled(bool enabled) { enabled_ = enabled; }
+    inline bool enabled() const { return enabled_; }
+
+    // Frames are bracketed by BeginFrame and EndFrame, and the frame as a
+    // whole is timed as the scope "frame".
+    void BeginFrame();
+    void EndFrame();
+
+    // The scopes seen so far, in the order they were first opened.
+    inline const std::vector<std::string>& scopes() const { return order_; }
+    inline const History& history(const std::string& scope) {
+        return history_[scope];
+    }
+    // The index in History of the oldest value.
+    inline int history_offset() const {
+        return (resolved_ + 1) % kHistory;
+    }
+    inline int dropped() const { return dropped_; }
+
+    // Write the recent frames as a Chrome trace, for chrome://tracing or
+    // Perfetto.
+    util::Status WriteTrace(const std::string& filename) const;
+
+  private:
+    // Frames are kept for the trace for about ten seconds at 60fps.
+    static const int kTraceFrames = 600;
+    static const int kBuffers = 2;
+
+    Profiler();
+    int Open(const char* name, bool gpu);
+    void Close(int event);
+    bool Resolve(int buffer, bool force);
+    void Record(const Frame& frame);
+
+    // A frame being recorded or waiting for its query results.
+    struct Buffer {
+        Frame frame;
+        // Two queries per event, for events timed on the GPU.
+        std::vector<GLuint> queries;
+        std::vector<bool> gpu;
+        // The last query issued, or -1.
+        int last_query;
+        bool pending;
+        // Converts GPU timestamps in nanoseconds to os::utime_now.
+        double gpu_offset;
+    };
+
+    bool enabled_;
+    bool timer_query_;
+    bool recording_;
+    uint64_t frame_;
+    uint64_t resolved_;
+    int dropped_;
+    Buffer buffers_[kBuffers];
+    Buffer* current_;
+    std::vector<int> stack_;
+
+    std::vector<std::string> order_;
+    std::map<std::string, History> history_;
+    std::deque<Frame> frames_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_PROFILER_H
@@ -0,0 +1,273 @@
+#include "gfx/program_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <GL/glew.h>
+
+#include "absl/strings/str_cat.h"
+#include "util/crc.h"
+#include "util/file.h"
+#include "util/logging.h"
+#include "util/os.h"
+
+namespace GFX {
+namespace {
+const uint64_t kFNVOffset = 0xcbf29ce484222325ULL;
+const uint64_t kFNVPrime = 0x100000001b3ULL;
+
+// Numbers temporary files, which the render and reloader threads may
+// write at the same time.
+std::atomic<uint64_t> temp_files(0);
+
+uint64_t Fnv1a(uint64_t h, const std::string& s) {
+    for(unsigned char c : s) {
+        h ^= c;
+        h *= kFNVPrime;
+    }
+    return h;
+}
+
+// Every cache file starts with this.
+struct Header {
+    char magic[4];
+    uint32_t format;
+};
+const char kMagic[4] = {'R', 'M', 'X', 'P'};
+
+// How old a temporary file must be before Trim takes it for a crashed
+// Store's.
+const int64_t kStaleTempSeconds = 3600;
+
+bool enabled = true;
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+}  // namespace
+
+ProgramCache::ProgramCache(const std::string& dir, int64_t max_bytes,
+                           int max_files)
+  : dir_(dir),
+    max_bytes_(max_bytes),
+    max_files_(max_files),
+    stats_{0, 0, 0.0, 0.0},
+    usage_(Trim(dir, max_bytes, max_files))
+{
+    for(GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const GLubyte* s = glGetString(name);
+        absl::StrAppend(&driver_, s ? reinterpret_cast<const char*>(s) : "",
+                        "\n");
+    }
+}
+
+ProgramCache::Usage ProgramCache::Trim(const std::string& dir,
+                                       int64_t max_bytes, int max_files) {
+    struct Entry {
+        std::string path;
+        int64_t size;
+        struct timespec mtime;
+    };
+    std::vector<Entry> entries;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return Usage{0, 0};
+    }
+    time_t now = time(nullptr);
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        bool temp = name.find(".bin.") != std::string::npos;
+        if (!temp && !EndsWith(name, ".bin")) {
+            continue;
+        }
+        std::string path = os::path::Join({dir, name});
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (temp) {
+            if (now - st.st_mtime > kStaleTempSeconds) {
+                remove(path.c_str());
+            }
+            continue;
+        }
+        entries.push_back(Entry{path, st.st_size, st.st_mtim});
+    }
+    closedir(d);
+
+    // Keep the most recently used entries that fit.
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) {
+        if (a.mtime.tv_sec != b.mtime.tv_sec) {
+            return a.mtime.tv_sec > b.mtime.tv_sec;
+        }
+        if (a.mtime.tv_nsec != b.mtime.tv_nsec) {
+            return a.mtime.tv_nsec > b.mtime.tv_nsec;
+        }
+        return a.path < b.path;
+    });
+    Usage usage{0, 0};
+    int evicted = 0;
+    for(const Entry& entry : entries) {
+        if (usage.files < max_files && usage.bytes + entry.size <= max_bytes) {
+            usage.files++;
+            usage.bytes += entry.size;
+        } else if (remove(entry.path.c_str()) == 0) {
+            ++evicted;
+        }
+    }
+    if (evicted) {
+        LOG(INFO, "Evicted ", evicted, " programs from the cache in ", dir);
+    }
+    return usage;
+}
+
+ProgramCache* ProgramCache::Get() {
+    static ProgramCache* cache = []() -> ProgramCache* {
+        GLint formats = 0;
+        if (GLEW_ARB_get_program_binary) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+        if (formats == 0) {
+            LOG(INFO, "The driver can't save program binaries; "
+                      "shaders will always be compiled.");
+            return nullptr;
+        }
+        return new ProgramCache(os::path::DataPath({"shader_cache"}));
+    }();
+    return enabled ? cache : nullptr;
+}
+
+void ProgramCache::set_enabled(bool e) {
+    enabled = e;
+}
+
+std::string ProgramCache::Key(const std::vector<std::string>& sources) const {
+    uint64_t hash = Fnv1a(kFNVOffset, driver_);
+    uint32_t crc = Crc32(0, driver_.data(), driver_.size());
+    for(const auto& s : sources) {
+        // Hash the length too, so text can't move between sources.
+        std::string length = absl::StrCat(s.size(), ":");
+        hash = Fnv1a(Fnv1a(hash, length), s);
+        crc = Crc32(crc, length.data(), length.size());
+        crc = Crc32(crc, s.data(), s.size());
+    }
+    char key[32];
+    snprintf(key, sizeof(key), "%016llx%08x",
+             static_cast<unsigned long long>(hash), crc);
+    return key;
+}
+
+std::string ProgramCache::Filename(const std::string& key) const {
+    return os::path::Join({dir_, key + ".bin"});
+}
+
+GLuint ProgramCache::Load(const std::string& key) {
+    int64_t start = os::utime_now();
+    std::string data;
+    Header header;
+    if (!File::GetContents(Filename(key), &data) ||
+        data.size() <= sizeof(header)) {
+        Count(false);
+        return 0;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        LOG(WARNING, "Ignoring corrupt program cache entry ", key);
+        Count(false);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, data.data() + sizeof(header),
+                    data.size() - sizeof(header));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        LOG(INFO, "The driver rejected cached program ", key);
+        glDeleteProgram(program);
+        Count(false);
+        return 0;
+    }
+    // Mark the entry used, for Trim.
+    utimes(Filename(key).c_str(), nullptr);
+    Count(true, double(os::utime_now() - start) / 1000.0);
+    return program;
+}
+
+void ProgramCache::Count(bool hit, double ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (hit) {
+        stats_.hits++;
+        stats_.load_ms += ms;
+    } else {
+        stats_.misses++;
+    }
+}
+
+void ProgramCache::AddCompileTime(double ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.compile_ms += ms;
+}
+
+ProgramCache::Stats ProgramCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ProgramCache::Store(const std::string& key, GLuint program) {
+    GLint linked = GL_FALSE, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!linked || length == 0) {
+        return;
+    }
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    std::string data(sizeof(header) + length, '\0');
+    GLenum format;
+    glGetProgramBinary(program, length, nullptr, &format,
+                       &data[sizeof(header)]);
+    header.format = format;
+    memcpy(&data[0], &header, sizeof(header));
+
+    util::Status status = File::MakeDirs(dir_);
+    if (!status.ok()) {
+        LOG(ERROR, "Can't create ", dir_, ": ", status.ToString());
+        return;
+    }
+    // Write to a temporary name first so a concurrent Load never sees a
+    // partial file.  The name is unique to this process and this Store.
+    std::string filename = Filename(key);
+    std::string temp = absl::StrCat(filename, ".", getpid(), ".",
+                                    temp_files++);
+    if (!File::SetContents(temp, data) ||
+        rename(temp.c_str(), filename.c_str()) != 0) {
+        LOG(ERROR, "Can't write program cache entry ", filename);
+        remove(temp.c_str());
+        return;
+    }
+
+    // Other processes may share the directory, so when the running total
+    // goes over, look at what's really there.
+    bool over;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        usage_.files++;
+        usage_.bytes += data.size();
+        over = usage_.files > max_files_ || usage_.bytes > max_bytes_;
+    }
+    if (over) {
+        Usage usage = Trim(dir_, max_bytes_, max_files_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        usage_ = usage;
+    }
+}
+
+}  // namespace GFX
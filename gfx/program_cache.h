@@ -0,0 +1,86 @@
+#ifndef RMX_GFX_PROGRAM_CACHE_H
+#define RMX_GFX_PROGRAM_CACHE_H
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+namespace GFX {
+
+// An on-disk cache of linked program binaries, so a program whose
+// preprocessed source hasn't changed is loaded with glProgramBinary
+// instead of being compiled.  Entries are keyed by a hash of the sources
+// and the driver's vendor, renderer and version strings, so a driver
+// update or any change to the source or its includes simply misses.  A
+// binary the driver rejects is treated as a miss too.  Programs may be
+// loaded and stored from several threads, each with its own context.
+//
+// Every edit of a hot-reloaded shader and every scene variant adds an
+// entry, so the cache is trimmed to the max_files most recently used
+// entries totalling at most max_bytes.  That happens when it's opened
+// and whenever a Store takes it past either limit.
+class ProgramCache {
+  public:
+    struct Stats {
+        int hits;
+        int misses;
+        // Time spent creating programs from the cache and from source.
+        double load_ms;
+        double compile_ms;
+    };
+
+    // The entries in a cache directory.
+    struct Usage {
+        int files;
+        int64_t bytes;
+    };
+
+    static const int64_t kMaxBytes = 64 << 20;
+    static const int kMaxFiles = 512;
+
+    explicit ProgramCache(const std::string& dir,
+                          int64_t max_bytes=kMaxBytes,
+                          int max_files=kMaxFiles);
+
+    // The cache used by Shader::Load, in the application's data directory,
+    // or nullptr if the driver can't save program binaries.  Needs a
+    // current GL context.
+    static ProgramCache* Get();
+    static void set_enabled(bool enabled);
+
+    // The key for a program built from these sources.
+    std::string Key(const std::vector<std::string>& sources) const;
+    // A linked program loaded from the cache, or 0 on a miss.
+    GLuint Load(const std::string& key);
+    // Save a linked program.  It must have been linked with
+    // GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+    void Store(const std::string& key, GLuint program);
+    // Record the time spent compiling a missed program.
+    void AddCompileTime(double ms);
+
+    Stats stats() const;
+
+    // Delete the least recently used entries in dir, going by their
+    // mtimes, until what's left fits the limits.  Load touches the
+    // entries it hits.  Temporary files a crashed Store left behind are
+    // deleted once they're an hour old.  Needs no GL context.
+    static Usage Trim(const std::string& dir, int64_t max_bytes,
+                      int max_files);
+
+  private:
+    std::string Filename(const std::string& key) const;
+    void Count(bool hit, double ms=0.0);
+
+    std::string dir_;
+    std::string driver_;
+    int64_t max_bytes_;
+    int max_files_;
+    mutable std::mutex mutex_;
+    Stats stats_;
+    // What's in dir_, as of the last Trim plus the Stores since.
+    Usage usage_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_PROGRAM_CACHE_H
@@ -0,0 +1,183 @@
+// Checks that ProgramCache trims its directory to the most recently used
+// entries, both directly and as programs are stored and loaded through a
+// headless GL context.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <GL/glew.h>
+
+#include "gfx/headless_gl.h"
+#include "gfx/program_cache.h"
+#include "gtest/gtest.h"
+#include "util/file.h"
+
+namespace GFX {
+namespace {
+
+class ProgramCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        const char* tmp = getenv("TEST_TMPDIR");
+        std::string pattern = std::string(tmp ? tmp : "/tmp") +
+                              "/program_cache_XXXXXX";
+        ASSERT_NE(mkdtemp(&pattern[0]), nullptr);
+        dir_ = pattern;
+    }
+
+    void TearDown() override {
+        std::string command = "rm -rf '" + dir_ + "'";
+        system(command.c_str());
+    }
+
+    std::string Path(const std::string& name) const {
+        return dir_ + "/" + name;
+    }
+
+    // Write a file of size bytes, last used age seconds ago.
+    void Write(const std::string& name, size_t size, int age) {
+        ASSERT_TRUE(File::SetContents(Path(name), std::string(size, 'x')));
+        Age(name, age);
+    }
+
+    void Age(const std::string& name, int age) {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        struct timeval times[2] = {now, now};
+        times[0].tv_sec -= age;
+        times[1].tv_sec -= age;
+        ASSERT_EQ(utimes(Path(name).c_str(), times), 0);
+    }
+
+    bool Exists(const std::string& name) const {
+        struct stat st;
+        return stat(Path(name).c_str(), &st) == 0;
+    }
+
+    std::string dir_;
+};
+
+TEST_F(ProgramCacheTest, TrimKeepsTheNewestFiles) {
+    Write("a.bin", 100, 50);
+    Write("b.bin", 100, 40);
+    Write("c.bin", 100, 30);
+    Write("d.bin", 100, 20);
+    Write("e.bin", 100, 10);
+    Write("notes.txt", 100, 60);
+
+    ProgramCache::Usage usage = ProgramCache::Trim(dir_, 1 << 20, 3);
+    EXPECT_EQ(usage.files, 3);
+    EXPECT_EQ(usage.bytes, 300);
+    EXPECT_FALSE(Exists("a.bin"));
+    EXPECT_FALSE(Exists("b.bin"));
+    EXPECT_TRUE(Exists("c.bin"));
+    EXPECT_TRUE(Exists("d.bin"));
+    EXPECT_TRUE(Exists("e.bin"));
+    // Only cache entries are counted or removed.
+    EXPECT_TRUE(Exists("notes.txt"));
+}
+
+TEST_F(ProgramCacheTest, TrimKeepsUnderTheByteLimit) {
+    Write("old.bin", 100, 30);
+    Write("big.bin", 500, 20);
+    Write("new.bin", 100, 10);
+
+    ProgramCache::Usage usage = ProgramCache::Trim(dir_, 650, 100);
+    EXPECT_EQ(usage.files, 2);
+    EXPECT_EQ(usage.bytes, 600);
+    EXPECT_FALSE(Exists("old.bin"));
+    EXPECT_TRUE(Exists("big.bin"));
+    EXPECT_TRUE(Exists("new.bin"));
+
+    // Limits that are already met remove nothing.
+    usage = ProgramCache::Trim(dir_, 600, 2);
+    EXPECT_EQ(usage.files, 2);
+    EXPECT_TRUE(Exists("big.bin"));
+    EXPECT_TRUE(Exists("new.bin"));
+}
+
+TEST_F(ProgramCacheTest, TrimRemovesStaleTemporaryFiles) {
+    Write("a.bin.123.0", 100, 2 * 3600);
+    Write("b.bin.123.1", 100, 10);
+
+    ProgramCache::Usage usage = ProgramCache::Trim(dir_, 1 << 20, 10);
+    EXPECT_EQ(usage.files, 0);
+    EXPECT_FALSE(Exists("a.bin.123.0"));
+    // It may still be being written.
+    EXPECT_TRUE(Exists("b.bin.123.1"));
+}
+
+TEST_F(ProgramCacheTest, MissingDirectory) {
+    ProgramCache::Usage usage = ProgramCache::Trim(Path("nope"), 1, 1);
+    EXPECT_EQ(usage.files, 0);
+    EXPECT_EQ(usage.bytes, 0);
+}
+
+GLuint LinkProgram() {
+    const char* vs =
+        "#version 150\n"
+        "in vec2 position;\n"
+        "void main() { gl_Position = vec4(position, 0.0, 1.0); }\n";
+    const char* fs =
+        "#version 150\n"
+        "out vec4 color;\n"
+        "void main() { color = vec4(1.0); }\n";
+    GLuint program = glCreateProgram();
+    for(auto stage : {std::make_pair(GL_VERTEX_SHADER, vs),
+                      std::make_pair(GL_FRAGMENT_SHADER, fs)}) {
+        GLuint shader = glCreateShader(stage.first);
+        glShaderSource(shader, 1, &stage.second, nullptr);
+        glCompileShader(shader);
+        glAttachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    return program;
+}
+
+TEST_F(ProgramCacheTest, StoreEvictsTheLeastRecentlyLoaded) {
+    util::Status status = InitHeadlessGL();
+    if (!status.ok()) {
+        GTEST_SKIP() << status.error_message();
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0) {
+        GTEST_SKIP() << "The driver can't save program binaries";
+    }
+
+    GLuint program = LinkProgram();
+    ProgramCache cache(dir_, 1 << 30, 2);
+    std::string k1 = cache.Key({"one"});
+    std::string k2 = cache.Key({"two"});
+    std::string k3 = cache.Key({"three"});
+    cache.Store(k1, program);
+    cache.Store(k2, program);
+    ASSERT_TRUE(Exists(k1 + ".bin"));
+    ASSERT_TRUE(Exists(k2 + ".bin"));
+
+    // k1 was stored first, but loading it makes it the most recent.
+    Age(k1 + ".bin", 20);
+    Age(k2 + ".bin", 10);
+    GLuint loaded = cache.Load(k1);
+    EXPECT_NE(loaded, 0u);
+    glDeleteProgram(loaded);
+
+    cache.Store(k3, program);
+    EXPECT_TRUE(Exists(k1 + ".bin"));
+    EXPECT_FALSE(Exists(k2 + ".bin"));
+    EXPECT_TRUE(Exists(k3 + ".bin"));
+    EXPECT_EQ(cache.Load(k2), 0u);
+
+    // Opening the cache with a lower limit trims it too.
+    ProgramCache small(dir_, 1 << 30, 1);
+    EXPECT_FALSE(Exists(k1 + ".bin"));
+    EXPECT_TRUE(Exists(k3 + ".bin"));
+    glDeleteProgram(program);
+}
+
+}  // namespace
+}  // namespace GFX
@@ -1,65 +1,1838 @@
 #include "gfx/raymarch.h"
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
 #include <GL/glew.h>
 
+#include "gfx/profiler.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "util/logging.h"
+#include "util/os.h"
 
 namespace GFX {
+
+// The defines that build a program for op, or for any op if op is -1,
+// with the shadow cache if it's on.
+std::map<std::string, std::string> RayMarchScene::Defines(int op) const {
+    std::map<std::string, std::string> defines;
+    if (op >= 0) {
+        defines["SCENE_OP"] = std::to_string(op);
+    }
+    if (ShadowCache()) {
+        defines["SHADOW_CACHE"] = "1";
+    }
+    return defines;
+}
+
 bool RayMarchScene::LoadProgram(const std::string& vs, const std::string& fs) {
-    auto p = Shader::Load(vs, fs, "");
+    int op = WantedOp(scene_);
+    auto p = Shader::Load(vs, fs, "", includes_, Defines(op));
     if (!p) {
         return false;
     }
     shader_ = std::move(p);
+    vs_ = vs;
+    fs_ = fs;
+    program_op_ = op;
+    defines_ = Defines(op);
+    op_programs_.clear();
+    cone_.reset();
+    reproject_.reset();
+    history_valid_ = false;
+    WatchPrograms();
     return true; 
 }
 
+namespace {
+// The contents of scene.inc for a scene whose primary rays march pruned.
+std::string SceneInclude(const sdf::NodeRef& scene,
+                         const sdf::NodeRef& pruned) {
+    if (pruned) {
+        return sdf::EmitGLSL(scene) + sdf::EmitGLSL(pruned, "DistPrimary");
+    }
+    return sdf::EmitGLSL(scene) +
+        "float DistPrimary(vec3 p) { return DistScene(p); }\n";
+}
+
+// The contents of scene.inc for a scene whose primary rays march a
+// BrickVolume.  Outside the volume they fall back to the scene.
+std::string VolumeInclude(const sdf::NodeRef& scene) {
+    return sdf::EmitGLSL(scene) +
+        "#include \"volume.inc\"\n"
+        "float DistPrimary(vec3 p) {\n"
+        "    return InVolume(p) ? DistVolume(p) : DistScene(p);\n"
+        "}\n";
+}
+
+// Texture units for the volume and prepass textures.  Unit 0 is left
+// alone.
+const int kVolumeUnit = 1;
+const int kPrepassUnit = 4;
+const int kHistoryUnit = 5;
+// The current interleaved pass, and the previous one on the next unit.
+const int kInterleaveUnit = 6;
+// The first antialiasing samples' colors, and their surfaces on the next
+// unit.
+const int kAntialiasUnit = 8;
+const int kHeatmapUnit = 10;
+const int kShadowCacheUnit = 11;
+
+// The fragment shader for the depth prepass.  It includes the same
+// scene as the main program.
+const char kConeMarchShader[] = "content/conemarch.fs";
+
+// Fills the pixels the temporal history can supply; it also includes
+// the scene.
+const char kReprojectShader[] = "content/reproject.fs";
+
+// Copies the temporal history to the screen.
+const char kResolveShader[] = "content/temporal.fs";
+
+// Reconstructs full frames from interleaved passes.
+const char kInterleaveShader[] = "content/interleave.fs";
+
+// Marks the pixels to antialias.
+const char kEdgesShader[] = "content/edges.fs";
+
+// Draws the heatmap of the per-pixel costs.
+const char kHeatmapShader[] = "content/heatmap.fs";
+
+// Step count readbacks in flight.
+const int kStepsReadbacks = 3;
+
+// temporal_mode values, see content/raymarch.fs.
+const int kTemporalOff = 0;
+const int kTemporalMarch = 1;
+const int kTemporalAccumulate = 2;
+
+// The radical inverse of i in base b, for Halton sequences.
+float Halton(int i, int b) {
+    float f = 1.0f, r = 0.0f;
+    for(; i > 0; i /= b) {
+        f /= b;
+        r += f * (i % b);
+    }
+    return r;
+}
+
+// The uniform buffer binding points for SceneBlock and PassBlock.
+// CameraBlock uses Camera::kUniformBinding.
+const GLuint kSceneBinding = 1;
+const GLuint kPassBinding = 2;
+
+// ShaderReloader slots.  The programs that include the scene have one
+// for each kind and op they're built for, op -1 being the scene_op
+// uniform; the other passes' programs follow, then the pruned tile
+// programs.
+const int kMainProgram = 0;
+const int kConeProgram = 1;
+const int kReprojectProgram = 2;
+const int kProgramKinds = 3;
+const int kResolveSlot = 100;
+const int kInterleaveSlot = 101;
+const int kEdgesSlot = 102;
+const int kHeatmapSlot = 103;
+// The main program for the scene's volume, once it's baked.
+const int kVolumeSlot = 104;
+const int kFirstVariantSlot = 1000;
+
+int SceneSlot(int op, int kind) {
+    return (op + 1) * kProgramKinds + kind;
+}
+
+void Texture3D(GLuint texture, GLint format, GLenum pixel_format,
+               GLenum type, GLint filter, const glm::ivec3& size,
+               const void* data) {
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, format, size.x, size.y, size.z, 0,
+                 pixel_format, type, data);
+}
+
+// Variants are compiled as the camera moves over the scene, so the cache
+// is dropped when it gets this big.
+const size_t kMaxVariants = 256;
+}  // namespace
+
+bool RayMarchScene::SetScene(const sdf::NodeRef& scene) {
+    std::map<std::string, std::string> includes;
+    std::shared_ptr<const BrickVolume> volume;
+    std::shared_ptr<const DistanceField> source;
+    if (scene) {
+        includes["scene.inc"] = SceneInclude(scene, nullptr);
+        if (use_volume_) {
+            source = scene == scene_ && volume_source_ ?
+                     volume_source_ : std::shared_ptr<const DistanceField>(
+                             sdf::Program::Compile(scene));
+            volume = volume_cache_.Get(source, volume_options_);
+        }
+        if (volume) {
+            includes["scene.inc"] = VolumeInclude(scene);
+        }
+    }
+    int op = WantedOp(scene);
+    auto p = Shader::Load(vs_, fs_, "", includes, Defines(op));
+    if (!p) {
+        return false;
+    }
+    if (volume && volume != volume_ && !UploadVolume(*volume)) {
+        return false;
+    }
+    scene_ = scene;
+    volume_source_ = source;
+    volume_pending_ = source && !volume;
+    SwapScene(std::move(p), op, includes, volume);
+    return true;
+}
+
+// Draw scene_ with p, built for op from includes, and drop the programs
+// built from the previous includes.
+void RayMarchScene::SwapScene(std::unique_ptr<Shader> p, int op,
+        const std::map<std::string, std::string>& includes,
+        std::shared_ptr<const BrickVolume> volume) {
+    shader_ = std::move(p);
+    program_op_ = op;
+    defines_ = Defines(op);
+    op_programs_.clear();
+    volume_ = std::move(volume);
+    includes_ = includes;
+    variants_.clear();
+    cone_.reset();
+    reproject_.reset();
+    history_valid_ = false;
+    InitProgram();
+    WatchPrograms();
+}
+
+bool RayMarchScene::SetVolume(bool enable,
+                              const BrickVolume::Options& options) {
+    use_volume_ = enable;
+    volume_options_ = options;
+    if (!enable) {
+        volume_cache_.Clear();
+    }
+    return scene_ ? SetScene(scene_) : true;
+}
+
+// Switch the scene to its volume once the bake SetScene started is done.
+// With a reloader the program that marches it is built in the
+// background, and SwapVolume switches when it's ready.
+void RayMarchScene::UpdateVolume() {
+    if (!volume_pending_ ||
+        !volume_cache_.Get(volume_source_, volume_options_)) {
+        return;
+    }
+    if (reloader_) {
+        RequestProgram(kVolumeSlot);
+        return;
+    }
+    volume_pending_ = false;
+    SetScene(scene_);
+}
+
+// Switch the scene to its volume, marched by p.
+void RayMarchScene::SwapVolume(std::unique_ptr<Shader> p) {
+    building_.erase(kVolumeSlot);
+    reloader_->Unwatch(this, kVolumeSlot);
+    auto volume = volume_cache_.Get(volume_source_, volume_options_);
+    if (!volume_pending_ || !volume) {
+        return;
+    }
+    volume_pending_ = false;
+    if (volume != volume_ && !UploadVolume(*volume)) {
+        return;
+    }
+    std::map<std::string, std::string> includes = includes_;
+    includes["scene.inc"] = VolumeInclude(scene_);
+    SwapScene(std::move(p), WantedOp(scene_), includes, volume);
+}
+
+bool RayMarchScene::UploadVolume(const BrickVolume& volume) {
+    // Pack the bricks into a roughly cubic atlas.
+    const int S = volume.options().brick_size + 1;
+    int slots = std::max(volume.slots(), 1);
+    int side = int(std::ceil(std::cbrt(float(slots))));
+    glm::ivec3 atlas(side, side, (slots + side * side - 1) / (side * side));
+    glm::ivec3 texels = atlas * S;
+
+    GLint max_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+    glm::ivec3 bricks = volume.bricks() + 1;
+    if (std::max(texels.x, texels.z) > max_size ||
+        std::max(std::max(bricks.x, bricks.y), bricks.z) > max_size) {
+        LOGF(ERROR, "Brick volume is too big for a %d^3 texture", max_size);
+        return false;
+    }
+
+    std::vector<float> voxels(size_t(texels.x) * texels.y * texels.z);
+    const float* src = volume.voxels().data();
+    for(int slot = 0; slot < volume.slots(); ++slot) {
+        glm::ivec3 a(slot % atlas.x, (slot / atlas.x) % atlas.y,
+                     slot / (atlas.x * atlas.y));
+        for(int z = 0; z < S; ++z) {
+            for(int y = 0; y < S; ++y, src += S) {
+                size_t row = size_t(a.z * S + z) * texels.y + a.y * S + y;
+                memcpy(&voxels[row * texels.x + a.x * S], src,
+                       S * sizeof(float));
+            }
+        }
+    }
+
+    if (!volume_tex_[0]) {
+        glGenTextures(3, volume_tex_);
+    }
+    Texture3D(volume_tex_[0], GL_R32I, GL_RED_INTEGER, GL_INT, GL_NEAREST,
+              volume.bricks(), volume.index().data());
+    Texture3D(volume_tex_[1], GL_R32F, GL_RED, GL_FLOAT, GL_NEAREST,
+              bricks, volume.coarse().data());
+    // Voxels are only stored near surfaces, so half floats are plenty.
+    Texture3D(volume_tex_[2], GL_R16F, GL_RED, GL_FLOAT, GL_LINEAR,
+              texels, voxels.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    volume_atlas_ = atlas;
+    LOGF(INFO, "Uploaded brick volume: %dx%dx%d atlas, %.2f MiB",
+         texels.x, texels.y, texels.z,
+         double(voxels.size() * 2 + volume.index().size() * 4 +
+                volume.coarse().size() * 4) / (1 << 20));
+    return true;
+}
+
+void RayMarchScene::BindVolume(const Locations& loc) {
+    const BrickVolume& v = *volume_;
+    const sdf::Bounds& bounds = v.options().bounds;
+    glUniform3fv(loc.volume.lo, 1, glm::value_ptr(bounds.lo));
+    glUniform3fv(loc.volume.hi, 1, glm::value_ptr(bounds.hi));
+    glUniform1f(loc.volume.brick_extent,
+                v.options().voxel_size * v.options().brick_size);
+    glUniform1i(loc.volume.brick_size, v.options().brick_size);
+    glUniform3i(loc.volume.bricks, v.bricks().x, v.bricks().y, v.bricks().z);
+    glUniform3i(loc.volume.atlas,
+                volume_atlas_.x, volume_atlas_.y, volume_atlas_.z);
+    glUniform1f(loc.volume.band, v.band());
+
+    GLuint samplers[] = {
+        loc.volume.index, loc.volume.coarse, loc.volume.voxels };
+    for(int i = 0; i < 3; ++i) {
+        glActiveTexture(GL_TEXTURE0 + kVolumeUnit + i);
+        glBindTexture(GL_TEXTURE_3D, volume_tex_[i]);
+        glUniform1i(samplers[i], kVolumeUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+RayMarchScene::~RayMarchScene() {
+    if (reloader_) {
+        reloader_->Unwatch(this);
+    }
+    for(const History& history : history_) {
+        if (history.fbo) {
+            glDeleteFramebuffers(1, &history.fbo);
+            glDeleteTextures(1, &history.texture);
+        }
+    }
+    if (history_depth_) {
+        glDeleteRenderbuffers(1, &history_depth_);
+    }
+    for(const History& pass : interleave_) {
+        if (pass.fbo) {
+            glDeleteFramebuffers(1, &pass.fbo);
+            glDeleteTextures(1, &pass.texture);
+        }
+    }
+    if (antialias_fbo_[0]) {
+        glDeleteFramebuffers(2, antialias_fbo_);
+        glDeleteTextures(3, antialias_texture_);
+        glDeleteRenderbuffers(1, &antialias_depth_);
+    }
+    if (antialias_query_) {
+        glDeleteQueries(1, &antialias_query_);
+    }
+    if (shadow_fbo_) {
+        glDeleteFramebuffers(1, &shadow_fbo_);
+        glDeleteTextures(1, &shadow_texture_);
+    }
+    if (steps_fbo_) {
+        glDeleteFramebuffers(1, &steps_fbo_);
+        glDeleteTextures(1, &steps_texture_);
+    }
+    for(const StepsReadback& readback : readbacks_) {
+        if (readback.sync) {
+            glDeleteSync(readback.sync);
+        }
+        if (readback.buffer) {
+            glDeleteBuffers(1, &readback.buffer);
+        }
+    }
+}
+
+void RayMarchScene::set_reloader(std::shared_ptr<ShaderReloader> reloader) {
+    if (reloader_) {
+        reloader_->Unwatch(this);
+    }
+    reloader_ = std::move(reloader);
+    WatchPrograms();
+}
+
+RayMarchScene::Variant* RayMarchScene::VariantAt(int slot) {
+    for(auto& v : variants_) {
+        if (v.second->slot == slot) {
+            return v.second.get();
+        }
+    }
+    return nullptr;
+}
+
+// Where the program for a reloader slot is kept, or null if the scene no
+// longer has a place for it.
+std::unique_ptr<Shader>* RayMarchScene::ProgramAt(int slot) {
+    if (slot >= kFirstVariantSlot) {
+        Variant* v = VariantAt(slot);
+        return v ? &v->shader : nullptr;
+    }
+    switch(slot) {
+    case kResolveSlot: return &resolve_;
+    case kInterleaveSlot: return &reconstruct_;
+    case kEdgesSlot: return &edges_;
+    case kHeatmapSlot: return &overlay_;
+    }
+    int op = slot / kProgramKinds - 1;
+    int kind = slot % kProgramKinds;
+    if (op == program_op_) {
+        return kind == kMainProgram ? &shader_
+             : kind == kConeProgram ? &cone_ : &reproject_;
+    }
+    auto it = op_programs_.find(op);
+    if (it == op_programs_.end()) {
+        return nullptr;
+    }
+    OpPrograms& p = it->second;
+    return kind == kMainProgram ? &p.shader
+         : kind == kConeProgram ? &p.cone : &p.reproject;
+}
+
+// What to build the program for a reloader slot from.
+ShaderReloader::Source RayMarchScene::ProgramSource(int slot) {
+    ShaderReloader::Source source{
+        vs_, fs_, "", includes_, defines_,
+        {{"CameraBlock", Camera::kUniformBinding},
+         {"SceneBlock", kSceneBinding},
+         {"PassBlock", kPassBinding}}};
+    if (slot >= kFirstVariantSlot) {
+        source.includes.clear();
+        source.includes["scene.inc"] =
+            SceneInclude(scene_, VariantAt(slot)->pruned);
+        return source;
+    }
+    if (slot == kVolumeSlot) {
+        source.includes["scene.inc"] = VolumeInclude(scene_);
+        return source;
+    }
+    const char* fs = slot == kResolveSlot ? kResolveShader
+                   : slot == kInterleaveSlot ? kInterleaveShader
+                   : slot == kEdgesSlot ? kEdgesShader
+                   : slot == kHeatmapSlot ? kHeatmapShader : nullptr;
+    if (fs) {
+        source.fs = fs;
+        source.includes.clear();
+        source.defines.clear();
+        return source;
+    }
+    int kind = slot % kProgramKinds;
+    source.defines = Defines(slot / kProgramKinds - 1);
+    if (kind == kConeProgram) {
+        source.fs = kConeMarchShader;
+    } else if (kind == kReprojectProgram) {
+        source.fs = kReprojectShader;
+    }
+    return source;
+}
+
+void RayMarchScene::WatchProgram(int slot) {
+    std::unique_ptr<Shader>* program = ProgramAt(slot);
+    if (!reloader_ || !program || !*program) {
+        return;
+    }
+    reloader_->Watch(this, slot, ProgramSource(slot),
+                     (*program)->dependencies());
+}
+
+// Watch the current programs, forgetting rebuilds of any earlier ones.
+void RayMarchScene::WatchPrograms() {
+    if (!reloader_) {
+        return;
+    }
+    reloader_->Unwatch(this);
+    building_.clear();
+    for(int kind = 0; kind < kProgramKinds; ++kind) {
+        WatchProgram(SceneSlot(program_op_, kind));
+        for(const auto& p : op_programs_) {
+            WatchProgram(SceneSlot(p.first, kind));
+        }
+    }
+    for(int slot : {kResolveSlot, kInterleaveSlot, kEdgesSlot,
+                    kHeatmapSlot}) {
+        WatchProgram(slot);
+    }
+    for(const auto& v : variants_) {
+        WatchProgram(v.second->slot);
+    }
+    // Have the scene_op uniform program ready to draw while the programs
+    // for other ops are built.
+    std::unique_ptr<Shader>* generic = ProgramAt(SceneSlot(-1, kMainProgram));
+    if (program_op_ >= 0 && (!generic || !*generic)) {
+        RequestProgram(SceneSlot(-1, kMainProgram));
+    }
+}
+
+// Have the reloader build the program for slot in the background, unless
+// it already is, and make a place for it.
+void RayMarchScene::RequestProgram(int slot) {
+    if (slot < kResolveSlot) {
+        int op = slot / kProgramKinds - 1;
+        if (op != program_op_) {
+            op_programs_.emplace(op, OpPrograms{});
+        }
+    }
+    if (building_.insert(slot).second) {
+        reloader_->Build(this, slot, ProgramSource(slot));
+    }
+}
+
+// Swap in the programs the reloader has rebuilt.  Called at the start of
+// a frame so every pass in the frame uses the same programs.
+void RayMarchScene::SwapReloaded() {
+    if (!reloader_) {
+        return;
+    }
+    std::unique_ptr<Shader> volume;
+    for(auto& taken : reloader_->TakeAll(this)) {
+        if (taken.first == kVolumeSlot) {
+            volume = std::move(taken.second);
+            continue;
+        }
+        std::unique_ptr<Shader>* program = ProgramAt(taken.first);
+        if (!program) {
+            continue;
+        }
+        *program = std::move(taken.second);
+        building_.erase(taken.first);
+        GLuint id = (*program)->program();
+        if (program == &shader_) {
+            history_valid_ = false;
+            InitProgram();
+            LOG(INFO, "Reloaded ", fs_);
+        } else if (program == &cone_) {
+            GetLocations(id, &cone_loc_);
+        } else if (program == &reproject_) {
+            GetLocations(id, &reproject_loc_);
+        } else if (program == &resolve_) {
+            GetLocations(id, &resolve_loc_);
+        } else if (program == &reconstruct_) {
+            GetLocations(id, &reconstruct_loc_);
+        } else if (program == &edges_) {
+            GetLocations(id, &edges_loc_);
+        } else if (program == &overlay_) {
+            GetLocations(id, &overlay_loc_);
+        } else if (Variant* v = VariantAt(taken.first)) {
+            GetLocations(id, &v->loc);
+        }
+    }
+    // Last, since it replaces every program built for the scene's GLSL.
+    if (volume) {
+        SwapVolume(std::move(volume));
+    }
+}
+
+void RayMarchScene::ClearVariants() {
+    for(const auto& v : variants_) {
+        if (reloader_) {
+            reloader_->Unwatch(this, v.second->slot);
+        }
+        building_.erase(v.second->slot);
+    }
+    variants_.clear();
+}
+
+int RayMarchScene::WantedOp(const sdf::NodeRef& scene) const {
+    return specialize_op_ && !scene ? op_ : -1;
+}
+
+// Swap in the programs for op_.  Programs that aren't cached are built
+// here without a reloader; with one they're built in the background, and
+// the scene_op uniform program is drawn until they're ready.
+void RayMarchScene::SelectOpProgram() {
+    int op = WantedOp(scene_);
+    if (op == program_op_) {
+        return;
+    }
+    auto next = op_programs_.find(op);
+    if (reloader_ && (next == op_programs_.end() || !next->second.shader)) {
+        RequestProgram(SceneSlot(op, kMainProgram));
+        op = -1;
+        next = op_programs_.find(op);
+        if (op == program_op_) {
+            return;
+        }
+        if (next == op_programs_.end() || !next->second.shader) {
+            // Keep the current program until one of them is ready.
+            RequestProgram(SceneSlot(op, kMainProgram));
+            return;
+        }
+    }
+    if (next == op_programs_.end() || !next->second.shader) {
+        int64_t start = os::utime_now();
+        auto p = Shader::Load(vs_, fs_, "", includes_, Defines(op));
+        if (!p) {
+            LOG(ERROR, "Can't build the program for op ", op,
+                "; using the scene_op uniform");
+            specialize_op_ = false;
+            return;
+        }
+        LOGF(INFO, "Built the program for op %d in %.1f ms", op,
+             double(os::utime_now() - start) / 1000.0);
+        next = op_programs_.emplace(op, OpPrograms{}).first;
+        next->second.shader = std::move(p);
+        WatchProgram(SceneSlot(op, kMainProgram));
+    }
+    OpPrograms& current = op_programs_[program_op_];
+    current.shader = std::move(shader_);
+    current.cone = std::move(cone_);
+    current.reproject = std::move(reproject_);
+    shader_ = std::move(next->second.shader);
+    cone_ = std::move(next->second.cone);
+    reproject_ = std::move(next->second.reproject);
+    op_programs_.erase(next);
+
+    program_op_ = op;
+    defines_ = Defines(op);
+    InitProgram();
+    if (cone_) {
+        GetLocations(cone_->program(), &cone_loc_);
+    }
+    if (reproject_) {
+        GetLocations(reproject_->program(), &reproject_loc_);
+    }
+}
+
 void RayMarchScene::Init() {
-    GLuint program = shader_->program();
+    InitProgram();
+}
 
+void RayMarchScene::Resize(int width, int height) {
+    width_ = width;
+    height_ = height;
+    aspect_ratio_ = float(width) / float(height);
+}
+
+void RayMarchScene::InitProgram() {
     shader_->Use();
-    camera_.Init(program);
-    loc_.resolution =   glGetUniformLocation(program, "scene_resolution");
-    loc_.aspect_ratio = glGetUniformLocation(program, "scene_aspect_ratio");
-    loc_.steps =        glGetUniformLocation(program, "scene_steps");
-    loc_.epsilon =      glGetUniformLocation(program, "scene_epsilon");
-    loc_.sky_color =    glGetUniformLocation(program, "scene_sky_color");
-    loc_.ambient =      glGetUniformLocation(program, "scene_ambient");
-    loc_.light0pos =    glGetUniformLocation(program, "scene_light0pos");
-    loc_.light0col =    glGetUniformLocation(program, "scene_light0col");
-    loc_.op =           glGetUniformLocation(program, "scene_op");
-    loc_.position =     glGetAttribLocation(program, "position");
+    GetLocations(shader_->program(), &loc_);
+}
+
+// Write the camera and scene blocks if they changed, and bind them for
+// every program drawn this frame.
+void RayMarchScene::UpdateUniforms() {
+    camera_.Update(ring_.get());
+    UpdateShadowBounds();
+    SceneUniforms u{sky_color_, ambient_, light0col_, light0pos_, epsilon_,
+                    glm::vec2(width_, height_), aspect_ratio_, steps_, op_,
+                    stepping_.strategy, stepping_.Stretch(),
+                    stepping_.relaxation,
+                    shadow_lo_, shadows_.k, shadow_hi_, shadows_.threshold,
+                    shadows_.min_step, shadows_.max_step,
+                    shadows_.cache_tolerance, 0.0f};
+    if (!ring_->Live(scene_block_) ||
+        memcmp(&u, &scene_uniforms_, sizeof(u)) != 0) {
+        scene_uniforms_ = u;
+        scene_block_ = ring_->Write(&scene_uniforms_, sizeof(u));
+    }
+    ring_->Bind(kSceneBinding, scene_block_);
+}
+
+// Write the pass block for the next draw if it differs from the last
+// one, and bind it.
+void RayMarchScene::BindPass() {
+    PassUniforms u{};
+    u.viewport = glm::vec4(viewport_[0], viewport_[1], viewport_[2],
+                           viewport_[3]);
+    u.prepass_factor = prepass_input_ ? prepass_input_->factor : 0;
+    u.cone_factor = cone_factor_;
+    u.output_steps = output_steps_;
+    u.interleave = interleave_mode_;
+    u.interleave_phase = interleave_phase_;
+    u.temporal_mode = temporal_mode_;
+    u.temporal_jitter = temporal_jitter_;
+    u.antialias_samples = antialias_pass_;
+    u.shadow_cache_factor = shadow_factor_;
+    u.shadow_cache_pass = shadow_pass_;
+    u.heatmap_counter = heatmap_counter_;
+    u.heatmap_range = heatmap_range_;
+    if (temporal_mode_ != kTemporalOff) {
+        const CameraUniforms& c = history_camera_;
+        u.temporal_samples = history_samples_;
+        u.temporal_refresh = temporal_refresh_;
+        u.temporal_frame = int(temporal_frame_ % 65536);
+        u.temporal_eye = c.eye;
+        u.temporal_forward = c.forward;
+        u.temporal_right = c.right;
+        u.temporal_up = c.up;
+    }
+    // Every pixel takes the same samples, spread by a Halton sequence
+    // around the first one at its centre.
+    for(int i = 0; i < antialias_pass_; ++i) {
+        glm::vec2 offset =
+            glm::vec2(Halton(i + 1, 2), Halton(i + 1, 3)) - 0.5f;
+        glm::vec4& pair = u.antialias_offsets[i / 2];
+        if (i & 1) {
+            pair.z = offset.x;
+            pair.w = offset.y;
+        } else {
+            pair.x = offset.x;
+            pair.y = offset.y;
+        }
+    }
+    if (!ring_->Live(pass_block_) ||
+        memcmp(&u, &pass_uniforms_, sizeof(u)) != 0) {
+        pass_uniforms_ = u;
+        pass_block_ = ring_->Write(&pass_uniforms_, sizeof(u));
+    }
+    ring_->Bind(kPassBinding, pass_block_);
+}
 
+void RayMarchScene::set_shadows(const ShadowOptions& options) {
+    bool rebuild = (options.cache > 1) != ShadowCache();
+    shadows_ = options;
+    if (rebuild && shader_) {
+        // Build the programs with or without the cache.
+        SetScene(scene_);
+    }
+}
 
-    glGenVertexArrays(1, &vao_);
-    glGenBuffers(1, &vbo_);
+// Shadow rays are clipped to the box around the scene's surfaces.  The
+// floor is raytraced rather than part of the scene, so it never casts a
+// shadow and needn't be in the box.  The box is found on another thread,
+// so the render thread never waits for it.  The default scene is GLSL
+// that no sdf::Node tree is sure to match, and may be edited and
+// reloaded while the app runs, so its shadows are never bounded.
+void RayMarchScene::UpdateShadowBounds() {
+    if (!shadows_.bounded) {
+        shadow_lo_ = glm::vec3(-kUnbounded);
+        shadow_hi_ = glm::vec3(kUnbounded);
+        shadow_scene_ = nullptr;
+        return;
+    }
+    if (shadow_bounds_.valid()) {
+        if (shadow_bounds_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            return;
+        }
+        sdf::Bounds bounds = shadow_bounds_.get();
+        if (shadow_scene_ == scene_) {
+            shadow_lo_ = bounds.lo;
+            shadow_hi_ = bounds.hi;
+        }
+    }
+    if (shadow_scene_ == scene_) {
+        return;
+    }
+    // Until the new scene's bounds are found, its shadows are unbounded.
+    shadow_lo_ = glm::vec3(-kUnbounded);
+    shadow_hi_ = glm::vec3(kUnbounded);
+    shadow_scene_ = scene_;
+    if (!scene_) {
+        return;
+    }
+    sdf::NodeRef scene = scene_;
+    shadow_bounds_ = std::async(std::launch::async, [scene]() {
+        auto program = sdf::Program::Compile(scene);
+        sdf::Bounds bounds;
+        SurfaceBounds([&](const glm::vec3& p) { return program->Distance(p); },
+                      &bounds.lo, &bounds.hi);
+        return bounds;
+    });
+}
+
+void RayMarchScene::GetLocations(GLuint program, Locations* loc) {
+    Camera::Init(program);
+    GLuint scene = glGetUniformBlockIndex(program, "SceneBlock");
+    if (scene != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, scene, kSceneBinding);
+    }
+    GLuint pass = glGetUniformBlockIndex(program, "PassBlock");
+    if (pass != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, pass, kPassBinding);
+    }
+
+    auto& v = loc->volume;
+    v.lo =              glGetUniformLocation(program, "volume_lo");
+    v.hi =              glGetUniformLocation(program, "volume_hi");
+    v.brick_extent =    glGetUniformLocation(program, "volume_brick_extent");
+    v.brick_size =      glGetUniformLocation(program, "volume_brick_size");
+    v.bricks =          glGetUniformLocation(program, "volume_bricks");
+    v.atlas =           glGetUniformLocation(program, "volume_atlas");
+    v.band =            glGetUniformLocation(program, "volume_band");
+    v.index =           glGetUniformLocation(program, "volume_index");
+    v.coarse =          glGetUniformLocation(program, "volume_coarse");
+    v.voxels =          glGetUniformLocation(program, "volume_voxels");
+
+    // Only the samplers; the rest of what changes per pass is PassBlock.
+    loc->prepass.texture = glGetUniformLocation(program, "scene_prepass");
+    loc->temporal.history = glGetUniformLocation(program, "temporal_history");
+    loc->antialias.color = glGetUniformLocation(program, "antialias_color");
+    loc->shadow.cache = glGetUniformLocation(program, "shadow_cache");
+    loc->resolve.history = glGetUniformLocation(program, "temporal_history");
+
+    auto& c = loc->reconstruct;
+    c.current =         glGetUniformLocation(program, "interleave_current");
+    c.previous =        glGetUniformLocation(program, "interleave_previous");
+    c.mode =            glGetUniformLocation(program, "interleave_mode");
+    c.phase =           glGetUniformLocation(program, "interleave_phase");
+    c.still =           glGetUniformLocation(program, "interleave_still");
+    c.viewport =        glGetUniformLocation(program, "interleave_viewport");
+
+    auto& e = loc->edges;
+    e.color =           glGetUniformLocation(program, "antialias_color");
+    e.surface =         glGetUniformLocation(program, "antialias_surface");
+
+    loc->heatmap.costs = glGetUniformLocation(program, "heatmap_costs");
+    loc->position =     glGetAttribLocation(program, "position");
 }
 
 void RayMarchScene::Draw() {
-    camera_.Update();
-    glUniform2f(loc_.resolution, width_, height_);
-    glUniform1f(loc_.aspect_ratio, aspect_ratio_);
-    glUniform1f(loc_.epsilon, epsilon_);
-    glUniform1i(loc_.steps, steps_);
-    glUniform4fv(loc_.sky_color, 1, glm::value_ptr(sky_color_));
-    glUniform4fv(loc_.ambient, 1, glm::value_ptr(ambient_));
-    glUniform3fv(loc_.light0pos, 1, glm::value_ptr(light0pos_));
-    glUniform4fv(loc_.light0col, 1, glm::value_ptr(light0col_));
-    glUniform1i(loc_.op, op_);
-
-    GLfloat vertices[] = {
-        -1.0f, -1.0f,
-        -1.0f,  1.0f,
-         1.0f, -1.0f,
-         1.0f,  1.0f,
-    };
-    glBindVertexArray(vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(loc_.position);
-    glVertexAttribPointer(loc_.position, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    Profiler::Scope draw("raymarch");
+    UpdateVolume();
+    SwapReloaded();
+    SelectOpProgram();
+    glGetIntegerv(GL_VIEWPORT, viewport_);
+    UpdateUniforms();
+    pass_stats_.resize(levels_.size() + 1);
+    ReadTimers();
+    timing_ = GLEW_ARB_timer_query && timed_passes_ == 0;
+
+    if (temporal_ || sampling_ != kFullRate) {
+        CheckHistory();
+    }
+
+    prepass_input_ = nullptr;
+    if (prepass_factor_ > 0 && !HistoryConverged()) {
+        Profiler::Scope scope("prepass");
+        if (DrawPrepass()) {
+            prepass_input_ = &levels_.back();
+        }
+    }
+
+    {
+        Profiler::Scope scope("march");
+        BeginPass(levels_.size());
+        shadow_factor_ = 0;
+        if (ShadowCache() && !HistoryConverged()) {
+            DrawShadowCache();
+        }
+        // The volume is already cheaper than any pruned scene.
+        if (temporal_) {
+            DrawTemporal();
+        } else if (sampling_ != kFullRate) {
+            DrawInterleaved();
+        } else if (antialias_samples_ > 1) {
+            DrawAntialiased();
+        } else if (prune_tiles_ > 0 && scene_ && !volume_) {
+            DrawTiles();
+        } else {
+            DrawQuad(loc_);
+        }
+        EndPass();
+    }
+    if (timing_) {
+        timed_passes_ = levels_.size() + 1;
+    }
+
+    MarchPassStats& full = pass_stats_.back();
+    full.factor = 1;
+    full.width = viewport_[2];
+    full.height = viewport_[3];
+    full.steps = -1;
+    if (collect_stats_ || heatmap_) {
+        Profiler::Scope scope("collect stats");
+        CollectSteps();
+    }
+    if (heatmap_) {
+        DrawHeatmap();
+    }
+    if (own_ring_) {
+        ring_->EndFrame();
+    }
+}
+
+// A box containing every point a primary ray through tile (tx, ty) can
+// reach before passing camera.far.  A ray's direction is
+// normalize(forward*focal + right*u*aspect + up*v), and the unnormalized
+// vector is never shorter than focal, so every such point lies in the
+// pyramid from the eye to the tile's corners scaled by far/focal.  The
+// tile is padded by a pixel on every side, which covers the temporal
+// jitter and antialiasing offsets of up to half a pixel and the rounding
+// of the tile to whole pixels.
+sdf::Bounds RayMarchScene::TileBounds(int tx, int ty) const {
+    const Camera& c = camera_;
+    float scale = c.far / c.focal_length;
+    glm::vec2 pad(2.0f / width_, 2.0f / height_);
+    sdf::Bounds b{c.eye, c.eye};
+    for(int corner = 0; corner < 4; ++corner) {
+        float su = corner & 1 ? 1.0f : -1.0f;
+        float sv = corner >> 1 ? 1.0f : -1.0f;
+        float u = -1.0f + 2.0f * float(tx + (corner & 1)) / prune_tiles_ +
+                  su * pad.x;
+        float v = -1.0f + 2.0f * float(ty + (corner >> 1)) / prune_tiles_ +
+                  sv * pad.y;
+        glm::vec3 w = c.forward * c.focal_length +
+                      c.right * u * aspect_ratio_ + c.up * v;
+        b.Extend(c.eye + w * scale);
+    }
+    return b;
+}
+
+// Prune the scene to each tile, unless nothing the tiles depend on has
+// changed since they were last pruned.
+void RayMarchScene::PruneTiles() {
+    const Camera& c = camera_;
+    CameraUniforms camera{c.up, c.focal_length, c.right, c.near,
+                          c.forward, c.far, c.eye, 0.0f};
+    size_t tiles = size_t(prune_tiles_) * prune_tiles_;
+    if (tile_scenes_.size() == tiles && tile_scene_ == scene_ &&
+        tile_width_ == width_ && tile_height_ == height_ &&
+        memcmp(&camera, &tile_camera_, sizeof(camera)) == 0) {
+        return;
+    }
+    tile_scenes_.clear();
+    for(int ty = 0; ty < prune_tiles_; ++ty) {
+        for(int tx = 0; tx < prune_tiles_; ++tx) {
+            tile_scenes_.push_back(sdf::Prune(scene_, TileBounds(tx, ty)));
+        }
+    }
+    tile_camera_ = camera;
+    tile_scene_ = scene_;
+    tile_width_ = width_;
+    tile_height_ = height_;
+}
+
+// The program for a pruned scene, or null to use the unpruned program.
+// With a reloader, variants are built in the background and the tile is
+// drawn unpruned until they're ready.
+RayMarchScene::Variant* RayMarchScene::GetVariant(
+        const sdf::NodeRef& pruned) {
+    if (sdf::Node::Equal(pruned, scene_)) {
+        return nullptr;
+    }
+    auto& v = variants_[pruned->Hash()];
+    if (v && sdf::Node::Equal(v->pruned, pruned)) {
+        return v->shader ? v.get() : nullptr;
+    }
+    if (v && reloader_) {
+        reloader_->Unwatch(this, v->slot);
+        building_.erase(v->slot);
+    }
+    v.reset(new Variant);
+    v->pruned = pruned;
+    v->slot = kFirstVariantSlot + next_variant_slot_++;
+    if (reloader_) {
+        RequestProgram(v->slot);
+        return nullptr;
+    }
+    ShaderReloader::Source source = ProgramSource(v->slot);
+    v->shader = Shader::Load(source.vs, source.fs, "", source.includes,
+                             source.defines);
+    if (!v->shader) {
+        // Draw the tile with the unpruned program.
+        variants_.erase(pruned->Hash());
+        return nullptr;
+    }
+    GetLocations(v->shader->program(), &v->loc);
+    return v.get();
+}
+
+void RayMarchScene::DrawTiles() {
+    if (variants_.size() > kMaxVariants) {
+        ClearVariants();
+    }
+    PruneTiles();
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glEnable(GL_SCISSOR_TEST);
+    int n = prune_tiles_;
+    for(int ty = 0; ty < n; ++ty) {
+        int y0 = viewport[1] + viewport[3] * ty / n;
+        int y1 = viewport[1] + viewport[3] * (ty + 1) / n;
+        for(int tx = 0; tx < n; ++tx) {
+            int x0 = viewport[0] + viewport[2] * tx / n;
+            int x1 = viewport[0] + viewport[2] * (tx + 1) / n;
+            Variant* v = GetVariant(tile_scenes_[ty * n + tx]);
+            Shader* shader = v ? v->shader.get() : shader_.get();
+            shader->Use();
+            glScissor(x0, y0, x1 - x0, y1 - y0);
+            DrawQuad(v ? v->loc : loc_);
+        }
+    }
+    glDisable(GL_SCISSOR_TEST);
+    InitProgram();
+}
+
+void RayMarchScene::set_prepass(int factor, int levels) {
+    prepass_factor_ = factor;
+    prepass_levels_ = factor > 0 ? std::max(levels, 1) : 0;
+    // Every level halves the factor, and needs a factor of at least 2.
+    while (prepass_levels_ > 1 && (factor >> (prepass_levels_ - 1)) < 2) {
+        --prepass_levels_;
+    }
+    if (factor == 0) {
+        ResizePrepass(0, 0);
+    }
+}
+
+void RayMarchScene::ResizePrepass(int width, int height) {
+    size_t levels = width > 0 ? prepass_levels_ : 0;
+    for(size_t i = 0; i < levels_.size(); ++i) {
+        const PrepassLevel& level = levels_[i];
+        int f = prepass_factor_ >> i;
+        if (i >= levels || level.factor != f ||
+            level.width != (width + f - 1) / f ||
+            level.height != (height + f - 1) / f) {
+            for(size_t j = i; j < levels_.size(); ++j) {
+                glDeleteFramebuffers(1, &levels_[j].fbo);
+                glDeleteTextures(1, &levels_[j].texture);
+            }
+            levels_.resize(i);
+            break;
+        }
+    }
+    while (levels_.size() < levels) {
+        PrepassLevel level;
+        level.factor = prepass_factor_ >> levels_.size();
+        level.width = (width + level.factor - 1) / level.factor;
+        level.height = (height + level.factor - 1) / level.factor;
+        glGenTextures(1, &level.texture);
+        glBindTexture(GL_TEXTURE_2D, level.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, level.width, level.height,
+                     0, GL_RG, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &level.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, level.texture, 0);
+        levels_.push_back(level);
+    }
+}
+
+// Cone march every prepass level into its own framebuffer, each level
+// starting from the one before.  Leaves the main program bound.
+bool RayMarchScene::DrawPrepass() {
+    if (!cone_ && reloader_) {
+        // March from the near plane until it's built.
+        RequestProgram(SceneSlot(program_op_, kConeProgram));
+        return false;
+    }
+    if (!cone_) {
+        cone_ = Shader::Load(vs_, kConeMarchShader, "", includes_, defines_);
+        if (!cone_) {
+            LOG(ERROR, "Disabling the depth prepass");
+            set_prepass(0);
+            return false;
+        }
+        GetLocations(cone_->program(), &cone_loc_);
+        WatchProgram(SceneSlot(program_op_, kConeProgram));
+    }
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    ResizePrepass(viewport_[2], viewport_[3]);
+    pass_stats_.resize(levels_.size() + 1);
+
+    cone_->Use();
+    prepass_input_ = nullptr;
+    for(size_t i = 0; i < levels_.size(); ++i) {
+        const PrepassLevel& level = levels_[i];
+        BeginPass(i);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glViewport(0, 0, level.width, level.height);
+        cone_factor_ = level.factor;
+        DrawQuad(cone_loc_);
+        EndPass();
+        prepass_input_ = &level;
+
+        MarchPassStats& stats = pass_stats_[i];
+        stats.factor = level.factor;
+        stats.width = level.width;
+        stats.height = level.height;
+        stats.steps = -1;
+    }
+    cone_factor_ = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+    InitProgram();
+    return true;
+}
+
+void RayMarchScene::ResizeShadowCache(int width, int height) {
+    if (width == shadow_width_ && height == shadow_height_) {
+        return;
+    }
+    if (!shadow_fbo_) {
+        glGenTextures(1, &shadow_texture_);
+        glGenFramebuffers(1, &shadow_fbo_);
+    }
+    glBindTexture(GL_TEXTURE_2D, shadow_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG,
+                 GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, shadow_texture_, 0);
+    shadow_width_ = width;
+    shadow_height_ = height;
+}
+
+// Draw the shadow cache at 1/factor resolution with the main program,
+// which marches each texel's ray from the eye, without the prepass, and
+// writes the visibility and depth of what it hit.  Every pass drawn after
+// it this frame looks shadows up in it.
+void RayMarchScene::DrawShadowCache() {
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    int f = shadows_.cache;
+    ResizeShadowCache((viewport_[2] + f - 1) / f, (viewport_[3] + f - 1) / f);
+
+    const PrepassLevel* prepass = prepass_input_;
+    prepass_input_ = nullptr;
+    glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo_);
+    glViewport(0, 0, shadow_width_, shadow_height_);
+    shadow_pass_ = f;
+    DrawQuad(loc_);
+    shadow_pass_ = 0;
+    prepass_input_ = prepass;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+    shadow_factor_ = f;
+}
+
+// Read back the step counts.  The cone steps are in the prepass levels;
+// the full pass is drawn again with the main program writing its step
+// counts instead of the color, which the heatmap draws from.  The
+// readbacks go through a ring of pixel buffers and are collected once
+// their fences pass, so the render thread never waits for the GPU.  A
+// frame drawn while every buffer is in flight isn't read back.
+void RayMarchScene::CollectSteps() {
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    CollectReadbacks(false);
+
+    int width = viewport_[2], height = viewport_[3];
+    if (!steps_texture_) {
+        glGenTextures(1, &steps_texture_);
+        glGenFramebuffers(1, &steps_fbo_);
+        glBindTexture(GL_TEXTURE_2D, steps_texture_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    if (width != steps_width_ || height != steps_height_) {
+        glBindTexture(GL_TEXTURE_2D, steps_texture_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
+                     GL_FLOAT, nullptr);
+        glBindFramebuffer(GL_FRAMEBUFFER, steps_fbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, steps_texture_, 0);
+        steps_width_ = width;
+        steps_height_ = height;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, steps_fbo_);
+
+    GLint viewport[4] = {viewport_[0], viewport_[1], width, height};
+    viewport_[0] = viewport_[1] = 0;
+    glViewport(0, 0, width, height);
+    output_steps_ = true;
+    DrawQuad(loc_);
+    output_steps_ = false;
+
+    if (readbacks_.empty()) {
+        readbacks_.resize(kStepsReadbacks);
+    }
+    if (readback_pending_ < int(readbacks_.size())) {
+        StepsReadback& r = readbacks_[readback_head_];
+        r.passes.clear();
+        GLsizeiptr size = 0;
+        for(const PrepassLevel& level : levels_) {
+            r.passes.emplace_back(level.width, level.height);
+            size += GLsizeiptr(level.width) * level.height * 2 * sizeof(float);
+        }
+        r.passes.emplace_back(width, height);
+        size += GLsizeiptr(width) * height * 4 * sizeof(float);
+        if (!r.buffer) {
+            glGenBuffers(1, &r.buffer);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+        if (r.size < size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            r.size = size;
+        }
+        GLintptr offset = 0;
+        for(const PrepassLevel& level : levels_) {
+            glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+            glReadPixels(0, 0, level.width, level.height, GL_RG, GL_FLOAT,
+                         reinterpret_cast<void*>(offset));
+            offset += GLintptr(level.width) * level.height * 2 * sizeof(float);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, steps_fbo_);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT,
+                     reinterpret_cast<void*>(offset));
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        r.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback_head_ = (readback_head_ + 1) % readbacks_.size();
+        ++readback_pending_;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    memcpy(viewport_, viewport, sizeof(viewport_));
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+}
+
+// Collect the readbacks whose fences have passed, oldest first, or wait
+// for all of them.  The newest fills in cost_ and the step counts of the
+// passes, if the frame has the same passes.
+void RayMarchScene::CollectReadbacks(bool wait) {
+    const int depth = readbacks_.size();
+    while (readback_pending_ > 0) {
+        StepsReadback& r =
+            readbacks_[(readback_head_ - readback_pending_ + depth) % depth];
+        // The first check flushes the fence, so it signals even if
+        // nothing else flushes the context.
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        GLenum status;
+        while ((status = glClientWaitSync(r.sync, flags, wait ? 1000000 : 0))
+               == GL_TIMEOUT_EXPIRED && wait) {
+            flags = 0;
+        }
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(r.sync);
+        r.sync = nullptr;
+        --readback_pending_;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+        const float* data = static_cast<const float*>(
+                glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, r.size,
+                                 GL_MAP_READ_BIT));
+        if (data) {
+            collected_steps_.assign(r.passes.size(), -1.0);
+            for(size_t i = 0; i + 1 < r.passes.size(); ++i) {
+                size_t n = size_t(r.passes[i].x) * r.passes[i].y;
+                double steps = 0;
+                for(size_t j = 0; j < n; ++j) {
+                    steps += data[j * 2 + 1];
+                }
+                collected_steps_[i] = steps / std::max(n, size_t(1));
+                data += n * 2;
+            }
+            // The rows come back bottom up.
+            int width = r.passes.back().x, height = r.passes.back().y;
+            cost_.Reset(width, height);
+            for(int y = 0; y < height; ++y) {
+                const float* row = &data[size_t(height - 1 - y) * width * 4];
+                for(int x = 0; x < width; ++x) {
+                    for(int c = 0; c < MarchCostMap::kCounters; ++c) {
+                        cost_.counts[c][y * width + x] = row[x * 4 + c];
+                    }
+                }
+            }
+            double steps = 0;
+            for(float s : cost_.counts[MarchCostMap::kMarchSteps]) {
+                steps += s;
+            }
+            collected_steps_.back() =
+                steps / std::max(size_t(width) * height, size_t(1));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if (collected_steps_.size() == pass_stats_.size()) {
+        for(size_t i = 0; i < pass_stats_.size(); ++i) {
+            pass_stats_[i].steps = collected_steps_[i];
+        }
+    }
+}
+
+void RayMarchScene::FlushStats() {
+    CollectReadbacks(true);
+}
+
+// Blend the false color of the counter CollectSteps just read back over
+// the frame.  Only the color is blended; the frame's alpha is kept.
+void RayMarchScene::DrawHeatmap() {
+    if (!overlay_ && reloader_) {
+        // Leave the frame alone until it's built.
+        RequestProgram(kHeatmapSlot);
+        return;
+    }
+    if (!overlay_) {
+        overlay_ = Shader::Load(vs_, kHeatmapShader, "");
+        if (!overlay_) {
+            LOG(ERROR, "Disabling the heatmap");
+            heatmap_ = false;
+            InitProgram();
+            return;
+        }
+        GetLocations(overlay_->program(), &overlay_loc_);
+        WatchProgram(kHeatmapSlot);
+    }
+    overlay_->Use();
+    glActiveTexture(GL_TEXTURE0 + kHeatmapUnit);
+    glBindTexture(GL_TEXTURE_2D, steps_texture_);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(overlay_loc_.heatmap.costs, kHeatmapUnit);
+    BindPass();
+    GLboolean blend = glIsEnabled(GL_BLEND);
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+    geometry_.DrawFullscreen(-1);
+    if (!blend) {
+        glDisable(GL_BLEND);
+    }
+    InitProgram();
+}
+
+// Each pass is timed with a GL_TIME_ELAPSED query.  The results are
+// read at the start of a later frame, once they're ready, so reading
+// them never stalls.  Frames drawn while results are outstanding aren't
+// timed.
+void RayMarchScene::BeginPass(int pass) {
+    if (!timing_) {
+        return;
+    }
+    while (queries_.size() <= size_t(pass)) {
+        GLuint query;
+        glGenQueries(1, &query);
+        queries_.push_back(query);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, queries_[pass]);
+}
+
+void RayMarchScene::EndPass() {
+    if (timing_) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+void RayMarchScene::ReadTimers() {
+    if (!timed_passes_) {
+        return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(queries_[timed_passes_ - 1],
+                       GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    for(int i = 0; i < timed_passes_; ++i) {
+        GLuint64 ns;
+        glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &ns);
+        // The full pass is always timed last.
+        if (i + 1 == timed_passes_) {
+            pass_stats_.back().ms = double(ns) / 1e6;
+        } else if (size_t(i) + 1 < pass_stats_.size()) {
+            pass_stats_[i].ms = double(ns) / 1e6;
+        }
+    }
+    timed_passes_ = 0;
+}
+
+void RayMarchScene::set_temporal(bool enable, int max_samples, int refresh) {
+    temporal_ = enable;
+    temporal_max_samples_ = std::max(max_samples, 1);
+    temporal_refresh_ = std::max(refresh, 0);
+    history_valid_ = false;
+}
+
+void RayMarchScene::ResizeHistory(int width, int height) {
+    if (width == history_width_ && height == history_height_) {
+        return;
+    }
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    if (!history_depth_) {
+        glGenRenderbuffers(1, &history_depth_);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, history_depth_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width,
+                          height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    for(History& history : history_) {
+        if (!history.fbo) {
+            glGenTextures(1, &history.texture);
+            glGenFramebuffers(1, &history.fbo);
+        }
+        glBindTexture(GL_TEXTURE_2D, history.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // The depths need full floats.
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0,
+                     GL_RGBA, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, history.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, history.texture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                  GL_RENDERBUFFER, history_depth_);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    history_width_ = width;
+    history_height_ = height;
+    history_valid_ = false;
+}
+
+// Drop the history if it can't be reused, and see whether the camera has
+// moved since it was drawn.
+void RayMarchScene::CheckHistory() {
+    if (temporal_) {
+        ResizeHistory(viewport_[2], viewport_[3]);
+    }
+    const Camera& c = camera_;
+    CameraUniforms camera{c.up, c.focal_length, c.right, c.near, c.forward,
+                          c.far, c.eye, 0.0f};
+    const CameraUniforms& last = history_camera_;
+    if (camera.focal_length != last.focal_length ||
+        camera.near != last.near || camera.far != last.far ||
+        memcmp(&scene_uniforms_, &history_scene_, sizeof(SceneUniforms))) {
+        history_valid_ = false;
+    }
+    history_still_ = history_valid_ &&
+                     memcmp(&camera, &last, sizeof(camera)) == 0;
+}
+
+// Whether the history has all the samples it will get, so the frame is
+// just the history.
+bool RayMarchScene::HistoryConverged() const {
+    return temporal_ && history_still_ &&
+           history_samples_ >= temporal_max_samples_;
+}
+
+// Draw the full resolution pass into the next history from the last one,
+// and copy it to the framebuffer.  While the camera moves, reproject_
+// first fills the pixels the last history can supply and marks them in
+// the depth buffer, and the march is drawn with a depth test that only
+// passes for the rest, so early depth testing skips reused pixels
+// instead of the march branching around them.
+void RayMarchScene::DrawTemporal() {
+    if (!resolve_ && reloader_) {
+        // Draw plain frames until it's built.
+        RequestProgram(kResolveSlot);
+        history_valid_ = false;
+        DrawQuad(loc_);
+        return;
+    }
+    if (!resolve_) {
+        resolve_ = Shader::Load(vs_, kResolveShader, "");
+        if (!resolve_) {
+            LOG(ERROR, "Disabling temporal reprojection");
+            temporal_ = false;
+            DrawQuad(loc_);
+            return;
+        }
+        GetLocations(resolve_->program(), &resolve_loc_);
+        WatchProgram(kResolveSlot);
+        InitProgram();
+    }
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    if (HistoryConverged()) {
+        ResolveHistory(history_[history_index_]);
+        return;
+    }
+    bool still = history_still_;
+    bool reproject = history_valid_ && !still && prepass_input_;
+    if (reproject && !reproject_ && reloader_) {
+        // March every pixel until it's built.
+        RequestProgram(SceneSlot(program_op_, kReprojectProgram));
+        reproject = false;
+    }
+    if (reproject && !reproject_) {
+        reproject_ = Shader::Load(vs_, kReprojectShader, "", includes_,
+                                  defines_);
+        if (!reproject_) {
+            LOG(ERROR, "Disabling temporal reprojection");
+            temporal_ = false;
+            InitProgram();
+            DrawQuad(loc_);
+            return;
+        }
+        GetLocations(reproject_->program(), &reproject_loc_);
+        WatchProgram(SceneSlot(program_op_, kReprojectProgram));
+        InitProgram();
+    }
+    temporal_jitter_ = glm::vec2(0.0f);
+    if (still) {
+        temporal_jitter_ = glm::vec2(Halton(history_samples_, 2),
+                                     Halton(history_samples_, 3)) - 0.5f;
+    }
+    glActiveTexture(GL_TEXTURE0 + kHistoryUnit);
+    glBindTexture(GL_TEXTURE_2D, history_[history_index_].texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    const History& next = history_[1 - history_index_];
+    GLint viewport[4];
+    memcpy(viewport, viewport_, sizeof(viewport));
+    glBindFramebuffer(GL_FRAMEBUFFER, next.fbo);
+    glViewport(0, 0, history_width_, history_height_);
+    viewport_[0] = viewport_[1] = 0;
+    if (reproject) {
+        // The quad's depth is 0.5.  Reused pixels keep it, and the march
+        // only passes where the clear value is left.
+        glClearDepth(1.0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_ALWAYS);
+        reproject_->Use();
+        temporal_mode_ = kTemporalMarch;
+        DrawQuad(reproject_loc_);
+        InitProgram();
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_FALSE);
+    }
+    temporal_mode_ = still ? kTemporalAccumulate : kTemporalMarch;
+    if (prune_tiles_ > 0 && scene_ && !volume_) {
+        DrawTiles();
+    } else {
+        DrawQuad(loc_);
+    }
+    if (reproject) {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_DEPTH_TEST);
+    }
+    temporal_mode_ = kTemporalOff;
+    temporal_jitter_ = glm::vec2(0.0f);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    memcpy(viewport_, viewport, sizeof(viewport_));
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+
+    history_index_ = 1 - history_index_;
+    history_samples_ = still ? history_samples_ + 1 : 1;
+    history_valid_ = true;
+    history_still_ = true;
+    const Camera& c = camera_;
+    history_camera_ = CameraUniforms{c.up, c.focal_length, c.right, c.near,
+                                     c.forward, c.far, c.eye, 0.0f};
+    history_scene_ = scene_uniforms_;
+    ++temporal_frame_;
+    ResolveHistory(next);
+}
+
+void RayMarchScene::ResolveHistory(const History& history) {
+    resolve_->Use();
+    glActiveTexture(GL_TEXTURE0 + kHistoryUnit);
+    glBindTexture(GL_TEXTURE_2D, history.texture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(resolve_loc_.resolve.history, kHistoryUnit);
+    BindPass();
+    geometry_.DrawFullscreen(-1);
+    InitProgram();
+}
+
+void RayMarchScene::set_sampling(Sampling sampling) {
+    sampling_ = sampling;
+    history_valid_ = false;
+}
+
+// Size the interleaved passes for a width x height frame.
+void RayMarchScene::ResizeInterleave(int width, int height) {
+    if (sampling_ == kCheckerboard) {
+        width = (width + 1) / 2;
+    } else {
+        height = (height + 1) / 2;
+    }
+    if (width == interleave_width_ && height == interleave_height_) {
+        return;
+    }
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    for(History& pass : interleave_) {
+        if (!pass.fbo) {
+            glGenTextures(1, &pass.texture);
+            glGenFramebuffers(1, &pass.fbo);
+        }
+        glBindTexture(GL_TEXTURE_2D, pass.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, pass.texture, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    interleave_width_ = width;
+    interleave_height_ = height;
+    history_valid_ = false;
+}
+
+// March this frame's half of the pixels into the next interleaved pass,
+// then reconstruct the frame from it and the last pass.  The passes'
+// phases alternate, so between them they hold every pixel.
+void RayMarchScene::DrawInterleaved() {
+    if (!reconstruct_ && reloader_) {
+        // March every pixel until it's built.
+        RequestProgram(kInterleaveSlot);
+        history_valid_ = false;
+        DrawQuad(loc_);
+        return;
+    }
+    if (!reconstruct_) {
+        reconstruct_ = Shader::Load(vs_, kInterleaveShader, "");
+        if (!reconstruct_) {
+            LOG(ERROR, "Disabling interleaved sampling");
+            sampling_ = kFullRate;
+            DrawQuad(loc_);
+            return;
+        }
+        GetLocations(reconstruct_->program(), &reconstruct_loc_);
+        WatchProgram(kInterleaveSlot);
+        InitProgram();
+    }
+    ResizeInterleave(viewport_[2], viewport_[3]);
+    int phase = 1 - interleave_phase_;
+    const History& next = interleave_[1 - interleave_index_];
+    const History& last = interleave_[interleave_index_];
+
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    GLint viewport[4];
+    memcpy(viewport, viewport_, sizeof(viewport));
+    glBindFramebuffer(GL_FRAMEBUFFER, next.fbo);
+    glViewport(0, 0, interleave_width_, interleave_height_);
+    viewport_[0] = viewport_[1] = 0;
+    interleave_mode_ = sampling_;
+    interleave_phase_ = phase;
+    DrawQuad(loc_);
+    interleave_mode_ = kFullRate;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    memcpy(viewport_, viewport, sizeof(viewport_));
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+
+    reconstruct_->Use();
+    glActiveTexture(GL_TEXTURE0 + kInterleaveUnit);
+    glBindTexture(GL_TEXTURE_2D, next.texture);
+    glActiveTexture(GL_TEXTURE0 + kInterleaveUnit + 1);
+    glBindTexture(GL_TEXTURE_2D, last.texture);
+    glActiveTexture(GL_TEXTURE0);
+    const auto& r = reconstruct_loc_.reconstruct;
+    glUniform1i(r.current, kInterleaveUnit);
+    glUniform1i(r.previous, kInterleaveUnit + 1);
+    glUniform1i(r.mode, sampling_);
+    glUniform1i(r.phase, phase);
+    glUniform1i(r.still, history_valid_ && history_still_);
+    glUniform4f(r.viewport, viewport_[0], viewport_[1], viewport_[2],
+                viewport_[3]);
+    geometry_.DrawFullscreen(-1);
+    InitProgram();
+
+    interleave_index_ = 1 - interleave_index_;
+    history_valid_ = true;
+    const Camera& c = camera_;
+    history_camera_ = CameraUniforms{c.up, c.focal_length, c.right, c.near,
+                                     c.forward, c.far, c.eye, 0.0f};
+    history_scene_ = scene_uniforms_;
+}
+
+void RayMarchScene::set_antialias(int samples) {
+    antialias_samples_ = glm::clamp(samples, 0, kMaxAntialiasSamples);
+    antialias_refined_ = 0.0;
+}
+
+// Size the antialiasing targets for a width x height frame.
+void RayMarchScene::ResizeAntialias(int width, int height) {
+    if (width == antialias_width_ && height == antialias_height_) {
+        return;
+    }
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    if (!antialias_fbo_[0]) {
+        glGenFramebuffers(2, antialias_fbo_);
+        glGenTextures(3, antialias_texture_);
+        glGenRenderbuffers(1, &antialias_depth_);
+    }
+    // The surfaces hold normals and depths out to camera.far.
+    const GLint formats[] = {GL_RGBA8, GL_RGBA16F, GL_RGBA8};
+    for(int i = 0; i < 3; ++i) {
+        glBindTexture(GL_TEXTURE_2D, antialias_texture_[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, antialias_depth_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width,
+                          height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias_fbo_[0]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, antialias_texture_[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D, antialias_texture_[1], 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias_fbo_[1]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, antialias_texture_[2], 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, antialias_depth_);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    antialias_width_ = width;
+    antialias_height_ = height;
+}
+
+// March a sample per pixel, along with its surface, into
+// antialias_fbo_[0].  edges_ copies the colors to antialias_fbo_[1] and
+// marks the pixels to refine in its depth buffer, and the depth tested
+// march adds the remaining samples to them.  Then the frame is copied to
+// the caller's framebuffer.
+void RayMarchScene::DrawAntialiased() {
+    if ((!edges_ || !resolve_) && reloader_) {
+        // Draw a sample per pixel until they're built.
+        if (!edges_) {
+            RequestProgram(kEdgesSlot);
+        }
+        if (!resolve_) {
+            RequestProgram(kResolveSlot);
+        }
+        DrawQuad(loc_);
+        return;
+    }
+    if (!edges_ || !resolve_) {
+        edges_ = Shader::Load(vs_, kEdgesShader, "");
+        if (!resolve_) {
+            resolve_ = Shader::Load(vs_, kResolveShader, "");
+        }
+        if (!edges_ || !resolve_) {
+            LOG(ERROR, "Disabling antialiasing");
+            antialias_samples_ = 0;
+            InitProgram();
+            DrawQuad(loc_);
+            return;
+        }
+        GetLocations(edges_->program(), &edges_loc_);
+        GetLocations(resolve_->program(), &resolve_loc_);
+        WatchProgram(kEdgesSlot);
+        WatchProgram(kResolveSlot);
+        InitProgram();
+    }
+    // Count the refined pixels unless the last count is outstanding.
+    if (!antialias_query_) {
+        glGenQueries(1, &antialias_query_);
+    }
+    if (antialias_pixels_) {
+        GLint available = 0;
+        glGetQueryObjectiv(antialias_query_, GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (available) {
+            GLuint refined;
+            glGetQueryObjectuiv(antialias_query_, GL_QUERY_RESULT, &refined);
+            antialias_refined_ = double(refined) / antialias_pixels_;
+            antialias_pixels_ = 0;
+        }
+    }
+    bool count = antialias_pixels_ == 0;
+
+    int width = viewport_[2], height = viewport_[3];
+    ResizeAntialias(width, height);
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    GLint viewport[4];
+    memcpy(viewport, viewport_, sizeof(viewport));
+    glViewport(0, 0, width, height);
+    viewport_[0] = viewport_[1] = 0;
+
+    // The surface output's location is up to the linker.
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias_fbo_[0]);
+    GLint surface = glGetFragDataLocation(shader_->program(), "outSurface");
+    std::vector<GLenum> buffers(std::max(surface + 1, 1), GL_NONE);
+    buffers[0] = GL_COLOR_ATTACHMENT0;
+    if (surface > 0) {
+        buffers[surface] = GL_COLOR_ATTACHMENT1;
+    }
+    glDrawBuffers(buffers.size(), buffers.data());
+    DrawQuad(loc_);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias_fbo_[1]);
+    glActiveTexture(GL_TEXTURE0 + kAntialiasUnit);
+    glBindTexture(GL_TEXTURE_2D, antialias_texture_[0]);
+    glActiveTexture(GL_TEXTURE0 + kAntialiasUnit + 1);
+    glBindTexture(GL_TEXTURE_2D, antialias_texture_[1]);
+    glActiveTexture(GL_TEXTURE0);
+    edges_->Use();
+    glUniform1i(edges_loc_.edges.color, kAntialiasUnit);
+    glUniform1i(edges_loc_.edges.surface, kAntialiasUnit + 1);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    geometry_.DrawFullscreen(-1);
+    InitProgram();
+
+    // The quad's depth is 0.5, so only the pixels edges_ left at the far
+    // depth pass.
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_FALSE);
+    if (count) {
+        glBeginQuery(GL_SAMPLES_PASSED, antialias_query_);
+    }
+    antialias_pass_ = antialias_samples_ - 1;
+    DrawQuad(loc_);
+    antialias_pass_ = 0;
+    if (count) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        antialias_pixels_ = width * height;
+    }
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    memcpy(viewport_, viewport, sizeof(viewport_));
+    glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+    ResolveHistory(History{antialias_fbo_[1], antialias_texture_[2]});
+}
+
+void RayMarchScene::DrawQuad(const Locations& loc) {
+    if (volume_) {
+        BindVolume(loc);
+    }
+    BindPass();
+    if (antialias_pass_ > 0) {
+        glUniform1i(loc.antialias.color, kAntialiasUnit);
+    }
+    if (temporal_mode_ != kTemporalOff) {
+        glUniform1i(loc.temporal.history, kHistoryUnit);
+    }
+    if (prepass_input_) {
+        glActiveTexture(GL_TEXTURE0 + kPrepassUnit);
+        glBindTexture(GL_TEXTURE_2D, prepass_input_->texture);
+        glUniform1i(loc.prepass.texture, kPrepassUnit);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    if (shadow_factor_ > 0) {
+        glActiveTexture(GL_TEXTURE0 + kShadowCacheUnit);
+        glBindTexture(GL_TEXTURE_2D, shadow_texture_);
+        glUniform1i(loc.shadow.cache, kShadowCacheUnit);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    geometry_.DrawFullscreen(loc.position);
 }
 
 }  // namespace GFX
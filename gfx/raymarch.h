@@ -1,13 +1,80 @@
 #ifndef RMX_GFX_RAYMARCH_H
 #define RMX_GFX_RAYMARCH_H
+#include <future>
+#include <map>
 #include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
 #include <GL/glew.h>
 #include "glm/glm.hpp"
 #include "gfx/camera.h"
+#include "gfx/geometry.h"
+#include "gfx/march_stats.h"
+#include "gfx/sdf.h"
+#include "gfx/sdf_interval.h"
+#include "gfx/sdf_volume.h"
 #include "gfx/shader.h"
+#include "gfx/shader_reloader.h"
+#include "gfx/shadow.h"
+#include "gfx/stepping.h"
+#include "gfx/uniform_ring.h"
 
 namespace GFX {
 
+// The scene's std140 uniform block, SceneBlock in content/uniforms.inc.
+struct SceneUniforms {
+    glm::vec4 sky_color;
+    glm::vec4 ambient;
+    glm::vec4 light0col;
+    glm::vec3 light0pos;
+    float epsilon;
+    glm::vec2 resolution;
+    float aspect_ratio;
+    int32_t steps;
+    int32_t op;
+    int32_t stepping;
+    float stretch;
+    float relaxation;
+    glm::vec3 shadow_lo;
+    float shadow_k;
+    glm::vec3 shadow_hi;
+    float shadow_threshold;
+    float shadow_min_step;
+    float shadow_max_step;
+    float shadow_cache_tolerance;
+    float pad;
+};
+static_assert(sizeof(SceneUniforms) == 144, "SceneUniforms isn't std140");
+
+// The std140 block of the values that change from one pass to the next,
+// PassBlock in content/uniforms.inc.  Each draw streams its own.
+struct PassUniforms {
+    glm::vec4 viewport;
+    int32_t prepass_factor;
+    int32_t cone_factor;
+    int32_t output_steps;
+    int32_t interleave;
+    int32_t interleave_phase;
+    int32_t temporal_mode;
+    glm::vec2 temporal_jitter;
+    int32_t temporal_samples;
+    int32_t temporal_refresh;
+    int32_t temporal_frame;
+    int32_t antialias_samples;
+    glm::vec3 temporal_eye;
+    int32_t shadow_cache_factor;
+    glm::vec3 temporal_forward;
+    int32_t shadow_cache_pass;
+    glm::vec3 temporal_right;
+    int32_t heatmap_counter;
+    glm::vec3 temporal_up;
+    float heatmap_range;
+    // Two offsets to an element.
+    glm::vec4 antialias_offsets[8];
+};
+static_assert(sizeof(PassUniforms) == 256, "PassUniforms isn't std140");
+
 class RayMarchScene {
   public:
     RayMarchScene(int width, int height)
@@ -20,15 +87,265 @@ class RayMarchScene {
         height_(height),
         aspect_ratio_(float(width)/float(height)),
         steps_(64),
-        epsilon_(0.001f)
+        epsilon_(0.001f),
+        stepping_{Stepping::kSphere, 1.6f, 1.0f},
+        shadow_lo_(-kUnbounded),
+        shadow_hi_(kUnbounded),
+        shadow_fbo_(0),
+        shadow_texture_(0),
+        shadow_width_(0),
+        shadow_height_(0),
+        shadow_factor_(0),
+        shadow_pass_(0),
+        prune_tiles_(0),
+        tile_camera_{},
+        tile_width_(0),
+        tile_height_(0),
+        specialize_op_(true),
+        program_op_(-1),
+        use_volume_(false),
+        volume_pending_(false),
+        volume_tex_{0, 0, 0},
+        prepass_factor_(0),
+        prepass_levels_(0),
+        prepass_input_(nullptr),
+        cone_factor_(0),
+        collect_stats_(false),
+        output_steps_(false),
+        steps_fbo_(0),
+        steps_texture_(0),
+        steps_width_(0),
+        steps_height_(0),
+        readback_head_(0),
+        readback_pending_(0),
+        cost_{},
+        heatmap_(false),
+        heatmap_counter_(MarchCostMap::kMarchSteps),
+        heatmap_range_(64.0f),
+        timing_(false),
+        timed_passes_(0),
+        temporal_(false),
+        temporal_max_samples_(16),
+        temporal_refresh_(8),
+        temporal_mode_(0),
+        temporal_jitter_(0.0f),
+        temporal_frame_(0),
+        history_{},
+        history_depth_(0),
+        history_index_(0),
+        history_width_(0),
+        history_height_(0),
+        history_valid_(false),
+        history_still_(false),
+        history_samples_(0),
+        history_camera_{},
+        history_scene_{},
+        sampling_(kFullRate),
+        interleave_{},
+        interleave_index_(0),
+        interleave_width_(0),
+        interleave_height_(0),
+        interleave_mode_(0),
+        interleave_phase_(0),
+        antialias_samples_(0),
+        antialias_fbo_{0, 0},
+        antialias_texture_{0, 0, 0},
+        antialias_depth_(0),
+        antialias_width_(0),
+        antialias_height_(0),
+        antialias_query_(0),
+        antialias_pixels_(0),
+        antialias_refined_(0.0),
+        antialias_pass_(0),
+        ring_(std::make_shared<UniformRing>()),
+        own_ring_(true),
+        scene_uniforms_{},
+        scene_block_{},
+        pass_uniforms_{},
+        pass_block_{},
+        next_variant_slot_(0)
     {}
+    ~RayMarchScene();
 
     bool LoadProgram(const std::string& vs, const std::string& fs);
     void Init();
     void Draw();
+    // Change the resolution and aspect ratio rays are cast for, e.g. when
+    // drawing into a DynamicResolution target.
+    void Resize(int width, int height);
+
+    // Replace the scene with GLSL generated from an sdf::Node tree.  A
+    // null scene restores the default scene from content/scene.inc.  The
+    // current program is kept if the new one fails to load.
+    bool SetScene(const sdf::NodeRef& scene);
+
+    // Build a program for each op_ as it's selected, with SCENE_OP
+    // defined so boolops.inc's switch is resolved at compile time, rather
+    // than switching on the scene_op uniform in every distance
+    // evaluation.  Programs are cached, so returning to an op is free.
+    // With set_reloader they're built in the background, and the scene_op
+    // uniform program is drawn until they're ready.  Only affects the
+    // default scene.
+    inline void set_specialize_op(bool s) { specialize_op_ = s; }
+    inline bool specialize_op() const { return specialize_op_; }
+
+    // Draw the screen as tiles x tiles regions, each with a program whose
+    // primary rays march the scene pruned to that tile's view frustum.
+    // Shadows and normals still use the whole scene.  Tiles are pruned
+    // again only when the camera or scene changes.  With set_reloader,
+    // tile programs are built in the background and the tile is drawn
+    // with the whole scene until they're ready.  Only applies to scenes
+    // set with SetScene; 0 draws the screen in one pass.
+    inline void set_prune_tiles(int tiles) { prune_tiles_ = tiles; }
+    inline int prune_tiles() const { return prune_tiles_; }
+    // The number of pruned programs compiled for the current scene.
+    inline int variants() const { return variants_.size(); }
+
+    // March primary rays through a BrickVolume baked from the scene and
+    // uploaded as 3D textures, instead of through the scene's GLSL.
+    // Shadows and normals still use the GLSL.  SetScene rebakes the
+    // volume in the background when the new scene's fingerprint differs
+    // from the baked one; the scene's GLSL is drawn until it's done, and
+    // with a reloader until the program that marches it is built too.
+    bool SetVolume(bool enable, const BrickVolume::Options& options={});
+    inline const BrickVolume* volume() const { return volume_.get(); }
+
+    // Cone march a low resolution depth prepass at 1/factor resolution,
+    // refined at half the factor for each further level, and start the
+    // full resolution march from the finest level's depth.  A factor of
+    // 0 disables the prepass.
+    void set_prepass(int factor, int levels=1);
+    inline int prepass_factor() const { return prepass_factor_; }
+
+    // Time each prepass level and the full resolution pass, in that
+    // order.  Times come from GPU timer queries and lag a frame behind.
+    // Step counts are only measured with collect_stats, which reads the
+    // passes back and renders the full pass a second time, so it is for
+    // profiling only.  The readbacks are collected once the GPU is done
+    // with them, so step counts lag a frame or two behind as well.
+    inline void set_collect_stats(bool c) { collect_stats_ = c; }
+    inline bool collect_stats() const { return collect_stats_; }
+    inline const std::vector<MarchPassStats>& pass_stats() const {
+        return pass_stats_;
+    }
+    // Wait for the step counts of the last frame drawn.
+    void FlushStats();
+    // With collect_stats, what each pixel cost in the second rendering
+    // of the full pass: one sample per pixel, marched from the prepass
+    // depth, whatever the sampling, antialiasing or temporal settings.
+    inline const MarchCostMap& cost_map() const { return cost_; }
+    // Blend a false-color map of one of cost_map()'s counters, red at
+    // range or more, over the frame.  Implies collect_stats.
+    inline void set_heatmap(bool enable,
+                            MarchCostMap::Counter counter=
+                                MarchCostMap::kMarchSteps,
+                            float range=64.0f) {
+        heatmap_ = enable;
+        heatmap_counter_ = counter;
+        heatmap_range_ = range;
+    }
+    inline bool heatmap() const { return heatmap_; }
+    inline MarchCostMap::Counter heatmap_counter() const {
+        return heatmap_counter_;
+    }
+    inline float heatmap_range() const { return heatmap_range_; }
+
+    // The most steps a primary ray takes, and the distance to a surface
+    // it stops at per unit it has travelled.
+    inline void set_steps(int steps) { steps_ = steps; }
+    inline int steps() const { return steps_; }
+    inline void set_epsilon(float epsilon) { epsilon_ = epsilon; }
+    inline float epsilon() const { return epsilon_; }
+    // How primary rays step, as SWMarcher::set_stepping.  The prepass
+    // still cone marches.
+    inline void set_stepping(const Stepping& s) { stepping_ = s; }
+    inline const Stepping& stepping() const { return stepping_; }
+
+    // How shadow rays are marched and cached, as SWMarcher::set_shadows.
+    // The bounds come from the scene's sdf::Node tree and are found on
+    // another thread; until they are, and always for the default scene,
+    // whose GLSL has no tree, shadows are unbounded.  The cache is drawn
+    // with the main program at the start of the full resolution pass, and
+    // is timed with it.  Turning the cache on or off rebuilds the
+    // programs.
+    void set_shadows(const ShadowOptions& options);
+    inline const ShadowOptions& shadows() const { return shadows_; }
+
+    // Keep each frame's color and depth for the next frame.  While the
+    // camera moves, pixels whose surface the previous frame saw keep its
+    // color instead of being marched and shaded again, and only pixels
+    // that were hidden or off screen are marched; a depth test rather
+    // than a branch skips the rest, so they cost nothing in the march.
+    // Reuse relies on the depth prepass to prove nothing new is in front
+    // of a surface, so without set_prepass every pixel is marched while
+    // the camera moves.
+    // While the camera is still, each frame adds a jittered sample to
+    // every pixel, antialiasing the image, until there are max_samples;
+    // then the history is shown without marching.  Every pixel is marched
+    // again at least every refresh frames, which bounds the error reused
+    // colors build up.  The history is dropped when the scene, its
+    // programs or the camera's lens change.
+    void set_temporal(bool enable, int max_samples=16, int refresh=8);
+    inline bool temporal() const { return temporal_; }
+    inline int temporal_max_samples() const { return temporal_max_samples_; }
+    inline int temporal_refresh() const { return temporal_refresh_; }
+    // The samples in each pixel of the history, 0 if there is none.
+    inline int temporal_samples() const {
+        return history_valid_ ? history_samples_ : 0;
+    }
+
+    // Which pixels are marched each frame.  With kCheckerboard, half the
+    // pixels are marched in a checker pattern that alternates every
+    // frame; kInterlaced marches every other row.  The pixels that
+    // weren't marched are interpolated from their marched neighbours
+    // while the camera moves, and taken from the previous frame, which
+    // marched them, while it's still, so a still image is exact.  Ignored
+    // while set_temporal is on, and tiles aren't pruned while
+    // interleaving.
+    enum Sampling { kFullRate, kCheckerboard, kInterlaced };
+    void set_sampling(Sampling sampling);
+    inline Sampling sampling() const { return sampling_; }
+
+    // Adaptive antialiasing.  Each pixel is marched once along with the
+    // depth and normal of what it hit; then only the pixels whose depth,
+    // normal or color differ from a neighbour's are marched samples - 1
+    // more times, with jittered rays.  A depth test rather than a branch
+    // skips the rest.  Up to kMaxAntialiasSamples; 1 or less disables
+    // it.  Ignored while set_temporal or set_sampling are on, and tiles
+    // aren't pruned while antialiasing.
+    static const int kMaxAntialiasSamples = 16;
+    void set_antialias(int samples);
+    inline int antialias() const { return antialias_samples_; }
+    // The fraction of pixels refined.  Like the timers, it lags a frame
+    // behind.
+    inline double antialias_refined() const { return antialias_refined_; }
 
     inline Camera* camera() { return &camera_; }
 
+    // The camera and scene parameters are uniform blocks streamed through
+    // a UniformRing, and only rewritten when they change.  Scenes drawn
+    // in the same frame can share a ring; the caller then calls the
+    // ring's EndFrame once per frame.  Otherwise each scene ends its own
+    // ring's frame after Draw.
+    inline void set_uniform_ring(std::shared_ptr<UniformRing> ring) {
+        ring_ = std::move(ring);
+        own_ring_ = false;
+        scene_block_ = {};
+        pass_block_ = {};
+    }
+    inline UniformRing* uniform_ring() const { return ring_.get(); }
+
+    // Rebuild the scene's programs in the background when any file they
+    // include changes, and swap them in at the start of the first Draw
+    // after they're ready.  Programs that fail to build are ignored.
+    // Every program the scene has built is watched: those for each op and
+    // pruned tile, and those of the temporal, interleaved, antialiasing
+    // and heatmap passes.  Draw never builds a program itself while there
+    // is a reloader: the first time a pass needs one, it's built in the
+    // background and the frame is drawn without the pass until it's
+    // ready.
+    void set_reloader(std::shared_ptr<ShaderReloader> reloader);
+
     glm::vec4 sky_color_;
     glm::vec4 ambient_;
     glm::vec3 light0pos_;
@@ -36,34 +353,314 @@ class RayMarchScene {
     int op_;
 
   private:
+    struct Locations;
+    struct Variant;
+    void InitProgram();
+    Variant* VariantAt(int slot);
+    std::unique_ptr<Shader>* ProgramAt(int slot);
+    ShaderReloader::Source ProgramSource(int slot);
+    void WatchProgram(int slot);
+    void WatchPrograms();
+    void RequestProgram(int slot);
+    void SwapReloaded();
+    void SwapScene(std::unique_ptr<Shader> p, int op,
+                   const std::map<std::string, std::string>& includes,
+                   std::shared_ptr<const BrickVolume> volume);
+    void ClearVariants();
+    int WantedOp(const sdf::NodeRef& scene) const;
+    std::map<std::string, std::string> Defines(int op) const;
+    void SelectOpProgram();
+    void UpdateUniforms();
+    void BindPass();
+    inline bool ShadowCache() const { return shadows_.cache > 1; }
+    void UpdateShadowBounds();
+    void DrawShadowCache();
+    void ResizeShadowCache(int width, int height);
+    static void GetLocations(GLuint program, Locations* loc);
+    void DrawQuad(const Locations& loc);
+    void DrawTiles();
+    sdf::Bounds TileBounds(int tx, int ty) const;
+    void PruneTiles();
+    Variant* GetVariant(const sdf::NodeRef& pruned);
+    bool UploadVolume(const BrickVolume& volume);
+    void UpdateVolume();
+    void SwapVolume(std::unique_ptr<Shader> p);
+    void BindVolume(const Locations& loc);
+    bool DrawPrepass();
+    void ResizePrepass(int width, int height);
+    void CollectSteps();
+    void CollectReadbacks(bool wait);
+    void DrawHeatmap();
+    void BeginPass(int pass);
+    void EndPass();
+    void ReadTimers();
+    struct History;
+    void CheckHistory();
+    bool HistoryConverged() const;
+    void DrawTemporal();
+    void ResizeHistory(int width, int height);
+    void ResolveHistory(const History& history);
+    void DrawInterleaved();
+    void ResizeInterleave(int width, int height);
+    void DrawAntialiased();
+    void ResizeAntialias(int width, int height);
+
     int width_;
     int height_;
     float aspect_ratio_;
     int steps_;
     float epsilon_;
+    Stepping stepping_;
 
-    GLuint vao_;
-    GLuint vbo_;
+    ShadowOptions shadows_;
+    glm::vec3 shadow_lo_;
+    glm::vec3 shadow_hi_;
+    // The scene the bounds are for, and the search for them while it
+    // runs.
+    sdf::NodeRef shadow_scene_;
+    std::future<sdf::Bounds> shadow_bounds_;
+    // The shadow cache: the visibility and depth each texel's ray found.
+    GLuint shadow_fbo_;
+    GLuint shadow_texture_;
+    int shadow_width_;
+    int shadow_height_;
+    // The factor the cache was drawn at this frame, 0 if it wasn't, and
+    // the factor the program being drawn draws it at, if it is.
+    int shadow_factor_;
+    int shadow_pass_;
 
     Camera camera_;
     std::unique_ptr<Shader> shader_;
+    std::string vs_;
+    std::string fs_;
+    sdf::NodeRef scene_;
+    int prune_tiles_;
+    // The scene pruned to each tile, row by row, and what it was pruned
+    // for.
+    std::vector<sdf::NodeRef> tile_scenes_;
+    sdf::NodeRef tile_scene_;
+    CameraUniforms tile_camera_;
+    int tile_width_;
+    int tile_height_;
 
+    bool specialize_op_;
+    // The op the current programs are built for, or -1 if they use the
+    // scene_op uniform, and the defines that select it.
+    int program_op_;
+    std::map<std::string, std::string> defines_;
+    // Programs for the ops that aren't current.
+    struct OpPrograms {
+        std::unique_ptr<Shader> shader;
+        std::unique_ptr<Shader> cone;
+        std::unique_ptr<Shader> reproject;
+    };
+    std::map<int, OpPrograms> op_programs_;
+
+    bool use_volume_;
+    BrickVolume::Options volume_options_;
+    VolumeCache volume_cache_;
+    std::shared_ptr<const BrickVolume> volume_;
+    // The compiled scene the volume is baked from, and whether its bake
+    // hadn't finished when the scene was set.
+    std::shared_ptr<const DistanceField> volume_source_;
+    bool volume_pending_;
+    // Brick index, coarse grid and voxel atlas textures.
+    GLuint volume_tex_[3];
+    glm::ivec3 volume_atlas_;
+
+    // Depth prepass levels, coarsest first.  Each texel holds the depth
+    // and the number of cone steps.
+    struct PrepassLevel {
+        int factor;
+        int width;
+        int height;
+        GLuint fbo;
+        GLuint texture;
+    };
+    int prepass_factor_;
+    int prepass_levels_;
+    std::vector<PrepassLevel> levels_;
+    // The level the pass being drawn starts from, if any.
+    const PrepassLevel* prepass_input_;
+    // The factor of the level being drawn, 0 outside the prepass.
+    int cone_factor_;
+    std::unique_ptr<Shader> cone_;
+    // The includes the current program was built with, for cone_.
+    std::map<std::string, std::string> includes_;
+    GLint viewport_[4];
+
+    bool collect_stats_;
+    bool output_steps_;
+    GLuint steps_fbo_;
+    GLuint steps_texture_;
+    int steps_width_;
+    int steps_height_;
+    // The step counts are read back through a ring of pixel buffers,
+    // like FrameCapture's.  Each holds the prepass levels, then the full
+    // pass, sized as in passes.
+    struct StepsReadback {
+        GLuint buffer = 0;
+        GLsizeiptr size = 0;
+        GLsync sync = nullptr;
+        std::vector<glm::ivec2> passes;
+    };
+    std::vector<StepsReadback> readbacks_;
+    // The next readback to use, and how many before it are pending.
+    int readback_head_;
+    int readback_pending_;
+    // The mean steps of each pass in the last readback collected.
+    std::vector<double> collected_steps_;
+    std::vector<MarchPassStats> pass_stats_;
+    MarchCostMap cost_;
+    bool heatmap_;
+    MarchCostMap::Counter heatmap_counter_;
+    float heatmap_range_;
+    std::unique_ptr<Shader> overlay_;
+    std::vector<GLuint> queries_;
+    bool timing_;
+    // The number of passes whose timer results are outstanding.
+    int timed_passes_;
+
+    bool temporal_;
+    int temporal_max_samples_;
+    int temporal_refresh_;
+    // The temporal_mode the programs draw with, see content/raymarch.fs.
+    int temporal_mode_;
+    glm::vec2 temporal_jitter_;
+    uint64_t temporal_frame_;
+    // Colors and depths of the last two frames; history_index_ is the
+    // last one.
+    struct History {
+        GLuint fbo;
+        GLuint texture;
+    };
+    History history_[2];
+    // Marks the pixels reproject_ filled, so they aren't marched.
+    GLuint history_depth_;
+    int history_index_;
+    int history_width_;
+    int history_height_;
+    bool history_valid_;
+    // Whether the camera is where the history was drawn from.
+    bool history_still_;
+    int history_samples_;
+    // What the history was drawn with.
+    CameraUniforms history_camera_;
+    SceneUniforms history_scene_;
+    std::unique_ptr<Shader> reproject_;
+    std::unique_ptr<Shader> resolve_;
+
+    Sampling sampling_;
+    // The pixels marched in the last two frames, packed together;
+    // interleave_index_ is the last one.
+    History interleave_[2];
+    int interleave_index_;
+    int interleave_width_;
+    int interleave_height_;
+    // The Sampling the program being drawn marches, and the phase of its
+    // pattern; see content/raymarch.fs.
+    int interleave_mode_;
+    int interleave_phase_;
+    std::unique_ptr<Shader> reconstruct_;
+
+    int antialias_samples_;
+    // The first samples, and the antialiased frame.
+    GLuint antialias_fbo_[2];
+    // The first samples' colors and surfaces, and the antialiased frame.
+    GLuint antialias_texture_[3];
+    // Marks the pixels to refine.
+    GLuint antialias_depth_;
+    int antialias_width_;
+    int antialias_height_;
+    // Counts the refined pixels, out of antialias_pixels_.
+    GLuint antialias_query_;
+    int antialias_pixels_;
+    double antialias_refined_;
+    // The number of extra samples the program being drawn marches.
+    int antialias_pass_;
+    std::unique_ptr<Shader> edges_;
+
+    // What every fullscreen pass draws.
+    StaticGeometry geometry_;
+    std::shared_ptr<UniformRing> ring_;
+    bool own_ring_;
+    std::shared_ptr<ShaderReloader> reloader_;
+    // The slots the reloader is building a first program for.
+    std::set<int> building_;
+    SceneUniforms scene_uniforms_;
+    UniformRing::Block scene_block_;
+    // The pass block last written.
+    PassUniforms pass_uniforms_;
+    UniformRing::Block pass_block_;
 
     struct Locations {
-        GLuint sky_color;
-        GLuint ambient;
-        GLuint light0pos;
-        GLuint light0col;
-        GLuint op;
-
-        GLuint resolution;
-        GLuint aspect_ratio;
-        GLuint steps;
-        GLuint epsilon;
-
-        // Vertex shader
-        GLuint position;
-    } loc_;
+        struct {
+            GLuint lo;
+            GLuint hi;
+            GLuint brick_extent;
+            GLuint brick_size;
+            GLuint bricks;
+            GLuint atlas;
+            GLuint band;
+            GLuint index;
+            GLuint coarse;
+            GLuint voxels;
+        } volume;
+
+        struct {
+            GLuint texture;
+        } prepass;
+
+        struct {
+            GLuint history;
+        } temporal;
+
+        struct {
+            GLuint color;
+        } antialias;
+
+        struct {
+            GLuint cache;
+        } shadow;
+
+        struct {
+            GLuint history;
+        } resolve;
+
+        struct {
+            GLuint current;
+            GLuint previous;
+            GLuint mode;
+            GLuint phase;
+            GLuint still;
+            GLuint viewport;
+        } reconstruct;
+
+        struct {
+            GLuint color;
+            GLuint surface;
+        } edges;
+
+        struct {
+            GLuint costs;
+        } heatmap;
+
+        // Vertex shader, -1 if it makes its own vertices.
+        GLint position;
+    } loc_, cone_loc_, reproject_loc_, resolve_loc_, reconstruct_loc_,
+      edges_loc_, overlay_loc_;
+
+    // A program whose primary rays use a pruned scene.
+    struct Variant {
+        sdf::NodeRef pruned;
+        std::unique_ptr<Shader> shader;
+        Locations loc;
+        // Its ShaderReloader slot.
+        int slot;
+    };
+    // Variants keyed by the pruned scene's hash.
+    std::unordered_map<uint64_t, std::unique_ptr<Variant>> variants_;
+    int next_variant_slot_;
 };
 
 }  // namespace GFX
@@ -0,0 +1,58 @@
+#include "gfx/raypacket.h"
+#include "gfx/raypacket_kernels.h"
+
+namespace GFX {
+
+const PacketKernels kScalarKernels =
+    MakePacketKernels<Float1>(SimdIsa::SCALAR, "scalar");
+#if defined(__SSE2__)
+const PacketKernels kSSE2Kernels =
+    MakePacketKernels<Float4>(SimdIsa::SSE2, "sse2");
+#else
+const PacketKernels kSSE2Kernels = { SimdIsa::SSE2, "sse2", 0 };
+#endif
+
+void RayPacket::Pad(int width) {
+    for(int i=count; i<width; ++i) {
+        ox[i] = ox[count-1]; oy[i] = oy[count-1]; oz[i] = oz[count-1];
+        dx[i] = dx[count-1]; dy[i] = dy[count-1]; dz[i] = dz[count-1];
+        start[i] = start[count-1];
+    }
+}
+
+const PacketKernels* PacketKernels::Get(SimdIsa isa) {
+    const PacketKernels* k = nullptr;
+    bool supported = true;
+    switch(isa) {
+        case SimdIsa::SCALAR: k = &kScalarKernels; break;
+        case SimdIsa::SSE2: k = &kSSE2Kernels; break;
+        case SimdIsa::AVX2:
+            k = &kAVX2Kernels;
+#if defined(__x86_64__) || defined(__i386__)
+            supported = __builtin_cpu_supports("avx2");
+#endif
+            break;
+        case SimdIsa::AVX512:
+            k = &kAVX512Kernels;
+#if defined(__x86_64__) || defined(__i386__)
+            supported = __builtin_cpu_supports("avx512f");
+#endif
+            break;
+    }
+    // A width of zero means this build didn't compile the kernels.
+    return (supported && k->width) ? k : nullptr;
+}
+
+const PacketKernels* PacketKernels::Best() {
+    static const PacketKernels* best = []() {
+        for(SimdIsa isa : {SimdIsa::AVX512, SimdIsa::AVX2, SimdIsa::SSE2}) {
+            if (const PacketKernels* k = Get(isa)) {
+                return k;
+            }
+        }
+        return &kScalarKernels;
+    }();
+    return best;
+}
+
+}  // namespace GFX
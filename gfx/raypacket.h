@@ -0,0 +1,102 @@
+#ifndef RMX_GFX_RAYPACKET_H
+#define RMX_GFX_RAYPACKET_H
+#include "gfx/distance_field.h"
+#include "gfx/shadow.h"
+#include "gfx/stepping.h"
+#include "glm/glm.hpp"
+
+namespace GFX {
+
+// A group of up to kMaxWidth rays (or points) in structure-of-arrays
+// layout, ready to be loaded straight into vector registers.  Lanes past
+// count are padding: the kernels compute them but ignore the results.
+struct RayPacket {
+    static const int kMaxWidth = 16;
+    alignas(64) float ox[kMaxWidth];
+    alignas(64) float oy[kMaxWidth];
+    alignas(64) float oz[kMaxWidth];
+    alignas(64) float dx[kMaxWidth];
+    alignas(64) float dy[kMaxWidth];
+    alignas(64) float dz[kMaxWidth];
+    // The distance along each ray to start marching from.
+    alignas(64) float start[kMaxWidth];
+    int count;
+
+    inline void Set(int i, const glm::vec3& o, const glm::vec3& d,
+                    float t=0.0f) {
+        ox[i] = o.x; oy[i] = o.y; oz[i] = o.z;
+        dx[i] = d.x; dy[i] = d.y; dz[i] = d.z;
+        start[i] = t;
+    }
+    // Fill the padding lanes with copies of the last real ray so they
+    // finish no later than it does.
+    void Pad(int width);
+};
+
+// Per-lane results of marching a RayPacket.
+struct PacketHits {
+    alignas(64) float distance[RayPacket::kMaxWidth];
+    alignas(64) int steps[RayPacket::kMaxWidth];
+};
+
+struct MarchParams {
+    int steps;
+    float epsilon;
+    float far;
+    Stepping stepping;
+    // stepping.Stretch(), worked out by the caller so the per-ISA
+    // kernels don't emit their own copies of it.
+    float stretch;
+};
+
+enum class SimdIsa {
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512,
+};
+
+// A set of ray-packet kernels compiled for one instruction set.  The
+// kernels mirror SWMarcher::RayMarch, GetNormal and GetVisibility, but
+// process width rays at a time and mask out rays as they finish.
+//
+// Each kernel takes the scene to march.  A null scene selects the
+// built-in scene, which is inlined into the kernels; any other scene is
+// evaluated through DistanceField's batch interface a packet at a time.
+struct PacketKernels {
+    SimdIsa isa;
+    const char* name;
+    int width;
+
+    // March each ray in the packet through the scene.
+    void (*RayMarch)(const DistanceField* scene, const RayPacket& rays,
+                     const MarchParams& params, PacketHits* hits);
+    // Compute the surface normal at each origin in the packet.  The
+    // normals are written to the packet's direction arrays.
+    void (*GetNormal)(const DistanceField* scene, RayPacket* points);
+    // Soft-shadow visibility from each origin in the packet towards
+    // light, marched as shadow says (see gfx/shadow.h).  active is a
+    // bitmask of lanes to evaluate; inactive lanes get a visibility of
+    // zero.  visibility must be 64-byte aligned and hold kMaxWidth
+    // floats.  steps, if given, gets the number of distance evaluations
+    // each lane took.
+    void (*GetVisibility)(const DistanceField* scene,
+                          const RayPacket& points, const glm::vec3& light,
+                          const ShadowParams& shadow, float epsilon,
+                          unsigned active, float* visibility, int* steps);
+
+    // The kernels for the widest instruction set the CPU supports.
+    static const PacketKernels* Best();
+    // The kernels for a particular instruction set, or nullptr if the
+    // CPU (or this build) doesn't support it.
+    static const PacketKernels* Get(SimdIsa isa);
+};
+
+// Per-ISA kernel tables, each defined in its own translation unit.
+extern const PacketKernels kScalarKernels;
+extern const PacketKernels kSSE2Kernels;
+extern const PacketKernels kAVX2Kernels;
+extern const PacketKernels kAVX512Kernels;
+
+}  // namespace GFX
+#endif // RMX_GFX_RAYPACKET_H
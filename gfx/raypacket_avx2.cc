@@ -0,0 +1,13 @@
+// Compiled with -mavx2; see gfx/BUILD.  kAVX2Kernels is the only symbol
+// this file exports: the lane types, and so the kernels instantiated
+// over them, have internal linkage (see gfx/simd.h).
+#include "gfx/raypacket_kernels.h"
+
+namespace GFX {
+#if defined(__AVX2__)
+const PacketKernels kAVX2Kernels =
+    MakePacketKernels<Float8>(SimdIsa::AVX2, "avx2");
+#else
+const PacketKernels kAVX2Kernels = { SimdIsa::AVX2, "avx2", 0 };
+#endif
+}  // namespace GFX
@@ -0,0 +1,13 @@
+// Compiled with -mavx512f; see gfx/BUILD.  kAVX512Kernels is the only
+// symbol this file exports: the lane types, and so the kernels
+// instantiated over them, have internal linkage (see gfx/simd.h).
+#include "gfx/raypacket_kernels.h"
+
+namespace GFX {
+#if defined(__AVX512F__)
+const PacketKernels kAVX512Kernels =
+    MakePacketKernels<Float16>(SimdIsa::AVX512, "avx512");
+#else
+const PacketKernels kAVX512Kernels = { SimdIsa::AVX512, "avx512", 0 };
+#endif
+}  // namespace GFX
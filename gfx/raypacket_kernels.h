@@ -0,0 +1,163 @@
+#ifndef RMX_GFX_RAYPACKET_KERNELS_H
+#define RMX_GFX_RAYPACKET_KERNELS_H
+#include "gfx/raypacket.h"
+#include "gfx/sdf_primitives.h"
+#include "gfx/simd.h"
+
+// Templated implementation of the ray-packet kernels.  Each ISA-specific
+// translation unit includes this file and instantiates MakePacketKernels
+// with its own lane type.  Keep the arithmetic in the same order as the
+// scalar code in gfx/swmarch.cc so both paths produce the same pixels.
+
+namespace GFX {
+
+template<typename V>
+class PacketKernelsImpl {
+  public:
+    typedef typename V::Mask Mask;
+
+    static inline V DistScene(const DistanceField* scene, V x, V y, V z) {
+        if (!scene) {
+            return sdf::DefaultScene(x, y, z);
+        }
+        alignas(64) float px[V::kWidth], py[V::kWidth], pz[V::kWidth];
+        alignas(64) float d[V::kWidth];
+        x.Store(px);
+        y.Store(py);
+        z.Store(pz);
+        scene->Distance(px, py, pz, d, V::kWidth);
+        return V::Load(d);
+    }
+
+    static inline Mask LaneMask(unsigned lanes) {
+        alignas(64) float bit[RayPacket::kMaxWidth];
+        for(int i=0; i<V::kWidth; ++i) {
+            bit[i] = float((lanes >> i) & 1);
+        }
+        return V::Load(bit) > V(0.0f);
+    }
+
+    static void RayMarch(const DistanceField* scene, const RayPacket& rays,
+                         const MarchParams& params, PacketHits* hits) {
+        V ox = V::Load(rays.ox), oy = V::Load(rays.oy), oz = V::Load(rays.oz);
+        V dx = V::Load(rays.dx), dy = V::Load(rays.dy), dz = V::Load(rays.dz);
+        V epsilon(params.epsilon), far(params.far), two(2.0f);
+        V distance = V::Load(rays.start);
+        Mask active = LaneMask((1u << rays.count) - 1);
+
+        // See gfx/stepping.h.
+        const Stepping& stepping = params.stepping;
+        bool predict = stepping.strategy == Stepping::kEnhanced;
+        V one(1.0f), zero(0.0f), relaxation(stepping.relaxation);
+        V stretch(predict ? 1.0f : params.stretch);
+        V step = zero, last = zero;
+        Mask stretching = stepping.strategy == Stepping::kSphere
+                          ? LaneMask(0) : active;
+
+        for(int i=0; i<V::kWidth; ++i) {
+            hits->steps[i] = params.steps;
+        }
+        for(int i=0; i<params.steps && Bits(active); ++i) {
+            V d = DistScene(scene, ox + dx * distance,
+                            oy + dy * distance,
+                            oz + dz * distance);
+            Mask back = (step > last) & (last + d < step) & active;
+            Mask done = ((d < epsilon * distance * two) | (distance >= far))
+                        & AndNot(active, back);
+            for(uint32_t b=Bits(done); b; b &= b - 1) {
+                hits->steps[__builtin_ctz(b)] = i;
+            }
+            active = AndNot(active, done);
+            Mask go = AndNot(active, back);
+            if (predict) {
+                stretch = Select(go & stretching & (step > zero),
+                                 PredictStretch(last, d, step, relaxation),
+                                 stretch);
+            }
+            stretch = Select(back, one, stretch);
+            stretching = AndNot(stretching, back);
+            V next = d * stretch;
+            distance = Select(back, distance - (step - last),
+                              Select(go, distance + next, distance));
+            step = Select(back, last, Select(go, next, step));
+            last = Select(go, d, last);
+        }
+        distance.Store(hits->distance);
+    }
+
+    static void GetNormal(const DistanceField* scene, RayPacket* points) {
+        V x = V::Load(points->ox), y = V::Load(points->oy), z = V::Load(points->oz);
+        V h(0.0001f);
+        V nx = DistScene(scene, x + h, y, z) - DistScene(scene, x - h, y, z);
+        V ny = DistScene(scene, x, y + h, z) - DistScene(scene, x, y - h, z);
+        V nz = DistScene(scene, x, y, z + h) - DistScene(scene, x, y, z - h);
+        V inv = V(1.0f) / sqrt(nx*nx + ny*ny + nz*nz);
+        (nx * inv).Store(points->dx);
+        (ny * inv).Store(points->dy);
+        (nz * inv).Store(points->dz);
+    }
+
+    static void GetVisibility(const DistanceField* scene,
+                              const RayPacket& points, const glm::vec3& light,
+                              const ShadowParams& shadow, float epsilon,
+                              unsigned lanes, float* visibility, int* steps) {
+        V x = V::Load(points.ox), y = V::Load(points.oy), z = V::Load(points.oz);
+        V lx = V(light.x) - x, ly = V(light.y) - y, lz = V(light.z) - z;
+        V dot = lx*lx + ly*ly + lz*lz;
+        V inv = V(1.0f) / sqrt(dot);
+        V rx = lx * inv, ry = ly * inv, rz = lz * inv;
+        V maxt = sqrt(dot);
+        V t(epsilon * 10.0f);
+        V f(1.0f), eps(epsilon), kk(shadow.k), zero(0.0f);
+        V last(1e20f), threshold(shadow.threshold);
+        V min_step(shadow.min_step), max_step(shadow.max_step);
+
+        // See gfx/shadow.h.
+        ClipToBox(x, y, z, rx, ry, rz, shadow.lo, shadow.hi, maxt / kk,
+                  &t, &maxt);
+
+        Mask active = LaneMask(lanes);
+        if (steps) {
+            for(int i=0; i<V::kWidth; ++i) {
+                steps[i] = 0;
+            }
+        }
+        for(;;) {
+            active = active & (t < maxt);
+            if (!Bits(active))
+                break;
+            if (steps) {
+                for(uint32_t b=Bits(active); b; b &= b - 1) {
+                    ++steps[__builtin_ctz(b)];
+                }
+            }
+            V d = DistScene(scene, x + rx * t, y + ry * t, z + rz * t);
+            // If we hit a surface before reaching the light, not visible.
+            Mask hit = active & (d < eps);
+            f = Select(hit, zero, f);
+            active = AndNot(active, hit);
+            // Compute penumbra factor, and give up once it's dark.
+            f = Select(active, Penumbra(f, d, last, t, kk), f);
+            Mask dark = active & (f < threshold);
+            f = Select(dark, zero, f);
+            active = AndNot(active, dark);
+            last = Select(active, d, last);
+            t = Select(active, t + min(max(d, min_step), max_step), t);
+        }
+
+        Select(LaneMask(lanes), f, zero).Store(visibility);
+    }
+};
+
+template<typename V>
+constexpr PacketKernels MakePacketKernels(SimdIsa isa, const char* name) {
+    return PacketKernels{
+        isa, name, V::kWidth,
+        &PacketKernelsImpl<V>::RayMarch,
+        &PacketKernelsImpl<V>::GetNormal,
+        &PacketKernelsImpl<V>::GetVisibility,
+    };
+}
+
+}  // namespace GFX
+#endif // RMX_GFX_RAYPACKET_KERNELS_H
@@ -0,0 +1,869 @@
+#include "gfx/sdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "gfx/sdf_primitives.h"
+#include "util/logging.h"
+
+namespace GFX {
+namespace sdf {
+namespace {
+const uint64_t kFNVOffset = 0xcbf29ce484222325ULL;
+const uint64_t kFNVPrime = 0x100000001b3ULL;
+
+inline uint64_t Mix(uint64_t h, uint64_t v) {
+    for(int i=0; i<8; ++i) {
+        h ^= (v >> (i*8)) & 0xFF;
+        h *= kFNVPrime;
+    }
+    return h;
+}
+
+inline uint64_t FloatBits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+NodeRef Make(Op op, std::vector<float> params,
+             std::vector<NodeRef> children = {}) {
+    return std::make_shared<const Node>(op, std::move(params),
+                                        std::move(children));
+}
+
+const char* kAxis[] = { "x", "y", "z" };
+
+// Format a float as a GLSL literal which reads back as the same value.
+std::string Literal(float f) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", f);
+    if (!strpbrk(buf, ".eni")) {
+        strcat(buf, ".0");
+    }
+    return buf;
+}
+
+std::string Vec3(const Node& n) {
+    return absl::StrCat("vec3(", Literal(n.param(0)), ", ",
+                        Literal(n.param(1)), ", ",
+                        Literal(n.param(2)), ")");
+}
+}  // namespace
+
+bool IsPrimitive(Op op) {
+    return op < Op::TRANSLATE;
+}
+
+bool IsDomain(Op op) {
+    return op >= Op::TRANSLATE && op <= Op::MIRROR;
+}
+
+bool IsCombinator(Op op) {
+    return op >= Op::UNION && op < Op::NUM_OPS;
+}
+
+const char* OpName(Op op) {
+    static const char* names[] = {
+        "SPHERE", "BOX", "BOX_CHEAP", "PLANE", "CYLINDER", "CAPSULE",
+        "TORUS", "GDF",
+        "TRANSLATE", "ROTATE", "MOD1", "MOD_MIRROR1", "MIRROR",
+        "UNION", "INTERSECTION", "DIFFERENCE",
+        "UNION_ROUND", "INTERSECTION_ROUND", "DIFFERENCE_ROUND",
+        "UNION_CHAMFER", "INTERSECTION_CHAMFER", "DIFFERENCE_CHAMFER",
+        "UNION_COLUMNS", "INTERSECTION_COLUMNS", "DIFFERENCE_COLUMNS",
+        "UNION_STAIRS", "INTERSECTION_STAIRS", "DIFFERENCE_STAIRS",
+        "PIPE", "ENGRAVE", "GROOVE", "TONGUE",
+    };
+    static_assert(sizeof(names)/sizeof(names[0]) == int(Op::NUM_OPS),
+                  "OpName table out of date");
+    return names[int(op)];
+}
+
+Node::Node(Op op, std::vector<float> params, std::vector<NodeRef> children)
+  : op_(op),
+    params_(std::move(params)),
+    children_(std::move(children)) {
+    hash_ = Mix(kFNVOffset, uint64_t(op_));
+    for(float p : params_) {
+        hash_ = Mix(hash_, FloatBits(p));
+    }
+    for(const auto& c : children_) {
+        hash_ = Mix(hash_, c->Hash());
+    }
+}
+
+bool Node::Equal(const NodeRef& a, const NodeRef& b) {
+    if (a == b)
+        return true;
+    if (a->Hash() != b->Hash() || a->op_ != b->op_ ||
+        a->params_ != b->params_ ||
+        a->children_.size() != b->children_.size())
+        return false;
+    for(size_t i=0; i<a->children_.size(); ++i) {
+        if (!Equal(a->children_[i], b->children_[i]))
+            return false;
+    }
+    return true;
+}
+
+// Primitives
+NodeRef Sphere(float radius) {
+    return Make(Op::SPHERE, {radius});
+}
+NodeRef Box(const glm::vec3& size) {
+    return Make(Op::BOX, {size.x, size.y, size.z});
+}
+NodeRef BoxCheap(const glm::vec3& size) {
+    return Make(Op::BOX_CHEAP, {size.x, size.y, size.z});
+}
+NodeRef Plane(const glm::vec3& normal, float distance) {
+    return Make(Op::PLANE, {normal.x, normal.y, normal.z, distance});
+}
+NodeRef Cylinder(float radius, float height) {
+    return Make(Op::CYLINDER, {radius, height});
+}
+NodeRef Capsule(float radius, float half_length) {
+    return Make(Op::CAPSULE, {radius, half_length});
+}
+NodeRef Torus(float small_radius, float large_radius) {
+    return Make(Op::TORUS, {small_radius, large_radius});
+}
+NodeRef Octahedron(float radius) {
+    return Make(Op::GDF, {radius, 3, 6});
+}
+NodeRef Dodecahedron(float radius) {
+    return Make(Op::GDF, {radius, 13, 18});
+}
+NodeRef Icosahedron(float radius) {
+    return Make(Op::GDF, {radius, 3, 12});
+}
+NodeRef TruncatedOctahedron(float radius) {
+    return Make(Op::GDF, {radius, 0, 6});
+}
+NodeRef TruncatedIcosahedron(float radius) {
+    return Make(Op::GDF, {radius, 3, 18});
+}
+
+// Domain operators
+NodeRef Translate(const glm::vec3& offset, NodeRef child) {
+    return Make(Op::TRANSLATE, {offset.x, offset.y, offset.z}, {child});
+}
+NodeRef Rotate(Axis a, Axis b, float angle, NodeRef child) {
+    return Make(Op::ROTATE, {float(a), float(b), angle}, {child});
+}
+NodeRef Mod1(Axis axis, float size, NodeRef child) {
+    return Make(Op::MOD1, {float(axis), size}, {child});
+}
+NodeRef ModMirror1(Axis axis, float size, NodeRef child) {
+    return Make(Op::MOD_MIRROR1, {float(axis), size}, {child});
+}
+NodeRef Mirror(Axis axis, float distance, NodeRef child) {
+    return Make(Op::MIRROR, {float(axis), distance}, {child});
+}
+
+// Combinators
+NodeRef Union(NodeRef a, NodeRef b) {
+    return Make(Op::UNION, {}, {a, b});
+}
+NodeRef Intersection(NodeRef a, NodeRef b) {
+    return Make(Op::INTERSECTION, {}, {a, b});
+}
+NodeRef Difference(NodeRef a, NodeRef b) {
+    return Make(Op::DIFFERENCE, {}, {a, b});
+}
+NodeRef UnionRound(NodeRef a, NodeRef b, float r) {
+    return Make(Op::UNION_ROUND, {r}, {a, b});
+}
+NodeRef IntersectionRound(NodeRef a, NodeRef b, float r) {
+    return Make(Op::INTERSECTION_ROUND, {r}, {a, b});
+}
+NodeRef DifferenceRound(NodeRef a, NodeRef b, float r) {
+    return Make(Op::DIFFERENCE_ROUND, {r}, {a, b});
+}
+NodeRef UnionChamfer(NodeRef a, NodeRef b, float r) {
+    return Make(Op::UNION_CHAMFER, {r}, {a, b});
+}
+NodeRef IntersectionChamfer(NodeRef a, NodeRef b, float r) {
+    return Make(Op::INTERSECTION_CHAMFER, {r}, {a, b});
+}
+NodeRef DifferenceChamfer(NodeRef a, NodeRef b, float r) {
+    return Make(Op::DIFFERENCE_CHAMFER, {r}, {a, b});
+}
+NodeRef UnionColumns(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::UNION_COLUMNS, {r, n}, {a, b});
+}
+NodeRef IntersectionColumns(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::INTERSECTION_COLUMNS, {r, n}, {a, b});
+}
+NodeRef DifferenceColumns(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::DIFFERENCE_COLUMNS, {r, n}, {a, b});
+}
+NodeRef UnionStairs(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::UNION_STAIRS, {r, n}, {a, b});
+}
+NodeRef IntersectionStairs(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::INTERSECTION_STAIRS, {r, n}, {a, b});
+}
+NodeRef DifferenceStairs(NodeRef a, NodeRef b, float r, float n) {
+    return Make(Op::DIFFERENCE_STAIRS, {r, n}, {a, b});
+}
+NodeRef Pipe(NodeRef a, NodeRef b, float r) {
+    return Make(Op::PIPE, {r}, {a, b});
+}
+NodeRef Engrave(NodeRef a, NodeRef b, float r) {
+    return Make(Op::ENGRAVE, {r}, {a, b});
+}
+NodeRef Groove(NodeRef a, NodeRef b, float ra, float rb) {
+    return Make(Op::GROOVE, {ra, rb}, {a, b});
+}
+NodeRef Tongue(NodeRef a, NodeRef b, float ra, float rb) {
+    return Make(Op::TONGUE, {ra, rb}, {a, b});
+}
+
+NodeRef BoolOpsScene(int op) {
+    NodeRef box = Box(glm::vec3(1));
+    NodeRef sphere = Translate(glm::vec3(1), Sphere(1));
+    float r = 0.3f;
+    float n = 4;
+
+    switch(op) {
+        case 1: return Intersection(box, sphere);
+        case 2: return Difference(box, sphere);
+
+        case 3: return UnionRound(box, sphere, r);
+        case 4: return IntersectionRound(box, sphere, r);
+        case 5: return DifferenceRound(box, sphere, r);
+
+        case 6: return UnionChamfer(box, sphere, r);
+        case 7: return IntersectionChamfer(box, sphere, r);
+        case 8: return DifferenceChamfer(box, sphere, r);
+
+        case 9 : return UnionColumns(box, sphere, r, n);
+        case 10: return IntersectionColumns(box, sphere, r, n);
+        case 11: return DifferenceColumns(box, sphere, r, n);
+
+        case 12: return UnionStairs(box, sphere, r, n);
+        case 13: return IntersectionStairs(box, sphere, r, n);
+        case 14: return DifferenceStairs(box, sphere, r, n);
+
+        case 15: return Pipe(box, sphere, r*0.3f);
+        case 16: return Engrave(box, sphere, r*0.3f);
+        case 17: return Groove(box, sphere, r*0.3f, r*0.3f);
+        case 18: return Tongue(box, sphere, r*0.3f, r*0.3f);
+
+        case 0:
+        default:
+            return Union(box, sphere);
+    }
+}
+
+//========================================================================
+// Simplify
+//========================================================================
+
+namespace {
+class Simplifier {
+  public:
+    NodeRef Run(const NodeRef& node) {
+        auto memo = memo_.find(node.get());
+        if (memo != memo_.end())
+            return memo->second;
+
+        std::vector<NodeRef> children;
+        bool changed = false;
+        for(const auto& c : node->children()) {
+            children.push_back(Run(c));
+            changed |= children.back() != c;
+        }
+        NodeRef result = changed ? Make(node->op(), node->params(), children)
+                                 : node;
+        result = Intern(Fold(result));
+        memo_[node.get()] = result;
+        return result;
+    }
+
+  private:
+    // Constant folding.  The children have already been folded.
+    NodeRef Fold(const NodeRef& node) {
+        const auto& p = node->params();
+        switch(node->op()) {
+        case Op::TRANSLATE: {
+            if (p[0] == 0 && p[1] == 0 && p[2] == 0)
+                return node->child(0);
+            const NodeRef& c = node->child(0);
+            if (c->op() == Op::TRANSLATE) {
+                return Fold(Translate(
+                    glm::vec3(p[0] + c->param(0), p[1] + c->param(1),
+                              p[2] + c->param(2)),
+                    c->child(0)));
+            }
+            break;
+        }
+        case Op::ROTATE: {
+            if (p[2] == 0 || p[0] == p[1])
+                return node->child(0);
+            const NodeRef& c = node->child(0);
+            // Rotations in the same plane add up.
+            if (c->op() == Op::ROTATE &&
+                c->param(0) == p[0] && c->param(1) == p[1]) {
+                return Fold(Rotate(Axis(int(p[0])), Axis(int(p[1])),
+                                   p[2] + c->param(2), c->child(0)));
+            }
+            break;
+        }
+        case Op::MIRROR:
+        case Op::MOD1:
+        case Op::MOD_MIRROR1:
+            break;
+        case Op::UNION:
+        case Op::INTERSECTION:
+            if (Node::Equal(node->child(0), node->child(1)))
+                return node->child(0);
+            break;
+        default:
+            break;
+        }
+        return node;
+    }
+
+    // Return the canonical instance of node so identical subtrees share
+    // one pointer.  The compilers key common subexpressions on it.
+    NodeRef Intern(const NodeRef& node) {
+        auto& bucket = interned_[node->Hash()];
+        for(const auto& n : bucket) {
+            if (Node::Equal(n, node))
+                return n;
+        }
+        bucket.push_back(node);
+        return node;
+    }
+
+    std::unordered_map<const Node*, NodeRef> memo_;
+    std::unordered_map<uint64_t, std::vector<NodeRef>> interned_;
+};
+}  // namespace
+
+NodeRef Simplify(const NodeRef& root) {
+    Simplifier s;
+    return s.Run(root);
+}
+
+//========================================================================
+// GLSL
+//========================================================================
+
+namespace {
+class GLSLEmitter {
+  public:
+    std::string Run(const NodeRef& root, const std::string& name) {
+        int d = Dist(root, 0);
+        return absl::StrCat(
+            "// Generated from an sdf::Node tree.\n",
+            "float ", name, "(vec3 p0) {\n", body_,
+            "    return d", d, ";\n",
+            "}\n");
+    }
+
+  private:
+    typedef std::pair<const Node*, int> Key;
+
+    // Emit the transformed position for a domain operator.
+    int Pos(const Node& n, int pos) {
+        auto it = pos_.find(Key(&n, pos));
+        if (it != pos_.end())
+            return it->second;
+        int out = npos_++;
+        std::string p = absl::StrCat("p", out);
+        if (n.op() == Op::TRANSLATE) {
+            absl::StrAppend(&body_, "    vec3 ", p, " = p", pos, " - ",
+                            Vec3(n), ";\n");
+        } else {
+            absl::StrAppend(&body_, "    vec3 ", p, " = p", pos, ";\n");
+            const char* axis = kAxis[int(n.param(0))];
+            switch(n.op()) {
+            case Op::ROTATE:
+                absl::StrAppend(&body_, "    pR(", p, ".", axis,
+                                kAxis[int(n.param(1))], ", ",
+                                Literal(n.param(2)), ");\n");
+                break;
+            case Op::MOD1:
+                absl::StrAppend(&body_, "    pMod1(", p, ".", axis, ", ",
+                                Literal(n.param(1)), ");\n");
+                break;
+            case Op::MOD_MIRROR1:
+                absl::StrAppend(&body_, "    pModMirror1(", p, ".", axis,
+                                ", ", Literal(n.param(1)), ");\n");
+                break;
+            case Op::MIRROR:
+                absl::StrAppend(&body_, "    pMirror(", p, ".", axis, ", ",
+                                Literal(n.param(1)), ");\n");
+                break;
+            default:
+                LOG(FATAL, "Not a domain operator: ", OpName(n.op()));
+            }
+        }
+        pos_[Key(&n, pos)] = out;
+        return out;
+    }
+
+    int Dist(const NodeRef& node, int pos) {
+        const Node& n = *node;
+        if (IsDomain(n.op()))
+            return Dist(n.child(0), Pos(n, pos));
+
+        auto it = dist_.find(Key(&n, pos));
+        if (it != dist_.end())
+            return it->second;
+
+        std::string expr;
+        std::string p = absl::StrCat("p", pos);
+        if (IsPrimitive(n.op())) {
+            switch(n.op()) {
+            case Op::SPHERE:
+                expr = absl::StrCat("fSphere(", p, ", ",
+                                    Literal(n.param(0)), ")");
+                break;
+            case Op::BOX:
+                expr = absl::StrCat("fBox(", p, ", ", Vec3(n), ")");
+                break;
+            case Op::BOX_CHEAP:
+                expr = absl::StrCat("fBoxCheap(", p, ", ", Vec3(n), ")");
+                break;
+            case Op::PLANE:
+                expr = absl::StrCat("fPlane(", p, ", ", Vec3(n), ", ",
+                                    Literal(n.param(3)), ")");
+                break;
+            case Op::CYLINDER:
+                expr = absl::StrCat("fCylinder(", p, ", ",
+                                    Literal(n.param(0)), ", ",
+                                    Literal(n.param(1)), ")");
+                break;
+            case Op::CAPSULE:
+                expr = absl::StrCat("fCapsule(", p, ", ",
+                                    Literal(n.param(0)), ", ",
+                                    Literal(n.param(1)), ")");
+                break;
+            case Op::TORUS:
+                expr = absl::StrCat("fTorus(", p, ", ",
+                                    Literal(n.param(0)), ", ",
+                                    Literal(n.param(1)), ")");
+                break;
+            case Op::GDF:
+                expr = absl::StrCat("fGDF(", p, ", ", Literal(n.param(0)),
+                                    ", ", int(n.param(1)), ", ",
+                                    int(n.param(2)), ")");
+                break;
+            default:
+                LOG(FATAL, "Not a primitive: ", OpName(n.op()));
+            }
+        } else {
+            std::string a = absl::StrCat("d", Dist(n.child(0), pos));
+            std::string b = absl::StrCat("d", Dist(n.child(1), pos));
+            std::string args = absl::StrCat(a, ", ", b);
+            for(float param : n.params()) {
+                absl::StrAppend(&args, ", ", Literal(param));
+            }
+            const char* fn = nullptr;
+            switch(n.op()) {
+            case Op::UNION: expr = absl::StrCat("min(", args, ")"); break;
+            case Op::INTERSECTION: expr = absl::StrCat("max(", args, ")"); break;
+            case Op::DIFFERENCE: expr = absl::StrCat("max(", a, ", -", b, ")"); break;
+            case Op::UNION_ROUND: fn = "fOpUnionRound"; break;
+            case Op::INTERSECTION_ROUND: fn = "fOpIntersectionRound"; break;
+            case Op::DIFFERENCE_ROUND: fn = "fOpDifferenceRound"; break;
+            case Op::UNION_CHAMFER: fn = "fOpUnionChamfer"; break;
+            case Op::INTERSECTION_CHAMFER: fn = "fOpIntersectionChamfer"; break;
+            case Op::DIFFERENCE_CHAMFER: fn = "fOpDifferenceChamfer"; break;
+            case Op::UNION_COLUMNS: fn = "fOpUnionColumns"; break;
+            case Op::INTERSECTION_COLUMNS: fn = "fOpIntersectionColumns"; break;
+            case Op::DIFFERENCE_COLUMNS: fn = "fOpDifferenceColumns"; break;
+            case Op::UNION_STAIRS: fn = "fOpUnionStairs"; break;
+            case Op::INTERSECTION_STAIRS: fn = "fOpIntersectionStairs"; break;
+            case Op::DIFFERENCE_STAIRS: fn = "fOpDifferenceStairs"; break;
+            case Op::PIPE: fn = "fOpPipe"; break;
+            case Op::ENGRAVE: fn = "fOpEngrave"; break;
+            case Op::GROOVE: fn = "fOpGroove"; break;
+            case Op::TONGUE: fn = "fOpTongue"; break;
+            default:
+                LOG(FATAL, "Not a combinator: ", OpName(n.op()));
+            }
+            if (fn) {
+                expr = absl::StrCat(fn, "(", args, ")");
+            }
+        }
+        int out = ndist_++;
+        absl::StrAppend(&body_, "    float d", out, " = ", expr, ";\n");
+        dist_[Key(&n, pos)] = out;
+        return out;
+    }
+
+    std::string body_;
+    std::map<Key, int> pos_;
+    std::map<Key, int> dist_;
+    int npos_ = 1;
+    int ndist_ = 0;
+};
+}  // namespace
+
+std::string EmitGLSL(const NodeRef& root, const std::string& name) {
+    GLSLEmitter e;
+    return e.Run(Simplify(root), name);
+}
+
+//========================================================================
+// Bytecode
+//========================================================================
+
+// Compiles a simplified tree into a Program.  Code is first generated
+// with a fresh virtual register for every value, then the registers are
+// renumbered so values which are no longer live share storage.
+class Compiler {
+  public:
+    explicit Compiler(Program* program) : program_(program) {}
+
+    void Run(const NodeRef& root) {
+        int result = Dist(root, 0);
+        Allocate();
+        program_->result_ = dist_reg_[result];
+
+        uint64_t h = kFNVOffset;
+        for(const auto& in : program_->code_) {
+            h = Mix(h, uint64_t(in.op) | uint64_t(in.dst) << 8 |
+                       uint64_t(in.a) << 24 | uint64_t(in.b) << 40);
+            h = Mix(h, in.k);
+        }
+        for(float k : program_->constants_) {
+            h = Mix(h, FloatBits(k));
+        }
+        program_->fingerprint_ = h;
+    }
+
+  private:
+    typedef std::pair<const Node*, int> Key;
+
+    uint32_t Constants(std::initializer_list<float> k) {
+        uint32_t index = program_->constants_.size();
+        program_->constants_.insert(program_->constants_.end(), k);
+        return index;
+    }
+
+    void Emit(Op op, int dst, int a, int b, uint32_t k) {
+        program_->code_.push_back(
+            Instruction{op, uint16_t(dst), uint16_t(a), uint16_t(b), k});
+    }
+
+    int Pos(const Node& n, int pos) {
+        auto it = pos_.find(Key(&n, pos));
+        if (it != pos_.end())
+            return it->second;
+        int out = npos_++;
+        const auto& p = n.params();
+        switch(n.op()) {
+        case Op::TRANSLATE:
+            Emit(n.op(), out, pos, 0, Constants({p[0], p[1], p[2]}));
+            break;
+        case Op::ROTATE:
+            Emit(n.op(), out, pos, int(p[0]) | int(p[1]) << 2,
+                 Constants({std::cos(p[2]), std::sin(p[2])}));
+            break;
+        case Op::MOD1:
+        case Op::MOD_MIRROR1:
+        case Op::MIRROR:
+            Emit(n.op(), out, pos, int(p[0]), Constants({p[1]}));
+            break;
+        default:
+            LOG(FATAL, "Not a domain operator: ", OpName(n.op()));
+        }
+        pos_[Key(&n, pos)] = out;
+        return out;
+    }
+
+    int Dist(const NodeRef& node, int pos) {
+        const Node& n = *node;
+        if (IsDomain(n.op()))
+            return Dist(n.child(0), Pos(n, pos));
+
+        auto it = dist_.find(Key(&n, pos));
+        if (it != dist_.end())
+            return it->second;
+
+        uint32_t k = program_->constants_.size();
+        program_->constants_.insert(program_->constants_.end(),
+                                    n.params().begin(), n.params().end());
+        int out;
+        if (IsPrimitive(n.op())) {
+            out = ndist_++;
+            Emit(n.op(), out, pos, 0, k);
+        } else {
+            int a = Dist(n.child(0), pos);
+            int b = Dist(n.child(1), pos);
+            out = ndist_++;
+            Emit(n.op(), out, a, b, k);
+        }
+        dist_[Key(&n, pos)] = out;
+        return out;
+    }
+
+    // Linear scan register allocation over the straight-line code.
+    void Allocate() {
+        auto& code = program_->code_;
+        std::vector<int> pos_last(npos_, -1), dist_last(ndist_, -1);
+        for(size_t i=0; i<code.size(); ++i) {
+            const Instruction& in = code[i];
+            if (IsCombinator(in.op)) {
+                dist_last[in.a] = dist_last[in.b] = i;
+            } else {
+                pos_last[in.a] = i;
+            }
+        }
+
+        pos_reg_.assign(npos_, -1);
+        dist_reg_.assign(ndist_, -1);
+        pos_reg_[0] = 0;
+        std::vector<int> pos_free, dist_free;
+        int npos = 1, ndist = 0;
+        for(size_t i=0; i<code.size(); ++i) {
+            Instruction& in = code[i];
+            // Rewrite the operands and release any registers this is the
+            // last reader of.  The VM reads every operand of a lane before
+            // writing the result, so dst may reuse a released register.
+            if (IsCombinator(in.op)) {
+                int a = in.a, b = in.b;
+                in.a = dist_reg_[a];
+                in.b = dist_reg_[b];
+                if (dist_last[a] == int(i))
+                    dist_free.push_back(dist_reg_[a]);
+                if (b != a && dist_last[b] == int(i))
+                    dist_free.push_back(dist_reg_[b]);
+            } else {
+                int a = in.a;
+                in.a = pos_reg_[a];
+                // Register 0 holds the input point and is never reused.
+                if (a != 0 && pos_last[a] == int(i))
+                    pos_free.push_back(pos_reg_[a]);
+            }
+
+            if (IsDomain(in.op)) {
+                int r;
+                if (pos_free.empty()) {
+                    r = npos++;
+                } else {
+                    r = pos_free.back();
+                    pos_free.pop_back();
+                }
+                pos_reg_[in.dst] = r;
+                in.dst = r;
+            } else {
+                int r;
+                if (dist_free.empty()) {
+                    r = ndist++;
+                } else {
+                    r = dist_free.back();
+                    dist_free.pop_back();
+                }
+                dist_reg_[in.dst] = r;
+                in.dst = r;
+            }
+        }
+        program_->npos_ = npos;
+        program_->ndist_ = ndist;
+    }
+
+    Program* program_;
+    std::map<Key, int> pos_;
+    std::map<Key, int> dist_;
+    std::vector<int> pos_reg_;
+    std::vector<int> dist_reg_;
+    int npos_ = 1;
+    int ndist_ = 0;
+};
+
+std::unique_ptr<Program> Program::Compile(const NodeRef& root) {
+    std::unique_ptr<Program> program(new Program);
+    Compiler c(program.get());
+    c.Run(Simplify(root));
+    return program;
+}
+
+float Program::Distance(const glm::vec3& p) const {
+    float d;
+    DistanceBatch(&p.x, &p.y, &p.z, &d, 1);
+    return d;
+}
+
+void Program::Distance(const float* x, const float* y, const float* z,
+                       float* d, int n) const {
+    for(int i=0; i<n; i+=kBatch) {
+        DistanceBatch(x+i, y+i, z+i, d+i, std::min(kBatch, n-i));
+    }
+}
+
+// Run the program over up to kBatch points.  Instructions are the outer
+// loop and points the inner loop, so the dispatch cost is paid once per
+// batch rather than once per point and the inner loops can vectorize.
+void Program::DistanceBatch(const float* x, const float* y, const float* z,
+                            float* d, int n) const {
+    // Position register r component c lives at P[(r*3 + c) * kBatch] and
+    // distance register r at D[r * kBatch].
+    thread_local std::vector<float> scratch;
+    size_t size = size_t(npos_ * 3 + ndist_) * kBatch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    float* P = scratch.data();
+    float* D = P + npos_ * 3 * kBatch;
+    std::copy(x, x + n, P);
+    std::copy(y, y + n, P + kBatch);
+    std::copy(z, z + n, P + 2 * kBatch);
+
+    for(const Instruction& in : code_) {
+        const float* k = constants_.data() + in.k;
+        if (IsPrimitive(in.op)) {
+            const float* px = P + in.a * 3 * kBatch;
+            const float* py = px + kBatch;
+            const float* pz = py + kBatch;
+            float* out = D + in.dst * kBatch;
+            switch(in.op) {
+            case Op::SPHERE:
+                for(int i=0; i<n; ++i)
+                    out[i] = fSphere(px[i], py[i], pz[i], k[0]);
+                break;
+            case Op::BOX:
+                for(int i=0; i<n; ++i)
+                    out[i] = fBox(px[i], py[i], pz[i], k[0], k[1], k[2]);
+                break;
+            case Op::BOX_CHEAP:
+                for(int i=0; i<n; ++i)
+                    out[i] = fBoxCheap(px[i], py[i], pz[i], k[0], k[1], k[2]);
+                break;
+            case Op::PLANE:
+                for(int i=0; i<n; ++i)
+                    out[i] = fPlane(px[i], py[i], pz[i], k[0], k[1], k[2], k[3]);
+                break;
+            case Op::CYLINDER:
+                for(int i=0; i<n; ++i)
+                    out[i] = fCylinder(px[i], py[i], pz[i], k[0], k[1]);
+                break;
+            case Op::CAPSULE:
+                for(int i=0; i<n; ++i)
+                    out[i] = fCapsule(px[i], py[i], pz[i], k[0], k[1]);
+                break;
+            case Op::TORUS:
+                for(int i=0; i<n; ++i)
+                    out[i] = fTorus(px[i], py[i], pz[i], k[0], k[1]);
+                break;
+            case Op::GDF:
+                for(int i=0; i<n; ++i)
+                    out[i] = fGDF(px[i], py[i], pz[i], k[0], int(k[1]), int(k[2]));
+                break;
+            default:
+                break;
+            }
+        } else if (IsDomain(in.op)) {
+            const float* src = P + in.a * 3 * kBatch;
+            float* dst = P + in.dst * 3 * kBatch;
+            if (in.op == Op::TRANSLATE) {
+                for(int c=0; c<3; ++c) {
+                    for(int i=0; i<n; ++i)
+                        dst[c*kBatch + i] = src[c*kBatch + i] - k[c];
+                }
+                continue;
+            }
+            if (dst != src) {
+                for(int c=0; c<3; ++c)
+                    std::copy(src + c*kBatch, src + c*kBatch + n, dst + c*kBatch);
+            }
+            float* u = dst + (in.b & 3) * kBatch;
+            switch(in.op) {
+            case Op::ROTATE: {
+                float* v = dst + (in.b >> 2) * kBatch;
+                for(int i=0; i<n; ++i)
+                    pR(u[i], v[i], k[0], k[1]);
+                break;
+            }
+            case Op::MOD1:
+                for(int i=0; i<n; ++i)
+                    pMod1(u[i], k[0]);
+                break;
+            case Op::MOD_MIRROR1:
+                for(int i=0; i<n; ++i)
+                    pModMirror1(u[i], k[0]);
+                break;
+            case Op::MIRROR:
+                for(int i=0; i<n; ++i)
+                    pMirror(u[i], k[0]);
+                break;
+            default:
+                break;
+            }
+        } else {
+            const float* a = D + in.a * kBatch;
+            const float* b = D + in.b * kBatch;
+            float* out = D + in.dst * kBatch;
+            switch(in.op) {
+#define COMBINE(op_, expr)                  \
+            case Op::op_:                   \
+                for(int i=0; i<n; ++i)      \
+                    out[i] = expr;          \
+                break;
+            COMBINE(UNION, fOpUnion(a[i], b[i]))
+            COMBINE(INTERSECTION, fOpIntersection(a[i], b[i]))
+            COMBINE(DIFFERENCE, fOpDifference(a[i], b[i]))
+            COMBINE(UNION_ROUND, fOpUnionRound(a[i], b[i], k[0]))
+            COMBINE(INTERSECTION_ROUND, fOpIntersectionRound(a[i], b[i], k[0]))
+            COMBINE(DIFFERENCE_ROUND, fOpDifferenceRound(a[i], b[i], k[0]))
+            COMBINE(UNION_CHAMFER, fOpUnionChamfer(a[i], b[i], k[0]))
+            COMBINE(INTERSECTION_CHAMFER, fOpIntersectionChamfer(a[i], b[i], k[0]))
+            COMBINE(DIFFERENCE_CHAMFER, fOpDifferenceChamfer(a[i], b[i], k[0]))
+            COMBINE(UNION_COLUMNS, fOpUnionColumns(a[i], b[i], k[0], k[1]))
+            COMBINE(INTERSECTION_COLUMNS, fOpIntersectionColumns(a[i], b[i], k[0], k[1]))
+            COMBINE(DIFFERENCE_COLUMNS, fOpDifferenceColumns(a[i], b[i], k[0], k[1]))
+            COMBINE(UNION_STAIRS, fOpUnionStairs(a[i], b[i], k[0], k[1]))
+            COMBINE(INTERSECTION_STAIRS, fOpIntersectionStairs(a[i], b[i], k[0], k[1]))
+            COMBINE(DIFFERENCE_STAIRS, fOpDifferenceStairs(a[i], b[i], k[0], k[1]))
+            COMBINE(PIPE, fOpPipe(a[i], b[i], k[0]))
+            COMBINE(ENGRAVE, fOpEngrave(a[i], b[i], k[0]))
+            COMBINE(GROOVE, fOpGroove(a[i], b[i], k[0], k[1]))
+            COMBINE(TONGUE, fOpTongue(a[i], b[i], k[0], k[1]))
+#undef COMBINE
+            default:
+                break;
+            }
+        }
+    }
+    std::copy(D + result_ * kBatch, D + result_ * kBatch + n, d);
+}
+
+std::string Program::Disassemble() const {
+    std::string out;
+    for(const Instruction& in : code_) {
+        if (IsPrimitive(in.op)) {
+            absl::StrAppend(&out, "d", in.dst, " = ", OpName(in.op),
+                            " p", in.a);
+        } else if (IsDomain(in.op)) {
+            absl::StrAppend(&out, "p", in.dst, " = ", OpName(in.op),
+                            " p", in.a);
+            if (in.op == Op::ROTATE) {
+                absl::StrAppend(&out, ".", kAxis[in.b & 3], kAxis[in.b >> 2]);
+            } else if (in.op != Op::TRANSLATE) {
+                absl::StrAppend(&out, ".", kAxis[in.b]);
+            }
+        } else {
+            absl::StrAppend(&out, "d", in.dst, " = ", OpName(in.op),
+                            " d", in.a, " d", in.b);
+        }
+        absl::StrAppend(&out, " [k", in.k, "]\n");
+    }
+    absl::StrAppend(&out, "result d", result_, "\n");
+    return out;
+}
+
+}  // namespace sdf
+}  // namespace GFX
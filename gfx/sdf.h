@@ -0,0 +1,207 @@
+#ifndef RMX_GFX_SDF_H
+#define RMX_GFX_SDF_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gfx/distance_field.h"
+#include "glm/glm.hpp"
+
+// An SDF scene described as an expression tree of hg_sdf.inc primitives,
+// domain operators and combinators.  A scene is authored once as a tree
+// of Nodes and then either:
+//
+//   - compiled to bytecode for the register VM in Program, which the
+//     software marcher evaluates on the CPU, or
+//   - emitted as GLSL which RayMarchScene compiles into its shader.
+//
+// Both backends run the tree through Simplify first, which folds
+// constant transforms and merges structurally identical subtrees, so the
+// CSE'd subtree is evaluated once per point in both backends.
+
+namespace GFX {
+namespace sdf {
+
+enum class Op : uint8_t {
+    // Primitives: distance from the current point.
+    SPHERE,                 // radius
+    BOX,                    // size.xyz
+    BOX_CHEAP,              // size.xyz
+    PLANE,                  // normal.xyz, distance from origin
+    CYLINDER,               // radius, height
+    CAPSULE,                // radius, half length
+    TORUS,                  // small radius, large radius
+    GDF,                    // radius, first vector, last vector
+
+    // Domain operators: transform the point for their one child.
+    TRANSLATE,              // offset.xyz
+    ROTATE,                 // axis a, axis b, angle (pR(p.ab, angle))
+    MOD1,                   // axis, size
+    MOD_MIRROR1,            // axis, size
+    MIRROR,                 // axis, distance
+
+    // Combinators: combine the distances of their two children.
+    UNION,
+    INTERSECTION,
+    DIFFERENCE,
+    UNION_ROUND,            // radius
+    INTERSECTION_ROUND,     // radius
+    DIFFERENCE_ROUND,       // radius
+    UNION_CHAMFER,          // radius
+    INTERSECTION_CHAMFER,   // radius
+    DIFFERENCE_CHAMFER,     // radius
+    UNION_COLUMNS,          // radius, count
+    INTERSECTION_COLUMNS,   // radius, count
+    DIFFERENCE_COLUMNS,     // radius, count
+    UNION_STAIRS,           // radius, count
+    INTERSECTION_STAIRS,    // radius, count
+    DIFFERENCE_STAIRS,      // radius, count
+    PIPE,                   // radius
+    ENGRAVE,                // radius
+    GROOVE,                 // radius a, radius b
+    TONGUE,                 // radius a, radius b
+
+    NUM_OPS,
+};
+
+bool IsPrimitive(Op op);
+bool IsDomain(Op op);
+bool IsCombinator(Op op);
+const char* OpName(Op op);
+
+class Node;
+typedef std::shared_ptr<const Node> NodeRef;
+
+// A node in the scene tree.  Nodes are immutable so subtrees can be
+// shared freely.
+class Node {
+  public:
+    Node(Op op, std::vector<float> params, std::vector<NodeRef> children);
+
+    inline Op op() const { return op_; }
+    inline const std::vector<float>& params() const { return params_; }
+    inline float param(int i) const { return params_[i]; }
+    inline const std::vector<NodeRef>& children() const { return children_; }
+    inline const NodeRef& child(int i) const { return children_[i]; }
+
+    // A hash of the node and its whole subtree.
+    inline uint64_t Hash() const { return hash_; }
+    // True if the two subtrees are structurally identical.
+    static bool Equal(const NodeRef& a, const NodeRef& b);
+
+  private:
+    Op op_;
+    std::vector<float> params_;
+    std::vector<NodeRef> children_;
+    uint64_t hash_;
+};
+
+// Axes for the domain operators.
+enum Axis { X = 0, Y = 1, Z = 2 };
+
+// Primitives
+NodeRef Sphere(float radius);
+NodeRef Box(const glm::vec3& size);
+NodeRef BoxCheap(const glm::vec3& size);
+NodeRef Plane(const glm::vec3& normal, float distance);
+NodeRef Cylinder(float radius, float height);
+NodeRef Capsule(float radius, float half_length);
+NodeRef Torus(float small_radius, float large_radius);
+NodeRef Octahedron(float radius);
+NodeRef Dodecahedron(float radius);
+NodeRef Icosahedron(float radius);
+NodeRef TruncatedOctahedron(float radius);
+NodeRef TruncatedIcosahedron(float radius);
+
+// Domain operators
+NodeRef Translate(const glm::vec3& offset, NodeRef child);
+NodeRef Rotate(Axis a, Axis b, float angle, NodeRef child);
+NodeRef Mod1(Axis axis, float size, NodeRef child);
+NodeRef ModMirror1(Axis axis, float size, NodeRef child);
+NodeRef Mirror(Axis axis, float distance, NodeRef child);
+
+// Combinators
+NodeRef Union(NodeRef a, NodeRef b);
+NodeRef Intersection(NodeRef a, NodeRef b);
+NodeRef Difference(NodeRef a, NodeRef b);
+NodeRef UnionRound(NodeRef a, NodeRef b, float r);
+NodeRef IntersectionRound(NodeRef a, NodeRef b, float r);
+NodeRef DifferenceRound(NodeRef a, NodeRef b, float r);
+NodeRef UnionChamfer(NodeRef a, NodeRef b, float r);
+NodeRef IntersectionChamfer(NodeRef a, NodeRef b, float r);
+NodeRef DifferenceChamfer(NodeRef a, NodeRef b, float r);
+NodeRef UnionColumns(NodeRef a, NodeRef b, float r, float n);
+NodeRef IntersectionColumns(NodeRef a, NodeRef b, float r, float n);
+NodeRef DifferenceColumns(NodeRef a, NodeRef b, float r, float n);
+NodeRef UnionStairs(NodeRef a, NodeRef b, float r, float n);
+NodeRef IntersectionStairs(NodeRef a, NodeRef b, float r, float n);
+NodeRef DifferenceStairs(NodeRef a, NodeRef b, float r, float n);
+NodeRef Pipe(NodeRef a, NodeRef b, float r);
+NodeRef Engrave(NodeRef a, NodeRef b, float r);
+NodeRef Groove(NodeRef a, NodeRef b, float ra, float rb);
+NodeRef Tongue(NodeRef a, NodeRef b, float ra, float rb);
+
+// The scene from content/boolops.inc: a box and a sphere combined with
+// operator number op (0-18, the same numbering as scene_op).
+NodeRef BoolOpsScene(int op);
+
+// Fold constant transforms (e.g. nested translations, zero rotations)
+// and merge structurally identical subtrees so they are shared.
+NodeRef Simplify(const NodeRef& root);
+
+// Generate GLSL defining `float name(vec3 p)` for the scene.  The result
+// expects hg_sdf.inc to have been included.
+std::string EmitGLSL(const NodeRef& root,
+                     const std::string& name="DistScene");
+
+// One VM instruction.  Primitives read position register a and write
+// distance register dst.  Domain operators read position register a and
+// write position register dst.  Combinators read distance registers a
+// and b and write distance register dst.  Constant operands live in the
+// program's constant pool starting at k.
+struct Instruction {
+    Op op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+    uint32_t k;
+};
+
+// A compiled scene.  Position register 0 holds the input point and the
+// result is left in distance register result_.
+class Program : public DistanceField {
+  public:
+    static std::unique_ptr<Program> Compile(const NodeRef& root);
+
+    float Distance(const glm::vec3& p) const override;
+    void Distance(const float* x, const float* y, const float* z,
+                  float* d, int n) const override;
+    uint64_t Fingerprint() const override { return fingerprint_; }
+
+    inline const std::vector<Instruction>& code() const { return code_; }
+    inline const std::vector<float>& constants() const { return constants_; }
+    inline int position_registers() const { return npos_; }
+    inline int distance_registers() const { return ndist_; }
+    std::string Disassemble() const;
+
+  private:
+    friend class Compiler;
+    Program() : npos_(1), ndist_(0), result_(0), fingerprint_(0) {}
+
+    // The number of points evaluated per pass in batched mode.
+    static const int kBatch = 64;
+    void DistanceBatch(const float* x, const float* y, const float* z,
+                       float* d, int n) const;
+
+    std::vector<Instruction> code_;
+    std::vector<float> constants_;
+    int npos_;
+    int ndist_;
+    int result_;
+    uint64_t fingerprint_;
+};
+
+}  // namespace sdf
+}  // namespace GFX
+#endif // RMX_GFX_SDF_H
@@ -0,0 +1,256 @@
+// Microbenchmarks for the hg_sdf operators in their scalar, SIMD packet
+// and bytecode VM forms, and for whole scenes as sdf::fixed templates
+// against the VM.  See gfx/sdf_benchmark.h.
+#include "gfx/sdf_benchmark.h"
+
+#include <memory>
+#include <random>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "gfx/sdf_fixed.h"
+
+namespace GFX {
+namespace sdf_benchmark {
+
+const Points& GetPoints() {
+    static const Points* points = [] {
+        Points* p = new Points;
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dist(-2.0f, 2.0f);
+        for(int i = 0; i < kPoints; ++i) {
+            p->x[i] = dist(rng);
+            p->y[i] = dist(rng);
+            p->z[i] = dist(rng);
+        }
+        return p;
+    }();
+    return *points;
+}
+
+// The float-only cases, a lane at a time, for the packet forms.
+#define PRIMITIVE_LANES(Name) \
+    void Name::Lanes(const float* x, const float* y, const float* z, \
+                     float* d, int n) { \
+        for(int i = 0; i < n; ++i) { \
+            d[i] = Lane(x[i], y[i], z[i]); \
+        } \
+    }
+#define COMBINATOR_LANES(Name) \
+    void Name::Lanes(const float* a, const float* b, float* d, int n) { \
+        for(int i = 0; i < n; ++i) { \
+            d[i] = Lane(a[i], b[i]); \
+        } \
+    }
+#define DOMAIN_LANES(Name) \
+    void Name::Lanes(float* p, int n) { \
+        for(int i = 0; i < n; ++i) { \
+            Lane(p[i]); \
+        } \
+    }
+
+PRIMITIVE_LANES(fCapsule)
+PRIMITIVE_LANES(fOctahedron)
+PRIMITIVE_LANES(fDodecahedron)
+PRIMITIVE_LANES(fIcosahedron)
+PRIMITIVE_LANES(fTruncatedOctahedron)
+PRIMITIVE_LANES(fTruncatedIcosahedron)
+COMBINATOR_LANES(fOpUnionColumns)
+COMBINATOR_LANES(fOpIntersectionColumns)
+COMBINATOR_LANES(fOpDifferenceColumns)
+COMBINATOR_LANES(fOpUnionStairs)
+COMBINATOR_LANES(fOpIntersectionStairs)
+COMBINATOR_LANES(fOpDifferenceStairs)
+DOMAIN_LANES(pMod1)
+DOMAIN_LANES(pModMirror1)
+DOMAIN_LANES(pMirror)
+#undef DOMAIN_LANES
+#undef COMBINATOR_LANES
+#undef PRIMITIVE_LANES
+
+namespace {
+
+template<typename Case>
+void Scalar(benchmark::State& state) {
+    const Points& p = GetPoints();
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        for(int i = 0; i < kPoints; ++i) {
+            d[i] = Case::Eval(p.x[i], p.y[i], p.z[i]);
+        }
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+}
+
+template<typename Case>
+void VM(benchmark::State& state) {
+    const Points& p = GetPoints();
+    std::unique_ptr<sdf::Program> program = sdf::Program::Compile(Case::Node());
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        program->Distance(p.x, p.y, p.z, d, kPoints);
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+    state.counters["instructions"] = program->code().size();
+}
+
+// Time one case's packet form, reporting evaluations per second.
+void Packet(benchmark::State& state,
+            void (*eval)(const Points& p, float* d)) {
+    const Points& p = GetPoints();
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        eval(p, d);
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+}
+
+template<typename... Cases>
+void RegisterPacket(const std::string& isa, const PacketTable& table,
+                    CaseList<Cases...>) {
+    int i = 0;
+    int unused[] = {
+        (benchmark::RegisterBenchmark(
+                (std::string(Cases::name()) + "/" + isa).c_str(),
+                [eval = table.eval[i++]](benchmark::State& state) {
+                    Packet(state, eval);
+                }), 0)...
+    };
+    (void)unused;
+}
+
+template<typename... Cases>
+void RegisterScalarAndVM(CaseList<Cases...>) {
+    int unused[] = {
+        (benchmark::RegisterBenchmark(
+                (std::string(Cases::name()) + "/scalar").c_str(),
+                Scalar<Cases>),
+         benchmark::RegisterBenchmark(
+                (std::string(Cases::name()) + "/vm").c_str(),
+                VM<Cases>), 0)...
+    };
+    (void)unused;
+}
+
+// Whole scenes, evaluated as an inlined sdf::fixed template ("fixed"),
+// through StaticScene's DistanceField interface as SWMarcher calls it
+// ("static"), and as the same tree compiled to bytecode ("vm").
+struct RoundUnionScene {
+    static const char* name() { return "Scene/RoundUnion"; }
+    static constexpr auto Fixed() {
+        using namespace sdf::fixed;
+        return UnionRound(Box(1, 1, 1), Translate(1, 1, 1, Sphere(1)),
+                          0.3f);
+    }
+};
+
+// A repeated field of rotated polyhedra and capsules over a floor, deep
+// enough that the VM's dispatch shows.
+struct ColonnadeScene {
+    static const char* name() { return "Scene/Colonnade"; }
+    static constexpr auto Fixed() {
+        using namespace sdf::fixed;
+        return UnionStairs(
+            Plane(0, 1, 0, 1),
+            ModMirror1(sdf::X, 2.0f, Mod1(sdf::Z, 2.0f, UnionRound(
+                Capsule(0.25f, 1.0f),
+                Translate(0, 1, 0, Rotate(sdf::X, sdf::Z, 0.6f,
+                                          Dodecahedron(0.4f))),
+                0.1f))),
+            0.3f, 3.0f);
+    }
+};
+
+template<typename Scene>
+void Fixed(benchmark::State& state) {
+    const Points& p = GetPoints();
+    constexpr auto scene = Scene::Fixed();
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        for(int i = 0; i < kPoints; ++i) {
+            d[i] = scene(p.x[i], p.y[i], p.z[i]);
+        }
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+}
+
+template<typename Scene>
+void Static(benchmark::State& state) {
+    const Points& p = GetPoints();
+    std::shared_ptr<const DistanceField> field =
+        sdf::fixed::MakeStaticScene(Scene::Fixed());
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        field->Distance(p.x, p.y, p.z, d, kPoints);
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+}
+
+template<typename Scene>
+void SceneVM(benchmark::State& state) {
+    const Points& p = GetPoints();
+    std::unique_ptr<sdf::Program> program =
+        sdf::Program::Compile(Scene::Fixed().ToNode());
+    alignas(64) static float d[kPoints];
+    for(auto _ : state) {
+        program->Distance(p.x, p.y, p.z, d, kPoints);
+        benchmark::DoNotOptimize(d);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kPoints);
+    state.counters["instructions"] = program->code().size();
+}
+
+template<typename... Scenes>
+void RegisterScenes() {
+    int unused[] = {
+        (benchmark::RegisterBenchmark(
+                (std::string(Scenes::name()) + "/fixed").c_str(),
+                Fixed<Scenes>),
+         benchmark::RegisterBenchmark(
+                (std::string(Scenes::name()) + "/static").c_str(),
+                Static<Scenes>),
+         benchmark::RegisterBenchmark(
+                (std::string(Scenes::name()) + "/vm").c_str(),
+                SceneVM<Scenes>), 0)...
+    };
+    (void)unused;
+}
+
+}  // namespace
+}  // namespace sdf_benchmark
+}  // namespace GFX
+
+int main(int argc, char** argv) {
+    using namespace GFX::sdf_benchmark;
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    RegisterScalarAndVM(AllCases());
+    RegisterScenes<RoundUnionScene, ColonnadeScene>();
+#if defined(__SSE2__)
+    RegisterPacket("sse2", MakePacketTable<GFX::Float4>(AllCases()),
+                   AllCases());
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2") && kAVX2Packets.eval[0]) {
+        RegisterPacket("avx2", kAVX2Packets, AllCases());
+    }
+    if (__builtin_cpu_supports("avx512f") && kAVX512Packets.eval[0]) {
+        RegisterPacket("avx512", kAVX512Packets, AllCases());
+    }
+#endif
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,252 @@
+#ifndef RMX_GFX_SDF_BENCHMARK_H
+#define RMX_GFX_SDF_BENCHMARK_H
+#include "gfx/sdf.h"
+#include "gfx/sdf_primitives.h"
+#include "gfx/simd.h"
+
+// The cases //gfx:sdf_benchmark measures, shared by its per-ISA
+// translation units the way gfx/raypacket_kernels.h is.
+//
+// Each case evaluates one hg_sdf operator at every point of a fixed
+// cloud, in three forms:
+//   scalar   the float port from gfx/sdf_primitives.h, a point at a time
+//   <isa>    the same port instantiated over a SIMD lane type, a packet
+//            at a time
+//   vm       the operator compiled to sdf::Program bytecode
+// Operators only ported for float, e.g. fCapsule, fGDF, pMod1 and the
+// Columns and Stairs combinators, run lane by lane in the packet form,
+// which is what a packet kernel pays for them today.
+//
+// The wide forms are built with -mavx2 or -mavx512f, so all they export
+// is a PacketTable of plain loops over the points.  The float ports they
+// run lane by lane are called out of line from sdf_benchmark.cc, and the
+// timing and registration live there too, all built for the baseline
+// ISA.  That way no VEX-encoded copy of a shared inline function, from
+// the ports, the standard library or the benchmark library, can be
+// linked in for the baseline callers.
+//
+// Combinators combine fSphere(p, 1) and fBox(p, 0.8) and domain
+// operators feed fSphere(p, 0.4), so every form does the same work; the
+// fOpUnion case is the baseline to subtract.
+
+namespace GFX {
+namespace sdf_benchmark {
+
+const int kPoints = 4096;
+
+// Points spread over [-2, 2]^3.
+struct Points {
+    alignas(64) float x[kPoints];
+    alignas(64) float y[kPoints];
+    alignas(64) float z[kPoints];
+};
+const Points& GetPoints();
+
+// Run a float-only case on each lane of a packet, through its Lanes,
+// or inline on a float.
+template<typename Case, typename F>
+inline F Lanewise(F x, F y, F z) {
+    alignas(64) float px[F::kWidth], py[F::kWidth], pz[F::kWidth];
+    alignas(64) float d[F::kWidth];
+    x.Store(px);
+    y.Store(py);
+    z.Store(pz);
+    Case::Lanes(px, py, pz, d, F::kWidth);
+    return F::Load(d);
+}
+
+template<typename Case>
+inline float Lanewise(float x, float y, float z) {
+    return Case::Lane(x, y, z);
+}
+
+template<typename Case, typename F>
+inline F Lanewise(F a, F b) {
+    alignas(64) float pa[F::kWidth], pb[F::kWidth], d[F::kWidth];
+    a.Store(pa);
+    b.Store(pb);
+    Case::Lanes(pa, pb, d, F::kWidth);
+    return F::Load(d);
+}
+
+template<typename Case>
+inline float Lanewise(float a, float b) {
+    return Case::Lane(a, b);
+}
+
+// Apply a float-only domain operator to each lane of one coordinate.
+template<typename Case, typename F>
+inline F LanewiseDomain(F p) {
+    alignas(64) float v[F::kWidth];
+    p.Store(v);
+    Case::Lanes(v, F::kWidth);
+    return F::Load(v);
+}
+
+template<typename Case>
+inline float LanewiseDomain(float p) {
+    Case::Lane(p);
+    return p;
+}
+
+// Primitives.
+#define PRIMITIVE(Name, Expr, NodeExpr) \
+    struct Name { \
+        static const char* name() { return #Name; } \
+        template<typename F> \
+        static F Eval(F x, F y, F z) { return Expr; } \
+        static sdf::NodeRef Node() { return NodeExpr; } \
+    }
+
+PRIMITIVE(fSphere, sdf::fSphere(x, y, z, 1.0f), sdf::Sphere(1.0f));
+PRIMITIVE(fBox, sdf::fBox(x, y, z, 0.8f, 0.6f, 0.4f),
+          sdf::Box(glm::vec3(0.8f, 0.6f, 0.4f)));
+PRIMITIVE(fBoxCheap, sdf::fBoxCheap(x, y, z, 0.8f, 0.6f, 0.4f),
+          sdf::BoxCheap(glm::vec3(0.8f, 0.6f, 0.4f)));
+PRIMITIVE(fCylinder, sdf::fCylinder(x, y, z, 0.5f, 1.0f),
+          sdf::Cylinder(0.5f, 1.0f));
+PRIMITIVE(fTorus, sdf::fTorus(x, y, z, 0.25f, 1.0f),
+          sdf::Torus(0.25f, 1.0f));
+
+// Float-only primitives, run lane by lane.  Lanes is defined in
+// sdf_benchmark.cc.
+#define LANEWISE_PRIMITIVE(Name, Expr, NodeExpr) \
+    struct Name { \
+        static const char* name() { return #Name; } \
+        static float Lane(float x, float y, float z) { return Expr; } \
+        static void Lanes(const float* x, const float* y, const float* z, \
+                          float* d, int n); \
+        template<typename F> \
+        static F Eval(F x, F y, F z) { return Lanewise<Name>(x, y, z); } \
+        static sdf::NodeRef Node() { return NodeExpr; } \
+    }
+
+LANEWISE_PRIMITIVE(fCapsule, sdf::fCapsule(x, y, z, 0.5f, 1.0f),
+                   sdf::Capsule(0.5f, 1.0f));
+
+// The fGDF polyhedra, by their range of GDFVectors.
+#define POLYHEDRON(Name, Begin, End, NodeFn) \
+    LANEWISE_PRIMITIVE(Name, sdf::fGDF(x, y, z, 1.0f, Begin, End), \
+                       sdf::NodeFn(1.0f))
+
+POLYHEDRON(fOctahedron, 3, 6, Octahedron);
+POLYHEDRON(fDodecahedron, 13, 18, Dodecahedron);
+POLYHEDRON(fIcosahedron, 3, 12, Icosahedron);
+POLYHEDRON(fTruncatedOctahedron, 0, 6, TruncatedOctahedron);
+POLYHEDRON(fTruncatedIcosahedron, 3, 18, TruncatedIcosahedron);
+#undef POLYHEDRON
+#undef LANEWISE_PRIMITIVE
+
+// Combinators of a sphere and a box.  Members adds to the struct.
+#define COMBINATOR(Name, Expr, Members, NodeFn, ...) \
+    struct Name { \
+        static const char* name() { return #Name; } \
+        Members \
+        template<typename F> \
+        static F Eval(F x, F y, F z) { \
+            F a = sdf::fSphere(x, y, z, 1.0f); \
+            F b = sdf::fBox(x, y, z, 0.8f, 0.8f, 0.8f); \
+            return Expr; \
+        } \
+        static sdf::NodeRef Node() { \
+            return sdf::NodeFn(sdf::Sphere(1.0f), \
+                               sdf::Box(glm::vec3(0.8f)), ##__VA_ARGS__); \
+        } \
+    }
+
+// Templated combinators run natively on every lane type.
+#define NATIVE_COMBINATOR(Name, NodeFn, ...) \
+    COMBINATOR(Name, sdf::Name(a, b, ##__VA_ARGS__), , \
+               NodeFn, ##__VA_ARGS__)
+// Float-only combinators run lane by lane.  Lanes is defined in
+// sdf_benchmark.cc.
+#define LANEWISE_COMBINATOR(Name, NodeFn, ...) \
+    COMBINATOR(Name, Lanewise<Name>(a, b), \
+               static float Lane(float a, float b) { \
+                   return sdf::Name(a, b, ##__VA_ARGS__); \
+               } \
+               static void Lanes(const float* a, const float* b, \
+                                 float* d, int n);, \
+               NodeFn, ##__VA_ARGS__)
+
+NATIVE_COMBINATOR(fOpUnion, Union);
+NATIVE_COMBINATOR(fOpUnionRound, UnionRound, 0.3f);
+NATIVE_COMBINATOR(fOpIntersectionRound, IntersectionRound, 0.3f);
+NATIVE_COMBINATOR(fOpDifferenceRound, DifferenceRound, 0.3f);
+NATIVE_COMBINATOR(fOpUnionChamfer, UnionChamfer, 0.3f);
+NATIVE_COMBINATOR(fOpIntersectionChamfer, IntersectionChamfer, 0.3f);
+NATIVE_COMBINATOR(fOpDifferenceChamfer, DifferenceChamfer, 0.3f);
+LANEWISE_COMBINATOR(fOpUnionColumns, UnionColumns, 0.3f, 4.0f);
+LANEWISE_COMBINATOR(fOpIntersectionColumns, IntersectionColumns, 0.3f, 4.0f);
+LANEWISE_COMBINATOR(fOpDifferenceColumns, DifferenceColumns, 0.3f, 4.0f);
+LANEWISE_COMBINATOR(fOpUnionStairs, UnionStairs, 0.3f, 4.0f);
+LANEWISE_COMBINATOR(fOpIntersectionStairs, IntersectionStairs, 0.3f, 4.0f);
+LANEWISE_COMBINATOR(fOpDifferenceStairs, DifferenceStairs, 0.3f, 4.0f);
+#undef LANEWISE_COMBINATOR
+#undef NATIVE_COMBINATOR
+#undef COMBINATOR
+
+// Domain operators on x, feeding a sphere.  They're all float-only, so
+// they run lane by lane; Lanes is defined in sdf_benchmark.cc.
+#define DOMAIN(Name, NodeFn, ...) \
+    struct Name { \
+        static const char* name() { return #Name; } \
+        static void Lane(float& p) { sdf::Name(p, ##__VA_ARGS__); } \
+        static void Lanes(float* p, int n); \
+        template<typename F> \
+        static F Eval(F x, F y, F z) { \
+            x = LanewiseDomain<Name>(x); \
+            return sdf::fSphere(x, y, z, 0.4f); \
+        } \
+        static sdf::NodeRef Node() { \
+            return sdf::NodeFn(sdf::X, ##__VA_ARGS__, sdf::Sphere(0.4f)); \
+        } \
+    }
+
+DOMAIN(pMod1, Mod1, 1.0f);
+DOMAIN(pModMirror1, ModMirror1, 1.0f);
+DOMAIN(pMirror, Mirror, 0.5f);
+#undef DOMAIN
+#undef PRIMITIVE
+
+template<typename... Cases> struct CaseList {
+    static const int kSize = sizeof...(Cases);
+};
+typedef CaseList<
+    fSphere, fBox, fBoxCheap, fCylinder, fTorus, fCapsule,
+    fOctahedron, fDodecahedron, fIcosahedron, fTruncatedOctahedron,
+    fTruncatedIcosahedron,
+    fOpUnion, fOpUnionRound, fOpIntersectionRound, fOpDifferenceRound,
+    fOpUnionChamfer, fOpIntersectionChamfer, fOpDifferenceChamfer,
+    fOpUnionColumns, fOpIntersectionColumns, fOpDifferenceColumns,
+    fOpUnionStairs, fOpIntersectionStairs, fOpDifferenceStairs,
+    pMod1, pModMirror1, pMirror> AllCases;
+
+// Evaluate Case at every point, F::kWidth points at a time, into d.
+template<typename F, typename Case>
+void EvalPacket(const Points& p, float* d) {
+    for(int i = 0; i < kPoints; i += F::kWidth) {
+        Case::Eval(F::Load(p.x + i), F::Load(p.y + i),
+                   F::Load(p.z + i)).Store(d + i);
+    }
+}
+
+// The packet form of every case, in AllCases order, for one lane type.
+// A null eval[0] means the build left that lane type out.
+struct PacketTable {
+    void (*eval[AllCases::kSize])(const Points& p, float* d);
+};
+
+template<typename F, typename... Cases>
+constexpr PacketTable MakePacketTable(CaseList<Cases...>) {
+    return PacketTable{{&EvalPacket<F, Cases>...}};
+}
+
+// The packet forms for the wider lane types, each defined in its own
+// translation unit.
+extern const PacketTable kAVX2Packets;
+extern const PacketTable kAVX512Packets;
+
+}  // namespace sdf_benchmark
+}  // namespace GFX
+#endif // RMX_GFX_SDF_BENCHMARK_H
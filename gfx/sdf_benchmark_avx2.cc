@@ -0,0 +1,15 @@
+// Compiled with -mavx2; see gfx/BUILD.  kAVX2Packets is the only symbol
+// this file exports, and it holds nothing but loops over the lane type.
+#include "gfx/sdf_benchmark.h"
+
+namespace GFX {
+namespace sdf_benchmark {
+
+#if defined(__AVX2__)
+const PacketTable kAVX2Packets = MakePacketTable<Float8>(AllCases());
+#else
+const PacketTable kAVX2Packets = {};
+#endif
+
+}  // namespace sdf_benchmark
+}  // namespace GFX
@@ -0,0 +1,16 @@
+// Compiled with -mavx512f; see gfx/BUILD.  kAVX512Packets is the only
+// symbol this file exports, and it holds nothing but loops over the lane
+// type.
+#include "gfx/sdf_benchmark.h"
+
+namespace GFX {
+namespace sdf_benchmark {
+
+#if defined(__AVX512F__)
+const PacketTable kAVX512Packets = MakePacketTable<Float16>(AllCases());
+#else
+const PacketTable kAVX512Packets = {};
+#endif
+
+}  // namespace sdf_benchmark
+}  // namespace GFX
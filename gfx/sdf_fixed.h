@@ -0,0 +1,354 @@
+#ifndef RMX_GFX_SDF_FIXED_H
+#define RMX_GFX_SDF_FIXED_H
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gfx/distance_field.h"
+#include "gfx/sdf.h"
+#include "gfx/sdf_primitives.h"
+#include "glm/glm.hpp"
+
+// Compile-time SDF scenes.  Each node is a small literal type and a scene
+// is a constexpr expression whose type spells out its structure:
+//
+//   using namespace GFX::sdf::fixed;
+//   constexpr auto scene = UnionRound(
+//       Box(1, 1, 1), Translate(1, 1, 1, Sphere(1)), 0.3f);
+//   // decltype(scene) is UnionRound<Box, Translate<Sphere>>
+//
+// Evaluating a scene inlines the whole tree into straight-line code with
+// every parameter a compile time constant, so there's no dispatch at all.
+// That wins for small scenes, but the VM runs each instruction over a
+// batch of points, which vectorizes, so it can win for deep scenes built
+// from the float-only operators; compare the Scene/ cases of
+// //gfx:sdf_benchmark before choosing.  Scenes which change at runtime
+// should use the VM.  Wrap a scene in StaticScene to
+// hand it to SWMarcher::set_scene, and use ToNode() to get the same scene
+// as an sdf::Node tree (e.g. for sdf::EmitGLSL).
+
+namespace GFX {
+namespace sdf {
+namespace fixed {
+
+// constexpr sine and cosine for the rotation constants.
+constexpr double kPi = 3.14159265358979323846;
+
+constexpr double ConstSin(double x) {
+    // Reduce to [-pi, pi], then sum the Taylor series.
+    while (x > kPi) x -= 2 * kPi;
+    while (x < -kPi) x += 2 * kPi;
+    double term = x, sum = x;
+    for(int i=1; i<12; ++i) {
+        term *= -x * x / ((2*i) * (2*i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double ConstCos(double x) {
+    return ConstSin(x + kPi / 2);
+}
+
+//========================================================================
+// Primitives
+//========================================================================
+
+struct Sphere {
+    float r;
+    constexpr explicit Sphere(float r) : r(r) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const { return fSphere(x, y, z, r); }
+    NodeRef ToNode() const { return sdf::Sphere(r); }
+};
+
+struct Box {
+    float sx, sy, sz;
+    constexpr Box(float sx, float sy, float sz) : sx(sx), sy(sy), sz(sz) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return fBox(x, y, z, sx, sy, sz);
+    }
+    NodeRef ToNode() const { return sdf::Box(glm::vec3(sx, sy, sz)); }
+};
+
+struct BoxCheap {
+    float sx, sy, sz;
+    constexpr BoxCheap(float sx, float sy, float sz)
+      : sx(sx), sy(sy), sz(sz) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return fBoxCheap(x, y, z, sx, sy, sz);
+    }
+    NodeRef ToNode() const { return sdf::BoxCheap(glm::vec3(sx, sy, sz)); }
+};
+
+struct Plane {
+    float nx, ny, nz, d;
+    constexpr Plane(float nx, float ny, float nz, float d)
+      : nx(nx), ny(ny), nz(nz), d(d) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return fPlane(x, y, z, nx, ny, nz, d);
+    }
+    NodeRef ToNode() const { return sdf::Plane(glm::vec3(nx, ny, nz), d); }
+};
+
+struct Cylinder {
+    float r, height;
+    constexpr Cylinder(float r, float height) : r(r), height(height) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return fCylinder(x, y, z, r, height);
+    }
+    NodeRef ToNode() const { return sdf::Cylinder(r, height); }
+};
+
+struct Capsule {
+    float r, c;
+    constexpr Capsule(float r, float c) : r(r), c(c) {}
+    inline float operator()(float x, float y, float z) const {
+        return fCapsule(x, y, z, r, c);
+    }
+    NodeRef ToNode() const { return sdf::Capsule(r, c); }
+};
+
+struct Torus {
+    float small_radius, large_radius;
+    constexpr Torus(float small_radius, float large_radius)
+      : small_radius(small_radius), large_radius(large_radius) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return fTorus(x, y, z, small_radius, large_radius);
+    }
+    NodeRef ToNode() const { return sdf::Torus(small_radius, large_radius); }
+};
+
+// The GDF solids: Begin and End select the range of GDFVectors.
+template<int Begin, int End>
+struct GDF {
+    float r;
+    constexpr explicit GDF(float r) : r(r) {}
+    inline float operator()(float x, float y, float z) const {
+        return fGDF(x, y, z, r, Begin, End);
+    }
+    NodeRef ToNode() const {
+        return std::make_shared<const Node>(
+            Op::GDF, std::vector<float>{r, float(Begin), float(End)},
+            std::vector<NodeRef>{});
+    }
+};
+typedef GDF<3, 6> Octahedron;
+typedef GDF<13, 18> Dodecahedron;
+typedef GDF<3, 12> Icosahedron;
+typedef GDF<0, 6> TruncatedOctahedron;
+typedef GDF<3, 18> TruncatedIcosahedron;
+
+//========================================================================
+// Domain operators
+//========================================================================
+
+template<typename T>
+struct Translate {
+    float ox, oy, oz;
+    T child;
+    constexpr Translate(float ox, float oy, float oz, T child)
+      : ox(ox), oy(oy), oz(oz), child(child) {}
+    template<typename F>
+    inline F operator()(F x, F y, F z) const {
+        return child(x - F(ox), y - F(oy), z - F(oz));
+    }
+    NodeRef ToNode() const {
+        return sdf::Translate(glm::vec3(ox, oy, oz), child.ToNode());
+    }
+};
+
+// pR(p.ab, angle).  The sine and cosine are computed at compile time.
+template<typename T>
+struct Rotate {
+    int a, b;
+    float angle, c, s;
+    T child;
+    constexpr Rotate(Axis a, Axis b, float angle, T child)
+      : a(a), b(b), angle(angle),
+        c(float(ConstCos(angle))), s(float(ConstSin(angle))),
+        child(child) {}
+    inline float operator()(float x, float y, float z) const {
+        float p[3] = {x, y, z};
+        pR(p[a], p[b], c, s);
+        return child(p[0], p[1], p[2]);
+    }
+    NodeRef ToNode() const {
+        return sdf::Rotate(Axis(a), Axis(b), angle, child.ToNode());
+    }
+};
+
+template<typename T>
+struct Mod1 {
+    int axis;
+    float size;
+    T child;
+    constexpr Mod1(Axis axis, float size, T child)
+      : axis(axis), size(size), child(child) {}
+    inline float operator()(float x, float y, float z) const {
+        float p[3] = {x, y, z};
+        pMod1(p[axis], size);
+        return child(p[0], p[1], p[2]);
+    }
+    NodeRef ToNode() const {
+        return sdf::Mod1(Axis(axis), size, child.ToNode());
+    }
+};
+
+template<typename T>
+struct ModMirror1 {
+    int axis;
+    float size;
+    T child;
+    constexpr ModMirror1(Axis axis, float size, T child)
+      : axis(axis), size(size), child(child) {}
+    inline float operator()(float x, float y, float z) const {
+        float p[3] = {x, y, z};
+        pModMirror1(p[axis], size);
+        return child(p[0], p[1], p[2]);
+    }
+    NodeRef ToNode() const {
+        return sdf::ModMirror1(Axis(axis), size, child.ToNode());
+    }
+};
+
+template<typename T>
+struct Mirror {
+    int axis;
+    float dist;
+    T child;
+    constexpr Mirror(Axis axis, float dist, T child)
+      : axis(axis), dist(dist), child(child) {}
+    inline float operator()(float x, float y, float z) const {
+        float p[3] = {x, y, z};
+        pMirror(p[axis], dist);
+        return child(p[0], p[1], p[2]);
+    }
+    NodeRef ToNode() const {
+        return sdf::Mirror(Axis(axis), dist, child.ToNode());
+    }
+};
+
+//========================================================================
+// Combinators
+//========================================================================
+
+// Combinators without parameters.
+#define RMX_FIXED_OP0(Name, fn)                                         \
+template<typename A, typename B>                                        \
+struct Name {                                                           \
+    A a;                                                                \
+    B b;                                                                \
+    constexpr Name(A a, B b) : a(a), b(b) {}                            \
+    template<typename F>                                                \
+    inline F operator()(F x, F y, F z) const {                          \
+        return fn(a(x, y, z), b(x, y, z));                              \
+    }                                                                   \
+    NodeRef ToNode() const { return sdf::Name(a.ToNode(), b.ToNode()); } \
+};
+
+// Combinators with one parameter.
+#define RMX_FIXED_OP1(Name, fn)                                         \
+template<typename A, typename B>                                        \
+struct Name {                                                           \
+    A a;                                                                \
+    B b;                                                                \
+    float r;                                                            \
+    constexpr Name(A a, B b, float r) : a(a), b(b), r(r) {}             \
+    template<typename F>                                                \
+    inline F operator()(F x, F y, F z) const {                          \
+        return fn(a(x, y, z), b(x, y, z), r);                           \
+    }                                                                   \
+    NodeRef ToNode() const {                                            \
+        return sdf::Name(a.ToNode(), b.ToNode(), r);                    \
+    }                                                                   \
+};
+
+// Combinators with two parameters.
+#define RMX_FIXED_OP2(Name, fn)                                         \
+template<typename A, typename B>                                        \
+struct Name {                                                           \
+    A a;                                                                \
+    B b;                                                                \
+    float r, n;                                                         \
+    constexpr Name(A a, B b, float r, float n)                          \
+      : a(a), b(b), r(r), n(n) {}                                       \
+    template<typename F>                                                \
+    inline F operator()(F x, F y, F z) const {                          \
+        return fn(a(x, y, z), b(x, y, z), r, n);                        \
+    }                                                                   \
+    NodeRef ToNode() const {                                            \
+        return sdf::Name(a.ToNode(), b.ToNode(), r, n);                 \
+    }                                                                   \
+};
+
+RMX_FIXED_OP0(Union, fOpUnion)
+RMX_FIXED_OP0(Intersection, fOpIntersection)
+RMX_FIXED_OP0(Difference, fOpDifference)
+RMX_FIXED_OP1(UnionRound, fOpUnionRound)
+RMX_FIXED_OP1(IntersectionRound, fOpIntersectionRound)
+RMX_FIXED_OP1(DifferenceRound, fOpDifferenceRound)
+RMX_FIXED_OP1(UnionChamfer, fOpUnionChamfer)
+RMX_FIXED_OP1(IntersectionChamfer, fOpIntersectionChamfer)
+RMX_FIXED_OP1(DifferenceChamfer, fOpDifferenceChamfer)
+RMX_FIXED_OP2(UnionColumns, fOpUnionColumns)
+RMX_FIXED_OP2(IntersectionColumns, fOpIntersectionColumns)
+RMX_FIXED_OP2(DifferenceColumns, fOpDifferenceColumns)
+RMX_FIXED_OP2(UnionStairs, fOpUnionStairs)
+RMX_FIXED_OP2(IntersectionStairs, fOpIntersectionStairs)
+RMX_FIXED_OP2(DifferenceStairs, fOpDifferenceStairs)
+RMX_FIXED_OP1(Pipe, fOpPipe)
+RMX_FIXED_OP1(Engrave, fOpEngrave)
+RMX_FIXED_OP2(Groove, fOpGroove)
+RMX_FIXED_OP2(Tongue, fOpTongue)
+
+#undef RMX_FIXED_OP0
+#undef RMX_FIXED_OP1
+#undef RMX_FIXED_OP2
+
+//========================================================================
+// Adaptor
+//========================================================================
+
+// Presents a fixed scene as a DistanceField.  The batch method inlines
+// the whole scene into its loop, so the packet marcher pays for one
+// virtual call per packet step and nothing per node.
+template<typename Scene>
+class StaticScene : public DistanceField {
+  public:
+    explicit StaticScene(const Scene& scene)
+      : scene_(scene),
+        fingerprint_(scene.ToNode()->Hash()) {}
+
+    float Distance(const glm::vec3& p) const override {
+        return scene_(p.x, p.y, p.z);
+    }
+    void Distance(const float* x, const float* y, const float* z,
+                  float* d, int n) const override {
+        for(int i=0; i<n; ++i) {
+            d[i] = scene_(x[i], y[i], z[i]);
+        }
+    }
+    uint64_t Fingerprint() const override { return fingerprint_; }
+
+    inline const Scene& scene() const { return scene_; }
+
+  private:
+    Scene scene_;
+    uint64_t fingerprint_;
+};
+
+template<typename Scene>
+std::shared_ptr<const DistanceField> MakeStaticScene(const Scene& scene) {
+    return std::make_shared<const StaticScene<Scene>>(scene);
+}
+
+}  // namespace fixed
+}  // namespace sdf
+}  // namespace GFX
+#endif // RMX_GFX_SDF_FIXED_H
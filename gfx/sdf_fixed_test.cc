@@ -0,0 +1,89 @@
+// Checks that sdf::fixed scenes evaluate the same field as their
+// ToNode() trees do through the VM, and that StaticScene presents them
+// unchanged.
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gfx/sdf.h"
+#include "gfx/sdf_fixed.h"
+#include "glm/glm.hpp"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace sdf {
+namespace {
+
+// The rotation constants and the scene itself fold at compile time.
+constexpr auto kSpun = fixed::Rotate(X, Y, 0.5f, fixed::Sphere(1.0f));
+static_assert(kSpun.c > 0.87758f && kSpun.c < 0.87759f, "cos(0.5)");
+static_assert(kSpun.s > 0.47942f && kSpun.s < 0.47943f, "sin(0.5)");
+static_assert(fixed::ConstSin(-7.0) < -0.65698 &&
+              fixed::ConstSin(-7.0) > -0.65699, "sin(-7)");
+
+// ConstSin and std::sin round differently, and the VM folds transforms
+// that the fixed scene applies one by one.
+const float kTolerance = 1e-4f;
+
+template<typename Scene>
+void ExpectSameField(const Scene& scene, float extent) {
+    std::unique_ptr<Program> program = Program::Compile(scene.ToNode());
+    auto field = fixed::MakeStaticScene(scene);
+    EXPECT_EQ(field->Fingerprint(), scene.ToNode()->Hash());
+
+    std::mt19937 rng(99);
+    std::uniform_real_distribution<float> u(-extent, extent);
+    std::vector<float> x(1000), y(1000), z(1000), d(1000);
+    for(size_t i = 0; i < x.size(); ++i) {
+        x[i] = u(rng);
+        y[i] = u(rng);
+        z[i] = u(rng);
+    }
+    field->Distance(x.data(), y.data(), z.data(), d.data(), d.size());
+    for(size_t i = 0; i < x.size(); ++i) {
+        glm::vec3 p(x[i], y[i], z[i]);
+        float want = program->Distance(p);
+        EXPECT_NEAR(scene(x[i], y[i], z[i]), want,
+                    kTolerance * std::max(1.0f, std::abs(want)))
+            << "at " << p.x << "," << p.y << "," << p.z;
+        EXPECT_EQ(d[i], field->Distance(p)) << "batch " << i;
+    }
+}
+
+TEST(SdfFixedTest, BoolOpsScene) {
+    constexpr auto scene = fixed::UnionRound(
+        fixed::Box(1, 1, 1), fixed::Translate(1, 1, 1, fixed::Sphere(1)),
+        0.3f);
+    ExpectSameField(scene, 4.0f);
+}
+
+TEST(SdfFixedTest, Combinators) {
+    constexpr fixed::Box box(1, 1, 1);
+    constexpr auto sphere = fixed::Translate(1, 1, 1, fixed::Sphere(1));
+    ExpectSameField(fixed::Intersection(box, sphere), 4.0f);
+    ExpectSameField(fixed::Difference(box, sphere), 4.0f);
+    ExpectSameField(fixed::IntersectionChamfer(box, sphere, 0.3f), 4.0f);
+    ExpectSameField(fixed::DifferenceColumns(box, sphere, 0.3f, 4), 4.0f);
+    ExpectSameField(fixed::UnionStairs(box, sphere, 0.3f, 4), 4.0f);
+    ExpectSameField(fixed::Pipe(box, sphere, 0.1f), 4.0f);
+    ExpectSameField(fixed::Tongue(box, sphere, 0.1f, 0.1f), 4.0f);
+}
+
+TEST(SdfFixedTest, PrimitivesAndDomains) {
+    constexpr auto solids = fixed::Union(
+        fixed::Rotate(X, Z, 0.4f, fixed::Cylinder(0.5f, 1.0f)),
+        fixed::Union(fixed::Translate(-2, 0, 0, fixed::Dodecahedron(0.8f)),
+                     fixed::Translate(2, 0, 0, fixed::Capsule(0.3f, 1.0f))));
+    constexpr auto scene = fixed::Union(
+        fixed::Plane(0, 1, 0, 2),
+        fixed::Mirror(Z, 1.0f,
+                      fixed::ModMirror1(X, 6.0f,
+                                        fixed::Mod1(Y, 5.0f, solids))));
+    ExpectSameField(scene, 8.0f);
+}
+
+}  // namespace
+}  // namespace sdf
+}  // namespace GFX
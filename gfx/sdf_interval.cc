@@ -0,0 +1,360 @@
+#include "gfx/sdf_interval.h"
+
+#include <cmath>
+
+#include "gfx/sdf_primitives.h"
+
+namespace GFX {
+namespace sdf {
+namespace {
+const float kSqrt2 = 1.41421356f;
+
+// The interval bounds are computed in float, like the distances they
+// bound, so only prune when one side wins by more than rounding error.
+inline bool Below(float a, float b) {
+    return a < b - 1e-5f * (1.0f + std::fabs(b));
+}
+
+inline Interval operator+(Interval a, Interval b) {
+    return Interval{a.lo + b.lo, a.hi + b.hi};
+}
+inline Interval operator-(Interval a, Interval b) {
+    return Interval{a.lo - b.hi, a.hi - b.lo};
+}
+inline Interval operator-(Interval a) {
+    return Interval{-a.hi, -a.lo};
+}
+inline Interval operator+(Interval a, float b) {
+    return Interval{a.lo + b, a.hi + b};
+}
+inline Interval operator-(Interval a, float b) {
+    return Interval{a.lo - b, a.hi - b};
+}
+inline Interval operator*(Interval a, float k) {
+    return k >= 0 ? Interval{a.lo * k, a.hi * k}
+                  : Interval{a.hi * k, a.lo * k};
+}
+inline Interval Min(Interval a, Interval b) {
+    return Interval{std::min(a.lo, b.lo), std::min(a.hi, b.hi)};
+}
+inline Interval Max(Interval a, Interval b) {
+    return Interval{std::max(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+inline Interval Max(Interval a, float b) {
+    return Interval{std::max(a.lo, b), std::max(a.hi, b)};
+}
+inline Interval Abs(Interval a) {
+    if (a.lo >= 0)
+        return a;
+    if (a.hi <= 0)
+        return -a;
+    return Interval{0, std::max(-a.lo, a.hi)};
+}
+inline Interval Square(Interval a) {
+    Interval b = Abs(a);
+    return Interval{b.lo * b.lo, b.hi * b.hi};
+}
+inline Interval Sqrt(Interval a) {
+    return Interval{std::sqrt(std::max(a.lo, 0.0f)),
+                    std::sqrt(std::max(a.hi, 0.0f))};
+}
+inline Interval Length(Interval x, Interval y) {
+    return Sqrt(Square(x) + Square(y));
+}
+inline Interval Length(Interval x, Interval y, Interval z) {
+    return Sqrt(Square(x) + Square(y) + Square(z));
+}
+
+// A position region as one interval per axis.
+struct Region {
+    Interval p[3];
+};
+
+Region Transform(const Node& n, Region r) {
+    const auto& k = n.params();
+    switch(n.op()) {
+    case Op::TRANSLATE:
+        for(int i=0; i<3; ++i) {
+            r.p[i] = r.p[i] - k[i];
+        }
+        break;
+    case Op::ROTATE: {
+        int a = int(k[0]), b = int(k[1]);
+        float c = std::cos(k[2]), s = std::sin(k[2]);
+        Interval pa = r.p[a], pb = r.p[b];
+        r.p[a] = pa * c + pb * s;
+        r.p[b] = pb * c - pa * s;
+        break;
+    }
+    case Op::MOD1:
+    case Op::MOD_MIRROR1: {
+        Interval& p = r.p[int(k[0])];
+        float size = k[1];
+        float half = size * 0.5f;
+        float c0 = std::floor((p.lo + half) / size);
+        float c1 = std::floor((p.hi + half) / size);
+        if (c0 != c1) {
+            // The region spans more than one cell.
+            p = Interval{-half, half};
+        } else {
+            p = p - c0 * size;
+            if (n.op() == Op::MOD_MIRROR1 && mod(c0, 2.0f) == 0) {
+                p = -p;
+            }
+        }
+        break;
+    }
+    case Op::MIRROR: {
+        Interval& p = r.p[int(k[0])];
+        p = Abs(p) - k[1];
+        break;
+    }
+    default:
+        break;
+    }
+    return r;
+}
+
+Interval Primitive(const Node& n, const Region& r) {
+    const auto& k = n.params();
+    Interval x = r.p[0], y = r.p[1], z = r.p[2];
+    switch(n.op()) {
+    case Op::SPHERE:
+        return Length(x, y, z) - k[0];
+    case Op::BOX: {
+        // fBox is monotonic in |p|, so evaluate it at the ends of the range.
+        Interval ax = Abs(x), ay = Abs(y), az = Abs(z);
+        return Interval{fBox(ax.lo, ay.lo, az.lo, k[0], k[1], k[2]),
+                        fBox(ax.hi, ay.hi, az.hi, k[0], k[1], k[2])};
+    }
+    case Op::BOX_CHEAP:
+        return Max(Max(Abs(x) - k[0], Abs(y) - k[1]), Abs(z) - k[2]);
+    case Op::PLANE:
+        return x * k[0] + y * k[1] + z * k[2] + k[3];
+    case Op::CYLINDER:
+        return Max(Length(x, z) - k[0], Abs(y) - k[1]);
+    case Op::CAPSULE:
+        return Length(x, Max(Abs(y) - k[1], 0.0f), z) - k[0];
+    case Op::TORUS:
+        return Length(Length(x, z) - k[1], y) - k[0];
+    case Op::GDF: {
+        Interval d{0, 0};
+        for(int i=int(k[1]); i<=int(k[2]); ++i) {
+            const float* v = GDFVector(i);
+            d = Max(d, Abs(x * v[0] + y * v[1] + z * v[2]));
+        }
+        return d - k[0];
+    }
+    default:
+        return Interval{-INFINITY, INFINITY};
+    }
+}
+
+// Bounds for the smooth union combinators.  Each is at most min(a, b)
+// and can only undercut it by an amount related to r; see hg_sdf.inc.
+Interval UnionLike(Op op, Interval a, Interval b, float r) {
+    Interval m = Min(a, b);
+    float lo = m.lo;
+    switch(op) {
+    case Op::UNION_ROUND:
+        if (m.lo < r)
+            lo = kSqrt2 * m.lo - (kSqrt2 - 1) * r;
+        break;
+    case Op::UNION_CHAMFER:
+        lo = std::min(m.lo, kSqrt2 * m.lo - r / kSqrt2);
+        break;
+    case Op::UNION_COLUMNS:
+        if (m.lo < r)
+            lo = std::min({m.lo, kSqrt2 * m.lo - r, -r});
+        break;
+    case Op::UNION_STAIRS:
+        lo = m.lo - r * 0.5f;
+        break;
+    default:
+        break;
+    }
+    return Interval{lo, m.hi};
+}
+
+// The union variant of an intersection or difference combinator.
+Op UnionOf(Op op) {
+    switch(op) {
+    case Op::INTERSECTION_ROUND: case Op::DIFFERENCE_ROUND:
+        return Op::UNION_ROUND;
+    case Op::INTERSECTION_CHAMFER: case Op::DIFFERENCE_CHAMFER:
+        return Op::UNION_CHAMFER;
+    case Op::INTERSECTION_COLUMNS: case Op::DIFFERENCE_COLUMNS:
+        return Op::UNION_COLUMNS;
+    case Op::INTERSECTION_STAIRS: case Op::DIFFERENCE_STAIRS:
+        return Op::UNION_STAIRS;
+    case Op::INTERSECTION: case Op::DIFFERENCE:
+        return Op::UNION;
+    default:
+        return op;
+    }
+}
+
+// Which children of a combinator can affect the result.
+enum Keep { KEEP_BOTH, KEEP_A, KEEP_B };
+
+// Decide whether fOpUnion*(a, b) reduces to b for every a and b in range.
+bool UnionIsB(Op op, Interval a, Interval b, float r) {
+    switch(op) {
+    case Op::UNION:
+        return Below(b.hi, a.lo);
+    case Op::UNION_ROUND:
+        return Below(std::max(r, b.hi), a.lo);
+    case Op::UNION_CHAMFER:
+        return Below(b.hi, a.lo) &&
+               Below((kSqrt2 - 1) * std::max(b.hi, 0.0f), a.lo - r);
+    case Op::UNION_COLUMNS:
+        return Below(std::max(r, b.hi), a.lo);
+    case Op::UNION_STAIRS:
+        return Below(b.hi, a.lo - r);
+    default:
+        return false;
+    }
+}
+
+Keep Combine(const Node& n, Interval a, Interval b, Interval* out) {
+    const auto& k = n.params();
+    float r = k.empty() ? 0.0f : k[0];
+    Op op = n.op();
+    switch(op) {
+    case Op::UNION:
+    case Op::UNION_ROUND:
+    case Op::UNION_CHAMFER:
+    case Op::UNION_COLUMNS:
+    case Op::UNION_STAIRS:
+        *out = UnionLike(op, a, b, r);
+        if (UnionIsB(op, a, b, r)) return KEEP_B;
+        // Stairs isn't symmetric in a and b, but the test is.
+        if (UnionIsB(op, b, a, r)) return KEEP_A;
+        return KEEP_BOTH;
+
+    case Op::INTERSECTION:
+    case Op::INTERSECTION_ROUND:
+    case Op::INTERSECTION_CHAMFER:
+    case Op::INTERSECTION_COLUMNS:
+    case Op::INTERSECTION_STAIRS:
+    case Op::DIFFERENCE:
+    case Op::DIFFERENCE_ROUND:
+    case Op::DIFFERENCE_CHAMFER:
+    case Op::DIFFERENCE_COLUMNS:
+    case Op::DIFFERENCE_STAIRS: {
+        // Difference(a, b) == Intersection(a, -b), and for all but the
+        // columns Intersection(a, b) == -Union(-a, -b).
+        bool difference = op == Op::DIFFERENCE ||
+                          op == Op::DIFFERENCE_ROUND ||
+                          op == Op::DIFFERENCE_CHAMFER ||
+                          op == Op::DIFFERENCE_COLUMNS ||
+                          op == Op::DIFFERENCE_STAIRS;
+        Interval nb = difference ? -b : b;
+        Op u = UnionOf(op);
+        if (u == Op::UNION_COLUMNS) {
+            Interval m = Max(a, nb);
+            *out = Interval{m.lo, std::max(m.hi, kSqrt2 * (m.hi + r))};
+            return KEEP_BOTH;
+        }
+        *out = -UnionLike(u, -a, -nb, r);
+        // Reducing a difference to -b would need a negation node.
+        if (!difference && UnionIsB(u, -a, -nb, r)) return KEEP_B;
+        if (UnionIsB(u, -nb, -a, r)) return KEEP_A;
+        return KEEP_BOTH;
+    }
+
+    case Op::PIPE:
+        *out = Length(a, b) - r;
+        return KEEP_BOTH;
+    case Op::ENGRAVE: {
+        // max(a, (a + r - |b|) / sqrt(2))
+        Interval e = (a + r - Abs(b)) * (1.0f / kSqrt2);
+        *out = Max(a, e);
+        return Below(e.hi, a.lo) ? KEEP_A : KEEP_BOTH;
+    }
+    case Op::GROOVE: {
+        // max(a, min(a + ra, rb - |b|))
+        Interval g = Min(a + k[0], -Abs(b) + k[1]);
+        *out = Max(a, g);
+        return Below(k[1] - Abs(b).lo, a.lo) ? KEEP_A : KEEP_BOTH;
+    }
+    case Op::TONGUE: {
+        // min(a, max(a - ra, |b| - rb))
+        Interval t = Max(a - k[0], Abs(b) - k[1]);
+        *out = Min(a, t);
+        return Below(a.hi, Abs(b).lo - k[1]) ? KEEP_A : KEEP_BOTH;
+    }
+    default:
+        *out = Interval{-INFINITY, INFINITY};
+        return KEEP_BOTH;
+    }
+}
+
+NodeRef PruneNode(const NodeRef& node, const Region& region,
+                  Interval* range) {
+    const Node& n = *node;
+    if (IsPrimitive(n.op())) {
+        *range = Primitive(n, region);
+        return node;
+    }
+    if (IsDomain(n.op())) {
+        NodeRef child = PruneNode(n.child(0), Transform(n, region), range);
+        if (child == n.child(0))
+            return node;
+        return std::make_shared<const Node>(n.op(), n.params(),
+                                            std::vector<NodeRef>{child});
+    }
+
+    Interval a, b;
+    NodeRef ca = PruneNode(n.child(0), region, &a);
+    NodeRef cb = PruneNode(n.child(1), region, &b);
+    switch(Combine(n, a, b, range)) {
+    case KEEP_A:
+        *range = a;
+        return ca;
+    case KEEP_B:
+        *range = b;
+        return cb;
+    case KEEP_BOTH:
+        break;
+    }
+    if (ca == n.child(0) && cb == n.child(1))
+        return node;
+    return std::make_shared<const Node>(n.op(), n.params(),
+                                        std::vector<NodeRef>{ca, cb});
+}
+
+Region ToRegion(const Bounds& b) {
+    return Region{{Interval{b.lo.x, b.hi.x},
+                   Interval{b.lo.y, b.hi.y},
+                   Interval{b.lo.z, b.hi.z}}};
+}
+}  // namespace
+
+Interval EvalInterval(const NodeRef& root, const Bounds& region) {
+    Interval range;
+    PruneNode(root, ToRegion(region), &range);
+    return range;
+}
+
+NodeRef Prune(const NodeRef& root, const Bounds& region, Interval* range) {
+    Interval r;
+    NodeRef result = PruneNode(root, ToRegion(region), &r);
+    if (range) {
+        *range = r;
+    }
+    return result;
+}
+
+int CountPrimitives(const NodeRef& root) {
+    if (IsPrimitive(root->op()))
+        return 1;
+    int n = 0;
+    for(const auto& c : root->children()) {
+        n += CountPrimitives(c);
+    }
+    return n;
+}
+
+}  // namespace sdf
+}  // namespace GFX
@@ -0,0 +1,57 @@
+#ifndef RMX_GFX_SDF_INTERVAL_H
+#define RMX_GFX_SDF_INTERVAL_H
+#include <algorithm>
+
+#include "gfx/sdf.h"
+#include "glm/glm.hpp"
+
+// Interval arithmetic over sdf::Node trees.
+//
+// EvalInterval bounds the distance a scene can take anywhere inside an
+// axis-aligned box.  Prune uses those bounds to drop the subtrees which
+// provably can't affect the result inside the box: e.g. in Union(a, b),
+// if a is always further away than b, the union is just b.  The pruned
+// tree evaluates to exactly the same distance as the original for every
+// point in the box, so it can stand in for the full scene there.
+
+namespace GFX {
+namespace sdf {
+
+struct Interval {
+    float lo;
+    float hi;
+};
+
+// An axis-aligned box.
+struct Bounds {
+    glm::vec3 lo;
+    glm::vec3 hi;
+
+    inline glm::vec3 size() const { return hi - lo; }
+    inline bool Contains(const glm::vec3& p) const {
+        return p.x >= lo.x && p.y >= lo.y && p.z >= lo.z &&
+               p.x <= hi.x && p.y <= hi.y && p.z <= hi.z;
+    }
+    inline void Extend(const glm::vec3& p) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+};
+
+// The range of distances the scene takes inside region.  The bounds are
+// conservative: the true range is always contained in the result.
+Interval EvalInterval(const NodeRef& root, const Bounds& region);
+
+// The scene with every subtree which can't affect the distance inside
+// region removed.  If range is not null it receives the range of the
+// scene inside region.
+NodeRef Prune(const NodeRef& root, const Bounds& region,
+              Interval* range=nullptr);
+
+// The number of primitives in the tree, counting shared subtrees once
+// per use.
+int CountPrimitives(const NodeRef& root);
+
+}  // namespace sdf
+}  // namespace GFX
+#endif // RMX_GFX_SDF_INTERVAL_H
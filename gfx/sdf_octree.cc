@@ -0,0 +1,126 @@
+#include "gfx/sdf_octree.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "gfx/octree.h"
+
+namespace GFX {
+namespace sdf {
+
+OctreeScene::OctreeScene(const NodeRef& scene, const Bounds& bounds,
+                         int max_depth, int leaf_primitives)
+  : bounds_(bounds),
+    resolution_(1 << max_depth),
+    scale_(float(1 << max_depth) / bounds.size()),
+    full_(Program::Compile(scene)),
+    cells_(size_t(resolution_) * resolution_ * resolution_),
+    leaves_(0) {
+    Build(scene, max_depth, leaf_primitives);
+
+    fingerprint_ = full_->Fingerprint() ^
+                   (uint64_t(max_depth) << 56 | uint64_t(leaf_primitives) << 48);
+}
+
+void OctreeScene::Build(const NodeRef& scene, int max_depth,
+                        int leaf_primitives) {
+    // Compiled programs keyed on the pruned tree.
+    std::unordered_map<uint64_t,
+                       std::vector<std::pair<NodeRef, const Program*>>> seen;
+    // The scene pruned to the cell being visited and to its ancestors.
+    std::vector<NodeRef> pruned(max_depth + 1);
+
+    auto visit = [&](const OctreeCell& cell) {
+        // Pad the cell a little so points which round into it from
+        // outside are still covered.
+        glm::vec3 pad = (cell.hi - cell.lo) * 1e-3f;
+        const NodeRef& parent = cell.depth > 0 ? pruned[cell.depth - 1]
+                                               : scene;
+        NodeRef& p = pruned[cell.depth];
+        p = Prune(parent, Bounds{cell.lo - pad, cell.hi + pad});
+        if (cell.depth < max_depth && CountPrimitives(p) > leaf_primitives) {
+            return true;
+        }
+
+        const Program* program = nullptr;
+        auto& bucket = seen[p->Hash()];
+        for(const auto& s : bucket) {
+            if (Node::Equal(s.first, p)) {
+                program = s.second;
+                break;
+            }
+        }
+        if (!program) {
+            programs_.push_back(Program::Compile(p));
+            program = programs_.back().get();
+            bucket.emplace_back(p, program);
+        }
+
+        leaves_ += 1;
+        int size = resolution_ >> cell.depth;
+        glm::ivec3 c = cell.index * size;
+        for(int k=c.z; k<c.z+size; ++k) {
+            for(int j=c.y; j<c.y+size; ++j) {
+                for(int i=c.x; i<c.x+size; ++i) {
+                    cells_[(size_t(k) * resolution_ + j) * resolution_ + i] =
+                        program;
+                }
+            }
+        }
+        return false;
+    };
+    SubdivideOctree(OctreeCell{bounds_.lo, bounds_.hi, 0, glm::ivec3(0)},
+                    visit);
+}
+
+float OctreeScene::mean_instructions() const {
+    double sum = 0;
+    for(const Program* p : cells_) {
+        sum += p->code().size();
+    }
+    return sum / cells_.size();
+}
+
+// The grid cell containing (x, y, z), or -1 if it's outside bounds.
+int OctreeScene::CellIndex(float x, float y, float z) const {
+    glm::vec3 p(x, y, z);
+    if (!bounds_.Contains(p))
+        return -1;
+    glm::vec3 f = (p - bounds_.lo) * scale_;
+    int i = std::min(int(f.x), resolution_ - 1);
+    int j = std::min(int(f.y), resolution_ - 1);
+    int k = std::min(int(f.z), resolution_ - 1);
+    return (k * resolution_ + j) * resolution_ + i;
+}
+
+float OctreeScene::Distance(const glm::vec3& p) const {
+    int cell = CellIndex(p.x, p.y, p.z);
+    const Program* program = cell < 0 ? full_.get() : cells_[cell];
+    return program->Distance(p);
+}
+
+void OctreeScene::Distance(const float* x, const float* y, const float* z,
+                           float* d, int n) const {
+    // Neighbouring points (e.g. the lanes of a ray packet) are usually in
+    // the same cell, so hand each run of points sharing a program to it
+    // in one batch.
+    int start = 0;
+    const Program* run = nullptr;
+    for(int i=0; i<n; ++i) {
+        int cell = CellIndex(x[i], y[i], z[i]);
+        const Program* program = cell < 0 ? full_.get() : cells_[cell];
+        if (program != run) {
+            if (run) {
+                run->Distance(x+start, y+start, z+start, d+start, i-start);
+            }
+            run = program;
+            start = i;
+        }
+    }
+    if (run) {
+        run->Distance(x+start, y+start, z+start, d+start, n-start);
+    }
+}
+
+}  // namespace sdf
+}  // namespace GFX
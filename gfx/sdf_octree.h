@@ -0,0 +1,62 @@
+#ifndef RMX_GFX_SDF_OCTREE_H
+#define RMX_GFX_SDF_OCTREE_H
+#include <memory>
+#include <vector>
+
+#include "gfx/distance_field.h"
+#include "gfx/sdf.h"
+#include "gfx/sdf_interval.h"
+
+namespace GFX {
+namespace sdf {
+
+// A scene split into octree cells, each with its own pruned program.
+//
+// The octree subdivides bounds until a cell's pruned scene has at most
+// leaf_primitives primitives or the cell is at max_depth, walking it
+// with SubdivideOctree from gfx/octree.h.  Children are pruned from their
+// parent's already pruned scene, so building stays cheap for large
+// scenes.  Cells whose pruned scenes are identical share
+// one compiled program.
+//
+// Within a cell, the pruned program gives the same distance as the full
+// scene, so this can replace the full scene anywhere: primary rays,
+// shadow rays and normals alike.  Points outside bounds use the full
+// scene.
+class OctreeScene : public DistanceField {
+  public:
+    OctreeScene(const NodeRef& scene, const Bounds& bounds,
+                int max_depth=4, int leaf_primitives=4);
+
+    float Distance(const glm::vec3& p) const override;
+    void Distance(const float* x, const float* y, const float* z,
+                  float* d, int n) const override;
+    uint64_t Fingerprint() const override { return fingerprint_; }
+
+    // Build statistics.
+    inline int leaves() const { return leaves_; }
+    inline int programs() const { return programs_.size(); }
+    // The number of instructions in the full program and the average
+    // over all cells, weighted by volume.
+    inline int full_instructions() const { return full_->code().size(); }
+    float mean_instructions() const;
+
+  private:
+    void Build(const NodeRef& scene, int max_depth, int leaf_primitives);
+    int CellIndex(float x, float y, float z) const;
+
+    Bounds bounds_;
+    int resolution_;
+    glm::vec3 scale_;
+    std::unique_ptr<Program> full_;
+    std::vector<std::unique_ptr<Program>> programs_;
+    // The program for each cell of a resolution_^3 grid.  Cells above
+    // max_depth point every grid cell they cover at the same program.
+    std::vector<const Program*> cells_;
+    int leaves_;
+    uint64_t fingerprint_;
+};
+
+}  // namespace sdf
+}  // namespace GFX
+#endif // RMX_GFX_SDF_OCTREE_H
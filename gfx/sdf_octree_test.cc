@@ -0,0 +1,88 @@
+// Checks that an OctreeScene gives the same distance as its whole scene,
+// and that SWMarcher renders the same image with it as without.
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gfx/sdf.h"
+#include "gfx/sdf_octree.h"
+#include "gfx/swmarch.h"
+#include "glm/glm.hpp"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace {
+
+const sdf::Bounds kBounds{glm::vec3(-4.0f, -1.0f, -4.0f),
+                          glm::vec3(4.0f, 1.0f, 4.0f)};
+
+// A grid of spheres and boxes with a rounded union in the middle, big
+// enough that most cells only keep a few of them.
+sdf::NodeRef TestScene() {
+    using namespace sdf;
+    NodeRef scene;
+    for(int i = 0; i < 8; ++i) {
+        for(int j = 0; j < 8; ++j) {
+            NodeRef p = (i + j) & 1 ? Sphere(0.3f) : Box(glm::vec3(0.25f));
+            p = Translate(glm::vec3(i - 3.5f, 0.0f, j - 3.5f), p);
+            scene = scene ? Union(scene, p) : p;
+        }
+    }
+    return Union(scene, UnionRound(Sphere(0.5f), Box(glm::vec3(0.4f)),
+                                   0.2f));
+}
+
+TEST(OctreeSceneTest, MatchesTheWholeScene) {
+    sdf::NodeRef scene = TestScene();
+    std::unique_ptr<sdf::Program> full = sdf::Program::Compile(scene);
+    sdf::OctreeScene octree(scene, kBounds);
+    EXPECT_GT(octree.leaves(), 1);
+    EXPECT_LT(octree.mean_instructions(), octree.full_instructions() / 4);
+    EXPECT_NE(octree.Fingerprint(), full->Fingerprint());
+
+    // Points inside and around the bounds.
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> u(-5.0f, 5.0f);
+    const int kN = 4096;
+    std::vector<float> x(kN), y(kN), z(kN), d(kN);
+    for(int i = 0; i < kN; ++i) {
+        x[i] = u(rng);
+        y[i] = u(rng) * 0.4f;
+        z[i] = u(rng);
+        glm::vec3 p(x[i], y[i], z[i]);
+        ASSERT_EQ(octree.Distance(p), full->Distance(p)) << i;
+    }
+    octree.Distance(x.data(), y.data(), z.data(), d.data(), kN);
+    for(int i = 0; i < kN; ++i) {
+        ASSERT_EQ(d[i], full->Distance(glm::vec3(x[i], y[i], z[i]))) << i;
+    }
+}
+
+std::vector<uint32_t> Render(SWMarcher* marcher) {
+    marcher->Render();
+    return std::vector<uint32_t>(
+        marcher->pixels(),
+        marcher->pixels() + marcher->width() * marcher->height());
+}
+
+TEST(OctreeSceneTest, SWMarcherRendersTheSameImage) {
+    sdf::NodeRef scene = TestScene();
+    SWMarcher marcher(96, 64, 2);
+    marcher.set_upload(false);
+    marcher.camera()->eye = glm::vec3(0.0f, 0.5f, -5.0f);
+
+    for(const PacketKernels* kernels :
+            {static_cast<const PacketKernels*>(nullptr),
+             PacketKernels::Best()}) {
+        marcher.set_packet_kernels(kernels);
+        marcher.set_scene(sdf::Program::Compile(scene));
+        std::vector<uint32_t> whole = Render(&marcher);
+        marcher.set_scene(scene, kBounds);
+        ASSERT_NE(marcher.scene(), nullptr);
+        std::vector<uint32_t> pruned = Render(&marcher);
+        EXPECT_EQ(pruned, whole) << (kernels ? "packets" : "scalar");
+    }
+}
+
+}  // namespace
+}  // namespace GFX
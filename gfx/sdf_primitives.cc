@@ -0,0 +1,87 @@
+#include "gfx/sdf_primitives.h"
+
+namespace GFX {
+namespace sdf {
+namespace {
+const float kSqrt2 = 1.41421356f;
+const float PHI = 1.61803399f;
+
+struct GDFTable {
+    float v[19][3];
+    GDFTable() {
+        const float raw[19][3] = {
+            {1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+            {1, 1, 1}, {-1, 1, 1}, {1, -1, 1}, {1, 1, -1},
+            {0, 1, PHI+1}, {0, -1, PHI+1}, {PHI+1, 0, 1},
+            {-PHI-1, 0, 1}, {1, PHI+1, 0}, {-1, PHI+1, 0},
+            {0, PHI, 1}, {0, -PHI, 1}, {1, 0, PHI},
+            {-1, 0, PHI}, {PHI, 1, 0}, {-PHI, 1, 0},
+        };
+        for(int i=0; i<19; ++i) {
+            float l = Length(raw[i][0], raw[i][1], raw[i][2]);
+            for(int j=0; j<3; ++j) {
+                v[i][j] = raw[i][j] / l;
+            }
+        }
+    }
+};
+}  // namespace
+
+const float* GDFVector(int i) {
+    static const GDFTable table;
+    return table.v[i];
+}
+
+float fOpUnionColumns(float a, float b, float r, float n) {
+    if ((a < r) && (b < r)) {
+        float columnradius = r*kSqrt2/((n-1)*2+kSqrt2);
+        // pR45
+        float px = (a + b) * kSqrtHalf;
+        float py = (b - a) * kSqrtHalf;
+        px -= kSqrt2/2*r;
+        px += columnradius*kSqrt2;
+        if (mod(n, 2.0f) == 1) {
+            py += columnradius;
+        }
+        // At this point, we have turned 45 degrees and moved at a point on
+        // the diagonal that we want to place the columns on.  Now, repeat
+        // the domain along this direction and place a circle.
+        pMod1(py, columnradius*2);
+        float result = Length(px, py) - columnradius;
+        result = std::min(result, px);
+        result = std::min(result, a);
+        return std::min(result, b);
+    } else {
+        return std::min(a, b);
+    }
+}
+
+float fOpDifferenceColumns(float a, float b, float r, float n) {
+    a = -a;
+    float m = std::min(a, b);
+    // Avoid the expensive computation where not needed (produces
+    // discontinuity though).
+    if ((a < r) && (b < r)) {
+        float columnradius = r*kSqrt2/((n-1)*2+kSqrt2);
+        // pR45
+        float px = (a + b) * kSqrtHalf;
+        float py = (b - a) * kSqrtHalf;
+        py += columnradius;
+        px -= kSqrt2/2*r;
+        px += -columnradius*kSqrt2/2;
+        if (mod(n, 2.0f) == 1) {
+            py += columnradius;
+        }
+        pMod1(py, columnradius*2);
+
+        float result = -Length(px, py) + columnradius;
+        result = std::max(result, px);
+        result = std::min(result, a);
+        return -std::min(result, b);
+    } else {
+        return -m;
+    }
+}
+
+}  // namespace sdf
+}  // namespace GFX
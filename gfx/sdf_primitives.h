@@ -0,0 +1,242 @@
+#ifndef RMX_GFX_SDF_PRIMITIVES_H
+#define RMX_GFX_SDF_PRIMITIVES_H
+#include <algorithm>
+#include <cmath>
+
+// CPU ports of the hg_sdf.inc primitives, domain operators and
+// combinators used by the software marcher and the SDF bytecode VM.
+//
+// The branch-free functions are templates over the lane type F so the
+// same source serves the scalar marcher (F = float) and the ray-packet
+// kernels (F = Float4, Float8, Float16 from gfx/simd.h).  The scalar and
+// packet paths therefore execute the same arithmetic in the same order
+// and produce identical distances.  Functions which branch per point are
+// only provided for float.
+
+namespace GFX {
+namespace sdf {
+
+template<typename F>
+inline F vmax(F x, F y, F z) {
+    using std::max;
+    return max(max(x, y), z);
+}
+
+template<typename F>
+inline F Length(F x, F y, F z) {
+    using std::sqrt;
+    return sqrt(x*x + y*y + z*z);
+}
+
+template<typename F>
+inline F fSphere(F x, F y, F z, float radius) {
+    return Length(x, y, z) - F(radius);
+}
+
+template<typename F>
+inline F fBoxCheap(F x, F y, F z, float sx, float sy, float sz) {
+    using std::abs;
+    return vmax(abs(x) - F(sx), abs(y) - F(sy), abs(z) - F(sz));
+}
+
+template<typename F>
+inline F Length(F x, F y) {
+    using std::sqrt;
+    return sqrt(x*x + y*y);
+}
+
+template<typename F>
+inline F fBox(F x, F y, F z, float sx, float sy, float sz) {
+    using std::abs;
+    using std::max;
+    using std::min;
+    F dx = abs(x) - F(sx), dy = abs(y) - F(sy), dz = abs(z) - F(sz);
+    F zero(0.0f);
+    return Length(max(dx, zero), max(dy, zero), max(dz, zero)) +
+           vmax(min(dx, zero), min(dy, zero), min(dz, zero));
+}
+
+template<typename F>
+inline F fPlane(F x, F y, F z, float nx, float ny, float nz, float dist) {
+    return x*F(nx) + y*F(ny) + z*F(nz) + F(dist);
+}
+
+template<typename F>
+inline F fCylinder(F x, F y, F z, float r, float height) {
+    using std::abs;
+    using std::max;
+    return max(Length(x, z) - F(r), abs(y) - F(height));
+}
+
+template<typename F>
+inline F fTorus(F x, F y, F z, float small_radius, float large_radius) {
+    return Length(Length(x, z) - F(large_radius), y) - F(small_radius);
+}
+
+inline float fCapsule(float x, float y, float z, float r, float c) {
+    float ay = std::fabs(y);
+    return ay < c ? Length(x, z) - r : Length(x, ay - c, z) - r;
+}
+
+// Entry i of the GDFVectors table from hg_sdf.inc.
+const float* GDFVector(int i);
+
+inline float fGDF(float x, float y, float z, float r, int begin, int end) {
+    float d = 0;
+    for(int i=begin; i<=end; ++i) {
+        const float* v = GDFVector(i);
+        d = std::max(d, std::fabs(x*v[0] + y*v[1] + z*v[2]));
+    }
+    return d - r;
+}
+
+// Domain operators.  These take the coordinate(s) by reference and
+// modify them in place, like the inout parameters in hg_sdf.inc.
+
+inline float mod(float x, float y) {
+    return x - y * std::floor(x / y);
+}
+
+inline void pR(float& a, float& b, float cos_angle, float sin_angle) {
+    float na = cos_angle * a + sin_angle * b;
+    float nb = cos_angle * b - sin_angle * a;
+    a = na;
+    b = nb;
+}
+
+inline float pMod1(float& p, float size) {
+    float halfsize = size * 0.5f;
+    float c = std::floor((p + halfsize) / size);
+    p = mod(p + halfsize, size) - halfsize;
+    return c;
+}
+
+inline float pModMirror1(float& p, float size) {
+    float halfsize = size * 0.5f;
+    float c = std::floor((p + halfsize) / size);
+    p = mod(p + halfsize, size) - halfsize;
+    p *= mod(c, 2.0f) * 2.0f - 1.0f;
+    return c;
+}
+
+inline float pMirror(float& p, float dist) {
+    float s = p < 0 ? -1.0f : 1.0f;
+    p = std::fabs(p) - dist;
+    return s;
+}
+
+// Combinators.
+const float kSqrtHalf = 0.70710678f;
+
+template<typename F>
+inline F fOpUnion(F a, F b) { using std::min; return min(a, b); }
+
+template<typename F>
+inline F fOpIntersection(F a, F b) { using std::max; return max(a, b); }
+
+template<typename F>
+inline F fOpDifference(F a, F b) { using std::max; return max(a, -b); }
+
+template<typename F>
+inline F fOpUnionChamfer(F a, F b, float r) {
+    using std::min;
+    return min(min(a, b), (a - F(r) + b) * F(kSqrtHalf));
+}
+
+template<typename F>
+inline F fOpIntersectionChamfer(F a, F b, float r) {
+    using std::max;
+    return max(max(a, b), (a + F(r) + b) * F(kSqrtHalf));
+}
+
+template<typename F>
+inline F fOpDifferenceChamfer(F a, F b, float r) {
+    return fOpIntersectionChamfer(a, -b, r);
+}
+
+template<typename F>
+inline F fOpUnionRound(F a, F b, float r) {
+    using std::max;
+    using std::min;
+    F zero(0.0f);
+    return max(F(r), min(a, b)) -
+           Length(max(F(r) - a, zero), max(F(r) - b, zero));
+}
+
+template<typename F>
+inline F fOpIntersectionRound(F a, F b, float r) {
+    using std::max;
+    using std::min;
+    F zero(0.0f);
+    return min(F(-r), max(a, b)) +
+           Length(max(F(r) + a, zero), max(F(r) + b, zero));
+}
+
+template<typename F>
+inline F fOpDifferenceRound(F a, F b, float r) {
+    return fOpIntersectionRound(a, -b, r);
+}
+
+float fOpUnionColumns(float a, float b, float r, float n);
+float fOpDifferenceColumns(float a, float b, float r, float n);
+inline float fOpIntersectionColumns(float a, float b, float r, float n) {
+    return fOpDifferenceColumns(a, -b, r, n);
+}
+
+inline float fOpUnionStairs(float a, float b, float r, float n) {
+    float s = r / n;
+    float u = b - r;
+    return std::min(std::min(a, b),
+                    0.5f * (u + a + std::fabs(mod(u - a + s, 2 * s) - s)));
+}
+
+inline float fOpIntersectionStairs(float a, float b, float r, float n) {
+    return -fOpUnionStairs(-a, -b, r, n);
+}
+
+inline float fOpDifferenceStairs(float a, float b, float r, float n) {
+    return -fOpUnionStairs(-a, b, r, n);
+}
+
+template<typename F>
+inline F fOpPipe(F a, F b, float r) {
+    return Length(a, b) - F(r);
+}
+
+template<typename F>
+inline F fOpEngrave(F a, F b, float r) {
+    using std::abs;
+    using std::max;
+    return max(a, (a + F(r) - abs(b)) * F(kSqrtHalf));
+}
+
+template<typename F>
+inline F fOpGroove(F a, F b, float ra, float rb) {
+    using std::abs;
+    using std::max;
+    using std::min;
+    return max(a, min(a + F(ra), F(rb) - abs(b)));
+}
+
+template<typename F>
+inline F fOpTongue(F a, F b, float ra, float rb) {
+    using std::abs;
+    using std::max;
+    using std::min;
+    return min(a, max(a - F(ra), abs(b) - F(rb)));
+}
+
+// The built-in scene rendered by SWMarcher.
+template<typename F>
+inline F DefaultScene(F x, F y, F z) {
+    using std::max;
+    F a = fSphere(x, y, z, 0.66f);
+    F b = fBoxCheap(x, y, z, 1.0f, 0.25f, 0.333f);
+    // min is union
+    // max is intersection
+    return max(a, b);
+}
+
+}  // namespace sdf
+}  // namespace GFX
+#endif // RMX_GFX_SDF_PRIMITIVES_H
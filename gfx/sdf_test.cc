@@ -0,0 +1,208 @@
+// Checks that Simplify keeps a scene's field and that Program evaluates
+// it like the tree does, by walking the trees directly with the
+// hg_sdf.inc ports and comparing on points scattered around the scenes.
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gfx/sdf.h"
+#include "gfx/sdf_primitives.h"
+#include "glm/glm.hpp"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace sdf {
+namespace {
+
+// The distance from p to the scene rooted at n, evaluated straight from
+// the tree.
+float TreeDistance(const NodeRef& n, glm::vec3 p) {
+    const auto& k = n->params();
+    switch(n->op()) {
+    case Op::SPHERE: return fSphere(p.x, p.y, p.z, k[0]);
+    case Op::BOX: return fBox(p.x, p.y, p.z, k[0], k[1], k[2]);
+    case Op::BOX_CHEAP: return fBoxCheap(p.x, p.y, p.z, k[0], k[1], k[2]);
+    case Op::PLANE: return fPlane(p.x, p.y, p.z, k[0], k[1], k[2], k[3]);
+    case Op::CYLINDER: return fCylinder(p.x, p.y, p.z, k[0], k[1]);
+    case Op::CAPSULE: return fCapsule(p.x, p.y, p.z, k[0], k[1]);
+    case Op::TORUS: return fTorus(p.x, p.y, p.z, k[0], k[1]);
+    case Op::GDF:
+        return fGDF(p.x, p.y, p.z, k[0], int(k[1]), int(k[2]));
+
+    case Op::TRANSLATE:
+        return TreeDistance(n->child(0), p - glm::vec3(k[0], k[1], k[2]));
+    case Op::ROTATE:
+        pR(p[int(k[0])], p[int(k[1])], std::cos(k[2]), std::sin(k[2]));
+        return TreeDistance(n->child(0), p);
+    case Op::MOD1:
+        pMod1(p[int(k[0])], k[1]);
+        return TreeDistance(n->child(0), p);
+    case Op::MOD_MIRROR1:
+        pModMirror1(p[int(k[0])], k[1]);
+        return TreeDistance(n->child(0), p);
+    case Op::MIRROR:
+        pMirror(p[int(k[0])], k[1]);
+        return TreeDistance(n->child(0), p);
+    default:
+        break;
+    }
+
+    float a = TreeDistance(n->child(0), p);
+    float b = TreeDistance(n->child(1), p);
+    switch(n->op()) {
+    case Op::UNION: return fOpUnion(a, b);
+    case Op::INTERSECTION: return fOpIntersection(a, b);
+    case Op::DIFFERENCE: return fOpDifference(a, b);
+    case Op::UNION_ROUND: return fOpUnionRound(a, b, k[0]);
+    case Op::INTERSECTION_ROUND: return fOpIntersectionRound(a, b, k[0]);
+    case Op::DIFFERENCE_ROUND: return fOpDifferenceRound(a, b, k[0]);
+    case Op::UNION_CHAMFER: return fOpUnionChamfer(a, b, k[0]);
+    case Op::INTERSECTION_CHAMFER: return fOpIntersectionChamfer(a, b, k[0]);
+    case Op::DIFFERENCE_CHAMFER: return fOpDifferenceChamfer(a, b, k[0]);
+    case Op::UNION_COLUMNS: return fOpUnionColumns(a, b, k[0], k[1]);
+    case Op::INTERSECTION_COLUMNS:
+        return fOpIntersectionColumns(a, b, k[0], k[1]);
+    case Op::DIFFERENCE_COLUMNS: return fOpDifferenceColumns(a, b, k[0], k[1]);
+    case Op::UNION_STAIRS: return fOpUnionStairs(a, b, k[0], k[1]);
+    case Op::INTERSECTION_STAIRS:
+        return fOpIntersectionStairs(a, b, k[0], k[1]);
+    case Op::DIFFERENCE_STAIRS: return fOpDifferenceStairs(a, b, k[0], k[1]);
+    case Op::PIPE: return fOpPipe(a, b, k[0]);
+    case Op::ENGRAVE: return fOpEngrave(a, b, k[0]);
+    case Op::GROOVE: return fOpGroove(a, b, k[0], k[1]);
+    case Op::TONGUE: return fOpTongue(a, b, k[0], k[1]);
+    default:
+        ADD_FAILURE() << "Unhandled op " << OpName(n->op());
+        return 0.0f;
+    }
+}
+
+std::vector<glm::vec3> SamplePoints(int n, float extent) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> u(-extent, extent);
+    std::vector<glm::vec3> points(n);
+    for(auto& p : points) {
+        p = glm::vec3(u(rng), u(rng), u(rng));
+    }
+    return points;
+}
+
+// Folding translations and rotations reassociates float arithmetic, so
+// simplified trees only match to within rounding.
+const float kTolerance = 1e-4f;
+
+// Compare the tree, its simplified form, and the compiled program, one
+// point at a time and in batches which span several VM passes.
+void ExpectSameField(const NodeRef& root, float extent) {
+    NodeRef simple = Simplify(root);
+    std::unique_ptr<Program> program = Program::Compile(root);
+    std::vector<glm::vec3> points = SamplePoints(1000, extent);
+
+    std::vector<float> x, y, z, d(points.size());
+    for(const auto& p : points) {
+        x.push_back(p.x);
+        y.push_back(p.y);
+        z.push_back(p.z);
+    }
+    program->Distance(x.data(), y.data(), z.data(), d.data(), d.size());
+
+    for(size_t i = 0; i < points.size(); ++i) {
+        const glm::vec3& p = points[i];
+        float want = TreeDistance(root, p);
+        float tol = kTolerance * std::max(1.0f, std::abs(want));
+        EXPECT_NEAR(TreeDistance(simple, p), want, tol)
+            << "simplified, at " << p.x << "," << p.y << "," << p.z;
+        EXPECT_NEAR(program->Distance(p), want, tol)
+            << "program, at " << p.x << "," << p.y << "," << p.z << "\n"
+            << program->Disassemble();
+        EXPECT_EQ(d[i], program->Distance(p)) << "batch " << i;
+    }
+}
+
+TEST(SdfTest, BoolOpsScenes) {
+    for(int op = 0; op <= 18; ++op) {
+        SCOPED_TRACE(op);
+        ExpectSameField(BoolOpsScene(op), 4.0f);
+    }
+}
+
+TEST(SdfTest, PrimitivesAndDomains) {
+    NodeRef solids = Union(
+        Union(Rotate(X, Z, 0.4f, Cylinder(0.5f, 1.0f)),
+              Translate(glm::vec3(0, 2, 0), Torus(0.2f, 1.0f))),
+        Union(Translate(glm::vec3(-2, 0, 0), Dodecahedron(0.8f)),
+              Translate(glm::vec3(2, 0, 0),
+                        Union(Capsule(0.3f, 1.0f),
+                              BoxCheap(glm::vec3(0.5f))))));
+    NodeRef scene = Union(
+        Plane(glm::vec3(0, 1, 0), 2.0f),
+        Mirror(Z, 1.0f, ModMirror1(X, 6.0f, Mod1(Y, 5.0f, solids))));
+    ExpectSameField(scene, 8.0f);
+}
+
+// Transforms that fold away, and stacks that fold into one, must leave
+// the field where it was.
+TEST(SdfTest, SimplifyFolds) {
+    NodeRef sphere = Sphere(1.0f);
+    NodeRef nested = Translate(
+        glm::vec3(1, 0, 0),
+        Translate(glm::vec3(0, 2, 0), Translate(glm::vec3(0, 0, 3), sphere)));
+    NodeRef folded = Simplify(nested);
+    ASSERT_EQ(folded->op(), Op::TRANSLATE);
+    EXPECT_EQ(folded->child(0), sphere);
+    ExpectSameField(nested, 6.0f);
+
+    NodeRef spun = Rotate(X, Y, 0.3f, Rotate(X, Y, 0.4f, Box(glm::vec3(1))));
+    NodeRef once = Simplify(spun);
+    ASSERT_EQ(once->op(), Op::ROTATE);
+    EXPECT_EQ(once->child(0)->op(), Op::BOX);
+    ExpectSameField(spun, 3.0f);
+
+    EXPECT_EQ(Simplify(Translate(glm::vec3(0), sphere)), sphere);
+    EXPECT_EQ(Simplify(Rotate(X, Z, 0.0f, sphere)), sphere);
+    EXPECT_EQ(Simplify(Union(sphere, Sphere(1.0f))), sphere);
+}
+
+// Identical subtrees built separately are merged, so the program
+// evaluates them once.
+TEST(SdfTest, SharedSubtrees) {
+    auto part = []() {
+        return Translate(glm::vec3(1, 2, 3),
+                         UnionRound(Box(glm::vec3(1)), Sphere(1.2f), 0.2f));
+    };
+    NodeRef scene = Difference(
+        Intersection(part(), Plane(glm::vec3(0, 1, 0), 0)),
+        Union(part(), Torus(0.1f, 2.0f)));
+    NodeRef simple = Simplify(scene);
+    EXPECT_EQ(simple->child(0)->child(0), simple->child(1)->child(0));
+
+    std::unique_ptr<Program> program = Program::Compile(scene);
+    int boxes = 0;
+    for(const Instruction& in : program->code()) {
+        boxes += in.op == Op::BOX;
+    }
+    EXPECT_EQ(boxes, 1) << program->Disassemble();
+    ExpectSameField(scene, 5.0f);
+}
+
+// A long chain of combinators needs far fewer registers than values once
+// dead values share storage.
+TEST(SdfTest, RegisterReuse) {
+    NodeRef scene = Sphere(0.5f);
+    for(int i = 1; i <= 24; ++i) {
+        float f = float(i);
+        glm::vec3 at(std::cos(f), std::sin(f), f * 0.1f);
+        scene = UnionRound(
+            scene, Translate(at, Rotate(Y, Z, f, Box(glm::vec3(0.2f)))), 0.1f);
+    }
+    std::unique_ptr<Program> program = Program::Compile(scene);
+    EXPECT_LE(program->distance_registers(), 3) << program->Disassemble();
+    EXPECT_LE(program->position_registers(), 3) << program->Disassemble();
+    ExpectSameField(scene, 4.0f);
+}
+
+}  // namespace
+}  // namespace sdf
+}  // namespace GFX
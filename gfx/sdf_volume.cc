@@ -0,0 +1,307 @@
+#include "gfx/sdf_volume.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "util/logging.h"
+#include "util/os.h"
+
+namespace GFX {
+namespace {
+uint64_t Mix(uint64_t h, uint64_t v) {
+    for(int i=0; i<8; ++i, v >>= 8) {
+        h ^= v & 0xFF;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t FloatBits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Trilinear interpolation in a dims-sized grid of samples at grid
+// coordinate g, which must lie within the grid.
+float Trilinear(const float* data, const glm::ivec3& dims,
+                const glm::vec3& g) {
+    glm::ivec3 i = glm::min(glm::ivec3(g), dims - 2);
+    glm::vec3 f = g - glm::vec3(i);
+    const float* p = data + (size_t(i.z) * dims.y + i.y) * dims.x + i.x;
+    size_t dy = dims.x, dz = size_t(dims.x) * dims.y;
+    float x00 = p[0]       + (p[1]           - p[0])       * f.x;
+    float x10 = p[dy]      + (p[dy + 1]      - p[dy])      * f.x;
+    float x01 = p[dz]      + (p[dz + 1]      - p[dz])      * f.x;
+    float x11 = p[dz + dy] + (p[dz + dy + 1] - p[dz + dy]) * f.x;
+    float y0 = x00 + (x10 - x00) * f.y;
+    float y1 = x01 + (x11 - x01) * f.y;
+    return y0 + (y1 - y0) * f.z;
+}
+
+// Evaluate source at lo + (x, y, z) * step for a dims-sized grid.  The
+// points are handed to the source in large batches, which keeps the
+// per-call overhead of compiled programs down.
+void SampleGrid(const DistanceField& source, const glm::vec3& lo,
+                float step, const glm::ivec3& dims, float* out) {
+    const int kBatch = 1024;
+    float x[kBatch], y[kBatch], z[kBatch];
+    size_t total = size_t(dims.x) * dims.y * dims.z;
+    for(size_t start = 0; start < total; start += kBatch) {
+        int n = int(std::min(total - start, size_t(kBatch)));
+        for(int i=0; i<n; ++i) {
+            size_t j = start + i;
+            x[i] = lo.x + float(j % dims.x) * step;
+            y[i] = lo.y + float(j / dims.x % dims.y) * step;
+            z[i] = lo.z + float(j / dims.x / dims.y) * step;
+        }
+        source.Distance(x, y, z, out + start, n);
+    }
+}
+}  // namespace
+
+BrickVolume::BrickVolume(std::shared_ptr<const DistanceField> source,
+                         const Options& options, TileScheduler* scheduler)
+  : source_(std::move(source)),
+    options_(options) {
+    int64_t start = os::utime_now();
+    const int B = options_.brick_size;
+    brick_extent_ = options_.voxel_size * float(B);
+    // Round the bounds up to a whole number of bricks.
+    bricks_ = glm::max(glm::ivec3(glm::ceil(
+            options_.bounds.size() / brick_extent_)), glm::ivec3(1));
+    options_.bounds.hi = options_.bounds.lo +
+                         glm::vec3(bricks_) * brick_extent_;
+    fingerprint_ = Fingerprint(*source_, options);
+
+    // A brick whose centre is further than radius + band_ from a surface
+    // has no point within band_ of one, so it only needs coarse data.
+    band_ = options_.voxel_size * 2.0f;
+    float radius = brick_extent_ * std::sqrt(3.0f) * 0.5f;
+
+    glm::ivec3 corners = bricks_ + 1;
+    coarse_.resize(size_t(corners.x) * corners.y * corners.z);
+    SampleGrid(*source_, options_.bounds.lo, brick_extent_, corners,
+               coarse_.data());
+    std::vector<float> centers(size_t(bricks_.x) * bricks_.y * bricks_.z);
+    SampleGrid(*source_, options_.bounds.lo + brick_extent_ * 0.5f,
+               brick_extent_, bricks_, centers.data());
+
+    index_.resize(centers.size());
+    int slots = 0;
+    for(size_t i=0; i<centers.size(); ++i) {
+        index_[i] = std::abs(centers[i]) <= radius + band_ ? slots++ : -1;
+    }
+
+    // Fill the bricks.  Each brick is sampled independently, so
+    // neighbours duplicate their shared faces and lookups never have to
+    // look outside one brick.
+    const int S = B + 1;
+    const size_t brick_floats = size_t(S) * S * S;
+    voxels_.resize(brick_floats * slots);
+    std::vector<glm::ivec3> work;
+    work.reserve(slots);
+    for(int z=0; z<bricks_.z; ++z) {
+        for(int y=0; y<bricks_.y; ++y) {
+            for(int x=0; x<bricks_.x; ++x) {
+                if (index_[(size_t(z) * bricks_.y + y) * bricks_.x + x] >= 0) {
+                    work.emplace_back(x, y, z);
+                }
+            }
+        }
+    }
+    auto fill = [&](int i) {
+        const glm::ivec3& b = work[i];
+        int slot = index_[(size_t(b.z) * bricks_.y + b.y) * bricks_.x + b.x];
+        SampleGrid(*source_,
+                   options_.bounds.lo + glm::vec3(b) * brick_extent_,
+                   options_.voxel_size, glm::ivec3(S),
+                   voxels_.data() + brick_floats * slot);
+    };
+    if (scheduler) {
+        // The scheduler works in tiles, so lay the bricks out as a
+        // one pixel wide image.
+        scheduler->Run(1, slots, 4, [&](const Tile& tile, int thread) {
+            for(int i=tile.y; i<tile.y+tile.h; ++i) {
+                fill(i);
+            }
+        });
+    } else {
+        for(int i=0; i<slots; ++i) {
+            fill(i);
+        }
+    }
+
+    stats_.bake_ms = double(os::utime_now() - start) / 1000.0;
+    stats_.bricks = slots;
+    stats_.total_bricks = int(index_.size());
+    stats_.bytes = index_.size() * sizeof(index_[0]) +
+                   coarse_.size() * sizeof(coarse_[0]) +
+                   voxels_.size() * sizeof(voxels_[0]);
+    LOGF(INFO, "Baked %dx%dx%d brick volume in %.1f ms: %d/%d bricks, "
+               "%.2f MiB (dense: %.2f MiB)",
+         bricks_.x, bricks_.y, bricks_.z, stats_.bake_ms,
+         stats_.bricks, stats_.total_bricks,
+         double(stats_.bytes) / (1 << 20),
+         double(stats_.total_bricks) * B * B * B * sizeof(float) / (1 << 20));
+}
+
+uint64_t BrickVolume::Fingerprint(const DistanceField& source,
+                                  const Options& options) {
+    return Fingerprint(source.Fingerprint(), options);
+}
+
+uint64_t BrickVolume::Fingerprint(uint64_t source, const Options& options) {
+    uint64_t h = Mix(0xcbf29ce484222325ULL, source);
+    h = Mix(h, FloatBits(options.bounds.lo.x));
+    h = Mix(h, FloatBits(options.bounds.lo.y));
+    h = Mix(h, FloatBits(options.bounds.lo.z));
+    h = Mix(h, FloatBits(options.bounds.hi.x));
+    h = Mix(h, FloatBits(options.bounds.hi.y));
+    h = Mix(h, FloatBits(options.bounds.hi.z));
+    h = Mix(h, FloatBits(options.voxel_size));
+    return Mix(h, uint64_t(options.brick_size));
+}
+
+// There's no surface in a coarse brick, so all its corners have the same
+// sign.  The field can't change faster than the distance travelled, so
+// each corner bounds the distance at g; take the tightest bound.  The
+// brick is also known to be at least band_ from any surface.
+float BrickVolume::Coarse(const glm::ivec3& b, const glm::vec3& g) const {
+    glm::ivec3 dims = bricks_ + 1;
+    const float* p =
+        coarse_.data() + (size_t(b.z) * dims.y + b.y) * dims.x + b.x;
+    glm::vec3 f = g - glm::vec3(b);
+    float sign = p[0] > 0.0f ? 1.0f : -1.0f;
+    float best = -INFINITY;
+    for(int i=0; i<8; ++i) {
+        int x = i & 1, y = (i >> 1) & 1, z = i >> 2;
+        float d = p[(size_t(z) * dims.y + y) * dims.x + x];
+        float r = glm::length(f - glm::vec3(x, y, z)) * brick_extent_;
+        best = std::max(best, sign * d - r);
+    }
+    return sign * std::max(best, band_);
+}
+
+float BrickVolume::Lookup(const glm::vec3& p) const {
+    glm::vec3 g = (p - options_.bounds.lo) / brick_extent_;
+    glm::ivec3 b = glm::clamp(glm::ivec3(g), glm::ivec3(0), bricks_ - 1);
+    int slot = index_[(size_t(b.z) * bricks_.y + b.y) * bricks_.x + b.x];
+    if (slot < 0) {
+        return Coarse(b, g);
+    }
+    const int S = options_.brick_size + 1;
+    return Trilinear(voxels_.data() + size_t(slot) * S * S * S, glm::ivec3(S),
+                     (g - glm::vec3(b)) * float(options_.brick_size));
+}
+
+float BrickVolume::Distance(const glm::vec3& p) const {
+    if (!options_.bounds.Contains(p)) {
+        return source_->Distance(p);
+    }
+    return Lookup(p);
+}
+
+void BrickVolume::Distance(const float* x, const float* y, const float* z,
+                           float* d, int n) const {
+    // Points outside the bounds are gathered up and handed to the
+    // source in batches.
+    const int kBatch = 64;
+    float ox[kBatch], oy[kBatch], oz[kBatch], od[kBatch];
+    int oi[kBatch];
+    int outside = 0;
+    for(int i=0; i<n; ++i) {
+        glm::vec3 p(x[i], y[i], z[i]);
+        if (options_.bounds.Contains(p)) {
+            d[i] = Lookup(p);
+            continue;
+        }
+        ox[outside] = x[i];
+        oy[outside] = y[i];
+        oz[outside] = z[i];
+        oi[outside] = i;
+        if (++outside == kBatch) {
+            source_->Distance(ox, oy, oz, od, outside);
+            for(int j=0; j<outside; ++j) {
+                d[oi[j]] = od[j];
+            }
+            outside = 0;
+        }
+    }
+    if (outside) {
+        source_->Distance(ox, oy, oz, od, outside);
+        for(int j=0; j<outside; ++j) {
+            d[oi[j]] = od[j];
+        }
+    }
+}
+
+BrickVolume::ErrorStats BrickVolume::MeasureError(int samples,
+                                                  uint32_t seed) const {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    const sdf::Bounds& bounds = options_.bounds;
+    ErrorStats e{0, 0, 0, 0, samples};
+    int fine = 0, coarse = 0;
+    for(int i=0; i<samples; ++i) {
+        glm::vec3 p = bounds.lo + bounds.size() *
+                      glm::vec3(u(rng), u(rng), u(rng));
+        float err = std::abs(Lookup(p) - source_->Distance(p));
+        glm::ivec3 b = glm::clamp(
+                glm::ivec3((p - bounds.lo) / brick_extent_),
+                glm::ivec3(0), bricks_ - 1);
+        if (index_[(size_t(b.z) * bricks_.y + b.y) * bricks_.x + b.x] >= 0) {
+            e.max_fine = std::max(e.max_fine, err);
+            e.mean_fine += err;
+            ++fine;
+        } else {
+            e.max_coarse = std::max(e.max_coarse, err);
+            e.mean_coarse += err;
+            ++coarse;
+        }
+    }
+    e.mean_fine /= std::max(fine, 1);
+    e.mean_coarse /= std::max(coarse, 1);
+    return e;
+}
+
+std::shared_ptr<const BrickVolume> VolumeCache::Get(
+        const std::shared_ptr<const DistanceField>& scene,
+        const BrickVolume::Options& options) {
+    if (scene != scene_) {
+        scene_ = scene;
+        scene_fingerprint_ = scene->Fingerprint();
+    }
+    uint64_t fingerprint =
+        BrickVolume::Fingerprint(scene_fingerprint_, options);
+    if (bake_.valid()) {
+        if (bake_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            return nullptr;
+        }
+        volume_ = bake_.get();
+    }
+    if (volume_ && volume_->Fingerprint() == fingerprint) {
+        return volume_;
+    }
+    // One bake at a time; a bake for a scene that has since changed is
+    // finished and dropped before the next one starts.  Bakes don't use
+    // the caller's tile scheduler, which it's rendering with meanwhile.
+    volume_.reset();
+    std::shared_ptr<const DistanceField> source = scene_;
+    bake_ = std::async(std::launch::async, [source, options]() {
+        return std::shared_ptr<const BrickVolume>(
+                std::make_shared<BrickVolume>(source, options));
+    });
+    return nullptr;
+}
+
+void VolumeCache::Clear() {
+    scene_.reset();
+    volume_.reset();
+}
+
+}  // namespace GFX
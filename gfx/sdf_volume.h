@@ -0,0 +1,119 @@
+#ifndef RMX_GFX_SDF_VOLUME_H
+#define RMX_GFX_SDF_VOLUME_H
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "gfx/distance_field.h"
+#include "gfx/sdf_interval.h"
+#include "gfx/tile_scheduler.h"
+#include "glm/glm.hpp"
+
+namespace GFX {
+
+// A distance field baked into a sparse volume of bricks.
+//
+// The bounds are cut into bricks of brick_size^3 voxels.  Bricks near a
+// surface store every voxel corner and are looked up trilinearly.  The
+// rest of the volume only stores distances at the brick corners, and
+// returns the tightest lower bound those corners give.  That is never
+// more than the true distance, so it's safe to sphere trace, and it's
+// exact at the corners.
+//
+// Points outside the bounds are handed to the source scene.
+class BrickVolume : public DistanceField {
+  public:
+    struct Options {
+        sdf::Bounds bounds{glm::vec3(-4.0f), glm::vec3(4.0f)};
+        float voxel_size = 1.0f / 16.0f;
+        int brick_size = 8;
+    };
+
+    struct Stats {
+        double bake_ms;
+        int bricks;             // Bricks with voxel data.
+        int total_bricks;       // Bricks in the whole grid.
+        size_t bytes;
+    };
+
+    struct ErrorStats {
+        // Absolute error in bricks with voxel data and in the coarse
+        // region, where the error is the deliberate underestimate.
+        float max_fine;
+        float mean_fine;
+        float max_coarse;
+        float mean_coarse;
+        int samples;
+    };
+
+    // Bake source.  Bricks are filled in parallel on scheduler if given.
+    BrickVolume(std::shared_ptr<const DistanceField> source,
+                const Options& options, TileScheduler* scheduler=nullptr);
+
+    float Distance(const glm::vec3& p) const override;
+    void Distance(const float* x, const float* y, const float* z,
+                  float* d, int n) const override;
+    // The source's fingerprint mixed with the bake options.
+    uint64_t Fingerprint() const override { return fingerprint_; }
+    static uint64_t Fingerprint(const DistanceField& source,
+                                const Options& options);
+    static uint64_t Fingerprint(uint64_t source, const Options& options);
+
+    // Compare against the source at random points inside the bounds.
+    // Too slow for every bake; see sdf_volume_test.cc.
+    ErrorStats MeasureError(int samples, uint32_t seed=1) const;
+
+    inline const Options& options() const { return options_; }
+    inline const Stats& stats() const { return stats_; }
+    inline const DistanceField* source() const { return source_.get(); }
+
+    // The raw volume, e.g. for uploading to textures.  index() holds the
+    // brick slot for each brick in x-major order, or -1 for coarse
+    // bricks.  coarse() holds (bricks+1)^3 corner distances.  voxels()
+    // holds (brick_size+1)^3 distances per slot.
+    inline const glm::ivec3& bricks() const { return bricks_; }
+    inline const std::vector<int32_t>& index() const { return index_; }
+    inline const std::vector<float>& coarse() const { return coarse_; }
+    inline const std::vector<float>& voxels() const { return voxels_; }
+    inline int slots() const { return stats_.bricks; }
+    // Coarse bricks are at least band from any surface.
+    inline float band() const { return band_; }
+
+  private:
+    float Lookup(const glm::vec3& p) const;
+    float Coarse(const glm::ivec3& b, const glm::vec3& g) const;
+
+    std::shared_ptr<const DistanceField> source_;
+    Options options_;
+    glm::ivec3 bricks_;
+    float brick_extent_;
+    float band_;
+    std::vector<int32_t> index_;
+    std::vector<float> coarse_;
+    std::vector<float> voxels_;
+    Stats stats_;
+    uint64_t fingerprint_;
+};
+
+// Holds the volume baked from the most recent scene.  When the scene's
+// fingerprint or the bake options change, the volume is rebaked on
+// another thread and Get returns nullptr until it's done, so the caller
+// marches the scene itself meanwhile.  A scene is only fingerprinted
+// when a different one is passed in.
+class VolumeCache {
+  public:
+    std::shared_ptr<const BrickVolume> Get(
+            const std::shared_ptr<const DistanceField>& scene,
+            const BrickVolume::Options& options);
+    // Forget the volume.  A bake that's running is dropped when it ends.
+    void Clear();
+
+  private:
+    std::shared_ptr<const DistanceField> scene_;
+    uint64_t scene_fingerprint_ = 0;
+    std::shared_ptr<const BrickVolume> volume_;
+    std::future<std::shared_ptr<const BrickVolume>> bake_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_SDF_VOLUME_H
@@ -0,0 +1,118 @@
+// Checks that a BrickVolume never overestimates the distance in its
+// coarse bricks, so it's safe to sphere trace, that it stays close to
+// the scene in its fine ones, and that VolumeCache bakes in the
+// background.
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "gfx/sdf.h"
+#include "gfx/sdf_volume.h"
+#include "glm/glm.hpp"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace {
+
+std::shared_ptr<const DistanceField> TestScene() {
+    using namespace sdf;
+    NodeRef scene = Union(
+        UnionRound(Box(glm::vec3(0.6f)),
+                   Translate(glm::vec3(0.5f, 0.5f, 0.0f), Sphere(0.5f)),
+                   0.2f),
+        Translate(glm::vec3(-1.2f, -0.8f, 0.7f), Torus(0.15f, 0.5f)));
+    return std::shared_ptr<const DistanceField>(Program::Compile(scene));
+}
+
+BrickVolume::Options TestOptions() {
+    BrickVolume::Options options;
+    options.bounds = sdf::Bounds{glm::vec3(-2.0f), glm::vec3(2.0f)};
+    options.voxel_size = 1.0f / 8.0f;
+    options.brick_size = 4;
+    return options;
+}
+
+bool Fine(const BrickVolume& volume, const glm::vec3& p) {
+    const auto& options = volume.options();
+    float extent = options.voxel_size * float(options.brick_size);
+    glm::ivec3 b = glm::clamp(glm::ivec3((p - options.bounds.lo) / extent),
+                              glm::ivec3(0), volume.bricks() - 1);
+    const glm::ivec3& n = volume.bricks();
+    return volume.index()[(size_t(b.z) * n.y + b.y) * n.x + b.x] >= 0;
+}
+
+TEST(BrickVolumeTest, CoarseBricksAreALowerBound) {
+    auto scene = TestScene();
+    BrickVolume volume(scene, TestOptions());
+    ASSERT_GT(volume.slots(), 0);
+    ASSERT_LT(volume.slots(), volume.stats().total_bricks);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(-2.0f, 2.0f);
+    int coarse = 0;
+    for(int i = 0; i < 20000; ++i) {
+        glm::vec3 p(u(rng), u(rng), u(rng));
+        if (Fine(volume, p)) {
+            continue;
+        }
+        ++coarse;
+        float want = scene->Distance(p);
+        float got = volume.Distance(p);
+        ASSERT_EQ(got > 0.0f, want > 0.0f)
+            << "at " << p.x << "," << p.y << "," << p.z;
+        ASSERT_LE(std::abs(got), std::abs(want) + 1e-5f)
+            << "at " << p.x << "," << p.y << "," << p.z;
+        ASSERT_GE(std::abs(got), volume.band());
+    }
+    EXPECT_GT(coarse, 1000);
+}
+
+TEST(BrickVolumeTest, CloseToTheScene) {
+    auto scene = TestScene();
+    BrickVolume volume(scene, TestOptions());
+    BrickVolume::ErrorStats e = volume.MeasureError(20000);
+    // Trilinear lookups are off by a fraction of a voxel at most.
+    EXPECT_LT(e.max_fine, TestOptions().voxel_size);
+    EXPECT_LT(e.mean_fine, TestOptions().voxel_size * 0.1f);
+
+    // Outside the bounds the scene answers.
+    glm::vec3 outside(3.0f, 0.5f, -2.5f);
+    EXPECT_EQ(volume.Distance(outside), scene->Distance(outside));
+}
+
+std::shared_ptr<const BrickVolume> WaitFor(
+        VolumeCache* cache, const std::shared_ptr<const DistanceField>& scene,
+        const BrickVolume::Options& options) {
+    for(int i = 0; i < 1000; ++i) {
+        if (auto volume = cache->Get(scene, options)) {
+            return volume;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return nullptr;
+}
+
+TEST(VolumeCacheTest, BakesInTheBackground) {
+    auto scene = TestScene();
+    BrickVolume::Options options = TestOptions();
+    VolumeCache cache;
+    EXPECT_EQ(cache.Get(scene, options), nullptr);
+    auto volume = WaitFor(&cache, scene, options);
+    ASSERT_NE(volume, nullptr);
+    EXPECT_EQ(volume->Fingerprint(),
+              BrickVolume::Fingerprint(*scene, options));
+
+    // The same scene compiled again is the same volume.
+    EXPECT_EQ(cache.Get(TestScene(), options), volume);
+
+    options.voxel_size = 1.0f / 4.0f;
+    EXPECT_EQ(cache.Get(scene, options), nullptr);
+    auto rebaked = WaitFor(&cache, scene, options);
+    ASSERT_NE(rebaked, nullptr);
+    EXPECT_NE(rebaked, volume);
+}
+
+}  // namespace
+}  // namespace GFX
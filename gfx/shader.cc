@@ -1,12 +1,9 @@
 #include "gfx/shader.h"
 
 #include "absl/memory/memory.h"
-#include "absl/strings/str_cat.h"
-#include "re2/re2.h"
-#include "util/file.h"
+#include "gfx/program_cache.h"
 #include "util/logging.h"
 #include "util/os.h"
-#include "util/status_macros.h"
 
 namespace GFX {
 
@@ -18,41 +15,95 @@ std::unique_ptr<Shader> Shader::New(const char* vs, const char* fs,
 std::unique_ptr<Shader> Shader::Load(const std::string& vs,
                                      const std::string& fs,
                                      const std::string& gs) {
-    std::string vertex, fragment, geometry;
-
-    File::GetContents(vs, &vertex);
-    ProcessIncludes(&vertex);
-    File::GetContents(fs, &fragment);
-    ProcessIncludes(&fragment);
-    //LOG(INFO, "Fragment shader\n", fragment);
-    if (!gs.empty()) {
-        File::GetContents(gs, &geometry);
-        ProcessIncludes(&geometry);
-    }
+    return Load(vs, fs, gs, {});
+}
+
+std::unique_ptr<Shader> Shader::Load(
+        const std::string& vs, const std::string& fs, const std::string& gs,
+        const std::map<std::string, std::string>& includes) {
+    return Load(vs, fs, gs, includes, {});
+}
 
-    return absl::WrapUnique(
-            new Shader(vertex.c_str(), fragment.c_str(),
-                       gs.empty() ? nullptr : geometry.c_str()));
+std::unique_ptr<Shader> Shader::Load(
+        const std::string& vs, const std::string& fs, const std::string& gs,
+        const std::map<std::string, std::string>& includes,
+        const std::map<std::string, std::string>& defines) {
+    GLSLPreprocessor stages[3] = {
+        GLSLPreprocessor(includes),
+        GLSLPreprocessor(includes),
+        GLSLPreprocessor(includes),
+    };
+    const std::string* paths[3] = { &vs, &fs, &gs };
+    std::string source[3];
+    std::set<std::string> dependencies;
+
+    for(int i=0; i<3; ++i) {
+        if (paths[i]->empty()) {
+            continue;
+        }
+        stages[i].set_defines(defines);
+        util::Status status = stages[i].Process(*paths[i], &source[i]);
+        if (!status.ok()) {
+            LOG(ERROR, "Error loading ", *paths[i], ": ",
+                status.error_message());
+            return nullptr;
+        }
+        for(const auto& path : stages[i].Dependencies()) {
+            dependencies.insert(path);
+        }
+    }
+    const char* geometry = gs.empty() ? nullptr : source[2].c_str();
+
+    std::unique_ptr<Shader> shader;
+    ProgramCache* cache = ProgramCache::Get();
+    if (!cache) {
+        shader = absl::WrapUnique(new Shader(
+                source[0].c_str(), source[1].c_str(), geometry, false, stages));
+        if (!shader->linked_) {
+            return nullptr;
+        }
+        shader->dependencies_ = std::move(dependencies);
+        return shader;
+    }
+    std::string key = cache->Key({source[0], source[1], source[2]});
+    if (GLuint program = cache->Load(key)) {
+        shader = absl::WrapUnique(new Shader(program));
+        shader->dependencies_ = std::move(dependencies);
+        return shader;
+    }
+    int64_t start = os::utime_now();
+    shader = absl::WrapUnique(new Shader(
+            source[0].c_str(), source[1].c_str(), geometry, true, stages));
+    if (!shader->linked_) {
+        return nullptr;
+    }
+    cache->Store(key, shader->program_);
+    cache->AddCompileTime(double(os::utime_now() - start) / 1000.0);
+    shader->dependencies_ = std::move(dependencies);
+    return shader;
 }
 
-Shader::Shader(const char* vs, const char* fs, const char* gs) {
+Shader::Shader(const char* vs, const char* fs, const char* gs,
+               bool retrievable, const GLSLPreprocessor* stages) {
     GLuint vertex = 0, fragment = 0, geometry = 0;
 
     vertex = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertex, 1, &vs, nullptr);
     glCompileShader(vertex);
-    CheckCompileErrors(vertex, "vertex");
+    CheckCompileErrors(vertex, "vertex", stages ? &stages[0] : nullptr);
 
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragment, 1, &fs, nullptr);
     glCompileShader(fragment);
-    CheckCompileErrors(fragment, "fragment");
+    CheckCompileErrors(fragment, "fragment",
+                       stages ? &stages[1] : nullptr);
 
     if (gs) {
         geometry = glCreateShader(GL_GEOMETRY_SHADER);
         glShaderSource(geometry, 1, &gs, nullptr);
         glCompileShader(geometry);
-        CheckCompileErrors(geometry, "geometry");
+        CheckCompileErrors(geometry, "geometry",
+                           stages ? &stages[2] : nullptr);
     }
 
     program_ = glCreateProgram();
@@ -61,8 +112,15 @@ Shader::Shader(const char* vs, const char* fs, const char* gs) {
     if (geometry) {
         glAttachShader(program_, geometry);
     }
+    // Fragment shaders may write more outputs than the framebuffer has
+    // buffers, but outColor always goes to the first.
+    glBindFragDataLocation(program_, 0, "outColor");
+    if (retrievable) {
+        glProgramParameteri(program_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+    }
     glLinkProgram(program_);
-    CheckCompileErrors(program_, "program");
+    linked_ = CheckCompileErrors(program_, "program");
 
     glDeleteShader(vertex);
     glDeleteShader(fragment);
@@ -71,34 +129,27 @@ Shader::Shader(const char* vs, const char* fs, const char* gs) {
     }
 }
 
-void Shader::CheckCompileErrors(GLuint shader, const std::string& type) {
+bool Shader::CheckCompileErrors(GLuint shader, const std::string& type,
+                                const GLSLPreprocessor* preprocessor) {
     GLint success = true;
     GLchar info[64*1024] = {0,};
 
     if (type == "program") {
         glGetProgramiv(shader, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(shader, sizeof(info), nullptr, info);
+        }
     } else {
-        glGetProgramiv(shader, GL_COMPILE_STATUS, &success);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, sizeof(info), nullptr, info);
+        }
     }
     if (!success) {
-        glGetProgramInfoLog(shader, sizeof(info), nullptr, info);
-        LOG(ERROR, "Error in ", type, "(", shader, "):\n", info);
-    }
-}
-
-util::Status Shader::ProcessIncludes(std::string* text) {
-    std::string filename;
-
-    while(RE2::PartialMatch(*text, "#include \"([^\"]+)\"", &filename)) {
-        std::string replace = RE2::QuoteMeta(
-                absl::StrCat("#include \"", filename, "\""));
-        filename = os::path::Join({os::path::ResourceDir(), "content", filename});
-        LOG(INFO, "Match: ", replace, " filename=", filename);
-        std::string data;
-        File::GetContents(filename, &data);
-        RE2::Replace(text, replace, data);
+        LOG(ERROR, "Error in ", type, "(", shader, "):\n",
+            preprocessor ? preprocessor->Annotate(info) : std::string(info));
     }
-    return util::Status();
+    return success;
 }
 
 }  // namespace GFX
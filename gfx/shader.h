@@ -1,9 +1,12 @@
 #ifndef CANVAS_GFX_SHADER_H
 #define CANVAS_GFX_SHADER_H
 
+#include <map>
+#include <set>
 #include <string>
 #include <memory>
 #include <GL/glew.h>
+#include "gfx/glsl_preprocessor.h"
 #include "util/status.h"
 
 namespace GFX {
@@ -15,14 +18,43 @@ class Shader {
     static std::unique_ptr<Shader> Load(const std::string& vs,
                                         const std::string& fs,
                                         const std::string& gs);
+    // Like Load, but an #include of a name found in includes is replaced
+    // by the mapped text instead of the file from the content directory.
+    // Programs are loaded from the ProgramCache when their preprocessed
+    // source was linked before.  Returns nullptr if a file can't be read,
+    // an #include can't be resolved or the program doesn't link.
+    static std::unique_ptr<Shader> Load(
+            const std::string& vs, const std::string& fs,
+            const std::string& gs,
+            const std::map<std::string, std::string>& includes);
+    // Like Load, but with defines inserted after #version in every stage,
+    // to build a variant of a program.
+    static std::unique_ptr<Shader> Load(
+            const std::string& vs, const std::string& fs,
+            const std::string& gs,
+            const std::map<std::string, std::string>& includes,
+            const std::map<std::string, std::string>& defines);
+    ~Shader() { glDeleteProgram(program_); }
     inline void Use() const { glUseProgram(program_); }
     inline GLuint program() const { return program_; }
+    // The files a loaded program was built from, including everything they
+    // #include.
+    inline const std::set<std::string>& dependencies() const {
+        return dependencies_;
+    }
   private:
-    Shader(const char* vs, const char* fs, const char* gs);
-    void CheckCompileErrors(GLuint shader, const std::string& type);
-    static util::Status ProcessIncludes(std::string* text);
+    // stages, when given, holds the preprocessors for vs, fs and gs, used
+    // to map compiler messages back to files.
+    Shader(const char* vs, const char* fs, const char* gs,
+           bool retrievable=false,
+           const GLSLPreprocessor* stages=nullptr);
+    explicit Shader(GLuint program) : program_(program), linked_(true) {}
+    bool CheckCompileErrors(GLuint shader, const std::string& type,
+                            const GLSLPreprocessor* preprocessor=nullptr);
 
     GLuint program_;
+    bool linked_;
+    std::set<std::string> dependencies_;
 };
 
 }  // namespace GFX
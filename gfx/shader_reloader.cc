@@ -0,0 +1,272 @@
+#include "gfx/shader_reloader.h"
+
+#include <chrono>
+#include <climits>
+#include <vector>
+
+#include "gfx/glsl_preprocessor.h"
+#include "util/logging.h"
+#include "util/os.h"
+
+namespace GFX {
+
+ShaderReloader::ShaderReloader(std::function<bool()> make_current,
+                               std::function<void()> release)
+  : make_current_(std::move(make_current)),
+    release_(std::move(release)),
+    generation_(0),
+    requested_(false),
+    quit_(false),
+    reloads_(0),
+    failures_(0),
+    warm_fbo_(0),
+    warm_texture_(0),
+    warm_vao_(0),
+    warm_ubo_(0),
+    thread_(&ShaderReloader::Run, this)
+{}
+
+ShaderReloader::~ShaderReloader() {
+    quit_ = true;
+    thread_.join();
+    for(auto& ready : ready_) {
+        glDeleteSync(ready.second.fence);
+    }
+}
+
+void ShaderReloader::Watch(const void* owner, int slot, const Source& source,
+                           const std::set<std::string>& dependencies) {
+    for(const auto& path : dependencies) {
+        watcher_.Watch(path);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    programs_[Key(owner, slot)] =
+        Program{source, dependencies, ++generation_, false};
+    auto it = ready_.find(Key(owner, slot));
+    if (it != ready_.end()) {
+        glDeleteSync(it->second.fence);
+        ready_.erase(it);
+    }
+}
+
+void ShaderReloader::Build(const void* owner, int slot,
+                           const Source& source) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        programs_[Key(owner, slot)] = Program{source, {}, ++generation_, true};
+        auto it = ready_.find(Key(owner, slot));
+        if (it != ready_.end()) {
+            glDeleteSync(it->second.fence);
+            ready_.erase(it);
+        }
+    }
+    requested_ = true;
+}
+
+void ShaderReloader::Unwatch(const void* owner, int slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    programs_.erase(Key(owner, slot));
+    auto it = ready_.find(Key(owner, slot));
+    if (it != ready_.end()) {
+        glDeleteSync(it->second.fence);
+        ready_.erase(it);
+    }
+}
+
+void ShaderReloader::Unwatch(const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    programs_.erase(programs_.lower_bound(Key(owner, INT_MIN)),
+                    programs_.upper_bound(Key(owner, INT_MAX)));
+    auto begin = ready_.lower_bound(Key(owner, INT_MIN));
+    auto end = ready_.upper_bound(Key(owner, INT_MAX));
+    for(auto it = begin; it != end; ++it) {
+        glDeleteSync(it->second.fence);
+    }
+    ready_.erase(begin, end);
+}
+
+// Move its to shader if its fence has passed, and forget it.
+bool ShaderReloader::TakeLocked(std::map<Key, Ready>::iterator it,
+                                std::unique_ptr<Shader>* shader) {
+    // The worker flushed after fencing, so a zero timeout is enough.
+    if (glClientWaitSync(it->second.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+    glDeleteSync(it->second.fence);
+    *shader = std::move(it->second.shader);
+    ready_.erase(it);
+    return true;
+}
+
+std::unique_ptr<Shader> ShaderReloader::Take(const void* owner, int slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<Shader> shader;
+    auto it = ready_.find(Key(owner, slot));
+    if (it != ready_.end()) {
+        TakeLocked(it, &shader);
+    }
+    return shader;
+}
+
+std::vector<std::pair<int, std::unique_ptr<Shader>>> ShaderReloader::TakeAll(
+        const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<int, std::unique_ptr<Shader>>> taken;
+    auto it = ready_.lower_bound(Key(owner, INT_MIN));
+    while (it != ready_.end() && it->first.first == owner) {
+        int slot = it->first.second;
+        std::unique_ptr<Shader> shader;
+        auto next = std::next(it);
+        if (TakeLocked(it, &shader)) {
+            taken.emplace_back(slot, std::move(shader));
+        }
+        it = next;
+    }
+    return taken;
+}
+
+void ShaderReloader::Run() {
+    if (!make_current_()) {
+        LOG(ERROR, "Can't make the shader reload context current; "
+                   "shaders won't be reloaded");
+        return;
+    }
+    while (!quit_) {
+        // The wait is also how long a requested build can wait to start.
+        bool requested = requested_.exchange(false);
+        std::vector<std::string> changed = watcher_.Wait(requested ? 0 : 20);
+        std::set<std::string> paths;
+        if (!changed.empty()) {
+            // Editors often save in several writes; let them finish.
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            paths.insert(changed.begin(), changed.end());
+            for(const auto& path : watcher_.Wait(0)) {
+                paths.insert(path);
+            }
+            for(const auto& path : paths) {
+                SourceFiles::Default()->Invalidate(path);
+            }
+        } else if (!requested) {
+            continue;
+        }
+        Rebuild(paths);
+    }
+    if (warm_fbo_) {
+        glDeleteFramebuffers(1, &warm_fbo_);
+        glDeleteTextures(1, &warm_texture_);
+        glDeleteVertexArrays(1, &warm_vao_);
+        glDeleteBuffers(1, &warm_ubo_);
+    }
+    release_();
+}
+
+// Draw a pixel with a new program.  Some drivers only generate code for
+// a program when it is first drawn with, which would otherwise stall the
+// first frame after the swap.  Its uniform blocks are bound where the
+// source says and all read zeros, so loops end immediately.
+void ShaderReloader::Warm(const Shader& shader, const Source& source) {
+    const GLsizeiptr kWarmBlockSize = 4096;
+    if (!warm_fbo_) {
+        glGenTextures(1, &warm_texture_);
+        glBindTexture(GL_TEXTURE_2D, warm_texture_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &warm_fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, warm_fbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, warm_texture_, 0);
+        glGenVertexArrays(1, &warm_vao_);
+        glGenBuffers(1, &warm_ubo_);
+        glBindBuffer(GL_UNIFORM_BUFFER, warm_ubo_);
+        std::vector<uint8_t> zeros(kWarmBlockSize);
+        glBufferData(GL_UNIFORM_BUFFER, zeros.size(), zeros.data(),
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, warm_fbo_);
+    glViewport(0, 0, 1, 1);
+    glBindVertexArray(warm_vao_);
+    GLuint program = shader.program();
+    for(const auto& block : source.blocks) {
+        GLuint index = glGetUniformBlockIndex(program, block.first.c_str());
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block.second);
+        }
+    }
+    GLint blocks = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+    for(GLint i = 0; i < blocks; ++i) {
+        GLint binding = 0, size = 0;
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_BINDING,
+                                  &binding);
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE,
+                                  &size);
+        if (size <= kWarmBlockSize) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, warm_ubo_);
+        }
+    }
+    shader.Use();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShaderReloader::Rebuild(const std::set<std::string>& changed) {
+    std::vector<std::pair<Key, Program>> stale;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& program : programs_) {
+            bool build = program.second.requested;
+            for(const auto& path : changed) {
+                build = build || program.second.dependencies.count(path);
+            }
+            if (build) {
+                stale.push_back(program);
+                program.second.requested = false;
+            }
+        }
+    }
+
+    for(auto& program : stale) {
+        const Source& source = program.second.source;
+        int64_t start = os::utime_now();
+        auto shader = Shader::Load(source.vs, source.fs, source.gs,
+                                   source.includes, source.defines);
+        if (!shader) {
+            failures_++;
+            LOG(ERROR, program.second.requested ? "Building " : "Reloading ",
+                source.fs, " failed; keeping the current program");
+            continue;
+        }
+        Warm(*shader, source);
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        LOGF(INFO, "%s %s in %.1f ms",
+             program.second.requested ? "Built" : "Rebuilt", source.fs.c_str(),
+             double(os::utime_now() - start) / 1000.0);
+        for(const auto& path : shader->dependencies()) {
+            watcher_.Watch(path);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = programs_.find(program.first);
+        if (it == programs_.end() ||
+            it->second.generation != program.second.generation) {
+            glDeleteSync(fence);
+            continue;
+        }
+        // Includes may have been added or removed.
+        it->second.dependencies = shader->dependencies();
+        Ready& ready = ready_[program.first];
+        if (ready.fence) {
+            glDeleteSync(ready.fence);
+        }
+        ready.shader = std::move(shader);
+        ready.fence = fence;
+        reloads_++;
+    }
+}
+
+}  // namespace GFX
@@ -0,0 +1,113 @@
+#ifndef RMX_GFX_SHADER_RELOADER_H
+#define RMX_GFX_SHADER_RELOADER_H
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+
+#include "gfx/file_watcher.h"
+#include "gfx/shader.h"
+
+namespace GFX {
+
+// Rebuilds shader programs on a background thread whenever a file they
+// were built from changes, so shaders and their includes can be edited
+// while the app runs.  The thread compiles with its own GL context,
+// which must share objects with the render context.  Finished programs
+// are fenced and handed over by Take, which never blocks, so the render
+// thread only ever swaps in a program that is completely built.  The
+// same thread also builds new programs on request, so variants can be
+// compiled without stalling the render thread.
+class ShaderReloader {
+  public:
+    // What to pass to Shader::Load to rebuild a program.
+    struct Source {
+        std::string vs;
+        std::string fs;
+        std::string gs;
+        std::map<std::string, std::string> includes;
+        std::map<std::string, std::string> defines;
+        // The binding point of each uniform block, by name, set before
+        // the program is warmed up so it's warmed as it will be drawn.
+        std::map<std::string, GLuint> blocks;
+    };
+
+    // make_current is called on the worker thread to make the shared
+    // context current, and release when the thread exits.
+    ShaderReloader(std::function<bool()> make_current,
+                   std::function<void()> release);
+    ~ShaderReloader();
+
+    // Rebuild source whenever one of dependencies changes.  Replaces any
+    // earlier watch of owner's slot, and discards a rebuild of it that
+    // hasn't been taken.
+    void Watch(const void* owner, int slot, const Source& source,
+               const std::set<std::string>& dependencies);
+    // Build source for owner's slot in the background as soon as the
+    // thread is free, then watch it like Watch does.  Replaces any
+    // earlier watch or build of the slot.
+    void Build(const void* owner, int slot, const Source& source);
+    // Stop watching all of owner's programs, or just one slot.
+    void Unwatch(const void* owner);
+    void Unwatch(const void* owner, int slot);
+    // The rebuilt program for owner's slot if one is ready, or nullptr.
+    // Programs that fail to build are logged and never returned, so the
+    // caller keeps its current program.
+    std::unique_ptr<Shader> Take(const void* owner, int slot);
+    // Every program of owner's that Take would return, by slot.
+    std::vector<std::pair<int, std::unique_ptr<Shader>>> TakeAll(
+            const void* owner);
+
+    inline int reloads() const { return reloads_; }
+    inline int failures() const { return failures_; }
+
+  private:
+    typedef std::pair<const void*, int> Key;
+    struct Program {
+        Source source;
+        std::set<std::string> dependencies;
+        // Bumped by Watch, so rebuilds of a replaced source are dropped.
+        int generation;
+        // Build without waiting for a change.
+        bool requested;
+    };
+    struct Ready {
+        std::unique_ptr<Shader> shader;
+        GLsync fence = nullptr;
+    };
+
+    void Run();
+    void Rebuild(const std::set<std::string>& changed);
+    void Warm(const Shader& shader, const Source& source);
+    bool TakeLocked(std::map<Key, Ready>::iterator it,
+                    std::unique_ptr<Shader>* shader);
+
+    std::function<bool()> make_current_;
+    std::function<void()> release_;
+    FileWatcher watcher_;
+    std::mutex mutex_;
+    std::map<Key, Program> programs_;
+    std::map<Key, Ready> ready_;
+    int generation_;
+    // Set by Build so the thread doesn't wait for a change first.
+    std::atomic<bool> requested_;
+    std::atomic<bool> quit_;
+    std::atomic<int> reloads_;
+    std::atomic<int> failures_;
+    // Objects in the worker's context for warming programs up.
+    GLuint warm_fbo_;
+    GLuint warm_texture_;
+    GLuint warm_vao_;
+    GLuint warm_ubo_;
+    std::thread thread_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_SHADER_RELOADER_H
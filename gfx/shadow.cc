@@ -0,0 +1,46 @@
+#include "gfx/shadow.h"
+
+#include "gfx/octree.h"
+
+namespace GFX {
+
+void SurfaceBounds(const std::function<float(const glm::vec3&)>& distance,
+                   glm::vec3* lo, glm::vec3* hi) {
+    float half = kSurfaceRegion * 0.5f;
+    glm::vec3 box_lo(half), box_hi(-half);
+    auto visit = [&](const OctreeCell& cell) {
+        // Nothing in a cell that is already inside the box can grow it.
+        if (cell.lo.x >= box_lo.x && cell.lo.y >= box_lo.y &&
+            cell.lo.z >= box_lo.z && cell.hi.x <= box_hi.x &&
+            cell.hi.y <= box_hi.y && cell.hi.z <= box_hi.z) {
+            return false;
+        }
+        // A surface can only pass through the cell if the centre is no
+        // further from it than the cell's corners.
+        float extent = (cell.hi.x - cell.lo.x) * 0.5f;
+        if (std::abs(distance((cell.lo + cell.hi) * 0.5f)) >
+            extent * 1.7321f) {
+            return false;
+        }
+        if (cell.depth == kSurfaceDepth) {
+            box_lo = glm::min(box_lo, cell.lo);
+            box_hi = glm::max(box_hi, cell.hi);
+            return false;
+        }
+        return true;
+    };
+    SubdivideOctree(OctreeCell{glm::vec3(-half), glm::vec3(half), 0,
+                               glm::ivec3(0)}, visit);
+    if (box_lo.x > box_hi.x) {
+        // No surfaces at all: nothing casts a shadow.
+        *lo = glm::vec3(kUnbounded);
+        *hi = glm::vec3(kUnbounded);
+        return;
+    }
+    for(int i = 0; i < 3; ++i) {
+        (*lo)[i] = box_lo[i] <= -half ? -kUnbounded : box_lo[i];
+        (*hi)[i] = box_hi[i] >= half ? kUnbounded : box_hi[i];
+    }
+}
+
+}  // namespace GFX
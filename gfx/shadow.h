@@ -0,0 +1,105 @@
+#ifndef RMX_GFX_SHADOW_H
+#define RMX_GFX_SHADOW_H
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "glm/glm.hpp"
+
+namespace GFX {
+
+// Soft shadows towards a point light, as SWMarcher::GetVisibility, the
+// packet kernels and GetVisibility in content/raymarch.fs march them.
+//
+// The penumbra is Quilez's improved estimate: each distance is
+// triangulated with the last one to where the ray passes closest to the
+// occluder, instead of being taken at the point it was measured, which
+// darkens the shadow wherever a step lands just past a corner.  Each step
+// is clamped to [min_step, max_step], so rays grazing a surface don't
+// crawl along it, and fields that overestimate the distance can be kept
+// from stepping over thin occluders.  The march stops, fully shadowed,
+// once the visibility drops below threshold.
+//
+// A ray only marches the part of its path inside the box around the
+// scene's surfaces (see SurfaceBounds), grown by how far the penumbra
+// reaches: k * d / t is at least 1, fully lit, wherever d >= t / k.
+// Bounds for a scene with no bounds, or with shadows unbounded.
+const float kUnbounded = 1e30f;
+
+struct ShadowOptions {
+    // Penumbra hardness; larger is harder.
+    float k = 16.0f;
+    float min_step = 0.005f;
+    float max_step = kUnbounded;
+    float threshold = 0.004f;
+    // Clip shadow rays to the scene's bounds.
+    bool bounded = true;
+    // Cache the visibility at 1/cache resolution, and interpolate it for
+    // the pixels whose four nearest cache texels hit about as far away as
+    // they did and agree to within cache_tolerance; march the rest.  0
+    // disables the cache.
+    int cache = 0;
+    float cache_tolerance = 0.05f;
+};
+
+// What the shadow kernels need: the options and the box they march in.
+struct ShadowParams {
+    float k;
+    float min_step;
+    float max_step;
+    float threshold;
+    glm::vec3 lo;
+    glm::vec3 hi;
+
+    static ShadowParams Make(const ShadowOptions& o, const glm::vec3& lo,
+                             const glm::vec3& hi) {
+        return ShadowParams{o.k, o.min_step, o.max_step, o.threshold,
+                            lo, hi};
+    }
+};
+
+// Clip the ray p + r * t, which runs from *enter to *leave, to the box
+// from lo to hi grown by margin.  The ray misses if *enter >= *leave.
+template<typename F>
+inline void ClipToBox(F px, F py, F pz, F rx, F ry, F rz,
+                      const glm::vec3& lo, const glm::vec3& hi, F margin,
+                      F* enter, F* leave) {
+    using std::max;
+    using std::min;
+    F p[3] = {px, py, pz}, r[3] = {rx, ry, rz};
+    // Plain members, so the packet kernels don't call glm's operator[].
+    float l[3] = {lo.x, lo.y, lo.z}, h[3] = {hi.x, hi.y, hi.z};
+    for(int i = 0; i < 3; ++i) {
+        F inv = F(1.0f) / r[i];
+        F a = (F(l[i]) - margin - p[i]) * inv;
+        F b = (F(h[i]) + margin - p[i]) * inv;
+        *enter = max(*enter, min(a, b));
+        *leave = min(*leave, max(a, b));
+    }
+}
+
+// The visibility f after a distance d at t along a shadow ray, where the
+// last distance was last.
+template<typename F>
+inline F Penumbra(F f, F d, F last, F t, F k) {
+    using std::max;
+    using std::min;
+    using std::sqrt;
+    F y = d * d / (F(2.0f) * last);
+    F h = sqrt(max(d * d - y * y, F(0.0f)));
+    return min(f, k * h / max(t - y, F(1e-6f)));
+}
+
+// Set lo and hi to a box around every surface of distance, a field never
+// steeper than 1, within a cube kSurfaceRegion across.  The cube is
+// subdivided kSurfaceDepth times, dropping every cell whose centre is
+// further from a surface than its corners are.  The faces of the box
+// that reach the cube's are pushed out to kUnbounded, as the surfaces may
+// go on past them.
+const float kSurfaceRegion = 64.0f;
+const int kSurfaceDepth = 7;
+void SurfaceBounds(const std::function<float(const glm::vec3&)>& distance,
+                   glm::vec3* lo, glm::vec3* hi);
+
+}  // namespace GFX
+#endif // RMX_GFX_SHADOW_H
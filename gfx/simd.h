@@ -0,0 +1,169 @@
+#ifndef RMX_GFX_SIMD_H
+#define RMX_GFX_SIMD_H
+#include <cmath>
+#include <cstdint>
+
+// Thin wrappers around the x86 vector registers so the packet marching
+// kernels can be written once as templates and instantiated per ISA.
+//
+// Each wrapper is only defined when the translation unit is compiled with
+// the matching instruction set enabled (e.g. -mavx2), so the wide kernels
+// live in their own files with their own copts; see gfx/BUILD.
+//
+// Every lane type provides:
+//   kWidth                   number of float lanes
+//   Mask                     result of a comparison
+//   Load/Store               aligned memory access
+//   + - * /, sqrt, min, max, abs
+//   < <= > >=                lane-wise comparison producing a Mask
+//   & | AndNot(a, b)         mask logic (AndNot is a & ~b)
+//   Select(m, a, b)          m ? a : b per lane
+//   Bits(m)                  mask as an integer, lane 0 in bit 0
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace GFX {
+// The lane types and their operators are in an unnamed namespace, so
+// each translation unit gets its own copy built for its own instruction
+// set, and so does everything instantiated over them.  That keeps the
+// code in the -mavx2 and -mavx512f translation units out of the symbol
+// table, where the linker could pick it over a baseline copy.
+namespace {
+
+// Scalar fallback: a "packet" of one ray.
+struct Float1 {
+    static const int kWidth = 1;
+    typedef bool Mask;
+    float v;
+
+    Float1() {}
+    Float1(float x) : v(x) {}
+    static inline Float1 Load(const float* p) { return Float1(*p); }
+    inline void Store(float* p) const { *p = v; }
+};
+inline Float1 operator+(Float1 a, Float1 b) { return a.v + b.v; }
+inline Float1 operator-(Float1 a, Float1 b) { return a.v - b.v; }
+inline Float1 operator*(Float1 a, Float1 b) { return a.v * b.v; }
+inline Float1 operator/(Float1 a, Float1 b) { return a.v / b.v; }
+inline Float1 operator-(Float1 a) { return -a.v; }
+inline bool operator<(Float1 a, Float1 b) { return a.v < b.v; }
+inline bool operator<=(Float1 a, Float1 b) { return a.v <= b.v; }
+inline bool operator>(Float1 a, Float1 b) { return a.v > b.v; }
+inline bool operator>=(Float1 a, Float1 b) { return a.v >= b.v; }
+inline Float1 sqrt(Float1 a) { return std::sqrt(a.v); }
+inline Float1 min(Float1 a, Float1 b) { return a.v < b.v ? a.v : b.v; }
+inline Float1 max(Float1 a, Float1 b) { return a.v > b.v ? a.v : b.v; }
+inline Float1 abs(Float1 a) { return std::fabs(a.v); }
+inline bool AndNot(bool a, bool b) { return a && !b; }
+inline Float1 Select(bool m, Float1 a, Float1 b) { return m ? a : b; }
+inline uint32_t Bits(bool m) { return m; }
+
+#if defined(__SSE2__)
+struct Mask4 { __m128 m; };
+inline Mask4 operator&(Mask4 a, Mask4 b) { return Mask4{_mm_and_ps(a.m, b.m)}; }
+inline Mask4 operator|(Mask4 a, Mask4 b) { return Mask4{_mm_or_ps(a.m, b.m)}; }
+inline Mask4 AndNot(Mask4 a, Mask4 b) { return Mask4{_mm_andnot_ps(b.m, a.m)}; }
+inline uint32_t Bits(Mask4 a) { return _mm_movemask_ps(a.m); }
+
+struct Float4 {
+    static const int kWidth = 4;
+    typedef Mask4 Mask;
+    __m128 v;
+
+    Float4() {}
+    Float4(__m128 x) : v(x) {}
+    Float4(float x) : v(_mm_set1_ps(x)) {}
+    static inline Float4 Load(const float* p) { return _mm_load_ps(p); }
+    inline void Store(float* p) const { _mm_store_ps(p, v); }
+};
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline Mask4 operator<(Float4 a, Float4 b) { return Mask4{_mm_cmplt_ps(a.v, b.v)}; }
+inline Mask4 operator<=(Float4 a, Float4 b) { return Mask4{_mm_cmple_ps(a.v, b.v)}; }
+inline Mask4 operator>(Float4 a, Float4 b) { return Mask4{_mm_cmpgt_ps(a.v, b.v)}; }
+inline Mask4 operator>=(Float4 a, Float4 b) { return Mask4{_mm_cmpge_ps(a.v, b.v)}; }
+inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline Float4 Select(Mask4 m, Float4 a, Float4 b) {
+    return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+#endif  // __SSE2__
+
+#if defined(__AVX2__)
+struct Mask8 { __m256 m; };
+inline Mask8 operator&(Mask8 a, Mask8 b) { return Mask8{_mm256_and_ps(a.m, b.m)}; }
+inline Mask8 operator|(Mask8 a, Mask8 b) { return Mask8{_mm256_or_ps(a.m, b.m)}; }
+inline Mask8 AndNot(Mask8 a, Mask8 b) { return Mask8{_mm256_andnot_ps(b.m, a.m)}; }
+inline uint32_t Bits(Mask8 a) { return _mm256_movemask_ps(a.m); }
+
+struct Float8 {
+    static const int kWidth = 8;
+    typedef Mask8 Mask;
+    __m256 v;
+
+    Float8() {}
+    Float8(__m256 x) : v(x) {}
+    Float8(float x) : v(_mm256_set1_ps(x)) {}
+    static inline Float8 Load(const float* p) { return _mm256_load_ps(p); }
+    inline void Store(float* p) const { _mm256_store_ps(p, v); }
+};
+inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline Float8 operator-(Float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline Mask8 operator<(Float8 a, Float8 b) { return Mask8{_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline Mask8 operator<=(Float8 a, Float8 b) { return Mask8{_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline Mask8 operator>(Float8 a, Float8 b) { return Mask8{_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline Mask8 operator>=(Float8 a, Float8 b) { return Mask8{_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline Float8 sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+inline Float8 min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline Float8 max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline Float8 abs(Float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline Float8 Select(Mask8 m, Float8 a, Float8 b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+#endif  // __AVX2__
+
+#if defined(__AVX512F__)
+struct Mask16 { __mmask16 m; };
+inline Mask16 operator&(Mask16 a, Mask16 b) { return Mask16{__mmask16(a.m & b.m)}; }
+inline Mask16 operator|(Mask16 a, Mask16 b) { return Mask16{__mmask16(a.m | b.m)}; }
+inline Mask16 AndNot(Mask16 a, Mask16 b) { return Mask16{__mmask16(a.m & ~b.m)}; }
+inline uint32_t Bits(Mask16 a) { return a.m; }
+
+struct Float16 {
+    static const int kWidth = 16;
+    typedef Mask16 Mask;
+    __m512 v;
+
+    Float16() {}
+    Float16(__m512 x) : v(x) {}
+    Float16(float x) : v(_mm512_set1_ps(x)) {}
+    static inline Float16 Load(const float* p) { return _mm512_load_ps(p); }
+    inline void Store(float* p) const { _mm512_store_ps(p, v); }
+};
+inline Float16 operator+(Float16 a, Float16 b) { return _mm512_add_ps(a.v, b.v); }
+inline Float16 operator-(Float16 a, Float16 b) { return _mm512_sub_ps(a.v, b.v); }
+inline Float16 operator*(Float16 a, Float16 b) { return _mm512_mul_ps(a.v, b.v); }
+inline Float16 operator/(Float16 a, Float16 b) { return _mm512_div_ps(a.v, b.v); }
+inline Float16 operator-(Float16 a) { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+inline Mask16 operator<(Float16 a, Float16 b) { return Mask16{_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)}; }
+inline Mask16 operator<=(Float16 a, Float16 b) { return Mask16{_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)}; }
+inline Mask16 operator>(Float16 a, Float16 b) { return Mask16{_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)}; }
+inline Mask16 operator>=(Float16 a, Float16 b) { return Mask16{_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)}; }
+inline Float16 sqrt(Float16 a) { return _mm512_sqrt_ps(a.v); }
+inline Float16 min(Float16 a, Float16 b) { return _mm512_min_ps(a.v, b.v); }
+inline Float16 max(Float16 a, Float16 b) { return _mm512_max_ps(a.v, b.v); }
+inline Float16 abs(Float16 a) { return _mm512_abs_ps(a.v); }
+inline Float16 Select(Mask16 m, Float16 a, Float16 b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+#endif  // __AVX512F__
+
+}  // namespace
+}  // namespace GFX
+#endif // RMX_GFX_SIMD_H
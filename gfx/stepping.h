@@ -0,0 +1,87 @@
+#ifndef RMX_GFX_STEPPING_H
+#define RMX_GFX_STEPPING_H
+#include <algorithm>
+#include <cstring>
+
+namespace GFX {
+
+// How the marchers step along a primary ray.  SWMarcher::RayMarch, the
+// packet kernels and RayMarch in content/raymarch.fs implement every
+// strategy the same way, so the steps and pixels compare across them.
+//
+// Each strategy stops where sphere tracing does, and only differs in how
+// far it steps from a distance d:
+//   kSphere       d.
+//   kOverRelaxed  d * relaxation (Keinert et al., "Enhanced Sphere
+//                 Tracing", 2014).
+//   kEnhanced     as far as a plane through the last two distances
+//                 predicts the next unbounding sphere still overlaps this
+//                 one, between d and d * relaxation (after Balint and
+//                 Valasek, "Accelerating Sphere Tracing", 2018).
+//   kLipschitz    d / lipschitz, for fields that aren't Euclidean
+//                 distances: a bound over 1 keeps fields that overestimate
+//                 the distance, e.g. under domain warps, from stepping
+//                 through surfaces, and one under 1 speeds up fields that
+//                 underestimate it, like fBoxCheap near edges.
+// A step longer than d is checked where it lands: if the unbounding
+// spheres at its ends don't overlap, it may have skipped a surface, so the
+// ray goes back, takes a plain step and steps plainly from then on.  The
+// check counts as a step.
+struct Stepping {
+    enum Strategy {
+        kSphere,
+        kOverRelaxed,
+        kEnhanced,
+        kLipschitz,
+        kStrategies
+    };
+
+    Strategy strategy;
+    float relaxation;
+    float lipschitz;
+
+    static const char* Name(Strategy s) {
+        switch(s) {
+            case kSphere:      return "sphere";
+            case kOverRelaxed: return "overrelaxed";
+            case kEnhanced:    return "enhanced";
+            case kLipschitz:   return "lipschitz";
+            default:           return "unknown";
+        }
+    }
+    // Sets s to the strategy called name.  Returns false if there isn't
+    // one.
+    static bool FromName(const char* name, Strategy* s) {
+        for(int i = 0; i < kStrategies; ++i) {
+            if (strcmp(name, Name(Strategy(i))) == 0) {
+                *s = Strategy(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The multiple of the distance a ray's first step takes.
+    float Stretch() const {
+        switch(strategy) {
+            case kOverRelaxed: return relaxation;
+            case kLipschitz:   return 1.0f / lipschitz;
+            default:           return 1.0f;
+        }
+    }
+};
+
+// The multiple of the distance d kEnhanced steps by next, given that
+// the last step went step from a distance of last.  Sphere tracing
+// towards a plane approaching at slope s = (d - last) / step, the next
+// sphere touches this one after 2 / (1 - s) times d; aim a little short.
+template<typename F>
+inline F PredictStretch(F last, F d, F step, F relaxation) {
+    using std::max;
+    using std::min;
+    F gap = max(step + last - d, F(1e-6f));
+    return min(max(F(1.8f) * step / gap, F(1.0f)), relaxation);
+}
+
+}  // namespace GFX
+#endif // RMX_GFX_STEPPING_H
@@ -1,39 +1,653 @@
 #include "gfx/swmarch.h"
+#include <algorithm>
 #include <cmath>
 
+#include "gfx/profiler.h"
+#include "gfx/sdf_octree.h"
+#include "gfx/sdf_primitives.h"
 #include "glm/glm.hpp"
 #include "imwidget/glbitmap.h"
+#include "util/os.h"
 
 namespace GFX {
 using namespace glm;
 
+namespace {
+bool SameView(const Camera& a, const Camera& b) {
+    return a.eye == b.eye && a.forward == b.forward && a.right == b.right &&
+           a.up == b.up && a.focal_length == b.focal_length &&
+           a.near == b.near && a.far == b.far;
+}
+}  // namespace
+
 void SWMarcher::Draw() {
     Render();
-    bitmap_.DrawAt(0, 0, 4.0f);
+    Profiler::Scope scope("blit");
+    (heatmap_ ? *heatmap_bitmap_ : bitmap_).DrawAt(0, 0, 4.0f);
 }
 
 // The Render function simulates what the GPU would do: execute the
-// shader program for every point in the image.
+// shader program for every point in the image.  Like the GPU, we run
+// many pixels at once: the image is cut into tiles and the tiles are
+// rendered in parallel.
 void SWMarcher::Render() {
+    Profiler::Scope render("swmarch", false);
+    volume_.reset();
+    if (use_volume_ && scene_) {
+        Profiler::Scope scope("volume", false);
+        volume_ = volume_cache_.Get(scene_, volume_options_);
+    }
+    UpdateShadowBounds();
+    pass_stats_.clear();
+    RenderPrepass();
+
+    int64_t start = os::utime_now();
+    pass_steps_ = 0;
+    RenderShadowCache();
+    phase_ = 1 - phase_;
+    if (Antialiasing()) {
+        surfaces_.resize(bitmap_.width() * bitmap_.height());
+        edges_.resize(surfaces_.size());
+    }
+    if (Collecting()) {
+        cost_.Reset(bitmap_.width(), bitmap_.height());
+    }
+    {
+        Profiler::Scope scope("march", false);
+        scheduler_.Run(bitmap_.width(), bitmap_.height(), tile_size_,
+                       [this](const Tile& tile, int thread) {
+                           RenderTile(tile);
+                       });
+    }
+    // While the camera is still, the pixels that weren't marched already
+    // hold what the last frame marched for them.
+    if (sampling_ != kFullRate &&
+        !(history_valid_ && SameView(camera_, history_camera_))) {
+        Profiler::Scope scope("reconstruct", false);
+        scheduler_.Run(bitmap_.width(), bitmap_.height(), tile_size_,
+                       [this](const Tile& tile, int thread) {
+                           ReconstructTile(tile);
+                       });
+    }
+    history_valid_ = true;
+    history_camera_ = camera_;
+    int pixels = bitmap_.width() * bitmap_.height();
+    if (Antialiasing()) {
+        Profiler::Scope scope("antialias", false);
+        refined_ = 0;
+        scheduler_.Run(bitmap_.width(), bitmap_.height(), tile_size_,
+                       [this](const Tile& tile, int thread) {
+                           FindEdges(tile);
+                       });
+        scheduler_.Run(bitmap_.width(), bitmap_.height(), tile_size_,
+                       [this](const Tile& tile, int thread) {
+                           RefineTile(tile);
+                       });
+        antialias_refined_ = double(refined_) / double(pixels);
+    }
+    if (sampling_ != kFullRate) {
+        pixels /= 2;
+    }
+    pass_stats_.push_back(MarchPassStats{
+            1, bitmap_.width(), bitmap_.height(),
+            double(os::utime_now() - start) / 1000.0,
+            double(pass_steps_) / double(pixels)});
+    if (heatmap_) {
+        Profiler::Scope scope("heatmap", false);
+        if (!heatmap_bitmap_) {
+            heatmap_bitmap_.reset(
+                    new GLBitmap(bitmap_.width(), bitmap_.height()));
+        }
+        cost_.Overlay(heatmap_counter_, heatmap_range_, bitmap_.data(),
+                      heatmap_bitmap_->data());
+    }
+    if (upload_) {
+        Profiler::Scope upload("upload");
+        (heatmap_ ? *heatmap_bitmap_ : bitmap_).Update();
+    }
+}
+
+void SWMarcher::set_scene(const sdf::NodeRef& scene,
+                          const sdf::Bounds& bounds, int max_depth) {
+    if (!scene) {
+        set_scene(nullptr);
+        return;
+    }
+    set_scene(std::make_shared<sdf::OctreeScene>(scene, bounds, max_depth));
+}
+
+void SWMarcher::set_prepass(int factor, int levels) {
+    prepass_factor_ = factor;
+    prepass_levels_ = factor > 0 ? std::max(levels, 1) : 0;
+    // Every level halves the factor, and needs a factor of at least 2.
+    while (prepass_levels_ > 1 && (factor >> (prepass_levels_ - 1)) < 2) {
+        --prepass_levels_;
+    }
+    levels_.resize(prepass_levels_);
+}
+
+// Each prepass texel stands for a factor x factor block of pixels, and
+// cone marches from the block's centre ray starting at the depth the
+// coarser level found for it.
+void SWMarcher::RenderPrepass() {
+    Profiler::Scope scope("prepass", false);
+    int width = bitmap_.width();
+    int height = bitmap_.height();
+    float ustep = 2.0f / width;
+    float vstep = 2.0f / height;
+
+    for(size_t l=0; l<levels_.size(); ++l) {
+        PrepassLevel& level = levels_[l];
+        const PrepassLevel* parent = l ? &levels_[l-1] : nullptr;
+        int f = prepass_factor_ >> l;
+        level.factor = f;
+        level.width = (width + f - 1) / f;
+        level.height = (height + f - 1) / f;
+        level.depth.resize(level.width * level.height);
+
+        // Any ray in the block is within half the block's diagonal of the
+        // centre ray on the image plane, so this bounds the cone's radius
+        // per unit of distance.
+        vec2 half_block(aspect_ratio_ * float(f) / width, float(f) / height);
+        float k = length(half_block) / camera_.focal_length;
+        float centre = 0.5f * float(f - 1);
+
+        int64_t start = os::utime_now();
+        pass_steps_ = 0;
+        scheduler_.Run(level.width, level.height, tile_size_,
+                       [&](const Tile& tile, int thread) {
+            int64_t steps = 0;
+            for(int y=tile.y; y<tile.y+tile.h; ++y) {
+                float v = 1.0f - (float(y * f) + centre) * vstep;
+                for(int x=tile.x; x<tile.x+tile.w; ++x) {
+                    float u = -1.0f + (float(x * f) + centre) * ustep;
+                    float t = 0.0f;
+                    if (parent) {
+                        int px = x * f / parent->factor;
+                        int py = y * f / parent->factor;
+                        t = parent->depth[py * parent->width + px];
+                    }
+                    int n;
+                    level.depth[y * level.width + x] = ConeMarch(
+                        camera_.eye, RayDirection(vec2(u, v)), k, t, n);
+                    steps += n;
+                }
+            }
+            pass_steps_ += steps;
+        });
+        pass_stats_.push_back(MarchPassStats{
+                f, level.width, level.height,
+                double(os::utime_now() - start) / 1000.0,
+                double(pass_steps_) / double(level.width * level.height)});
+    }
+}
+
+// Shadow rays are clipped to the box around the scene's surfaces.  The
+// floor is raytraced rather than part of the scene, so it never casts a
+// shadow and needn't be in the box.
+void SWMarcher::UpdateShadowBounds() {
+    if (!shadows_.bounded) {
+        shadow_lo_ = vec3(-kUnbounded);
+        shadow_hi_ = vec3(kUnbounded);
+        return;
+    }
+    uint64_t key = scene_ ? scene_->Fingerprint() : 0;
+    if (shadow_bounds_valid_ && key == shadow_bounds_key_) {
+        return;
+    }
+    Profiler::Scope scope("shadow bounds", false);
+    SurfaceBounds([this](const vec3& p) { return DistScene(p); },
+                  &shadow_lo_, &shadow_hi_);
+    shadow_bounds_valid_ = true;
+    shadow_bounds_key_ = key;
+}
+
+// Each cache texel marches the centre ray of its block of pixels, like a
+// prepass texel, but on to the surface and from there to the light.
+void SWMarcher::RenderShadowCache() {
+    ShadowCache& cache = shadow_cache_;
+    cache.factor = 0;
+    int f = shadows_.cache;
+    if (f < 2) {
+        return;
+    }
+    Profiler::Scope scope("shadow cache", false);
+    int width = bitmap_.width();
+    int height = bitmap_.height();
+    float ustep = 2.0f / width;
+    float vstep = 2.0f / height;
+    float centre = 0.5f * float(f - 1);
+    cache.width = (width + f - 1) / f;
+    cache.height = (height + f - 1) / f;
+    cache.texels.resize(cache.width * cache.height);
+
+    scheduler_.Run(cache.width, cache.height, tile_size_,
+                   [&](const Tile& tile, int thread) {
+        for(int y=tile.y; y<tile.y+tile.h; ++y) {
+            float v = 1.0f - (float(y * f) + centre) * vstep;
+            for(int x=tile.x; x<tile.x+tile.w; ++x) {
+                float u = -1.0f + (float(x * f) + centre) * ustep;
+                vec3 rd = RayDirection(vec2(u, v));
+                int i;
+                float t0;
+                Surface s;
+                RayMarch(camera_.eye, rd, i, t0);
+                vec2 texel(0.0f, -1.0f);
+                if (FindSurface(camera_.eye, rd, i, t0, &s)) {
+                    texel = vec2(GetVisibility(s.pos, light0pos_, shadows_.k),
+                                 distance(s.pos, camera_.eye));
+                }
+                cache.texels[y * cache.width + x] = texel;
+            }
+        }
+    });
+    cache.factor = f;
+}
+
+namespace {
+// How far, relative to p's distance from the eye, the surfaces the cache
+// texels around p hit may be for the cache to be used at p.
+const float kCacheDepth = 0.05f;
+}  // namespace
+
+bool SWMarcher::CachedVisibility(const vec3& p, float* vis) const {
+    const ShadowCache& cache = shadow_cache_;
+    if (cache.factor == 0) {
+        return false;
+    }
+    // Project p back onto the image plane, undoing RayDirection, and
+    // from there into the cache's texels.
+    vec3 v = p - camera_.eye;
+    float z = dot(v, camera_.forward);
+    if (z <= 0.0f) {
+        return false;
+    }
+    float u = dot(v, camera_.right) * camera_.focal_length /
+              (z * aspect_ratio_);
+    float w = dot(v, camera_.up) * camera_.focal_length / z;
+    float centre = 0.5f * float(cache.factor - 1);
+    float tx = ((u + 1.0f) * 0.5f * bitmap_.width() - centre) / cache.factor;
+    float ty = ((1.0f - w) * 0.5f * bitmap_.height() - centre) / cache.factor;
+    int x0 = int(std::floor(tx));
+    int y0 = int(std::floor(ty));
+
+    float depth = length(v);
+    float lo = 1.0f, hi = 0.0f;
+    float s[4];
+    for(int i=0; i<4; ++i) {
+        int x = glm::clamp(x0 + (i & 1), 0, cache.width - 1);
+        int y = glm::clamp(y0 + (i >> 1), 0, cache.height - 1);
+        const vec2& texel = cache.texels[y * cache.width + x];
+        if (std::abs(texel.y - depth) > kCacheDepth * depth) {
+            return false;
+        }
+        s[i] = texel.x;
+        lo = std::min(lo, s[i]);
+        hi = std::max(hi, s[i]);
+    }
+    if (hi - lo > shadows_.cache_tolerance) {
+        return false;
+    }
+    float fx = tx - float(x0), fy = ty - float(y0);
+    *vis = mix(mix(s[0], s[1], fx), mix(s[2], s[3], fx), fy);
+    return true;
+}
+
+// The depth the primary ray through pixel (x, y) can start from.
+float SWMarcher::PrepassDepth(int x, int y) const {
+    if (levels_.empty()) {
+        return 0.0f;
+    }
+    const PrepassLevel& level = levels_.back();
+    return level.depth[(y / level.factor) * level.width + x / level.factor];
+}
+
+namespace {
+uint32_t PackColor(vec4 color) {
+    color = clamp(color, 0.0f, 1.0f) * 255.0f;
+    // We want ABGR ordering.
+    return uint32_t(color.r) <<  0 |
+           uint32_t(color.g) <<  8 |
+           uint32_t(color.b) << 16 |
+           uint32_t(color.a) << 24 ;
+}
+
+int Luma(uint32_t c) {
+    return 299 * (c & 0xff) + 587 * (c >> 8 & 0xff) +
+           114 * (c >> 16 & 0xff);
+}
+
+vec4 UnpackColor(uint32_t c) {
+    return vec4(c & 0xff, c >> 8 & 0xff, c >> 16 & 0xff, c >> 24) / 255.0f;
+}
+
+// The per-channel mean of two ABGR colors.
+uint32_t Average(uint32_t a, uint32_t b) {
+    return (a & b) + (((a ^ b) & 0xfefefefe) >> 1);
+}
+
+// The radical inverse of i in base b.  RayMarchScene spreads its
+// antialiasing samples with the same Halton sequence.
+float Halton(int i, int b) {
+    float f = 1.0f, r = 0.0f;
+    for(; i > 0; i /= b) {
+        f /= b;
+        r += f * (i % b);
+    }
+    return r;
+}
+
+// FindEdges' thresholds, the same as content/edges.fs's.
+const float kDepthEdge = 0.1f;
+const float kNormalEdge = 0.9f;
+// In Luma's units.
+const int kColorEdge = 25500;
+
+bool DepthEdge(float t, float ta, float tb) {
+    return std::abs(2.0f - t / ta - t / tb) > kDepthEdge;
+}
+
+bool Edge(uint32_t color, const vec4& surface, uint32_t c, const vec4& s) {
+    // The sky's normal is 0, so only compare normals between hits.
+    vec3 n0(surface), n1(s);
+    bool hits = dot(n0, n0) > 0.25f && dot(n1, n1) > 0.25f;
+    return std::abs(Luma(color) - Luma(c)) > kColorEdge ||
+           (hits && dot(n0, n1) < kNormalEdge);
+}
+}  // namespace
+
+void SWMarcher::RenderTile(const Tile& tile) {
     float ustep = 2.0f / bitmap_.width();
     float vstep = 2.0f / bitmap_.height();
-    float u, v;
+    int64_t steps = 0;
+
+    int stride = sampling_ == kCheckerboard ? 2 : 1;
+    bool antialias = Antialiasing();
+    bool collect = Collecting();
+    for(int y=tile.y; y<tile.y+tile.h; ++y) {
+        int start = tile.x;
+        if (!Marched(start, y)) {
+            if (sampling_ == kInterlaced) {
+                continue;
+            }
+            ++start;
+        }
+        int end = tile.x + tile.w;
+        if (packet_) {
+            int width = packet_->width;
+            for(int x=start; x<end; x+=width*stride) {
+                int count = (end - x + stride - 1) / stride;
+                RenderPacket(x, y, std::min(width, count), stride);
+            }
+            continue;
+        }
+        // Compute uv from the pixel coordinates rather than accumulating
+        // steps so the result doesn't depend on where the tile starts.
+        float v = 1.0f - float(y) * vstep;
+        for(int x=start; x<end; x+=stride) {
+            float u = -1.0f + float(x) * ustep;
+            RayCost cost;
+            vec4* surface = antialias
+                ? &surfaces_[y * bitmap_.width() + x] : nullptr;
+            vec4 color = RenderMain(vec2(u, v), PrepassDepth(x, y), &cost,
+                                    surface);
+            bitmap_.SetPixel(x, y, PackColor(color));
+            steps += cost.march;
+            if (collect) {
+                AddCost(y * bitmap_.width() + x, cost);
+            }
+        }
+    }
+    pass_steps_ += steps;
+}
+
+// Fill in the pixels the last RenderTile didn't march by interpolating
+// along whichever of their row and column the color changes least.
+// Their marched neighbours aren't written, so tiles can be done in any
+// order.
+void SWMarcher::ReconstructTile(const Tile& tile) {
+    int width = bitmap_.width();
+    int height = bitmap_.height();
+    const uint32_t* data = bitmap_.data();
+    for(int y=tile.y; y<tile.y+tile.h; ++y) {
+        // Off the edge of the bitmap, use the neighbour on the other side.
+        int up = y > 0 ? y - 1 : y + 1;
+        int down = y < height - 1 ? y + 1 : y - 1;
+        for(int x=tile.x; x<tile.x+tile.w; ++x) {
+            if (Marched(x, y)) {
+                continue;
+            }
+            int left = x > 0 ? x - 1 : x + 1;
+            int right = x < width - 1 ? x + 1 : x - 1;
+            uint32_t u = data[up * width + x];
+            uint32_t d = data[down * width + x];
+            uint32_t color = Average(u, d);
+            if (sampling_ == kCheckerboard) {
+                uint32_t l = data[y * width + left];
+                uint32_t r = data[y * width + right];
+                int h = std::abs(Luma(l) - Luma(r));
+                int v = std::abs(Luma(u) - Luma(d));
+                color = h < v ? Average(l, r)
+                      : v < h ? color
+                      : Average(Average(l, r), color);
+            }
+            bitmap_.SetPixel(x, y, color);
+        }
+    }
+}
+
+// Mark the pixels whose depth, normal or color differ from a
+// neighbour's, with the same tests as content/edges.fs.  Only reads the
+// first samples, so tiles can be done in any order.
+void SWMarcher::FindEdges(const Tile& tile) {
+    int width = bitmap_.width();
+    int height = bitmap_.height();
+    const uint32_t* data = bitmap_.data();
+    int64_t refined = 0;
+    for(int y=tile.y; y<tile.y+tile.h; ++y) {
+        int up = std::max(y - 1, 0) * width;
+        int down = std::min(y + 1, height - 1) * width;
+        for(int x=tile.x; x<tile.x+tile.w; ++x) {
+            int i = y * width + x;
+            int left = y * width + std::max(x - 1, 0);
+            int right = y * width + std::min(x + 1, width - 1);
+            const vec4& s = surfaces_[i];
+            bool edge =
+                DepthEdge(s.w, surfaces_[left].w, surfaces_[right].w) ||
+                DepthEdge(s.w, surfaces_[up + x].w, surfaces_[down + x].w);
+            for(int q : {left, right, up + x, down + x}) {
+                edge = edge || Edge(data[i], s, data[q], surfaces_[q]);
+            }
+            edges_[i] = edge;
+            refined += edge;
+        }
+    }
+    refined_ += refined;
+}
+
+// Average the remaining samples of the pixels FindEdges marked into
+// their first.  Every pixel takes the same samples, spread by a Halton
+// sequence around the first.  The samples of a row's pixels are marched
+// together so the packets are full.
+void SWMarcher::RefineTile(const Tile& tile) {
+    int width = bitmap_.width();
+    float ustep = 2.0f / width;
+    float vstep = 2.0f / bitmap_.height();
+    int extra = antialias_samples_ - 1;
+    vec2 offset[16];
+    for(int i=0; i<extra; ++i) {
+        offset[i] = vec2(Halton(i + 1, 2), Halton(i + 1, 3)) - 0.5f;
+    }
+    const uint32_t* data = bitmap_.data();
+    std::vector<vec2> uv;
+    std::vector<float> start;
+    std::vector<int> pixel;
+    std::vector<vec4> color;
+    std::vector<RayCost> cost;
+    std::vector<vec4> sum(tile.w);
+    bool collect = Collecting();
+    int64_t steps = 0;
+    for(int y=tile.y; y<tile.y+tile.h; ++y) {
+        uv.clear();
+        start.clear();
+        pixel.clear();
+        for(int x=tile.x; x<tile.x+tile.w; ++x) {
+            if (!edges_[y * width + x]) {
+                continue;
+            }
+            sum[x - tile.x] = UnpackColor(data[y * width + x]);
+            // The prepass cone covers the whole pixel.
+            for(int i=0; i<extra; ++i) {
+                uv.push_back(vec2(-1.0f + (float(x) + offset[i].x) * ustep,
+                                  1.0f - (float(y) + offset[i].y) * vstep));
+                start.push_back(PrepassDepth(x, y));
+                pixel.push_back(x - tile.x);
+            }
+        }
+        int count = uv.size();
+        color.resize(count);
+        cost.resize(count);
+        if (packet_) {
+            for(int i=0; i<count; i+=packet_->width) {
+                ShadePacket(&uv[i], &start[i],
+                            std::min(packet_->width, count - i),
+                            &color[i], nullptr, &cost[i]);
+            }
+        } else {
+            for(int i=0; i<count; ++i) {
+                color[i] = RenderMain(uv[i], start[i], &cost[i]);
+                steps += cost[i].march;
+            }
+        }
+        for(int i=0; i<count; ++i) {
+            sum[pixel[i]] += color[i];
+            if (collect) {
+                AddCost(y * width + tile.x + pixel[i], cost[i]);
+            }
+        }
+        for(int x=tile.x; x<tile.x+tile.w; ++x) {
+            if (edges_[y * width + x]) {
+                bitmap_.SetPixel(x, y, PackColor(sum[x - tile.x] /
+                                                 float(extra + 1)));
+            }
+        }
+    }
+    pass_steps_ += steps;
+}
+
+// RenderPacket does the same work as RenderMain for count pixels
+// starting at (x, y).
+void SWMarcher::RenderPacket(int x, int y, int count, int stride) {
+    int width = bitmap_.width();
+    float ustep = 2.0f / width;
+    float vstep = 2.0f / bitmap_.height();
+    float v = 1.0f - float(y) * vstep;
 
-    v = 1.0f;
-    for(int y=0; y<bitmap_.height(); ++y, v-=vstep) {
-        u = -1.0f;
-        for(int x=0; x<bitmap_.width(); ++x, u+=ustep) {
-            vec4 color = RenderMain(vec2(u, v));
-            color = clamp(color, 0.0f, 1.0f) * 255.0f;
-            // We want ABGR ordering.
-            uint32_t pixel = uint32_t(color.r) <<  0 |
-                             uint32_t(color.g) <<  8 |
-                             uint32_t(color.b) << 16 |
-                             uint32_t(color.a) << 24 ;
-            bitmap_.SetPixel(x, y, pixel);
+    vec2 uv[RayPacket::kMaxWidth];
+    float start[RayPacket::kMaxWidth];
+    for(int i=0; i<count; ++i) {
+        uv[i] = vec2(-1.0f + float(x + i * stride) * ustep, v);
+        start[i] = PrepassDepth(x + i * stride, y);
+    }
+    vec4 color[RayPacket::kMaxWidth];
+    vec4 surface[RayPacket::kMaxWidth];
+    RayCost cost[RayPacket::kMaxWidth];
+    bool antialias = Antialiasing();
+    bool collect = Collecting();
+    ShadePacket(uv, start, count, color, antialias ? surface : nullptr,
+                collect ? cost : nullptr);
+    for(int i=0; i<count; ++i) {
+        bitmap_.SetPixel(x + i * stride, y, PackColor(color[i]));
+        if (antialias) {
+            surfaces_[y * width + x + i * stride] = surface[i];
+        }
+        if (collect) {
+            AddCost(y * width + x + i * stride, cost[i]);
+        }
+    }
+}
+
+// ShadePacket hands the marching to the packet kernels.  Only the
+// per-ray bookkeeping between the kernels is scalar.
+void SWMarcher::ShadePacket(const vec2* uv, const float* start, int count,
+                            vec4* color, vec4* surfaces, RayCost* cost) {
+    const PacketKernels* k = packet_;
+    RayPacket rays;
+    rays.count = count;
+    for(int i=0; i<count; ++i) {
+        rays.Set(i, camera_.eye, RayDirection(uv[i]), start[i]);
+    }
+    rays.Pad(k->width);
+
+    PacketHits hits;
+    const DistanceField* scene = scene_.get();
+    MarchParams params{steps_, epsilon_, camera_.far, stepping_,
+                       stepping_.Stretch()};
+    k->RayMarch(volume_ ? volume_.get() : scene, rays, params, &hits);
+    int64_t steps = 0;
+    for(int i=0; i<count; ++i) {
+        steps += hits.steps[i];
+    }
+    pass_steps_ += steps;
+
+    // Gather the surface points.  Sky lanes keep the eye position so the
+    // normal kernel has something sane to chew on.
+    Surface surface[RayPacket::kMaxWidth];
+    RayPacket points;
+    points.count = count;
+    unsigned lit = 0;
+    for(int i=0; i<count; ++i) {
+        vec3 ro(rays.ox[i], rays.oy[i], rays.oz[i]);
+        vec3 rd(rays.dx[i], rays.dy[i], rays.dz[i]);
+        if (FindSurface(ro, rd, hits.steps[i], hits.distance[i], &surface[i])) {
+            lit |= 1u << i;
+            points.Set(i, surface[i].pos, vec3(0));
+        } else {
+            points.Set(i, camera_.eye, vec3(0));
+        }
+    }
+    points.Pad(k->width);
+
+    // Only march the shadow rays the cache can't answer.
+    float cached[RayPacket::kMaxWidth];
+    unsigned shade = lit;
+    for(int i=0; i<count; ++i) {
+        if ((lit & (1u << i)) && CachedVisibility(surface[i].pos, &cached[i])) {
+            shade &= ~(1u << i);
+        }
+    }
+    alignas(64) float vis[RayPacket::kMaxWidth];
+    int shadow[RayPacket::kMaxWidth];
+    k->GetVisibility(scene, points, light0pos_,
+                     ShadowParams::Make(shadows_, shadow_lo_, shadow_hi_),
+                     epsilon_, shade, vis, cost ? shadow : nullptr);
+    for(unsigned b = lit & ~shade; b; b &= b - 1) {
+        vis[__builtin_ctz(b)] = cached[__builtin_ctz(b)];
+    }
+    k->GetNormal(scene, &points);
+
+    for(int i=0; i<count; ++i) {
+        color[i] = sky_color_;
+        if (surfaces) {
+            surfaces[i] = vec4(vec3(0.0f), camera_.far);
+        }
+        if (cost) {
+            // Like the scalar path, only count the normals that are used.
+            bool normal = (lit & (1u << i)) && !surface[i].floor;
+            cost[i] = RayCost{hits.steps[i], shadow[i], normal ? 6 : 0};
+        }
+        if (lit & (1u << i)) {
+            Surface& s = surface[i];
+            if (!s.floor) {
+                s.normal = vec3(points.dx[i], points.dy[i], points.dz[i]);
+            }
+            color[i] = s.texture * GetShading(s.pos, s.normal, light0pos_,
+                                              light0col_, vis[i]);
+            if (surfaces) {
+                surfaces[i] = vec4(s.normal, distance(s.pos, camera_.eye));
+            }
         }
     }
-    bitmap_.Update();
 }
 
 //========================================================================
@@ -78,29 +692,24 @@ float clamp(float v, float min, float max) {
            v;
 }
 
-float vmax(const glm::vec3& v) {
-    return max(max(v.x, v.y), v.z);
-}
-
-float fSphere(const glm::vec3& position, float radius) {
-    return length(position) - radius;
-}
-
-float fBoxCheap(const glm::vec3& position, const glm::vec3& size) {
-    return vmax(abs(position) - size);
+float SWMarcher::DistScene(const glm::vec3& position) {
+    if (scene_) {
+        return scene_->Distance(position);
+    }
+    return sdf::DefaultScene(position.x, position.y, position.z);
 }
 
-float DistScene(const glm::vec3& position) {
-    float a = fSphere(position, 0.66f);
-    float b = fBoxCheap(position, vec3(1.0f, 0.25f, 0.333f));
-    // min is union
-    // max is intersection
-    return max(a, b);
+// The scene as seen by primary rays.
+float SWMarcher::DistPrimary(const glm::vec3& position) {
+    if (volume_) {
+        return volume_->Distance(position);
+    }
+    return DistScene(position);
 }
 
 // Approximate the normalized gradient of the distance function at point p.
 // If p is near a surface, the gradient will approximate the surface normal.
-vec3 GetNormal(const glm::vec3& p) {
+vec3 SWMarcher::GetNormal(const glm::vec3& p) {
     float h = 0.0001f;
     return normalize(vec3(
         DistScene(p + vec3(h, 0, 0)) - DistScene(p - vec3(h, 0, 0)),
@@ -110,31 +719,54 @@ vec3 GetNormal(const glm::vec3& p) {
 
 // Return a value [0,1] depending on how visible p1 is from p0.
 // k is the soft shadow factor (larger -> harder shadows).
-// See http://www.iquilezles.org/www/articles/rmshadows/rmshadows.htm
-float SWMarcher::GetVisibility(const vec3& p0, const vec3& p1, float k) {
+// See http://www.iquilezles.org/www/articles/rmshadows/rmshadows.htm and
+// gfx/shadow.h.
+float SWMarcher::GetVisibility(const vec3& p0, const vec3& p1, float k,
+                               int* steps) {
     vec3 rd = normalize(p1 - p0);
     float maxt = length(p1 - p0);
     float t = epsilon_ * 10.0f;
     float f = 1.0f;
+    float last = 1e20f;
+    int n = 0;
 
+    // Only march where the scene's penumbra can reach.
+    ClipToBox(p0.x, p0.y, p0.z, rd.x, rd.y, rd.z, shadow_lo_, shadow_hi_,
+              maxt / k, &t, &maxt);
     while (t < maxt) {
         float d = DistScene(p0 + rd*t);
+        ++n;
 
         // If we hit a surface before reaching p1, not visible.
         if (d < epsilon_) {
-            return 0.0f;
+            f = 0.0f;
+            break;
         }
-        // Compute penumbra factor
-        f = min(f, k * d/t);
-        t += d;
+        // Compute penumbra factor, and give up once it's dark.
+        f = Penumbra(f, d, last, t, k);
+        if (f < shadows_.threshold) {
+            f = 0.0f;
+            break;
+        }
+        last = d;
+        t += std::min(std::max(d, shadows_.min_step), shadows_.max_step);
+    }
+    if (steps) {
+        *steps = n;
     }
     return f;
 }
 vec4 SWMarcher::GetShading(
         const vec3& pos, const vec3& normal,
         const vec3& light_pos, const vec4& light_col) {
+    float vis = GetVisibility(pos, light_pos, shadows_.k);
+    return GetShading(pos, normal, light_pos, light_col, vis);
+}
+
+vec4 SWMarcher::GetShading(
+        const vec3& pos, const vec3& normal,
+        const vec3& light_pos, const vec4& light_col, float vis) {
     float intensity = 0.0f;
-    float vis = GetVisibility(pos, light_pos, 16.0f);
     if (vis > 0.0f) {
         vec3 light_dir = normalize(light_pos - pos);
         intensity = vis * clamp(dot(normal, light_dir), 0, 1);
@@ -144,21 +776,58 @@ vec4 SWMarcher::GetShading(
 
 void SWMarcher::RayMarch(
         const glm::vec3& ro, const glm::vec3& rd,
-        int& i, float& distance) {
-    distance = 0.0f;
+        int& i, float& distance, float start) {
+    distance = start;
+    // The stretch of the next step, and the last step and the distance
+    // it was taken from.  See gfx/stepping.h.
+    bool predict = stepping_.strategy == Stepping::kEnhanced;
+    bool stretching = stepping_.strategy != Stepping::kSphere;
+    float stretch = predict ? 1.0f : stepping_.Stretch();
+    float step = 0.0f, last = 0.0f;
     for(i=0; i<steps_; ++i) {
-        float d = DistScene(ro + rd * distance);
-
+        float d = DistPrimary(ro + rd * distance);
+
+        if (step > last && last + d < step) {
+            // The step was longer than the last distance and its spheres
+            // don't overlap: go back and step plainly from there on.
+            distance -= step - last;
+            step = last;
+            stretch = 1.0f;
+            stretching = false;
+            continue;
+        }
         // Make epsilon proportional to the distance so that accuracy can
         // drop as we get further into the scene.  We also just drop the
         // ray if it goes outside the far camera bound.
         if (d < epsilon_*distance*2.0f || distance >= camera_.far) {
             break;
         }
-        distance += d;
+        if (predict && stretching && step > 0.0f) {
+            stretch = PredictStretch(last, d, step, stepping_.relaxation);
+        }
+        step = d * stretch;
+        last = d;
+        distance += step;
     }
 }
 
+// Cone marching: a step is only as long as the empty sphere around the
+// cone's axis reaches past the cone's edge, and the march stops once the
+// sphere is no wider than the cone.
+float SWMarcher::ConeMarch(
+        const vec3& ro, const vec3& rd, float k, float start, int& i) {
+    float t = start;
+    for(i=0; i<steps_; ++i) {
+        float r = t * k;
+        float d = DistPrimary(ro + rd * t);
+        if (d < r * 2.0f || t >= camera_.far) {
+            break;
+        }
+        t += d - r;
+    }
+    return min(t, camera_.far);
+}
+
 vec4 SWMarcher::GetFloorTexture(const vec3& pos) {
     // Compute a checkerboard texture
     vec2 m = pos.xz;
@@ -172,7 +841,7 @@ float SWMarcher::RaytraceFloor(
     return dot(pos - ro, normal) / dot(rd, normal);
 }
 
-vec4 DistLines(const vec3& p) {
+vec4 SWMarcher::DistLines(const vec3& p) {
     float d = fmodf(DistScene(p), 0.1);
     if (d < 0.025f) {
         return vec4(0,0,0,1);
@@ -182,57 +851,91 @@ vec4 DistLines(const vec3& p) {
     return vec4(1);
 }
 
-vec4 SWMarcher::ComputeColor(const vec3& ro, const vec3& rd) {
+bool SWMarcher::FindSurface(
+        const vec3& ro, const vec3& rd,
+        int i, float t0, Surface* surface) {
     vec3 floor_normal = vec3(0, 1, 0);
     vec3 floor_pos = vec3(0, -0.5f, 0);
 
     float t;                    // Distance travelled by ray to eye
-    vec3 p;                     // Surface point
-    vec3 normal;                // Surface normal
-    vec4 texture = vec4(1.0f);  // Surface texture
-
-    int i;          // Steps traveled in raymarch
-    float t0;       // Distance traveled in raymarch
-    RayMarch(ro, rd, i, t0);
     float t1 = RaytraceFloor(ro, rd, floor_normal, floor_pos);
+    surface->texture = vec4(1.0f);
 
     // Check if floor was closet and in view of the camera.
     if (t1 < t0 && t1 >= camera_.near && t1 < camera_.far) {
         t = t1;
-        p = ro + rd*t;
-        normal = floor_normal;
-        texture = GetFloorTexture(p) * DistLines(p);
-
+        surface->pos = ro + rd*t;
+        surface->normal = floor_normal;
+        surface->texture = GetFloorTexture(surface->pos) *
+                           DistLines(surface->pos);
+        surface->floor = true;
     } else if (i < steps_ && t0 >= camera_.near && t0 < camera_.far) {
         t = t0;
-        p = ro + rd*t;
-        normal = GetNormal(p);
+        surface->pos = ro + rd*t;
+        surface->floor = false;
     } else {
+        return false;
+    }
+    return true;
+}
+
+vec4 SWMarcher::ComputeColor(const vec3& ro, const vec3& rd,
+                              float start, RayCost* cost, vec4* surface) {
+    Surface s;      // Surface point, normal and texture
+
+    int i;          // Steps traveled in raymarch
+    float t0;       // Distance traveled in raymarch
+    RayMarch(ro, rd, i, t0, start);
+    if (cost) {
+        *cost = RayCost{i, 0, 0};
+    }
+    if (!FindSurface(ro, rd, i, t0, &s)) {
+        if (surface) {
+            *surface = vec4(vec3(0.0f), camera_.far);
+        }
         return sky_color_;
     }
+    if (!s.floor) {
+        s.normal = GetNormal(s.pos);
+        if (cost) {
+            cost->normal = 6;
+        }
+    }
+    if (surface) {
+        *surface = vec4(s.normal, distance(s.pos, ro));
+    }
 
-    vec4 color;
-    float z = mapTo(t, camera_.near, camera_.far, 1, 0);
     // Color as a function of distance
+    //float z = mapTo(t, camera_.near, camera_.far, 1, 0);
     //color = vec4(1.0f) * z * texture;
 
     // Light sourc anbd ambient with shading
-    color = texture * GetShading(p, normal, light0pos_, light0col_);
+    float vis;
+    if (!CachedVisibility(s.pos, &vis)) {
+        vis = GetVisibility(s.pos, light0pos_, shadows_.k,
+                            cost ? &cost->shadow : nullptr);
+    }
+    return s.texture * GetShading(s.pos, s.normal, light0pos_, light0col_,
+                                  vis);
+}
 
-    return color;
+vec3 SWMarcher::RayDirection(const vec2& uv) {
+    return normalize(camera_.forward * camera_.focal_length +
+                     camera_.right * uv.x * aspect_ratio_ +
+                     camera_.up * uv.y);
 }
 
 // The RenderMain function is similar to the fragment shader main() function.
-vec4 SWMarcher::RenderMain(const vec2& uv) {
+vec4 SWMarcher::RenderMain(const vec2& uv, float start, RayCost* cost,
+                           vec4* surface) {
     vec3 rayorigin = camera_.eye;
-    vec3 raydirection = normalize(camera_.forward * camera_.focal_length +
-                                  camera_.right * uv.x * aspect_ratio_ +
-                                  camera_.up * uv.y);
+    vec3 raydirection = RayDirection(uv);
 
     // If you want to validate that uv sweeps over (-1,-1) to (1, 1)
     //vec4 color = vec4(0, uv.x*0.5f+0.5f, uv.y*0.5f+0.5f, 1.0f);
 
-    vec4 color = ComputeColor(rayorigin, raydirection);
+    vec4 color = ComputeColor(rayorigin, raydirection, start, cost,
+                              surface);
     return color;
 }
 
@@ -1,7 +1,20 @@
 #ifndef RMX_GFX_SWMARCH_H
 #define RMX_GFX_SWMARCH_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "gfx/camera.h"
+#include "gfx/distance_field.h"
+#include "gfx/march_stats.h"
+#include "gfx/raypacket.h"
+#include "gfx/sdf.h"
+#include "gfx/sdf_interval.h"
+#include "gfx/sdf_volume.h"
+#include "gfx/shadow.h"
+#include "gfx/stepping.h"
+#include "gfx/tile_scheduler.h"
 #include "glm/glm.hpp"
 #include "imwidget/glbitmap.h"
 
@@ -9,45 +22,282 @@ namespace GFX {
 
 class SWMarcher {
   public:
-    SWMarcher(int width, int height)
+    SWMarcher(int width, int height, int threads=0)
       : bitmap_(width, height),
+        scheduler_(threads),
+        tile_size_(32),
+        packet_(PacketKernels::Best()),
         aspect_ratio_(float(width)/float(height)),
         steps_(64),
         epsilon_(0.001f),
         sky_color_(glm::vec4(0.31f, 0.47f, 0.67f, 1.0f)),
         ambient_(glm::vec4(0.15, 0.20, 0.32, 1.0f)),
         light0pos_(glm::vec3(0.0f, 3.0f, 0.0f)),
-        light0col_(glm::vec4(1))
+        light0col_(glm::vec4(1)),
+        stepping_{Stepping::kSphere, 1.6f, 1.0f},
+        shadow_lo_(-kUnbounded),
+        shadow_hi_(kUnbounded),
+        shadow_bounds_valid_(false),
+        shadow_bounds_key_(0),
+        shadow_cache_{},
+        use_volume_(false),
+        prepass_factor_(0),
+        prepass_levels_(0),
+        pass_steps_(0),
+        sampling_(kFullRate),
+        phase_(0),
+        history_valid_(false),
+        antialias_samples_(0),
+        antialias_refined_(0.0),
+        refined_(0),
+        collect_stats_(false),
+        cost_{},
+        heatmap_(false),
+        heatmap_counter_(MarchCostMap::kMarchSteps),
+        heatmap_range_(64.0f),
+        upload_(true)
         {}
     
     void Render();
     void Draw();
     inline Camera* camera() { return &camera_; }
 
+    // The rendered frame, ABGR with the top row first.
+    inline const uint32_t* pixels() { return bitmap_.data(); }
+    inline int width() const { return bitmap_.width(); }
+    inline int height() const { return bitmap_.height(); }
+    // Render uploads each frame to a texture for Draw.  Turn it off to
+    // render without a GL context.
+    inline void set_upload(bool upload) { upload_ = upload; }
+
+    // Rendering is split into tile_size_ x tile_size_ tiles which are
+    // spread across the scheduler's threads.  A single thread renders
+    // serially on the caller.  Every pixel is computed from its own
+    // coordinates, so all thread counts and both scheduling modes produce
+    // identical images.
+    inline void SetThreads(int n) { scheduler_.SetThreads(n); }
+    inline int threads() const { return scheduler_.threads(); }
+    inline void set_deterministic(bool d) { scheduler_.set_deterministic(d); }
+    inline void set_tile_size(int size) { tile_size_ = size; }
+    void RenderTile(const Tile& tile);
+
+    // In packet mode, rays are marched packet_->width at a time by the
+    // SIMD kernels in gfx/raypacket.h.  The widest ISA supported by the
+    // CPU is selected by default; nullptr selects the scalar path.  Both
+    // paths produce the same image.
+    inline void set_packet_kernels(const PacketKernels* k) { packet_ = k; }
+    inline const PacketKernels* packet_kernels() const { return packet_; }
+    // Pixels x, x + stride, ... are rendered.
+    void RenderPacket(int x, int y, int count, int stride=1);
+
+    // The scene to render, e.g. a compiled sdf::Program.  nullptr (the
+    // default) renders the built-in scene from gfx/sdf_primitives.h.
+    inline void set_scene(std::shared_ptr<const DistanceField> scene) {
+        scene_ = std::move(scene);
+        history_valid_ = false;
+    }
+    // Render scene through an sdf::OctreeScene over bounds, so rays only
+    // evaluate the primitives that can reach the cells they pass through.
+    // The image is the same as the compiled scene's.
+    void set_scene(const sdf::NodeRef& scene, const sdf::Bounds& bounds,
+                   int max_depth=4);
+    inline const DistanceField* scene() const { return scene_.get(); }
+
+    // March primary rays through a BrickVolume baked from the scene.
+    // Normals and shadows still use the scene itself.  The volume is
+    // rebaked in the background whenever the scene's fingerprint
+    // changes, and the scene is marched until the bake is done.
+    inline void set_volume(bool enable,
+                           const BrickVolume::Options& options={}) {
+        use_volume_ = enable;
+        volume_options_ = options;
+    }
+    // The volume used by the last Render, if any.
+    inline const BrickVolume* volume() const { return volume_.get(); }
+
+    // Cone march a depth prepass at 1/factor resolution, refined at half
+    // the factor for each further level, and start every primary ray
+    // from the finest level's depth.  Works like RayMarchScene's prepass.
+    // A factor of 0 disables the prepass.
+    void set_prepass(int factor, int levels=1);
+    inline int prepass_factor() const { return prepass_factor_; }
+    // Time and mean steps per ray of each prepass level and of the full
+    // resolution pass during the last Render.
+    inline const std::vector<MarchPassStats>& pass_stats() const {
+        return pass_stats_;
+    }
+
+    // Which pixels are marched each frame, as RayMarchScene::set_sampling:
+    // half of them in a checker pattern or every other row, alternating
+    // every frame.  The rest keep the previous frame's color while the
+    // camera is still, and are interpolated from their neighbours while
+    // it moves.
+    enum Sampling { kFullRate, kCheckerboard, kInterlaced };
+    inline void set_sampling(Sampling s) {
+        sampling_ = s;
+        history_valid_ = false;
+    }
+    inline Sampling sampling() const { return sampling_; }
+
+    // Adaptive antialiasing, as RayMarchScene::set_antialias: the pixels
+    // whose depth, normal or color differ from a neighbour's are marched
+    // samples - 1 more times with jittered rays.  Up to 16; 1 or less
+    // disables it.  Ignored while interleaving.  The steps per ray in
+    // pass_stats include the extra samples.
+    inline void set_antialias(int samples) {
+        antialias_samples_ = glm::clamp(samples, 0, 16);
+    }
+    inline int antialias() const { return antialias_samples_; }
+    // The fraction of pixels the last frame refined.
+    inline double antialias_refined() const { return antialias_refined_; }
+
+    // How primary rays step; see gfx/stepping.h.  Sphere tracing by
+    // default.  The prepass still cone marches.
+    inline void set_stepping(const Stepping& s) { stepping_ = s; }
+    inline const Stepping& stepping() const { return stepping_; }
+
+    // How shadow rays are marched and cached; see gfx/shadow.h.  The
+    // scene's bounds are found again whenever its fingerprint changes.
+    // The cache is rendered at the start of the full resolution pass, and
+    // its time counts towards it in pass_stats.
+    inline void set_shadows(const ShadowOptions& options) {
+        shadows_ = options;
+        shadow_bounds_valid_ = false;
+    }
+    inline const ShadowOptions& shadows() const { return shadows_; }
+    // The box shadow rays are clipped to; kUnbounded on the sides the
+    // scene goes on past.
+    inline void shadow_bounds(glm::vec3* lo, glm::vec3* hi) const {
+        *lo = shadow_lo_;
+        *hi = shadow_hi_;
+    }
+
+    // Record what every pixel of each frame costs in cost_map(): its
+    // march and shadow steps and normal evaluations, summed over its
+    // samples.  Pixels set_sampling skips cost nothing, and the prepass
+    // isn't counted.
+    inline void set_collect_stats(bool c) { collect_stats_ = c; }
+    inline bool collect_stats() const { return collect_stats_; }
+    inline const MarchCostMap& cost_map() const { return cost_; }
+    // Draw a false-color map of one of cost_map()'s counters, red at
+    // range or more, over the frame.  Implies collect_stats.  pixels()
+    // still holds the frame itself.
+    inline void set_heatmap(bool enable,
+                            MarchCostMap::Counter counter=
+                                MarchCostMap::kMarchSteps,
+                            float range=64.0f) {
+        heatmap_ = enable;
+        heatmap_counter_ = counter;
+        heatmap_range_ = range;
+    }
+    inline bool heatmap() const { return heatmap_; }
+    inline MarchCostMap::Counter heatmap_counter() const {
+        return heatmap_counter_;
+    }
+    inline float heatmap_range() const { return heatmap_range_; }
+
+    // Distance evaluations spent on one ray, by MarchCostMap counter.
+    struct RayCost {
+        int march;
+        int shadow;
+        int normal;
+    };
+
     // These methods implement the ray marcher, and should be very similar
     // to what you'd implement in a fragment shader.
     // Common abbrieviations:
     //   ro -> rayorigin
     //   rd -> raydirection
     //
-    glm::vec4 RenderMain(const glm::vec2& uv);
-    glm::vec4 ComputeColor(const glm::vec3& rayorigin, const glm::vec3& raydirection);
+    float DistScene(const glm::vec3& position);
+    float DistPrimary(const glm::vec3& position);
+    glm::vec3 GetNormal(const glm::vec3& p);
+    // surface, if given, is set to the normal and the distance to what
+    // the ray hit, or 0 and camera.far for the sky.
+    glm::vec4 RenderMain(const glm::vec2& uv, float start=0.0f,
+                         RayCost* cost=nullptr, glm::vec4* surface=nullptr);
+    glm::vec3 RayDirection(const glm::vec2& uv);
+    glm::vec4 ComputeColor(const glm::vec3& rayorigin, const glm::vec3& raydirection,
+                           float start=0.0f, RayCost* cost=nullptr,
+                           glm::vec4* surface=nullptr);
     glm::vec4 GetFloorTexture(const glm::vec3& pos);
-    float GetVisibility(const glm::vec3& p0, const glm::vec3& p1, float k);
+    // steps, if given, is set to the number of distance evaluations.
+    float GetVisibility(const glm::vec3& p0, const glm::vec3& p1, float k,
+                        int* steps=nullptr);
     glm::vec4 GetShading(
             const glm::vec3& pos, const glm::vec3& normal,
             const glm::vec3& light_pos, const glm::vec4& light_col);
+    glm::vec4 GetShading(
+            const glm::vec3& pos, const glm::vec3& normal,
+            const glm::vec3& light_pos, const glm::vec4& light_col,
+            float visibility);
+    glm::vec4 DistLines(const glm::vec3& p);
     float RaytraceFloor(
             const glm::vec3& ro, const glm::vec3& rd,
             const glm::vec3& normal, const glm::vec3& pos);
     void RayMarch(
             const glm::vec3& ro, const glm::vec3& rd,
-            int& steps, float& distance);
+            int& steps, float& distance, float start=0.0f);
+    // March a cone around rd whose radius grows by k per unit of
+    // distance, starting at start.  Returns a depth every ray within the
+    // cone can start marching from.
+    float ConeMarch(
+            const glm::vec3& ro, const glm::vec3& rd,
+            float k, float start, int& steps);
 
+    // The surface a primary ray landed on.
+    struct Surface {
+        glm::vec3 pos;
+        glm::vec3 normal;
+        glm::vec4 texture;
+        bool floor;
+    };
+    // Given the result of RayMarch, decide whether the ray hit the floor,
+    // the scene or the sky (returns false).  The normal is only filled
+    // in for the floor.
+    bool FindSurface(
+            const glm::vec3& ro, const glm::vec3& rd,
+            int steps, float distance, Surface* surface);
 
 
   private:
+    void RenderPrepass();
+    float PrepassDepth(int x, int y) const;
+    // Whether pixel (x, y) is marched this frame.
+    inline bool Marched(int x, int y) const {
+        switch(sampling_) {
+            case kCheckerboard: return ((x + y + phase_) & 1) == 0;
+            case kInterlaced:   return ((y + phase_) & 1) == 0;
+            default:            return true;
+        }
+    }
+    void ReconstructTile(const Tile& tile);
+    void UpdateShadowBounds();
+    void RenderShadowCache();
+    // Sets vis to p's visibility interpolated from the shadow cache.
+    // Returns false if the cache can't be trusted there.
+    bool CachedVisibility(const glm::vec3& p, float* vis) const;
+    inline bool Antialiasing() const {
+        return sampling_ == kFullRate && antialias_samples_ > 1;
+    }
+    // March count rays through uv with the packet kernels.
+    void ShadePacket(const glm::vec2* uv, const float* start, int count,
+                     glm::vec4* color, glm::vec4* surface, RayCost* cost);
+    inline bool Collecting() const { return collect_stats_ || heatmap_; }
+    // Add a sample's cost to pixel i of cost_.
+    inline void AddCost(int i, const RayCost& c) {
+        cost_.counts[MarchCostMap::kMarchSteps][i] += c.march;
+        cost_.counts[MarchCostMap::kShadowSteps][i] += c.shadow;
+        cost_.counts[MarchCostMap::kNormalEvals][i] += c.normal;
+    }
+    void FindEdges(const Tile& tile);
+    void RefineTile(const Tile& tile);
+
     GLBitmap bitmap_;
+    TileScheduler scheduler_;
+    int tile_size_;
+    const PacketKernels* packet_;
+    std::shared_ptr<const DistanceField> scene_;
   public:
     float aspect_ratio_;
     int steps_;
@@ -57,7 +307,65 @@ class SWMarcher {
     glm::vec3 light0pos_;
     glm::vec4 light0col_;
   private:
+    Stepping stepping_;
+    ShadowOptions shadows_;
+    glm::vec3 shadow_lo_;
+    glm::vec3 shadow_hi_;
+    bool shadow_bounds_valid_;
+    uint64_t shadow_bounds_key_;
+    // Each texel holds the visibility of what the centre ray of a
+    // factor x factor block of pixels hit, and how far away that was,
+    // or -1 for the sky.  A factor of 0 means there's no cache.
+    struct ShadowCache {
+        int factor;
+        int width;
+        int height;
+        std::vector<glm::vec2> texels;
+    };
+    ShadowCache shadow_cache_;
     Camera camera_;
+    bool use_volume_;
+    BrickVolume::Options volume_options_;
+    VolumeCache volume_cache_;
+    std::shared_ptr<const BrickVolume> volume_;
+
+    // Depth prepass levels, coarsest first.
+    struct PrepassLevel {
+        int factor;
+        int width;
+        int height;
+        std::vector<float> depth;
+    };
+    int prepass_factor_;
+    int prepass_levels_;
+    std::vector<PrepassLevel> levels_;
+    std::vector<MarchPassStats> pass_stats_;
+    // March steps taken by the pass being rendered.
+    std::atomic<int64_t> pass_steps_;
+
+    Sampling sampling_;
+    int phase_;
+    // Whether the bitmap holds the last frame, and the camera it was
+    // rendered with.
+    bool history_valid_;
+    Camera history_camera_;
+
+    int antialias_samples_;
+    double antialias_refined_;
+    // Each pixel's first sample's surface, see RenderMain, and whether
+    // FindEdges marked it for refining.
+    std::vector<glm::vec4> surfaces_;
+    std::vector<uint8_t> edges_;
+    std::atomic<int64_t> refined_;
+
+    bool collect_stats_;
+    MarchCostMap cost_;
+    bool heatmap_;
+    MarchCostMap::Counter heatmap_counter_;
+    float heatmap_range_;
+    // The frame with the heatmap over it.
+    std::unique_ptr<GLBitmap> heatmap_bitmap_;
+    bool upload_;
 };
 
 }  // namespace GFX
@@ -0,0 +1,142 @@
+#include "gfx/tile_scheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace GFX {
+
+TileScheduler::TileScheduler(int threads)
+  : deterministic_(false),
+    generation_(0),
+    running_(0),
+    quit_(false)
+{
+    Start(threads);
+}
+
+TileScheduler::~TileScheduler() {
+    Stop();
+}
+
+void TileScheduler::SetThreads(int threads) {
+    Stop();
+    Start(threads);
+}
+
+void TileScheduler::Start(int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    quit_ = false;
+    queues_.clear();
+    for(int i=0; i<threads; ++i) {
+        queues_.emplace_back(new Queue);
+    }
+    steals_.assign(threads, 0);
+    // Worker 0 is whichever thread calls Run.
+    for(int i=1; i<threads; ++i) {
+        workers_.emplace_back(&TileScheduler::WorkerMain, this, i, generation_);
+    }
+}
+
+void TileScheduler::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    start_.notify_all();
+    for(auto& t : workers_) {
+        t.join();
+    }
+    workers_.clear();
+}
+
+void TileScheduler::Run(int width, int height, int tile_size,
+                        std::function<void(const Tile&, int)> fn) {
+    int nq = queues_.size();
+    int tx = (width + tile_size - 1) / tile_size;
+    int ty = (height + tile_size - 1) / tile_size;
+    int ntiles = tx * ty;
+
+    // Hand each worker a contiguous run of tiles so neighbouring tiles
+    // (which tend to have similar cost and share cache lines in the
+    // bitmap) stay on the same core until stealing kicks in.
+    for(int i=0; i<ntiles; ++i) {
+        int x = (i % tx) * tile_size;
+        int y = (i / tx) * tile_size;
+        Tile t{x, y,
+               std::min(tile_size, width - x),
+               std::min(tile_size, height - y)};
+        queues_[int64_t(i) * nq / ntiles]->tiles.push_back(t);
+    }
+    std::fill(steals_.begin(), steals_.end(), 0);
+    fn_ = std::move(fn);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = nq - 1;
+        ++generation_;
+    }
+    start_.notify_all();
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return running_ == 0; });
+    fn_ = nullptr;
+}
+
+void TileScheduler::WorkerMain(int id, uint64_t generation) {
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&]() {
+                return quit_ || generation_ != generation;
+            });
+            if (quit_)
+                return;
+            generation = generation_;
+        }
+        Work(id);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --running_;
+        }
+        done_.notify_one();
+    }
+}
+
+void TileScheduler::Work(int id) {
+    Tile tile;
+    while(Pop(id, &tile) || (!deterministic_ && Steal(id, &tile))) {
+        fn_(tile, id);
+    }
+}
+
+bool TileScheduler::Pop(int id, Tile* tile) {
+    Queue* q = queues_[id].get();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (q->tiles.empty())
+        return false;
+    *tile = q->tiles.front();
+    q->tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::Steal(int id, Tile* tile) {
+    int nq = queues_.size();
+    for(int i=1; i<nq; ++i) {
+        Queue* q = queues_[(id + i) % nq].get();
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (!q->tiles.empty()) {
+            // Take from the opposite end to the owner so we don't fight
+            // over the same cache lines.
+            *tile = q->tiles.back();
+            q->tiles.pop_back();
+            ++steals_[id];
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace GFX
@@ -0,0 +1,80 @@
+#ifndef RMX_GFX_TILE_SCHEDULER_H
+#define RMX_GFX_TILE_SCHEDULER_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GFX {
+
+// A rectangular region of an image.
+struct Tile {
+    int x, y;
+    int w, h;
+};
+
+// TileScheduler splits an image into tiles and runs a function over every
+// tile using a pool of worker threads.  Each worker owns a queue of tiles;
+// when a worker runs out of work it steals tiles from the back of another
+// worker's queue.
+//
+// The thread which calls Run participates as worker 0, so a scheduler
+// with one thread renders serially on the calling thread.
+class TileScheduler {
+  public:
+    // A thread count of zero means "one thread per hardware core".
+    explicit TileScheduler(int threads=0);
+    ~TileScheduler();
+
+    // Restarts the pool with a new number of threads.
+    void SetThreads(int threads);
+    inline int threads() const { return int(workers_.size()) + 1; }
+
+    // In deterministic mode tiles are statically assigned to workers and
+    // no stealing occurs, so every run processes the same tiles on the
+    // same threads in the same order.
+    inline void set_deterministic(bool d) { deterministic_ = d; }
+    inline bool deterministic() const { return deterministic_; }
+
+    // Split a width x height image into tile_size x tile_size tiles and
+    // call fn(tile, thread_index) on each.  Blocks until all tiles are done.
+    void Run(int width, int height, int tile_size,
+             std::function<void(const Tile& tile, int thread)> fn);
+
+    // Number of tiles each worker stole during the last Run.
+    inline const std::vector<int>& steals() const { return steals_; }
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    void Start(int threads);
+    void Stop();
+    void WorkerMain(int id, uint64_t generation);
+    void Work(int id);
+    bool Pop(int id, Tile* tile);
+    bool Steal(int id, Tile* tile);
+
+    bool deterministic_;
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<int> steals_;
+    std::function<void(const Tile&, int)> fn_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    uint64_t generation_;
+    int running_;
+    bool quit_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_TILE_SCHEDULER_H
@@ -0,0 +1,109 @@
+// Checks that TileScheduler runs every tile exactly once, and that idle
+// workers steal from a busy one unless it's deterministic.
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "gfx/tile_scheduler.h"
+#include "gtest/gtest.h"
+
+namespace GFX {
+namespace {
+
+constexpr int kWidth = 203;
+constexpr int kHeight = 117;
+constexpr int kTileSize = 16;
+constexpr int kThreads = 4;
+
+uint32_t Pixel(int x, int y) {
+    return uint32_t(x) * 2654435761u ^ uint32_t(y) * 40503u;
+}
+
+// Renders Pixel into an image, counting how often each pixel is written.
+// Tiles in the top rows are slow, and they all start on worker 0.
+struct Render {
+    Render()
+      : image(kWidth * kHeight, 0),
+        visits(new std::atomic<int>[kWidth * kHeight]) {
+        for(int i = 0; i < kWidth * kHeight; ++i) {
+            visits[i] = 0;
+        }
+    }
+
+    void Run(TileScheduler* scheduler) {
+        scheduler->Run(kWidth, kHeight, kTileSize,
+                       [this](const Tile& tile, int thread) {
+            ASSERT_GE(thread, 0);
+            ASSERT_LT(thread, kThreads);
+            if (tile.y < 2 * kTileSize) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            for(int y = tile.y; y < tile.y + tile.h; ++y) {
+                for(int x = tile.x; x < tile.x + tile.w; ++x) {
+                    image[y * kWidth + x] = Pixel(x, y);
+                    ++visits[y * kWidth + x];
+                }
+            }
+        });
+    }
+
+    void ExpectComplete() const {
+        for(int y = 0; y < kHeight; ++y) {
+            for(int x = 0; x < kWidth; ++x) {
+                ASSERT_EQ(visits[y * kWidth + x], 1) << x << "," << y;
+                ASSERT_EQ(image[y * kWidth + x], Pixel(x, y)) << x << "," << y;
+            }
+        }
+    }
+
+    std::vector<uint32_t> image;
+    std::unique_ptr<std::atomic<int>[]> visits;
+};
+
+int Steals(const TileScheduler& scheduler) {
+    return std::accumulate(scheduler.steals().begin(),
+                           scheduler.steals().end(), 0);
+}
+
+TEST(TileSchedulerTest, RunsEveryTileOnceAndSteals) {
+    TileScheduler scheduler(kThreads);
+    ASSERT_EQ(scheduler.threads(), kThreads);
+    for(int run = 0; run < 3; ++run) {
+        Render render;
+        render.Run(&scheduler);
+        render.ExpectComplete();
+        // Worker 0 owns the slow tiles, so it's never the thief.
+        EXPECT_GT(Steals(scheduler), 0);
+        EXPECT_EQ(scheduler.steals()[0], 0);
+    }
+}
+
+TEST(TileSchedulerTest, DeterministicNeverSteals) {
+    TileScheduler scheduler(kThreads);
+    scheduler.set_deterministic(true);
+    Render render;
+    render.Run(&scheduler);
+    render.ExpectComplete();
+    EXPECT_EQ(Steals(scheduler), 0);
+}
+
+TEST(TileSchedulerTest, SetThreads) {
+    TileScheduler scheduler(1);
+    Render serial;
+    serial.Run(&scheduler);
+    serial.ExpectComplete();
+
+    scheduler.SetThreads(kThreads);
+    ASSERT_EQ(scheduler.threads(), kThreads);
+    Render parallel;
+    parallel.Run(&scheduler);
+    parallel.ExpectComplete();
+    EXPECT_EQ(parallel.image, serial.image);
+}
+
+}  // namespace
+}  // namespace GFX
@@ -0,0 +1,132 @@
+#include "gfx/uniform_ring.h"
+
+#include <cstring>
+#include <GL/glew.h>
+
+#include "util/logging.h"
+
+namespace GFX {
+
+UniformRing::UniformRing(size_t capacity)
+  : capacity_(capacity),
+    alignment_(256),
+    buffer_(0),
+    mapped_(nullptr),
+    head_(0),
+    low_(0)
+{}
+
+UniformRing::~UniformRing() {
+    for(const Pending& fence : fences_) {
+        glDeleteSync(fence.sync);
+    }
+    if (!buffer_) {
+        return;
+    }
+    if (mapped_) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &buffer_);
+}
+
+void UniformRing::Init() {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment_);
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, capacity_, nullptr, flags);
+        mapped_ = static_cast<uint8_t*>(
+                glMapBufferRange(GL_UNIFORM_BUFFER, 0, capacity_, flags));
+    }
+    if (!mapped_) {
+        glBufferData(GL_UNIFORM_BUFFER, capacity_, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    LOGF(INFO, "Uniform ring: %zu bytes, %s", capacity_,
+         mapped_ ? "persistently mapped" : "glBufferSubData");
+}
+
+UniformRing::Block UniformRing::Write(const void* data, size_t size) {
+    if (!buffer_) {
+        Init();
+    }
+    size_t aligned = (size + alignment_ - 1) / alignment_ * alignment_;
+    // Blocks never straddle the end of the buffer.
+    uint64_t offset = head_ % capacity_;
+    if (offset + aligned > capacity_) {
+        head_ += capacity_ - offset;
+    }
+    Reclaim(head_ + aligned);
+    uint64_t position = head_;
+    offset = head_ % capacity_;
+    head_ += aligned;
+
+    if (mapped_) {
+        memcpy(mapped_ + offset, data, size);
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    return Block{position, GLintptr(offset), GLsizeiptr(size)};
+}
+
+void UniformRing::Reclaim(uint64_t end) {
+    if (end <= capacity_) {
+        return;
+    }
+    uint64_t limit = end - capacity_;
+    if (low_ < limit) {
+        // This frame has used the whole ring.  Fence what it has drawn
+        // so far so that can be waited for like an earlier frame; the
+        // frame goes on and its other blocks stay live.
+        LOG(WARNING, "Uniform ring overflowed within one frame");
+        Fence();
+    }
+    // Fences pass in order, and a frame that rebinds an old block fences
+    // from there, so wait for the last fence that uses the space.
+    size_t used = 0;
+    for(size_t i = 0; i < fences_.size(); ++i) {
+        if (fences_[i].low < limit) {
+            used = i + 1;
+        }
+    }
+    if (!used) {
+        return;
+    }
+    GLsync sync = fences_[used - 1].sync;
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(sync, flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+        flags = 0;
+    }
+    for(size_t i = 0; i < used; ++i) {
+        glDeleteSync(fences_[i].sync);
+    }
+    fences_.erase(fences_.begin(), fences_.begin() + used);
+}
+
+void UniformRing::Bind(GLuint binding, const Block& block) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_, block.offset,
+                      block.size);
+    if (block.position < low_) {
+        low_ = block.position;
+    }
+}
+
+void UniformRing::Fence() {
+    if (low_ != head_) {
+        fences_.push_back(Pending{
+                low_, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+        low_ = head_;
+    }
+}
+
+void UniformRing::EndFrame() {
+    Fence();
+}
+
+}  // namespace GFX
@@ -0,0 +1,75 @@
+#ifndef RMX_GFX_UNIFORM_RING_H
+#define RMX_GFX_UNIFORM_RING_H
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <GL/glew.h>
+
+namespace GFX {
+
+// A ring buffer that std140 uniform blocks are streamed through.  Each
+// frame's blocks are written after the previous frame's, and EndFrame
+// fences every block written or bound in the frame, so a block is never
+// overwritten while the GPU may still be reading it.  A block can be
+// bound again in later frames until the ring comes round to it, so
+// uniforms that don't change needn't be uploaded again.  With
+// ARB_buffer_storage the buffer is persistently mapped and a write is a
+// memcpy; otherwise writes use glBufferSubData.
+//
+// Several scenes or views can share one ring, and so one buffer and one
+// upload per frame.  Whoever owns the ring calls EndFrame once per frame.
+class UniformRing {
+  public:
+    // A block written to the ring.
+    struct Block {
+        // Where the block starts, counting every byte written to the ring.
+        uint64_t position;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    // capacity is in bytes and should hold a few frames' worth of blocks.
+    explicit UniformRing(size_t capacity=1 << 16);
+    ~UniformRing();
+
+    // Copy size bytes into the ring.
+    Block Write(const void* data, size_t size);
+    // Whether a block may be bound again instead of being rewritten.
+    // It may until the ring is half way round to it, so the blocks the
+    // rest of the frame writes can't reach it while it's still bound.
+    inline bool Live(const Block& block) const {
+        return block.size && head_ <= block.position + capacity_ / 2;
+    }
+    // Bind a block to a uniform buffer binding point.
+    void Bind(GLuint binding, const Block& block);
+    // Fence everything written or bound since the last EndFrame.
+    void EndFrame();
+
+    inline bool persistent() const { return mapped_ != nullptr; }
+
+  private:
+    void Init();
+    // Wait for the frames using [0, end) of the ring's previous lap.
+    void Reclaim(uint64_t end);
+    // Fence what's been written or bound since the last fence.
+    void Fence();
+
+    size_t capacity_;
+    GLint alignment_;
+    GLuint buffer_;
+    uint8_t* mapped_;
+    // Bytes written since the ring was created; head_ % capacity_ is the
+    // next offset.
+    uint64_t head_;
+    // The earliest position written or bound since the last fence.
+    uint64_t low_;
+
+    struct Pending {
+        uint64_t low;
+        GLsync sync;
+    };
+    std::deque<Pending> fences_;
+};
+
+}  // namespace GFX
+#endif // RMX_GFX_UNIFORM_RING_H
@@ -34,24 +34,30 @@ uint32_t* GLBitmap::Allocate(uint32_t* data, bool claim_ownership) {
     data_ = data ? data : new uint32_t[width_ * height_]();
     owned_data_.reset(claim_ownership ? data_ : nullptr);
 
-    if (texture_id_)
+    if (texture_id_) {
         glDeleteTextures(1, &texture_id_);
-
-    glEnable(GL_TEXTURE_2D);
-    glGenTextures(1, &texture_id_);
-    glBindTexture(GL_TEXTURE_2D, texture_id_);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                 width_, height_, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, (void*)data_);
-    glBindTexture(GL_TEXTURE_2D, 0);
+        texture_id_ = 0;
+    }
     return data_;
 }
 
+// The texture is created by the first Update, so a bitmap can be drawn
+// into without a GL context.
 void GLBitmap::Update() {
+    if (!texture_id_) {
+        glEnable(GL_TEXTURE_2D);
+        glGenTextures(1, &texture_id_);
+        glBindTexture(GL_TEXTURE_2D, texture_id_);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                     width_, height_, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, (void*)data_);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return;
+    }
     glBindTexture(GL_TEXTURE_2D, texture_id_);
     glTexSubImage2D(GL_TEXTURE_2D, 0,
                     0, 0, width_, height_,
@@ -1,4 +1,6 @@
 #include <gflags/gflags.h>
+// Before imapp.h: GLEW must be included before any other GL header.
+#include "gfx/profiler.h"
 #include "imapp.h"
 #include "imgui.h"
 #include "util/os.h"
@@ -92,6 +94,21 @@ void ImApp::Quit(DebugConsole* console, int argc, char **argv) {
     running_ = false;
 }
 
+SDL_GLContext ImApp::CreateSharedContext() {
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    SDL_GLContext context = SDL_GL_CreateContext(window_);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    if (!context) {
+        LOG(ERROR, "Can't create a shared GL context: ", SDL_GetError());
+    }
+    SDL_GL_MakeCurrent(window_, glcontext_);
+    return context;
+}
+
+bool ImApp::MakeCurrent(SDL_GLContext context) {
+    return SDL_GL_MakeCurrent(window_, context) == 0;
+}
+
 void ImApp::SetTitle(const std::string& title, bool with_appname) {
     std::string val;
     if (with_appname) {
@@ -125,30 +142,45 @@ bool ImApp::ProcessEvents() {
 }
 
 void ImApp::BaseDraw() {
-    if (!PreDraw()) {
-        glViewport(0, 0,
-                   (int)ImGui::GetIO().DisplaySize.x,
-                   (int)ImGui::GetIO().DisplaySize.y);
-        glClearColor(clear_color_.x, clear_color_.y, clear_color_.z, clear_color_.w);
-        glClear(GL_COLOR_BUFFER_BIT);
+    GFX::Profiler* profiler = GFX::Profiler::Get();
+    profiler->BeginFrame();
+    {
+        GFX::Profiler::Scope scope("predraw");
+        if (!PreDraw()) {
+            glViewport(0, 0,
+                       (int)ImGui::GetIO().DisplaySize.x,
+                       (int)ImGui::GetIO().DisplaySize.y);
+            glClearColor(clear_color_.x, clear_color_.y, clear_color_.z, clear_color_.w);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
     }
 
-    ImGui_ImplSdlGL3_NewFrame(window_);
-    console_.Draw();
-    for(auto it=draw_callback_.begin(); it != draw_callback_.end();) {
-        if ((*it)->visible()) {
-            (*it)->Draw();
-        } else if ((*it)->want_dispose()) {
-            it = draw_callback_.erase(it);
-            continue;
+    {
+        GFX::Profiler::Scope scope("ui", false);
+        ImGui_ImplSdlGL3_NewFrame(window_);
+        console_.Draw();
+        for(auto it=draw_callback_.begin(); it != draw_callback_.end();) {
+            if ((*it)->visible()) {
+                (*it)->Draw();
+            } else if ((*it)->want_dispose()) {
+                it = draw_callback_.erase(it);
+                continue;
+            }
+            ++it;
         }
-        ++it;
-    }
 
-    Draw();
-    ImGui::Render();
-    ImGui_ImplSdlGL3_RenderDrawData(ImGui::GetDrawData());
-    SDL_GL_SwapWindow(window_);
+        Draw();
+        ImGui::Render();
+    }
+    {
+        GFX::Profiler::Scope scope("imgui");
+        ImGui_ImplSdlGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+    {
+        GFX::Profiler::Scope scope("swap");
+        SDL_GL_SwapWindow(window_);
+    }
+    profiler->EndFrame();
     for(auto& widget : draw_added_) {
         draw_callback_.emplace_back(std::move(widget));
     }
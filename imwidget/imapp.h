@@ -26,6 +26,12 @@ class ImApp {
     virtual void Help(const std::string& topickey) {}
 
     void SetTitle(const std::string& title, bool with_appname=true);
+    // Create a GL context that shares objects with the window's, for use
+    // on another thread.  The window's context stays current.
+    SDL_GLContext CreateSharedContext();
+    // Make context current on the calling thread, or release the
+    // thread's context if it is null.
+    bool MakeCurrent(SDL_GLContext context);
     void Run();
     void BaseDraw();
     virtual bool ProcessEvents();
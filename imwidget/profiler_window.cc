@@ -0,0 +1,75 @@
+#include "imwidget/profiler_window.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "gfx/profiler.h"
+#include "imgui.h"
+#include "util/os.h"
+
+ProfilerWindow::ProfilerWindow()
+  : ImWindowBase(false, false),
+    gpu_(true) {
+    snprintf(filename_, sizeof(filename_), "%s",
+             os::path::DataPath({"trace.json"}).c_str());
+}
+
+bool ProfilerWindow::Draw() {
+    if (!visible_)
+        return false;
+
+    ImGui::SetNextWindowSize(ImVec2(420, 560), ImGuiSetCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &visible_)) {
+        ImGui::End();
+        return false;
+    }
+    GFX::Profiler* profiler = GFX::Profiler::Get();
+    bool enabled = profiler->enabled();
+    if (ImGui::Checkbox("Record", &enabled)) {
+        profiler->set_enabled(enabled);
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("GPU", gpu_)) {
+        gpu_ = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("CPU", !gpu_)) {
+        gpu_ = false;
+    }
+    if (profiler->dropped()) {
+        ImGui::SameLine();
+        ImGui::Text("%d frames without GPU times", profiler->dropped());
+    }
+
+    const int n = GFX::Profiler::kHistory;
+    int offset = profiler->history_offset();
+    for(const auto& scope : profiler->scopes()) {
+        const auto& history = profiler->history(scope);
+        const float* ms = gpu_ ? history.gpu_ms : history.cpu_ms;
+        float sum = 0.0f, max = 0.0f;
+        for(int i = 0; i < n; ++i) {
+            sum += ms[i];
+            max = std::max(max, ms[i]);
+        }
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "avg %.2f ms  max %.2f ms",
+                 sum / n, max);
+        ImGui::Text("%*s%s", history.depth * 2, "", scope.c_str());
+        ImGui::PlotHistogram(("##" + scope).c_str(), ms, n, offset, overlay,
+                             0.0f, max * 1.2f, ImVec2(0, 40));
+    }
+
+    ImGui::Separator();
+    ImGui::InputText("##filename", filename_, sizeof(filename_));
+    ImGui::SameLine();
+    if (ImGui::Button("Export trace")) {
+        util::Status status = profiler->WriteTrace(filename_);
+        message_ = status.ok() ? std::string("Wrote ") + filename_
+                               : status.ToString();
+    }
+    if (!message_.empty()) {
+        ImGui::TextUnformatted(message_.c_str());
+    }
+    ImGui::End();
+    return true;
+}
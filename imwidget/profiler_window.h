@@ -0,0 +1,18 @@
+#ifndef PROJECT_IMWIDGET_PROFILER_WINDOW_H
+#define PROJECT_IMWIDGET_PROFILER_WINDOW_H
+#include <string>
+#include "imwidget/imwidget.h"
+
+// Shows GFX::Profiler's recent CPU or GPU times for each scope as
+// histograms, and exports them as a Chrome trace.
+class ProfilerWindow: public ImWindowBase {
+  public:
+    ProfilerWindow();
+    bool Draw() override;
+  private:
+    bool gpu_;
+    char filename_[256];
+    std::string message_;
+};
+
+#endif // PROJECT_IMWIDGET_PROFILER_WINDOW_H
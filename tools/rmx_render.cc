@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <gflags/gflags.h>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "gfx/camera.h"
+#include "gfx/frame_capture.h"
+#include "gfx/frame_writer.h"
+#include "gfx/headless_gl.h"
+#include "gfx/raymarch.h"
+#include "gfx/shadow.h"
+#include "gfx/stepping.h"
+#include "gfx/swmarch.h"
+#include "glm/glm.hpp"
+#include "util/logging.h"
+#include "util/os.h"
+
+const char kUsage[] =
+R"ZZZ(<optional flags>
+
+Description:
+  Renders frames of the scene to PNG files without a window, e.g. on
+  servers and in CI.  The gl renderer needs Mesa's surfaceless EGL
+  platform and finds its shaders in content/ like the application does.
+
+Example:
+  rmx_render --renderer=cpu --width=1280 --height=720 --frames=120 \
+      --camera_path="0,0,-2,0,0;2,1,-4,-0.5,0.2" --output=/tmp/f%04d.png
+)ZZZ";
+
+DEFINE_string(renderer, "cpu",
+              "cpu: SWMarcher; gl: the GLSL marcher in a surfaceless EGL "
+              "context");
+DEFINE_int32(width, 640, "Frame width");
+DEFINE_int32(height, 360, "Frame height");
+DEFINE_string(camera_path, "0,0,-2,0,0",
+              "Camera keyframes 'x,y,z,theta,phi' separated by ';' and "
+              "spread evenly over --frames.  theta turns the camera right "
+              "and phi down, in radians, as in the application");
+DEFINE_int32(frames, 1, "Frames the camera path is spread over");
+DEFINE_int32(first_frame, 0, "The first frame to render");
+DEFINE_int32(last_frame, -1, "The last frame to render; -1 for the last "
+                             "frame of the path");
+DEFINE_string(output, "frame%04d.png",
+              "printf pattern for each frame's filename, with one %d for "
+              "its number");
+DEFINE_bool(crc, false,
+            "Print each frame's CRC32 instead of writing it, to compare "
+            "renders");
+DEFINE_int32(threads, 0, "cpu renderer threads; 0 for one per core");
+DEFINE_int32(encoders, 0, "PNG encoding threads; 0 for one per core");
+DEFINE_int32(prepass, 0,
+             "Cone march a depth prepass at 1/prepass resolution; 0 for none");
+DEFINE_int32(antialias, 0, "Samples per edge pixel; 1 or less for none");
+DEFINE_string(stepping, "sphere",
+              "How primary rays step: sphere, overrelaxed, enhanced or "
+              "lipschitz; see gfx/stepping.h");
+DEFINE_double(relaxation, 1.6,
+              "The overrelaxed step factor, and the most enhanced steps "
+              "stretch by");
+DEFINE_double(lipschitz, 1.0, "The bound lipschitz stepping divides by");
+DEFINE_int32(shadow_cache, 0,
+             "Cache shadows at 1/shadow_cache resolution and interpolate "
+             "them where they agree; 0 for none");
+DEFINE_bool(shadow_bounds, true,
+            "Clip shadow rays to the box around the scene's surfaces");
+
+namespace {
+
+// The stepping the flags ask for.  main checks --stepping names a
+// strategy.
+GFX::Stepping FlagStepping() {
+    GFX::Stepping s{GFX::Stepping::kSphere, float(FLAGS_relaxation),
+                    float(FLAGS_lipschitz)};
+    GFX::Stepping::FromName(FLAGS_stepping.c_str(), &s.strategy);
+    return s;
+}
+
+GFX::ShadowOptions FlagShadows() {
+    GFX::ShadowOptions shadows;
+    shadows.cache = FLAGS_shadow_cache;
+    shadows.bounded = FLAGS_shadow_bounds;
+    return shadows;
+}
+
+struct Keyframe {
+    glm::vec3 eye;
+    float theta;
+    float phi;
+};
+
+bool ParsePath(const std::string& path, std::vector<Keyframe>* keys) {
+    for(absl::string_view key : absl::StrSplit(path, ';')) {
+        std::vector<absl::string_view> v = absl::StrSplit(key, ',');
+        float f[5];
+        if (v.size() != 5) {
+            LOG(ERROR, "Keyframe '", key, "' isn't x,y,z,theta,phi");
+            return false;
+        }
+        for(int i = 0; i < 5; ++i) {
+            if (!absl::SimpleAtof(v[i], &f[i])) {
+                LOG(ERROR, "Keyframe '", key, "' has a bad number");
+                return false;
+            }
+        }
+        keys->push_back(Keyframe{glm::vec3(f[0], f[1], f[2]), f[3], f[4]});
+    }
+    return !keys->empty();
+}
+
+// Place the camera where the path is at frame, out of frames.
+void Pose(const std::vector<Keyframe>& keys, int frame, int frames,
+          GFX::Camera* c) {
+    float s = frames > 1 ? float(frame) / float(frames - 1) : 0.0f;
+    s *= keys.size() - 1;
+    size_t i = std::min(size_t(s), keys.size() - 1);
+    size_t j = std::min(i + 1, keys.size() - 1);
+    float f = s - float(i);
+    glm::vec3 eye = glm::mix(keys[i].eye, keys[j].eye, f);
+    float theta = glm::mix(keys[i].theta, keys[j].theta, f);
+    float phi = glm::mix(keys[i].phi, keys[j].phi, f);
+    c->eye = eye;
+    c->Orient(theta, phi);
+}
+
+// Renders frames with SWMarcher.
+class CPURenderer {
+  public:
+    CPURenderer(int width, int height, GFX::FrameWriter* writer)
+      : marcher_(width, height, FLAGS_threads),
+        writer_(writer) {
+        marcher_.set_upload(false);
+        marcher_.set_prepass(FLAGS_prepass, 2);
+        marcher_.set_antialias(FLAGS_antialias);
+        marcher_.set_stepping(FlagStepping());
+        marcher_.set_shadows(FlagShadows());
+    }
+    GFX::Camera* camera() { return marcher_.camera(); }
+    void Render(const std::string& filename) {
+        marcher_.Render();
+        GFX::FrameWriter::Frame frame{filename, marcher_.width(),
+                                      marcher_.height(), {}};
+        const uint32_t* p = marcher_.pixels();
+        frame.pixels.assign(p, p + marcher_.width() * marcher_.height());
+        writer_->Submit(std::move(frame));
+    }
+    void Flush() {}
+  private:
+    GFX::SWMarcher marcher_;
+    GFX::FrameWriter* writer_;
+};
+
+// Renders frames with RayMarchScene into a framebuffer, which
+// FrameCapture reads back while the next frames render.
+class GLRenderer {
+  public:
+    GLRenderer(int width, int height, GFX::FrameWriter* writer)
+      : width_(width),
+        height_(height),
+        scene_(width, height),
+        capture_(writer) {}
+    ~GLRenderer() {
+        capture_.Flush();
+        glDeleteFramebuffers(1, &fbo_);
+        glDeleteRenderbuffers(1, &color_);
+    }
+    bool Init() {
+        if (!scene_.LoadProgram("content/raymarch.vs", "content/raymarch.fs")) {
+            return false;
+        }
+        scene_.Init();
+        scene_.set_prepass(FLAGS_prepass, 2);
+        scene_.set_antialias(FLAGS_antialias);
+        scene_.set_stepping(FlagStepping());
+        scene_.set_shadows(FlagShadows());
+        glGenRenderbuffers(1, &color_);
+        glBindRenderbuffer(GL_RENDERBUFFER, color_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+        glGenFramebuffers(1, &fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER, color_);
+        return glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE;
+    }
+    GFX::Camera* camera() { return scene_.camera(); }
+    void Render(const std::string& filename) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glViewport(0, 0, width_, height_);
+        scene_.Draw();
+        capture_.Capture(0, 0, width_, height_, filename);
+    }
+    void Flush() { capture_.Flush(); }
+  private:
+    int width_;
+    int height_;
+    GFX::RayMarchScene scene_;
+    GFX::FrameCapture capture_;
+    GLuint fbo_ = 0;
+    GLuint color_ = 0;
+};
+
+template<typename Renderer>
+int RenderFrames(Renderer* renderer, GFX::FrameWriter* writer,
+                 const std::vector<Keyframe>& keys) {
+    int last = FLAGS_last_frame < 0 ? FLAGS_frames - 1 : FLAGS_last_frame;
+    int64_t start = os::utime_now();
+    int64_t render = 0;
+    int frames = 0;
+    for(int frame = FLAGS_first_frame; frame <= last; ++frame) {
+        Pose(keys, frame, FLAGS_frames, renderer->camera());
+        std::string filename = GFX::FrameFilename(FLAGS_output, frame);
+        int64_t t = os::utime_now();
+        renderer->Render(filename);
+        render += os::utime_now() - t;
+        ++frames;
+    }
+    renderer->Flush();
+    util::Status status = writer->Finish();
+    if (!status.ok()) {
+        LOG(ERROR, status.error_message());
+        return 1;
+    }
+    double total = double(os::utime_now() - start) / 1000.0;
+    if (writer->output() == GFX::FrameWriter::kCRC32) {
+        for(const auto& hash : writer->hashes()) {
+            printf("%s %08x\n", hash.first.c_str(), hash.second);
+        }
+    }
+    printf("Rendered %d frames in %.1f ms: %.2f ms per frame rendering, "
+           "%.2f ms per frame overall, %d encoders\n",
+           frames, total, double(render) / 1000.0 / std::max(frames, 1),
+           total / std::max(frames, 1), writer->threads());
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    gflags::SetUsageMessage(kUsage);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    std::vector<Keyframe> keys;
+    if (!ParsePath(FLAGS_camera_path, &keys)) {
+        LOG(ERROR, "Bad --camera_path");
+        return 1;
+    }
+    if (FLAGS_width <= 0 || FLAGS_height <= 0 || FLAGS_frames <= 0) {
+        LOG(ERROR, "--width, --height and --frames must be positive");
+        return 1;
+    }
+    util::Status status = GFX::CheckFramePattern(FLAGS_output);
+    if (!status.ok()) {
+        LOG(ERROR, "Bad --output: ", status.error_message());
+        return 1;
+    }
+
+    GFX::Stepping::Strategy strategy;
+    if (!GFX::Stepping::FromName(FLAGS_stepping.c_str(), &strategy)) {
+        LOG(ERROR, "Unknown --stepping ", FLAGS_stepping);
+        return 1;
+    }
+
+    GFX::FrameWriter writer(FLAGS_encoders);
+    if (FLAGS_crc) {
+        writer.set_output(GFX::FrameWriter::kCRC32);
+    }
+    if (FLAGS_renderer == "cpu") {
+        CPURenderer renderer(FLAGS_width, FLAGS_height, &writer);
+        return RenderFrames(&renderer, &writer, keys);
+    }
+    if (FLAGS_renderer == "gl") {
+        status = GFX::InitHeadlessGL();
+        if (!status.ok()) {
+            LOG(ERROR, status.error_message());
+            return 1;
+        }
+        GLRenderer renderer(FLAGS_width, FLAGS_height, &writer);
+        if (!renderer.Init()) {
+            LOG(ERROR, "Can't set up the GL renderer");
+            return 1;
+        }
+        return RenderFrames(&renderer, &writer, keys);
+    }
+    LOG(ERROR, "Unknown --renderer ", FLAGS_renderer);
+    return 1;
+}
@@ -0,0 +1,154 @@
+#include <cstdlib>
+
+#include "util/compress.h"
+#include "util/crc.h"
+#include "util/png.h"
+
+namespace {
+void Put32(std::string* out, uint32_t v) {
+    out->push_back(char(v >> 24));
+    out->push_back(char(v >> 16));
+    out->push_back(char(v >> 8));
+    out->push_back(char(v));
+}
+
+void Chunk(std::string* out, const char* type, const std::string& data) {
+    Put32(out, data.size());
+    size_t start = out->size();
+    out->append(type, 4);
+    out->append(data);
+    Put32(out, Crc32(0, out->data() + start, out->size() - start));
+}
+
+uint32_t Get32(const std::string& in, size_t pos) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(in.data()) + pos;
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 |
+           uint32_t(p[2]) << 8 | uint32_t(p[3]);
+}
+
+uint8_t Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+util::Status Corrupt(const std::string& why) {
+    return util::Status(util::error::Code::INVALID_ARGUMENT,
+                        "Bad PNG: " + why);
+}
+}  // namespace
+
+std::string PNG::Encode(const uint32_t* pixels, int width, int height) {
+    std::string header;
+    Put32(&header, width);
+    Put32(&header, height);
+    // 8 bits per channel, RGB, deflate, adaptive filtering, no interlace.
+    header.append("\x08\x02\x00\x00\x00", 5);
+
+    // Each row is filtered with Sub, storing each byte's difference from
+    // the pixel to its left, which deflates rendered images far better
+    // than the raw bytes.
+    std::string raw;
+    raw.resize(size_t(height) * (1 + width * 3));
+    char* p = &raw[0];
+    for(int y = 0; y < height; ++y) {
+        const uint32_t* row = pixels + size_t(y) * width;
+        *p++ = 1;
+        uint32_t left = 0;
+        for(int x = 0; x < width; ++x) {
+            uint32_t c = row[x];
+            *p++ = char((c & 0xff) - (left & 0xff));
+            *p++ = char((c >> 8 & 0xff) - (left >> 8 & 0xff));
+            *p++ = char((c >> 16 & 0xff) - (left >> 16 & 0xff));
+            left = c;
+        }
+    }
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    Chunk(&png, "IHDR", header);
+    Chunk(&png, "IDAT", ZLib::Compress(raw));
+    Chunk(&png, "IEND", "");
+    return png;
+}
+
+util::Status PNG::Decode(const std::string& png, int* width, int* height,
+                         std::vector<uint32_t>* pixels) {
+    if (png.size() < 8 || png.compare(0, 8, "\x89PNG\r\n\x1a\n", 8)) {
+        return Corrupt("no signature");
+    }
+    std::string idat;
+    int w = 0, h = 0, bpp = 0;
+    for(size_t pos = 8; pos + 12 <= png.size();) {
+        size_t length = Get32(png, pos);
+        if (pos + 12 + length > png.size()) {
+            return Corrupt("truncated chunk");
+        }
+        std::string type = png.substr(pos + 4, 4);
+        if (type == "IHDR") {
+            if (length < 13) {
+                return Corrupt("short IHDR");
+            }
+            w = Get32(png, pos + 8);
+            h = Get32(png, pos + 12);
+            int depth = uint8_t(png[pos + 16]);
+            int color = uint8_t(png[pos + 17]);
+            int interlace = uint8_t(png[pos + 20]);
+            if (depth != 8 || (color != 2 && color != 6) || interlace) {
+                return Corrupt("only 8-bit non-interlaced RGB(A) is supported");
+            }
+            bpp = color == 6 ? 4 : 3;
+        } else if (type == "IDAT") {
+            idat.append(png, pos + 8, length);
+        } else if (type == "IEND") {
+            break;
+        }
+        pos += 12 + length;
+    }
+    if (w <= 0 || h <= 0 || bpp == 0) {
+        return Corrupt("no IHDR");
+    }
+    size_t stride = size_t(w) * bpp;
+    auto inflated = ZLib::Uncompress(idat, h * (stride + 1));
+    if (!inflated.ok()) {
+        return inflated.status();
+    }
+    std::string raw = inflated.ValueOrDie();
+    if (raw.size() < h * (stride + 1)) {
+        return Corrupt("short image data");
+    }
+
+    // Undo each row's filter in place; prior is the unfiltered row above.
+    std::vector<uint8_t> prior(stride, 0), row(stride);
+    pixels->resize(size_t(w) * h);
+    for(int y = 0; y < h; ++y) {
+        const uint8_t* in =
+            reinterpret_cast<const uint8_t*>(raw.data()) + y * (stride + 1);
+        int filter = in[0];
+        ++in;
+        for(size_t i = 0; i < stride; ++i) {
+            int a = i >= size_t(bpp) ? row[i - bpp] : 0;
+            int b = prior[i];
+            int c = i >= size_t(bpp) ? prior[i - bpp] : 0;
+            switch(filter) {
+                case 0: row[i] = in[i]; break;
+                case 1: row[i] = in[i] + a; break;
+                case 2: row[i] = in[i] + b; break;
+                case 3: row[i] = in[i] + (a + b) / 2; break;
+                case 4: row[i] = in[i] + Paeth(a, b, c); break;
+                default: return Corrupt("bad filter");
+            }
+        }
+        uint32_t* out = pixels->data() + size_t(y) * w;
+        for(int x = 0; x < w; ++x) {
+            const uint8_t* p = &row[x * bpp];
+            out[x] = 0xff000000 | uint32_t(p[2]) << 16 |
+                     uint32_t(p[1]) << 8 | p[0];
+        }
+        prior.swap(row);
+    }
+    *width = w;
+    *height = h;
+    return util::Status();
+}
@@ -0,0 +1,22 @@
+#ifndef PROJECT_UTIL_PNG_H
+#define PROJECT_UTIL_PNG_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util/status.h"
+
+// A minimal PNG encoder for rendered frames.
+class PNG {
+  public:
+    // Encode width x height pixels, top row first, as an 8-bit RGB PNG.
+    // Pixels are ABGR words, as GLBitmap and glReadPixels(GL_RGBA) lay
+    // them out in memory on little endian machines; alpha is dropped.
+    static std::string Encode(const uint32_t* pixels, int width, int height);
+    // Decode an 8-bit, non-interlaced RGB or RGBA PNG into ABGR pixels,
+    // top row first, with alpha set to 255.
+    static util::Status Decode(const std::string& png, int* width,
+                               int* height, std::vector<uint32_t>* pixels);
+};
+
+#endif // PROJECT_UTIL_PNG_H